@@ -1119,6 +1119,464 @@ inline byte *SkipBoneFrame( byte flags, byte * RESTRICT pFrameData, byte *&pCons
 }
 
 
+static ConVar anim_simd_decode( "anim_simd_decode", "1", FCVAR_REPLICATED, "Decode interpolated animation frames four bones at a time." );
+
+//-----------------------------------------------------------------------------
+// Purpose: Structure-of-arrays staging for bones that need interpolation.
+//			The per-bone parsers only unpack raw values into here; the
+//			rebuild, blend and normalize then run four bones per iteration
+//			and the results are written straight into the pos/q arrays that
+//			Studio_BuildMatrices consumes.
+//-----------------------------------------------------------------------------
+class ALIGN16 CAnimDecodeBatch
+{
+public:
+	CAnimDecodeBatch() : m_nRotations( 0 ), m_nPositions( 0 ) {}
+
+	// packed frame animation rotations
+	void AddRotation( int bone, const Quaternion48 *p1, const Quaternion48 *p2 );
+	void AddRotation( int bone, const Quaternion48S *p1, const Quaternion48S *p2 );
+
+	// RLE animation rotations, optionally aligned to the unified bone afterwards
+	void AddRotation( int bone, const RadianEuler &angle1, const RadianEuler &angle2, const Quaternion *pAlignment );
+
+	void AddPosition( int bone, const Vector &p1, const Vector &p2 );
+
+	void FlushPacked( float s, BoneQuaternion *q, BoneVector *pos );
+	void FlushEuler( float s, BoneQuaternion *q, BoneVector *pos );
+
+private:
+	void PadRotations( void );
+	void FlushPositions( float s, BoneVector *pos );
+	void StoreRotations( int i, fltx4 x, fltx4 y, fltx4 z, fltx4 w, BoneQuaternion *q );
+
+	// [frame][component][bone]; for packed rotations the component rebuilt
+	// from the unit length constraint is left at zero and named by m_missing
+	float	m_rotation[2][4][MAXSTUDIOBONES];
+	float	m_missing[2][MAXSTUDIOBONES];
+	float	m_sign[2][MAXSTUDIOBONES];
+	float	m_alignment[4][MAXSTUDIOBONES];
+	float	m_position[2][3][MAXSTUDIOBONES];
+	short	m_rotationBone[MAXSTUDIOBONES];
+	short	m_positionBone[MAXSTUDIOBONES];
+	int		m_nRotations;
+	int		m_nPositions;
+} ALIGN16_POST;
+
+void CAnimDecodeBatch::AddRotation( int bone, const Quaternion48 *p1, const Quaternion48 *p2 )
+{
+	int n = m_nRotations++;
+	m_rotationBone[n] = bone;
+
+	const Quaternion48 *pPacked[2] = { p1, p2 };
+	for ( int f = 0; f < 2; f++ )
+	{
+		m_rotation[f][0][n] = ((int)pPacked[f]->x - 32768) * (1 / 32768.5f);
+		m_rotation[f][1][n] = ((int)pPacked[f]->y - 32768) * (1 / 32768.5f);
+		m_rotation[f][2][n] = ((int)pPacked[f]->z - 16384) * (1 / 16384.5f);
+		m_rotation[f][3][n] = 0.0f;
+		m_missing[f][n] = 3.0f;
+		m_sign[f][n] = pPacked[f]->wneg ? -1.0f : 1.0f;
+	}
+}
+
+void CAnimDecodeBatch::AddRotation( int bone, const Quaternion48S *p1, const Quaternion48S *p2 )
+{
+	int n = m_nRotations++;
+	m_rotationBone[n] = bone;
+
+	const Quaternion48S *pPacked[2] = { p1, p2 };
+	for ( int f = 0; f < 2; f++ )
+	{
+		int ia = pPacked[f]->offsetL + pPacked[f]->offsetH * 2;
+		int ib = ( ia + 1 ) % 4;
+		int ic = ( ia + 2 ) % 4;
+		int id = ( ia + 3 ) % 4;
+		m_rotation[f][ia][n] = ( (int)pPacked[f]->a - SHIFT48S ) * ( 1.0f / SCALE48S );
+		m_rotation[f][ib][n] = ( (int)pPacked[f]->b - SHIFT48S ) * ( 1.0f / SCALE48S );
+		m_rotation[f][ic][n] = ( (int)pPacked[f]->c - SHIFT48S ) * ( 1.0f / SCALE48S );
+		m_rotation[f][id][n] = 0.0f;
+		m_missing[f][n] = id;
+		m_sign[f][n] = pPacked[f]->dneg ? -1.0f : 1.0f;
+	}
+}
+
+void CAnimDecodeBatch::AddRotation( int bone, const RadianEuler &angle1, const RadianEuler &angle2, const Quaternion *pAlignment )
+{
+	int n = m_nRotations++;
+	m_rotationBone[n] = bone;
+
+	for ( int c = 0; c < 3; c++ )
+	{
+		m_rotation[0][c][n] = angle1[c];
+		m_rotation[1][c][n] = angle2[c];
+	}
+
+	// aligning against a zero quaternion never flips
+	for ( int c = 0; c < 4; c++ )
+	{
+		m_alignment[c][n] = pAlignment ? (*pAlignment)[c] : 0.0f;
+	}
+}
+
+void CAnimDecodeBatch::AddPosition( int bone, const Vector &p1, const Vector &p2 )
+{
+	int n = m_nPositions++;
+	m_positionBone[n] = bone;
+
+	for ( int c = 0; c < 3; c++ )
+	{
+		m_position[0][c][n] = p1[c];
+		m_position[1][c][n] = p2[c];
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Fill the tail of the last group of four with identity rotations
+//			so the unused lanes never see uninitialized data
+//-----------------------------------------------------------------------------
+void CAnimDecodeBatch::PadRotations( void )
+{
+	for ( int n = m_nRotations; n & 3; n++ )
+	{
+		for ( int f = 0; f < 2; f++ )
+		{
+			for ( int c = 0; c < 4; c++ )
+			{
+				m_rotation[f][c][n] = 0.0f;
+			}
+			m_missing[f][n] = 3.0f;
+			m_sign[f][n] = 1.0f;
+		}
+		for ( int c = 0; c < 4; c++ )
+		{
+			m_alignment[c][n] = 0.0f;
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Transpose four blended rotations back to AoS and store the lanes
+//			that hold real bones
+//-----------------------------------------------------------------------------
+void CAnimDecodeBatch::StoreRotations( int i, fltx4 x, fltx4 y, fltx4 z, fltx4 w, BoneQuaternion *q )
+{
+	TransposeSIMD( x, y, z, w );
+	const fltx4 rows[4] = { x, y, z, w };
+	int nLanes = MIN( 4, m_nRotations - i );
+	for ( int k = 0; k < nLanes; k++ )
+	{
+		StoreUnalignedSIMD( q[ m_rotationBone[i + k] ].Base(), rows[k] );
+		Assert( q[ m_rotationBone[i + k] ].IsValid() );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Blend four aligned quaternions; matches QuaternionBlend
+//-----------------------------------------------------------------------------
+static FORCEINLINE void QuaternionBlendFour( 
+	const fltx4 &px, const fltx4 &py, const fltx4 &pz, const fltx4 &pw, 
+	fltx4 &qx, fltx4 &qy, fltx4 &qz, fltx4 &qw, 
+	const fltx4 &sclp, const fltx4 &sclq )
+{
+	// decide if one of the quaternions is backwards
+	fltx4 dx = SubSIMD( px, qx ), dy = SubSIMD( py, qy ), dz = SubSIMD( pz, qz ), dw = SubSIMD( pw, qw );
+	fltx4 ax = AddSIMD( px, qx ), ay = AddSIMD( py, qy ), az = AddSIMD( pz, qz ), aw = AddSIMD( pw, qw );
+	fltx4 a = MaddSIMD( dw, dw, MaddSIMD( dz, dz, MaddSIMD( dy, dy, MulSIMD( dx, dx ) ) ) );
+	fltx4 b = MaddSIMD( aw, aw, MaddSIMD( az, az, MaddSIMD( ay, ay, MulSIMD( ax, ax ) ) ) );
+	fltx4 flip = (fltx4) CmpGtSIMD( a, b );
+	qx = MaskedAssign( flip, NegSIMD( qx ), qx );
+	qy = MaskedAssign( flip, NegSIMD( qy ), qy );
+	qz = MaskedAssign( flip, NegSIMD( qz ), qz );
+	qw = MaskedAssign( flip, NegSIMD( qw ), qw );
+
+	qx = MaddSIMD( sclq, qx, MulSIMD( sclp, px ) );
+	qy = MaddSIMD( sclq, qy, MulSIMD( sclp, py ) );
+	qz = MaddSIMD( sclq, qz, MulSIMD( sclp, pz ) );
+	qw = MaddSIMD( sclq, qw, MulSIMD( sclp, pw ) );
+
+	fltx4 radius = MaddSIMD( qw, qw, MaddSIMD( qz, qz, MaddSIMD( qy, qy, MulSIMD( qx, qx ) ) ) );
+	fltx4 zero = (fltx4) CmpEqSIMD( radius, Four_Zeros );
+	fltx4 iradius = DivSIMD( Four_Ones, SqrtSIMD( MaskedAssign( zero, Four_Ones, radius ) ) );
+	qx = MulSIMD( qx, iradius );
+	qy = MulSIMD( qy, iradius );
+	qz = MulSIMD( qz, iradius );
+	qw = MulSIMD( qw, iradius );
+}
+
+void CAnimDecodeBatch::FlushPositions( float s, BoneVector *pos )
+{
+	fltx4 f2 = ReplicateX4( s );
+	fltx4 f1 = SubSIMD( Four_Ones, f2 );
+
+	for ( int n = m_nPositions; n & 3; n++ )
+	{
+		for ( int c = 0; c < 3; c++ )
+		{
+			m_position[0][c][n] = m_position[1][c][n] = 0.0f;
+		}
+	}
+
+	for ( int i = 0; i < m_nPositions; i += 4 )
+	{
+		fltx4 x = MaddSIMD( LoadAlignedSIMD( &m_position[1][0][i] ), f2, MulSIMD( LoadAlignedSIMD( &m_position[0][0][i] ), f1 ) );
+		fltx4 y = MaddSIMD( LoadAlignedSIMD( &m_position[1][1][i] ), f2, MulSIMD( LoadAlignedSIMD( &m_position[0][1][i] ), f1 ) );
+		fltx4 z = MaddSIMD( LoadAlignedSIMD( &m_position[1][2][i] ), f2, MulSIMD( LoadAlignedSIMD( &m_position[0][2][i] ), f1 ) );
+		fltx4 w = Four_Zeros;
+		TransposeSIMD( x, y, z, w );
+
+		const fltx4 rows[4] = { x, y, z, w };
+		int nLanes = MIN( 4, m_nPositions - i );
+		for ( int k = 0; k < nLanes; k++ )
+		{
+			StoreUnaligned3SIMD( pos[ m_positionBone[i + k] ].Base(), rows[k] );
+			Assert( pos[ m_positionBone[i + k] ].IsValid() );
+		}
+	}
+	m_nPositions = 0;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Rebuild the missing component of four packed quaternions
+//-----------------------------------------------------------------------------
+static FORCEINLINE void RebuildPackedFour( const float *pComponents[4], const float *pMissing, const float *pSign, fltx4 &x, fltx4 &y, fltx4 &z, fltx4 &w )
+{
+	x = LoadAlignedSIMD( pComponents[0] );
+	y = LoadAlignedSIMD( pComponents[1] );
+	z = LoadAlignedSIMD( pComponents[2] );
+	w = LoadAlignedSIMD( pComponents[3] );
+
+	fltx4 length = MaddSIMD( w, w, MaddSIMD( z, z, MaddSIMD( y, y, MulSIMD( x, x ) ) ) );
+	fltx4 d = MulSIMD( SqrtSIMD( MaxSIMD( Four_Zeros, SubSIMD( Four_Ones, length ) ) ), LoadAlignedSIMD( pSign ) );
+
+	fltx4 missing = LoadAlignedSIMD( pMissing );
+	x = MaskedAssign( (fltx4) CmpEqSIMD( missing, Four_Zeros ), d, x );
+	y = MaskedAssign( (fltx4) CmpEqSIMD( missing, Four_Ones ), d, y );
+	z = MaskedAssign( (fltx4) CmpEqSIMD( missing, Four_Twos ), d, z );
+	w = MaskedAssign( (fltx4) CmpEqSIMD( missing, Four_Threes ), d, w );
+}
+
+void CAnimDecodeBatch::FlushPacked( float s, BoneQuaternion *q, BoneVector *pos )
+{
+	BONE_PROFILE_FUNC();
+	PadRotations();
+
+	fltx4 sclq = ReplicateX4( s );
+	fltx4 sclp = SubSIMD( Four_Ones, sclq );
+
+	for ( int i = 0; i < m_nRotations; i += 4 )
+	{
+		const float *p1[4] = { &m_rotation[0][0][i], &m_rotation[0][1][i], &m_rotation[0][2][i], &m_rotation[0][3][i] };
+		const float *p2[4] = { &m_rotation[1][0][i], &m_rotation[1][1][i], &m_rotation[1][2][i], &m_rotation[1][3][i] };
+
+		fltx4 px, py, pz, pw, qx, qy, qz, qw;
+		RebuildPackedFour( p1, &m_missing[0][i], &m_sign[0][i], px, py, pz, pw );
+		RebuildPackedFour( p2, &m_missing[1][i], &m_sign[1][i], qx, qy, qz, qw );
+
+		QuaternionBlendFour( px, py, pz, pw, qx, qy, qz, qw, sclp, sclq );
+		StoreRotations( i, qx, qy, qz, qw, q );
+	}
+	m_nRotations = 0;
+
+	FlushPositions( s, pos );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: AngleQuaternion for four RadianEulers
+//-----------------------------------------------------------------------------
+static FORCEINLINE void AngleQuaternionFour( const float *pAngles[3], fltx4 &x, fltx4 &y, fltx4 &z, fltx4 &w )
+{
+	fltx4 sr, sp, sy, cr, cp, cy;
+	SinCosSIMD( sr, cr, MulSIMD( LoadAlignedSIMD( pAngles[0] ), Four_PointFives ) );
+	SinCosSIMD( sp, cp, MulSIMD( LoadAlignedSIMD( pAngles[1] ), Four_PointFives ) );
+	SinCosSIMD( sy, cy, MulSIMD( LoadAlignedSIMD( pAngles[2] ), Four_PointFives ) );
+
+	fltx4 srXcp = MulSIMD( sr, cp ), crXsp = MulSIMD( cr, sp );
+	x = SubSIMD( MulSIMD( srXcp, cy ), MulSIMD( crXsp, sy ) );
+	y = AddSIMD( MulSIMD( crXsp, cy ), MulSIMD( srXcp, sy ) );
+
+	fltx4 crXcp = MulSIMD( cr, cp ), srXsp = MulSIMD( sr, sp );
+	z = SubSIMD( MulSIMD( crXcp, sy ), MulSIMD( srXsp, cy ) );
+	w = AddSIMD( MulSIMD( crXcp, cy ), MulSIMD( srXsp, sy ) );
+}
+
+void CAnimDecodeBatch::FlushEuler( float s, BoneQuaternion *q, BoneVector *pos )
+{
+	BONE_PROFILE_FUNC();
+	PadRotations();
+
+	fltx4 sclq = ReplicateX4( s );
+	fltx4 sclp = SubSIMD( Four_Ones, sclq );
+
+	for ( int i = 0; i < m_nRotations; i += 4 )
+	{
+		const float *pAngle1[3] = { &m_rotation[0][0][i], &m_rotation[0][1][i], &m_rotation[0][2][i] };
+		const float *pAngle2[3] = { &m_rotation[1][0][i], &m_rotation[1][1][i], &m_rotation[1][2][i] };
+
+		fltx4 px, py, pz, pw, qx, qy, qz, qw;
+		AngleQuaternionFour( pAngle1, px, py, pz, pw );
+		AngleQuaternionFour( pAngle2, qx, qy, qz, qw );
+
+		QuaternionBlendFour( px, py, pz, pw, qx, qy, qz, qw, sclp, sclq );
+
+		// align to unified bone
+		fltx4 bx = LoadAlignedSIMD( &m_alignment[0][i] ), by = LoadAlignedSIMD( &m_alignment[1][i] );
+		fltx4 bz = LoadAlignedSIMD( &m_alignment[2][i] ), bw = LoadAlignedSIMD( &m_alignment[3][i] );
+		fltx4 dx = SubSIMD( bx, qx ), dy = SubSIMD( by, qy ), dz = SubSIMD( bz, qz ), dw = SubSIMD( bw, qw );
+		fltx4 ax = AddSIMD( bx, qx ), ay = AddSIMD( by, qy ), az = AddSIMD( bz, qz ), aw = AddSIMD( bw, qw );
+		fltx4 a = MaddSIMD( dw, dw, MaddSIMD( dz, dz, MaddSIMD( dy, dy, MulSIMD( dx, dx ) ) ) );
+		fltx4 b = MaddSIMD( aw, aw, MaddSIMD( az, az, MaddSIMD( ay, ay, MulSIMD( ax, ax ) ) ) );
+		fltx4 flip = (fltx4) CmpGtSIMD( a, b );
+		qx = MaskedAssign( flip, NegSIMD( qx ), qx );
+		qy = MaskedAssign( flip, NegSIMD( qy ), qy );
+		qz = MaskedAssign( flip, NegSIMD( qz ), qz );
+		qw = MaskedAssign( flip, NegSIMD( qw ), qw );
+
+		StoreRotations( i, qx, qy, qz, qw, q );
+	}
+	m_nRotations = 0;
+
+	FlushPositions( s, pos );
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: ExtractTwoFrames, but rotations and positions that need blending
+//			are staged in the batch instead of being blended one at a time
+//-----------------------------------------------------------------------------
+
+inline byte *StageTwoFrames( byte flags, byte *RESTRICT pFrameData, byte *&pConstantData, int framelength, BoneQuaternion &q, BoneVector &pos, CAnimDecodeBatch &batch, int bone, bool bIsDelta = false, const mstudiolinearbone_t *pLinearBones = NULL )
+{
+	BONE_PROFILE_FUNC();
+	if (flags & STUDIO_FRAME_ANIM_ROT)
+	{
+		batch.AddRotation( bone, (Quaternion48 *)(pFrameData), (Quaternion48 *)(pFrameData + framelength) );
+		pFrameData += sizeof( Quaternion48 );
+	}
+	else if (flags & STUDIO_FRAME_ANIM_ROT2)
+	{
+		batch.AddRotation( bone, (Quaternion48S *)(pFrameData), (Quaternion48S *)(pFrameData + framelength) );
+		pFrameData += sizeof( Quaternion48S );
+	}
+	else if (flags & STUDIO_FRAME_CONST_ROT)
+	{
+		q = *((Quaternion48 *)(pConstantData));
+		Assert( q.IsValid() );
+		pConstantData += sizeof( Quaternion48 );
+	}
+	else if (flags & STUDIO_FRAME_CONST_ROT2)
+	{
+		q = *((Quaternion48S *)(pConstantData));
+		Assert( q.IsValid() );
+		pConstantData += sizeof( Quaternion48S );
+	}
+	// the non-virtual version needs initializers for no-animation
+	else if (pLinearBones)
+	{
+		if (bIsDelta)
+		{
+			q.Init( 0.0f, 0.0f, 0.0f, 1.0f );
+		}
+		else
+		{
+			q = pLinearBones->quat( bone );
+		}
+	}
+	if (flags & STUDIO_FRAME_ANIM_POS)
+	{
+		Vector p1 = *((Vector48 *)(pFrameData));
+		Vector p2 = *((Vector48 *)(pFrameData + framelength));
+		batch.AddPosition( bone, p1, p2 );
+		pFrameData += sizeof( Vector48 );
+	}
+	else if (flags & STUDIO_FRAME_CONST_POS)
+	{
+		pos = *((Vector48 *)(pConstantData));
+		Assert( pos.IsValid() );
+		pConstantData += sizeof( Vector48 );
+	}
+	else if (flags & STUDIO_FRAME_ANIM_POS2)
+	{
+		// pFrameData has no alignment guarantees, so using V_memcpy.
+		Vector p1, p2;
+		V_memcpy( &p1, pFrameData, sizeof( p1 ) );
+		V_memcpy( &p2, pFrameData + framelength, sizeof( p2 ) );
+		batch.AddPosition( bone, p1, p2 );
+		pFrameData += sizeof( Vector );
+	}
+	else if (flags & STUDIO_FRAME_CONST_POS2)
+	{
+		// pFrameData has no alignment guarantees, so using V_memcpy.
+		V_memcpy( &pos, pConstantData, sizeof( pos ) );
+		Assert( pos.IsValid() );
+		pConstantData += sizeof( Vector );
+	}
+	// the non-virtual version needs initializers for no-animation
+	else if (pLinearBones)
+	{
+		if (bIsDelta)
+		{
+			pos.Init( 0.0f, 0.0f, 0.0f );
+		}
+		else
+		{
+			pos = pLinearBones->pos( bone );
+		}
+	}
+	return pFrameData;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: CalcBoneQuaternion for s > 0.001, staging animated rotations in
+//			the batch instead of blending them one at a time
+//-----------------------------------------------------------------------------
+static void StageBoneQuaternion( int frame, 
+						const mstudiobone_t *pBone,
+						const mstudiolinearbone_t *pLinearBones,
+						const mstudio_rle_anim_t *panim, BoneQuaternion &q, 
+						CAnimDecodeBatch &batch, int bone )
+{
+	if ( ( panim->flags & ( STUDIO_ANIM_RAWROT | STUDIO_ANIM_RAWROT2 ) ) || !( panim->flags & STUDIO_ANIM_ANIMROT ) )
+	{
+		// nothing to blend
+		CalcBoneQuaternion( frame, 1.0f, pBone, pLinearBones, panim, q );
+		return;
+	}
+
+	int iBone = panim->bone;
+	const RadianEuler &baseRot = pLinearBones ? pLinearBones->rot( iBone ) : pBone->rot;
+	const Vector &baseRotScale = pLinearBones ? pLinearBones->rotscale( iBone ) : pBone->rotscale;
+	int iBaseFlags = pLinearBones ? pLinearBones->flags( iBone ) : pBone->flags;
+	const Quaternion &baseAlignment = pLinearBones ? pLinearBones->qalignment( iBone ) : pBone->qAlignment;
+
+	mstudioanim_valueptr_t *pValuesPtr = panim->pRotV();
+
+	RadianEuler angle1, angle2;
+	ExtractAnimValue( frame, pValuesPtr->pAnimvalue( 0 ), baseRotScale.x, angle1.x, angle2.x );
+	ExtractAnimValue( frame, pValuesPtr->pAnimvalue( 1 ), baseRotScale.y, angle1.y, angle2.y );
+	ExtractAnimValue( frame, pValuesPtr->pAnimvalue( 2 ), baseRotScale.z, angle1.z, angle2.z );
+
+	const Quaternion *pAlignment = NULL;
+	if (!(panim->flags & STUDIO_ANIM_DELTA))
+	{
+		angle1.x = angle1.x + baseRot.x;
+		angle1.y = angle1.y + baseRot.y;
+		angle1.z = angle1.z + baseRot.z;
+		angle2.x = angle2.x + baseRot.x;
+		angle2.y = angle2.y + baseRot.y;
+		angle2.z = angle2.z + baseRot.z;
+
+		if (iBaseFlags & BONE_FIXED_ALIGNMENT)
+		{
+			pAlignment = &baseAlignment;
+		}
+	}
+
+	Assert( angle1.IsValid() && angle2.IsValid() );
+	batch.AddRotation( bone, angle1, angle2, pAlignment );
+}
+
+
 //-----------------------------------------------------------------------------
 // Purpose: Extract a single bone of animation
 //-----------------------------------------------------------------------------
@@ -1350,7 +1808,28 @@ static void CalcVirtualAnimation( virtualmodel_t *pVModel, const CStudioHdr *pSt
 // 		byte *pFrameData = pFrameanim->pFrameData( iLocalFrame );
 // 		int framelength = pFrameanim->framelength;
 
-		if (s > 0.0)
+		if (s > 0.0 && anim_simd_decode.GetBool())
+		{
+			CAnimDecodeBatch batch;
+			for (i = 0; i < pAnimStudioHdr->numbones; i++)
+			{
+				j = pAnimGroup->masterBone[i];
+				if ( j >= 0 && ( pStudioHdr->boneFlags(j) & boneMask ) )
+				{
+					pFrameData = StageTwoFrames( *pBoneFlags, pFrameData, pConstantData, framelength, q[j], pos[j], batch, j );
+	#ifdef STUDIO_ENABLE_PERF_COUNTERS
+					pStudioHdr->m_nPerfAnimatedBones++;
+	#endif
+				}
+				else
+				{
+					pFrameData = SkipBoneFrame( *pBoneFlags, pFrameData, pConstantData );
+				}
+				pBoneFlags++;
+			}
+			batch.FlushPacked( s, q, pos );
+		}
+		else if (s > 0.0)
 		{
 			for (i = 0; i < pAnimStudioHdr->numbones; i++)
 			{
@@ -1391,6 +1870,9 @@ static void CalcVirtualAnimation( virtualmodel_t *pVModel, const CStudioHdr *pSt
 	}
 	else if (panim)
 	{
+		CAnimDecodeBatch batch;
+		bool bBatch = s > 0.001f && anim_simd_decode.GetBool();
+
 		// FIXME: change encoding so that bone -1 is never the case
 		while (panim && panim->bone < 255)
 		{
@@ -1401,7 +1883,14 @@ static void CalcVirtualAnimation( virtualmodel_t *pVModel, const CStudioHdr *pSt
 
 				if (k >= 0 && pweight[k] > 0.0f)
 				{
-					CalcBoneQuaternion( iLocalFrame, s, &pAnimbone[panim->bone], pAnimLinearBones, panim, q[j] );
+					if ( bBatch )
+					{
+						StageBoneQuaternion( iLocalFrame, &pAnimbone[panim->bone], pAnimLinearBones, panim, q[j], batch, j );
+					}
+					else
+					{
+						CalcBoneQuaternion( iLocalFrame, s, &pAnimbone[panim->bone], pAnimLinearBones, panim, q[j] );
+					}
 					CalcBonePosition  ( iLocalFrame, s, &pAnimbone[panim->bone], pAnimLinearBones, panim, pos[j] );
 	#ifdef STUDIO_ENABLE_PERF_COUNTERS
 					pStudioHdr->m_nPerfAnimatedBones++;
@@ -1410,6 +1899,11 @@ static void CalcVirtualAnimation( virtualmodel_t *pVModel, const CStudioHdr *pSt
 			}
 			panim = panim->pNext();
 		}
+
+		if ( bBatch )
+		{
+			batch.FlushEuler( s, q, pos );
+		}
 	}
 	else
 	{
@@ -1573,7 +2067,27 @@ void CalcAnimation( const CStudioHdr *pStudioHdr, BoneVector *pos, BoneQuaternio
 // 		byte *pFrameData = pFrameanim->pFrameData( iLocalFrame );
 // 		int framelength = pFrameanim->framelength;
 
-		if (s > 0.0)
+		if (s > 0.0 && anim_simd_decode.GetBool())
+		{
+			CAnimDecodeBatch batch;
+			for (i = 0; i < pStudioHdr->numbones(); i++, pBoneFlags++, pweight++)
+			{
+				if (*pweight > 0 && (pStudioHdr->boneFlags(i) & boneMask))
+				{
+					pFrameData = StageTwoFrames( *pBoneFlags, pFrameData, pConstantData, framelength, q[i], pos[i], batch, i, bIsDelta, pLinearBones );
+	#ifdef STUDIO_ENABLE_PERF_COUNTERS
+					pStudioHdr->m_nPerfAnimatedBones++;
+	#endif
+				}
+				else
+				{
+					pFrameData = SkipBoneFrame( *pBoneFlags, pFrameData, pConstantData );
+				}
+				pStudioHdr->m_nPerfUsedBones++;
+			}
+			batch.FlushPacked( s, q, pos );
+		}
+		else if (s > 0.0)
 		{
 			for (i = 0; i < pStudioHdr->numbones(); i++, pBoneFlags++, pweight++)
 			{
@@ -1612,6 +2126,9 @@ void CalcAnimation( const CStudioHdr *pStudioHdr, BoneVector *pos, BoneQuaternio
 	}
 	else
 	{
+		CAnimDecodeBatch batch;
+		bool bBatch = s > 0.001f && anim_simd_decode.GetBool();
+
 		// BUGBUG: the sequence, the anim, and the model can have all different bone mappings.
 		for (i = 0; i < pStudioHdr->numbones(); i++, pbone++, pweight++)
 		{
@@ -1619,7 +2136,14 @@ void CalcAnimation( const CStudioHdr *pStudioHdr, BoneVector *pos, BoneQuaternio
 			{
 				if (*pweight > 0 && (pStudioHdr->boneFlags(i) & boneMask))
 				{
-					CalcBoneQuaternion( iLocalFrame, s, pbone, pLinearBones, panim, q[i] );
+					if ( bBatch )
+					{
+						StageBoneQuaternion( iLocalFrame, pbone, pLinearBones, panim, q[i], batch, i );
+					}
+					else
+					{
+						CalcBoneQuaternion( iLocalFrame, s, pbone, pLinearBones, panim, q[i] );
+					}
 					CalcBonePosition  ( iLocalFrame, s, pbone, pLinearBones, panim, pos[i] );
 	#ifdef STUDIO_ENABLE_PERF_COUNTERS
 					pStudioHdr->m_nPerfAnimatedBones++;
@@ -1645,6 +2169,11 @@ void CalcAnimation( const CStudioHdr *pStudioHdr, BoneVector *pos, BoneQuaternio
 	#endif
 			}
 		}
+
+		if ( bBatch )
+		{
+			batch.FlushEuler( s, q, pos );
+		}
 	}
 
 	// cross fade in previous zeroframe data
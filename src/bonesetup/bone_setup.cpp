@@ -25,6 +25,9 @@
 #include "posedebugger.h"
 #include "mathlib/softbody.h"
 #include "tier0/miniprofiler.h"
+#include "tier0/fasttimer.h"
+#include "tier1/utlhashtable.h"
+#include "generichash.h"
 
 #ifdef CLIENT_DLL
 	#include "posedebugger.h"
@@ -701,6 +704,256 @@ void CalcPose(
 }
 #endif
 
+//-----------------------------------------------------------------------------
+// Pose cache: local space poses from CalcPoseSingle, shared between every
+// entity that plays the same sequence of the same model at the same quantized
+// cycle and pose parameters. Entries live in a CDataManager so the least
+// recently used ones are dropped once the cache outgrows its budget.
+//-----------------------------------------------------------------------------
+static ConVar anim_pose_cache( "anim_pose_cache", "0", FCVAR_REPLICATED, "Share sequence poses between entities with the same model, sequence, cycle and pose parameters." );
+static ConVar anim_pose_cache_budget( "anim_pose_cache_budget", "4096", FCVAR_REPLICATED, "Memory budget of the pose cache in KB.", true, 64, true, 262144 );
+static ConVar anim_pose_cache_cycle_steps( "anim_pose_cache_cycle_steps", "1024", FCVAR_REPLICATED, "Number of steps the cycle is quantized to for pose cache lookups.", true, 16, true, 65536 );
+static ConVar anim_pose_cache_stats( "anim_pose_cache_stats", "0", FCVAR_REPLICATED, "Time sequence pose evaluation and bone setup for sv_anim_pose_cache_stats." );
+static ConVar anim_pose_cache_pose_steps( "anim_pose_cache_pose_steps", "256", FCVAR_REPLICATED, "Number of steps pose parameters are quantized to for pose cache lookups.", true, 16, true, 65536 );
+
+struct PoseCacheKey_t
+{
+	const studiohdr_t *m_pStudioHdr;
+	const virtualmodel_t *m_pVModel;
+	int m_nChecksum;
+	int m_nSequence;
+	int m_nBoneMask;
+	int m_nCycle;
+	int m_nPose[3];
+	int m_nFlags;
+
+	bool operator==( const PoseCacheKey_t &other ) const { return !memcmp( this, &other, sizeof( *this ) ); }
+};
+
+struct PoseCacheKeyHash_t
+{
+	unsigned int operator()( const PoseCacheKey_t &key ) const { return HashBlock( &key, sizeof( key ) ); }
+};
+
+struct posecacheparams_t
+{
+	const PoseCacheKey_t *pKey;
+	const BoneVector *pos;
+	const BoneQuaternionAligned *q;
+	int numbones;
+	bool bResult;
+};
+
+class CPoseCacheEntry
+{
+public:
+	// you must implement these static functions for the ResourceManager
+	// -----------------------------------------------------------
+	static CPoseCacheEntry *CreateResource( const posecacheparams_t &params );
+	static unsigned int EstimatedSize( const posecacheparams_t &params );
+	// -----------------------------------------------------------
+	// member functions that must be present for the ResourceManager
+	void			DestroyResource();
+	CPoseCacheEntry	*GetData() { return this; }
+	unsigned int	Size() { return m_size; }
+	// -----------------------------------------------------------
+
+	BoneQuaternionAligned *Quaternions() { return (BoneQuaternionAligned *)( (byte *)this + AlignValue( sizeof( CPoseCacheEntry ), 16 ) ); }
+	BoneVector		*Positions() { return (BoneVector *)( Quaternions() + m_numbones ); }
+
+	PoseCacheKey_t	m_key;
+	unsigned int	m_size;
+	int				m_numbones;
+	bool			m_bResult;
+};
+
+// The key table has to outlive the data manager, which destroys its entries on shutdown
+static CUtlHashtable< PoseCacheKey_t, memhandle_t, PoseCacheKeyHash_t > g_PoseCacheTable;
+static CDataManager< CPoseCacheEntry, posecacheparams_t, CPoseCacheEntry *, CThreadFastMutex > g_PoseCache( 4096 * 1024 );
+
+static CInterlockedInt g_nPoseCacheLookups;
+static CInterlockedInt g_nPoseCacheHits;
+static CInterlockedInt g_nPoseCacheInserts;
+static CInterlockedInt g_nPoseCacheEvictions;
+static CPerThreadCycleCounter g_PoseEvaluations;
+
+CPoseCacheEntry *CPoseCacheEntry::CreateResource( const posecacheparams_t &params )
+{
+	unsigned int size = EstimatedSize( params );
+	CPoseCacheEntry *pMem = (CPoseCacheEntry *)MemAlloc_AllocAligned( size, 16 );
+	pMem->m_key = *params.pKey;
+	pMem->m_size = size;
+	pMem->m_numbones = params.numbones;
+	pMem->m_bResult = params.bResult;
+	memcpy( pMem->Quaternions(), params.q, sizeof( BoneQuaternionAligned ) * params.numbones );
+	memcpy( pMem->Positions(), params.pos, sizeof( BoneVector ) * params.numbones );
+	return pMem;
+}
+
+unsigned int CPoseCacheEntry::EstimatedSize( const posecacheparams_t &params )
+{
+	return AlignValue( sizeof( CPoseCacheEntry ), 16 ) + params.numbones * ( sizeof( BoneQuaternionAligned ) + sizeof( BoneVector ) );
+}
+
+void CPoseCacheEntry::DestroyResource()
+{
+	// Called with the cache mutex held, either on eviction or on a flush
+	g_PoseCacheTable.Remove( m_key );
+	++g_nPoseCacheEvictions;
+	MemAlloc_FreeAligned( this );
+}
+
+static inline int QuantizePoseValue( float flValue, int nSteps )
+{
+	return (int)floorf( flValue * nSteps + 0.5f );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Builds the cache key for a sequence and writes out the cycle and
+//			pose parameters snapped to the key, so that whoever computes the
+//			pose computes it for exactly the values every sharer will get
+//-----------------------------------------------------------------------------
+static bool BuildPoseCacheKey( const CStudioHdr *pStudioHdr, mstudioseqdesc_t &seqdesc, int sequence, float cycle, const float poseParameter[], int boneMask,
+	PoseCacheKey_t &key, float &flSnappedCycle, float *pSnappedPoseParameter )
+{
+	// realtime sequences are driven by the clock, not the cycle
+	if ( seqdesc.flags & STUDIO_REALTIME )
+		return false;
+
+	const studiohdr_t *pRenderHdr = pStudioHdr->GetRenderHdr();
+	if ( !pRenderHdr )
+		return false;
+
+	memset( &key, 0, sizeof( key ) );
+	key.m_pStudioHdr = pRenderHdr;
+	key.m_pVModel = pStudioHdr->GetVirtualModel();
+	key.m_nChecksum = pRenderHdr->checksum;
+	key.m_nSequence = sequence;
+	key.m_nBoneMask = boneMask;
+	key.m_nFlags = anim_3wayblend.GetBool() ? 1 : 0;
+
+	int nPoseSteps = anim_pose_cache_pose_steps.GetInt();
+	int nPoseParameters = MIN( pStudioHdr->GetNumPoseParameters(), MAXSTUDIOPOSEPARAM );
+	memcpy( pSnappedPoseParameter, poseParameter, sizeof( float ) * nPoseParameters );
+
+	int iPose[3];
+	iPose[0] = pStudioHdr->GetSharedPoseParameter( sequence, seqdesc.paramindex[0] );
+	iPose[1] = pStudioHdr->GetSharedPoseParameter( sequence, seqdesc.paramindex[1] );
+	iPose[2] = ( seqdesc.flags & STUDIO_CYCLEPOSE ) ? pStudioHdr->GetSharedPoseParameter( sequence, seqdesc.cycleposeindex ) : -1;
+	for ( int i = 0; i < 3; i++ )
+	{
+		if ( iPose[i] < 0 || iPose[i] >= nPoseParameters )
+			continue;
+
+		key.m_nPose[i] = QuantizePoseValue( poseParameter[ iPose[i] ], nPoseSteps );
+		pSnappedPoseParameter[ iPose[i] ] = (float)key.m_nPose[i] / nPoseSteps;
+	}
+
+	// cycle pose sequences take their cycle from a pose parameter
+	if ( seqdesc.flags & STUDIO_CYCLEPOSE )
+	{
+		flSnappedCycle = 0.0f;
+	}
+	else
+	{
+		int nCycleSteps = anim_pose_cache_cycle_steps.GetInt();
+		key.m_nCycle = QuantizePoseValue( cycle, nCycleSteps );
+		flSnappedCycle = (float)key.m_nCycle / nCycleSteps;
+	}
+
+	return true;
+}
+
+static bool LookupCachedPose( const PoseCacheKey_t &key, BoneVector pos[], BoneQuaternionAligned q[], int numbones, bool &bResult )
+{
+	++g_nPoseCacheLookups;
+
+	AUTO_LOCK( g_PoseCache.AccessMutex() );
+	UtlHashHandle_t h = g_PoseCacheTable.Find( key );
+	if ( h == g_PoseCacheTable.InvalidHandle() )
+		return false;
+
+	CPoseCacheEntry *pEntry = g_PoseCache.GetResource_NoLock( g_PoseCacheTable[h] );
+	if ( !pEntry || pEntry->m_numbones != numbones )
+	{
+		g_PoseCacheTable.RemoveByHandle( h );
+		return false;
+	}
+
+	memcpy( q, pEntry->Quaternions(), sizeof( BoneQuaternionAligned ) * numbones );
+	memcpy( pos, pEntry->Positions(), sizeof( BoneVector ) * numbones );
+	bResult = pEntry->m_bResult;
+	++g_nPoseCacheHits;
+	return true;
+}
+
+static void StoreCachedPose( const PoseCacheKey_t &key, const BoneVector pos[], const BoneQuaternionAligned q[], int numbones, bool bResult )
+{
+	posecacheparams_t params;
+	params.pKey = &key;
+	params.pos = pos;
+	params.q = q;
+	params.numbones = numbones;
+	params.bResult = bResult;
+
+	AUTO_LOCK( g_PoseCache.AccessMutex() );
+
+	// another thread may have computed the same pose in the meantime
+	if ( g_PoseCacheTable.HasElement( key ) )
+		return;
+
+	unsigned int nBudget = (unsigned int)anim_pose_cache_budget.GetInt() * 1024;
+	if ( g_PoseCache.TargetSize() != nBudget )
+	{
+		g_PoseCache.SetTargetSize( nBudget );
+		g_PoseCache.FlushToTargetSize();
+	}
+
+	memhandle_t hEntry = g_PoseCache.CreateResource( params );
+	g_PoseCacheTable.Insert( key, hEntry );
+	++g_nPoseCacheInserts;
+}
+
+void Studio_GetPoseCacheStats( posecachestats_t &stats )
+{
+	stats.m_nLookups = g_nPoseCacheLookups;
+	stats.m_nHits = g_nPoseCacheHits;
+	stats.m_nInserts = g_nPoseCacheInserts;
+	stats.m_nEvictions = g_nPoseCacheEvictions;
+	int64 nEvaluationCycles;
+	g_PoseEvaluations.Get( stats.m_nEvaluations, nEvaluationCycles );
+
+	CCycleCount cycles;
+	cycles.Init( (uint64)nEvaluationCycles );
+	stats.m_flEvaluationTime = cycles.GetSeconds();
+
+	AUTO_LOCK( g_PoseCache.AccessMutex() );
+	stats.m_nEntries = g_PoseCacheTable.Count();
+	stats.m_nUsedBytes = g_PoseCache.UsedSize();
+	stats.m_nBudgetBytes = g_PoseCache.TargetSize();
+}
+
+void Studio_ResetPoseCacheStats()
+{
+	g_nPoseCacheLookups = 0;
+	g_nPoseCacheHits = 0;
+	g_nPoseCacheInserts = 0;
+	g_nPoseCacheEvictions = 0;
+	g_PoseEvaluations.Reset();
+}
+
+bool Studio_PoseCacheStatsEnabled()
+{
+	return anim_pose_cache_stats.GetBool();
+}
+
+void Studio_FlushPoseCache()
+{
+	AUTO_LOCK( g_PoseCache.AccessMutex() );
+	g_PoseCache.FlushAll();
+	Assert( g_PoseCacheTable.Count() == 0 );
+}
+
 extern ConVar cl_use_simd_bones;
 //-----------------------------------------------------------------------------
 // Purpose: accumulate a pose for a single sequence on top of existing animation
@@ -769,12 +1022,49 @@ void CBoneSetup::AccumulatePose(
 		seq_ik.AddSequenceLocks( seqdesc, pos, q );
 	}
 
-	if ((seqdesc.flags & STUDIO_LOCAL) || (seqdesc.flags & STUDIO_ROOTXFORM) || (seqdesc.flags & STUDIO_WORLD_AND_RELATIVE))
+	bool bTimePose = anim_pose_cache_stats.GetBool();
+	CFastTimer poseTimer;
+	if ( bTimePose )
+	{
+		poseTimer.Start();
+	}
+
+	bool bPoseResult = false;
+	PoseCacheKey_t poseKey;
+	float flSnappedCycle;
+	float flSnappedPoseParameter[MAXSTUDIOPOSEPARAM];
+	int numbones = m_pStudioHdr->numbones();
+	if ( anim_pose_cache.GetBool() &&
+		BuildPoseCacheKey( m_pStudioHdr, seqdesc, sequence, cycle, m_flPoseParameter, m_boneMask, poseKey, flSnappedCycle, flSnappedPoseParameter ) )
+	{
+		if ( !LookupCachedPose( poseKey, pos2, q2, numbones, bPoseResult ) )
+		{
+			if ((seqdesc.flags & STUDIO_LOCAL) || (seqdesc.flags & STUDIO_ROOTXFORM) || (seqdesc.flags & STUDIO_WORLD_AND_RELATIVE))
+			{
+				::InitPose( m_pStudioHdr, pos2, q2, m_boneMask );
+			}
+
+			bPoseResult = CalcPoseSingle( m_pStudioHdr, pos2, q2, seqdesc, sequence, flSnappedCycle, flSnappedPoseParameter, m_boneMask, flTime );
+			StoreCachedPose( poseKey, pos2, q2, numbones, bPoseResult );
+		}
+	}
+	else
+	{
+		if ((seqdesc.flags & STUDIO_LOCAL) || (seqdesc.flags & STUDIO_ROOTXFORM) || (seqdesc.flags & STUDIO_WORLD_AND_RELATIVE))
+		{
+			::InitPose( m_pStudioHdr, pos2, q2, m_boneMask );
+		}
+
+		bPoseResult = CalcPoseSingle( m_pStudioHdr, pos2, q2, seqdesc, sequence, cycle, m_flPoseParameter, m_boneMask, flTime );
+	}
+
+	if ( bTimePose )
 	{
-		::InitPose( m_pStudioHdr, pos2, q2, m_boneMask );
+		poseTimer.End();
+		g_PoseEvaluations.Add( (int64)poseTimer.GetDuration().GetLongCycles() );
 	}
 
-	if (CalcPoseSingle( m_pStudioHdr, pos2, q2, seqdesc, sequence, cycle, m_flPoseParameter, m_boneMask, flTime ))
+	if ( bPoseResult )
 	{
 
 		if ( (seqdesc.flags & STUDIO_ROOTXFORM) && seqdesc.rootDriverIndex > 0 )
@@ -22,6 +22,7 @@
 #include "tier0/memdbgon.h"
 
 #define NETWORKED_TYPE_BITS 4
+#define MAX_POOLED_EVENTS	256
 
 //////////////////////////////////////////////////////////////////////
 // Construction/Destruction
@@ -61,101 +62,496 @@ static ConVar net_showeventlisteners( "net_showeventlisteners", "0", 0, "Show li
 
 EXPOSE_SINGLE_INTERFACE_GLOBALVAR( CGameEventManager, IGameEventManager2, INTERFACEVERSION_GAMEEVENTSMANAGER2, s_GameEventManager );
 
+void CGameEventDescriptor::BuildKeyList()
+{
+	keyList.RemoveAll();
+	keyIndices.RemoveAll();
+
+	if ( keys )
+	{
+		for ( KeyValues *key = keys->GetFirstSubKey(); key; key = key->GetNextKey() )
+		{
+			CGameEventKey &eventKey = keyList[ keyList.AddToTail() ];
+			eventKey.name = key->GetName();
+			eventKey.type = key->GetInt();
+			keyIndices.Insert( eventKey.name, keyList.Count() - 1 );
+		}
+	}
+
+	numDeclaredKeys = keyList.Count();
+
+	// every event remembers the split screen slot it was created in
+	if ( FindKey( "splitscreenplayer" ) < 0 )
+	{
+		CGameEventKey &eventKey = keyList[ keyList.AddToTail() ];
+		eventKey.name = "splitscreenplayer";
+		eventKey.type = CGameEventManager::TYPE_LOCAL;
+		keyIndices.Insert( eventKey.name, keyList.Count() - 1 );
+	}
+}
+
 CGameEvent::CGameEvent( CGameEventDescriptor *descriptor, const char *name )
+{
+	m_pExtraKeys = NULL;
+	m_pDataKeys = NULL;
+	m_pSerialized = NULL;
+	m_bSerialized = false;
+	m_pPrevLive = NULL;
+	m_pNextLive = NULL;
+	m_nInlineStringsUsed = 0;
+	m_nStringBlockUsed = 0;
+	m_nStringBlockSize = 0;
+
+	Init( descriptor, name );
+}
+
+CGameEvent::~CGameEvent()
+{
+	Clear();
+	delete m_pSerialized;
+}
+
+void CGameEvent::Init( CGameEventDescriptor *descriptor, const char *name )
 {
 	Assert( descriptor );
 
+	Clear();
+
 	m_pDescriptor = descriptor;
-	m_pDataKeys = new KeyValues( name );
-	m_pDataKeys->SetInt( "splitscreenplayer", GET_ACTIVE_SPLITSCREEN_SLOT() );
+	m_pName = name;
+
+	m_Values.SetCount( descriptor->keyList.Count() );
+	V_memset( m_Values.Base(), 0, m_Values.Count() * sizeof( Value_t ) );
+
+	SetInt( "splitscreenplayer", GET_ACTIVE_SPLITSCREEN_SLOT() );
 }
 
-CGameEvent::~CGameEvent()
+void CGameEvent::Clear()
+{
+	m_Values.RemoveAll();
+
+	if ( m_pExtraKeys )
+	{
+		m_pExtraKeys->deleteThis();
+		m_pExtraKeys = NULL;
+	}
+
+	if ( m_pDataKeys )
+	{
+		m_pDataKeys->deleteThis();
+		m_pDataKeys = NULL;
+	}
+
+	m_bSerialized = false;
+
+	m_nInlineStringsUsed = 0;
+	m_StringBlocks.PurgeAndDeleteElementsArray();
+	m_nStringBlockUsed = 0;
+	m_nStringBlockSize = 0;
+}
+
+void CGameEvent::CopyFrom( const CGameEvent &src )
+{
+	Init( src.m_pDescriptor, src.m_pName );
+
+	int count = MIN( m_Values.Count(), src.m_Values.Count() );
+	for ( int i = 0; i < count; i++ )
+	{
+		const Value_t &value = src.m_Values[i];
+		switch ( value.m_nType )
+		{
+		case VALUE_NONE: break;
+		case VALUE_STRING: SetStringByIndex( i, value.m_pString ); break;
+		case VALUE_WSTRING: SetWStringByIndex( i, value.m_pWString ); break;
+		default: SetValue( i, value.m_nType )->m_nUint64 = value.m_nUint64; break;
+		}
+	}
+
+	if ( src.m_pExtraKeys )
+	{
+		m_pExtraKeys = src.m_pExtraKeys->MakeCopy();
+	}
+}
+
+void *CGameEvent::AllocStringSpace( int size ) const
+{
+	size = AlignValue( size, 8 );
+
+	if ( m_nInlineStringsUsed + size <= INLINE_STRING_BYTES )
+	{
+		void *p = (char *)m_InlineStrings + m_nInlineStringsUsed;
+		m_nInlineStringsUsed += size;
+		return p;
+	}
+
+	if ( !m_StringBlocks.Count() || m_nStringBlockUsed + size > m_nStringBlockSize )
+	{
+		m_nStringBlockSize = MAX( size, 4096 );
+		m_nStringBlockUsed = 0;
+		m_StringBlocks.AddToTail( new char[ m_nStringBlockSize ] );
+	}
+
+	void *p = m_StringBlocks.Tail() + m_nStringBlockUsed;
+	m_nStringBlockUsed += size;
+	return p;
+}
+
+const char *CGameEvent::AllocString( const char *value ) const
+{
+	int size = V_strlen( value ) + 1;
+	char *p = (char *)AllocStringSpace( size );
+	V_memcpy( p, value, size );
+	return p;
+}
+
+const wchar_t *CGameEvent::AllocWString( const wchar_t *value ) const
+{
+	int size = ( wcslen( value ) + 1 ) * sizeof( wchar_t );
+	wchar_t *p = (wchar_t *)AllocStringSpace( size );
+	V_memcpy( p, value, size );
+	return p;
+}
+
+CGameEvent::Value_t *CGameEvent::SetValue( int index, int type )
+{
+	Value_t &value = m_Values[index];
+	value.m_nType = type;
+	value.m_pConvertedString = NULL;
+	value.m_pConvertedWString = NULL;
+	m_bSerialized = false;
+	return &value;
+}
+
+KeyValues *CGameEvent::ExtraKeys()
+{
+	if ( !m_pExtraKeys )
+	{
+		m_pExtraKeys = new KeyValues( m_pName );
+	}
+
+	return m_pExtraKeys;
+}
+
+int CGameEvent::GetIntByIndex( int index, int defaultValue ) const
+{
+	if ( !m_Values.IsValidIndex( index ) )
+		return defaultValue;
+
+	const Value_t &value = m_Values[index];
+	switch ( value.m_nType )
+	{
+	case VALUE_INT:		return value.m_nInt;
+	case VALUE_FLOAT:	return (int)value.m_flFloat;
+	case VALUE_UINT64:	return (int)value.m_nUint64;
+	case VALUE_STRING:	return V_atoi( value.m_pString );
+	case VALUE_WSTRING:	return (int)wcstol( value.m_pWString, NULL, 10 );
+	case VALUE_PTR:		return (int)(intp)value.m_pPtr;
+	}
+
+	return defaultValue;
+}
+
+uint64 CGameEvent::GetUint64ByIndex( int index, uint64 defaultValue ) const
+{
+	if ( !m_Values.IsValidIndex( index ) )
+		return defaultValue;
+
+	const Value_t &value = m_Values[index];
+	switch ( value.m_nType )
+	{
+	case VALUE_INT:		return (uint64)value.m_nInt;
+	case VALUE_FLOAT:	return (uint64)value.m_flFloat;
+	case VALUE_UINT64:	return value.m_nUint64;
+	case VALUE_STRING:	return V_atoui64( value.m_pString );
+	case VALUE_WSTRING:	return (uint64)wcstoull( value.m_pWString, NULL, 10 );
+	case VALUE_PTR:		return (uint64)(uintp)value.m_pPtr;
+	}
+
+	return defaultValue;
+}
+
+float CGameEvent::GetFloatByIndex( int index, float defaultValue ) const
+{
+	if ( !m_Values.IsValidIndex( index ) )
+		return defaultValue;
+
+	const Value_t &value = m_Values[index];
+	switch ( value.m_nType )
+	{
+	case VALUE_INT:		return (float)value.m_nInt;
+	case VALUE_FLOAT:	return value.m_flFloat;
+	case VALUE_UINT64:	return (float)value.m_nUint64;
+	case VALUE_STRING:	return (float)V_atof( value.m_pString );
+	case VALUE_WSTRING:	return (float)wcstod( value.m_pWString, NULL );
+	case VALUE_PTR:		return (float)(intp)value.m_pPtr;
+	}
+
+	return defaultValue;
+}
+
+const char *CGameEvent::GetStringByIndex( int index, const char *defaultValue ) const
 {
-	m_pDataKeys->deleteThis();
+	if ( !m_Values.IsValidIndex( index ) )
+		return defaultValue;
+
+	const Value_t &value = m_Values[index];
+	if ( value.m_nType == VALUE_STRING )
+		return value.m_pString;
+
+	if ( value.m_nType == VALUE_NONE )
+		return defaultValue;
+
+	if ( !value.m_pConvertedString )
+	{
+		char buf[64];
+		switch ( value.m_nType )
+		{
+		case VALUE_INT:		V_snprintf( buf, sizeof( buf ), "%d", value.m_nInt ); break;
+		case VALUE_FLOAT:	V_snprintf( buf, sizeof( buf ), "%f", value.m_flFloat ); break;
+		case VALUE_UINT64:	V_snprintf( buf, sizeof( buf ), "%llu", value.m_nUint64 ); break;
+		case VALUE_PTR:		V_snprintf( buf, sizeof( buf ), "%p", value.m_pPtr ); break;
+		case VALUE_WSTRING:
+			{
+				int size = wcslen( value.m_pWString ) * 4 + 1;
+				char *pUTF8 = (char *)AllocStringSpace( size );
+				V_UnicodeToUTF8( value.m_pWString, pUTF8, size );
+				value.m_pConvertedString = pUTF8;
+				return pUTF8;
+			}
+		}
+
+		value.m_pConvertedString = AllocString( buf );
+	}
+
+	return value.m_pConvertedString;
+}
+
+const wchar_t *CGameEvent::GetWStringByIndex( int index, const wchar_t *defaultValue ) const
+{
+	if ( !m_Values.IsValidIndex( index ) )
+		return defaultValue;
+
+	const Value_t &value = m_Values[index];
+	if ( value.m_nType == VALUE_WSTRING )
+		return value.m_pWString;
+
+	if ( value.m_nType == VALUE_NONE )
+		return defaultValue;
+
+	if ( !value.m_pConvertedWString )
+	{
+		const char *pString = GetStringByIndex( index, "" );
+		int size = ( V_strlen( pString ) + 1 ) * sizeof( wchar_t );
+		wchar_t *pUnicode = (wchar_t *)AllocStringSpace( size );
+		V_UTF8ToUnicode( pString, pUnicode, size );
+		value.m_pConvertedWString = pUnicode;
+	}
+
+	return value.m_pConvertedWString;
+}
+
+const void *CGameEvent::GetPtrByIndex( int index ) const
+{
+	if ( !m_Values.IsValidIndex( index ) || m_Values[index].m_nType != VALUE_PTR )
+		return NULL;
+
+	return m_Values[index].m_pPtr;
+}
+
+void CGameEvent::SetIntByIndex( int index, int value )
+{
+	if ( m_Values.IsValidIndex( index ) )
+	{
+		SetValue( index, VALUE_INT )->m_nInt = value;
+	}
+}
+
+void CGameEvent::SetUint64ByIndex( int index, uint64 value )
+{
+	if ( m_Values.IsValidIndex( index ) )
+	{
+		SetValue( index, VALUE_UINT64 )->m_nUint64 = value;
+	}
+}
+
+void CGameEvent::SetFloatByIndex( int index, float value )
+{
+	if ( m_Values.IsValidIndex( index ) )
+	{
+		SetValue( index, VALUE_FLOAT )->m_flFloat = value;
+	}
+}
+
+void CGameEvent::SetStringByIndex( int index, const char *value )
+{
+	if ( m_Values.IsValidIndex( index ) )
+	{
+		SetValue( index, VALUE_STRING )->m_pString = AllocString( value ? value : "" );
+	}
+}
+
+void CGameEvent::SetWStringByIndex( int index, const wchar_t *value )
+{
+	if ( m_Values.IsValidIndex( index ) )
+	{
+		SetValue( index, VALUE_WSTRING )->m_pWString = AllocWString( value ? value : L"" );
+	}
+}
+
+void CGameEvent::SetPtrByIndex( int index, const void *value )
+{
+	if ( m_Values.IsValidIndex( index ) )
+	{
+		SetValue( index, VALUE_PTR )->m_pPtr = value;
+	}
 }
 
 bool CGameEvent::GetBool( const char *keyName, bool defaultValue) const
 {
-	return m_pDataKeys->GetInt( keyName, defaultValue ) != 0;
+	return GetInt( keyName, defaultValue ) != 0;
 }
 
 int CGameEvent::GetInt( const char *keyName, int defaultValue) const
 {
-	return m_pDataKeys->GetInt( keyName, defaultValue );
+	int index = m_pDescriptor->FindKey( keyName );
+	if ( index >= 0 )
+		return GetIntByIndex( index, defaultValue );
+
+	return m_pExtraKeys ? m_pExtraKeys->GetInt( keyName, defaultValue ) : defaultValue;
 }
 
 uint64 CGameEvent::GetUint64( const char *keyName, uint64 defaultValue) const
 {
-	return m_pDataKeys->GetUint64( keyName, defaultValue );
+	int index = m_pDescriptor->FindKey( keyName );
+	if ( index >= 0 )
+		return GetUint64ByIndex( index, defaultValue );
+
+	return m_pExtraKeys ? m_pExtraKeys->GetUint64( keyName, defaultValue ) : defaultValue;
 }
 
 float CGameEvent::GetFloat( const char *keyName, float defaultValue ) const
 {
-	return m_pDataKeys->GetFloat( keyName, defaultValue );
+	int index = m_pDescriptor->FindKey( keyName );
+	if ( index >= 0 )
+		return GetFloatByIndex( index, defaultValue );
+
+	return m_pExtraKeys ? m_pExtraKeys->GetFloat( keyName, defaultValue ) : defaultValue;
 }
 
 const char *CGameEvent::GetString( const char *keyName, const char *defaultValue ) const
 {
-	return m_pDataKeys->GetString( keyName, defaultValue );
+	int index = m_pDescriptor->FindKey( keyName );
+	if ( index >= 0 )
+		return GetStringByIndex( index, defaultValue );
+
+	return m_pExtraKeys ? m_pExtraKeys->GetString( keyName, defaultValue ) : defaultValue;
 }
 
 const void *CGameEvent::GetPtr( const char *keyName ) const
 {
 	Assert( IsLocal() );
-	return m_pDataKeys->GetPtr( keyName );
+
+	int index = m_pDescriptor->FindKey( keyName );
+	if ( index >= 0 )
+		return GetPtrByIndex( index );
+
+	return m_pExtraKeys ? m_pExtraKeys->GetPtr( keyName ) : NULL;
 }
 
 const wchar_t *CGameEvent::GetWString( const char *keyName, const wchar_t *defaultValue ) const
 {
-	return m_pDataKeys->GetWString( keyName, defaultValue );
+	int index = m_pDescriptor->FindKey( keyName );
+	if ( index >= 0 )
+		return GetWStringByIndex( index, defaultValue );
+
+	return m_pExtraKeys ? m_pExtraKeys->GetWString( keyName, defaultValue ) : defaultValue;
 }
 
 
 void CGameEvent::SetBool( const char *keyName, bool value )
 {
-	m_pDataKeys->SetInt( keyName, value?1:0 );
+	SetInt( keyName, value?1:0 );
 }
 
 void CGameEvent::SetInt( const char *keyName, int value )
 {
-	m_pDataKeys->SetInt( keyName, value );
+	int index = m_pDescriptor->FindKey( keyName );
+	if ( index >= 0 )
+		SetIntByIndex( index, value );
+	else
+		ExtraKeys()->SetInt( keyName, value );
 }
 
 void CGameEvent::SetUint64( const char *keyName, uint64 value )
 {
-	m_pDataKeys->SetUint64( keyName, value );
+	int index = m_pDescriptor->FindKey( keyName );
+	if ( index >= 0 )
+		SetUint64ByIndex( index, value );
+	else
+		ExtraKeys()->SetUint64( keyName, value );
 }
 
 void CGameEvent::SetFloat( const char *keyName, float value )
 {
-	m_pDataKeys->SetFloat( keyName, value );
+	int index = m_pDescriptor->FindKey( keyName );
+	if ( index >= 0 )
+		SetFloatByIndex( index, value );
+	else
+		ExtraKeys()->SetFloat( keyName, value );
 }
 
 void CGameEvent::SetString( const char *keyName, const char *value )
 {
-	m_pDataKeys->SetString( keyName, value );
+	int index = m_pDescriptor->FindKey( keyName );
+	if ( index >= 0 )
+		SetStringByIndex( index, value );
+	else
+		ExtraKeys()->SetString( keyName, value );
 }
 
 void CGameEvent::SetPtr( const char *keyName, const void *value )
 {
 	Assert( IsLocal() );
-	m_pDataKeys->SetPtr( keyName, const_cast< void *>( value ) );
+
+	int index = m_pDescriptor->FindKey( keyName );
+	if ( index >= 0 )
+		SetPtrByIndex( index, value );
+	else
+		ExtraKeys()->SetPtr( keyName, const_cast< void *>( value ) );
 }
 
 void CGameEvent::SetWString( const char* keyName, const wchar_t* value )
 {
-	m_pDataKeys->SetWString( keyName, value );
+	int index = m_pDescriptor->FindKey( keyName );
+	if ( index >= 0 )
+		SetWStringByIndex( index, value );
+	else
+		ExtraKeys()->SetWString( keyName, value );
 }
 
 bool CGameEvent::IsEmpty( const char *keyName ) const
 {
-	return m_pDataKeys->IsEmpty( keyName );
+	if ( !keyName )
+	{
+		for ( int i = 0; i < m_Values.Count(); i++ )
+		{
+			if ( m_Values[i].m_nType != VALUE_NONE )
+				return false;
+		}
+
+		return !m_pExtraKeys || !m_pExtraKeys->GetFirstSubKey();
+	}
+
+	int index = m_pDescriptor->FindKey( keyName );
+	if ( index >= 0 )
+		return !m_Values.IsValidIndex( index ) || m_Values[index].m_nType == VALUE_NONE;
+
+	return !m_pExtraKeys || m_pExtraKeys->IsEmpty( keyName );
 }
 
 const char *CGameEvent::GetName() const
 {
-	return m_pDataKeys->GetName();
+	return m_pName;
 }
 
 bool CGameEvent::IsLocal() const
@@ -173,32 +569,85 @@ bool CGameEvent::ForEventData( IGameEventVisitor2* visitor ) const
 	CGameEventDescriptor *descriptor = m_pDescriptor;
 
 	bool iterate = true;
-	for ( KeyValues* key = descriptor->keys->GetFirstSubKey(); key && iterate; key = key->GetNextKey() )
+	for ( int i = 0; i < descriptor->numDeclaredKeys && iterate; i++ )
 	{
-		const char * keyName = key->GetName();
-
-		int type = key->GetInt();
+		const char * keyName = descriptor->keyList[i].name;
 
 		// see s_GameEventTypesMap for index
-		switch ( type )
+		switch ( descriptor->keyList[i].type )
 		{
-		case CGameEventManager::TYPE_LOCAL: iterate = visitor->VisitLocal( keyName, GetPtr( keyName ) ); break;
-		case CGameEventManager::TYPE_STRING: iterate = visitor->VisitString( keyName, GetString( keyName, "" ) ); break;
-		case CGameEventManager::TYPE_FLOAT: iterate = visitor->VisitFloat( keyName, GetFloat( keyName, 0.0f ) ); break;
-		case CGameEventManager::TYPE_LONG: iterate = visitor->VisitInt( keyName, GetInt( keyName, 0 ) ); break;
-		case CGameEventManager::TYPE_SHORT: iterate = visitor->VisitInt( keyName, GetInt( keyName, 0 ) ); break;
-		case CGameEventManager::TYPE_BYTE: iterate = visitor->VisitInt( keyName, GetInt( keyName, 0 ) ); break;
-		case CGameEventManager::TYPE_BOOL: iterate = visitor->VisitBool( keyName, GetBool( keyName, false ) ); break;
-		case CGameEventManager::TYPE_UINT64: iterate = visitor->VisitUint64( keyName, GetUint64( keyName, 0 ) ); break;
-		case CGameEventManager::TYPE_WSTRING: iterate = visitor->VisitWString( keyName, GetWString( keyName, L"" ) ); break;
+		case CGameEventManager::TYPE_LOCAL: iterate = visitor->VisitLocal( keyName, GetPtrByIndex( i ) ); break;
+		case CGameEventManager::TYPE_STRING: iterate = visitor->VisitString( keyName, GetStringByIndex( i, "" ) ); break;
+		case CGameEventManager::TYPE_FLOAT: iterate = visitor->VisitFloat( keyName, GetFloatByIndex( i, 0.0f ) ); break;
+		case CGameEventManager::TYPE_LONG: iterate = visitor->VisitInt( keyName, GetIntByIndex( i, 0 ) ); break;
+		case CGameEventManager::TYPE_SHORT: iterate = visitor->VisitInt( keyName, GetIntByIndex( i, 0 ) ); break;
+		case CGameEventManager::TYPE_BYTE: iterate = visitor->VisitInt( keyName, GetIntByIndex( i, 0 ) ); break;
+		case CGameEventManager::TYPE_BOOL: iterate = visitor->VisitBool( keyName, GetIntByIndex( i, 0 ) != 0 ); break;
+		case CGameEventManager::TYPE_UINT64: iterate = visitor->VisitUint64( keyName, GetUint64ByIndex( i, 0 ) ); break;
+		case CGameEventManager::TYPE_WSTRING: iterate = visitor->VisitWString( keyName, GetWStringByIndex( i, L"" ) ); break;
 		}
 	}
 
 	return iterate;
 }
 
+KeyValues *CGameEvent::GetDataKeys()
+{
+	if ( m_pDataKeys )
+		return m_pDataKeys;
+
+	m_pDataKeys = m_pExtraKeys ? m_pExtraKeys->MakeCopy() : new KeyValues( m_pName );
+
+	for ( int i = 0; i < m_Values.Count(); i++ )
+	{
+		const char *keyName = m_pDescriptor->keyList[i].name;
+		const Value_t &value = m_Values[i];
+		switch ( value.m_nType )
+		{
+		case VALUE_INT: m_pDataKeys->SetInt( keyName, value.m_nInt ); break;
+		case VALUE_FLOAT: m_pDataKeys->SetFloat( keyName, value.m_flFloat ); break;
+		case VALUE_UINT64: m_pDataKeys->SetUint64( keyName, value.m_nUint64 ); break;
+		case VALUE_STRING: m_pDataKeys->SetString( keyName, value.m_pString ); break;
+		case VALUE_WSTRING: m_pDataKeys->SetWString( keyName, value.m_pWString ); break;
+		case VALUE_PTR: m_pDataKeys->SetPtr( keyName, const_cast< void * >( value.m_pPtr ) ); break;
+		}
+	}
+
+	return m_pDataKeys;
+}
+
+void CGameEvent::SetDataKeys( KeyValues *keys )
+{
+	for ( KeyValues *key = keys->GetFirstSubKey(); key; key = key->GetNextKey() )
+	{
+		const char *keyName = key->GetName();
+		int index = m_pDescriptor->FindKey( keyName );
+
+		switch ( key->GetDataType() )
+		{
+		case KeyValues::TYPE_STRING: SetString( keyName, key->GetString() ); break;
+		case KeyValues::TYPE_INT: SetInt( keyName, key->GetInt() ); break;
+		case KeyValues::TYPE_FLOAT: SetFloat( keyName, key->GetFloat() ); break;
+		case KeyValues::TYPE_UINT64: SetUint64( keyName, key->GetUint64() ); break;
+		case KeyValues::TYPE_WSTRING: SetWString( keyName, key->GetWString() ); break;
+		case KeyValues::TYPE_PTR:
+			if ( index >= 0 )
+				SetPtrByIndex( index, key->GetPtr() );
+			else
+				ExtraKeys()->SetPtr( keyName, key->GetPtr() );
+			break;
+		default:
+			ExtraKeys()->AddSubKey( key->MakeCopy() );
+			break;
+		}
+	}
+
+	keys->deleteThis();
+}
+
 CGameEventManager::CGameEventManager()
 {
+	m_pLiveEvents = NULL;
 	Reset();
 }
 
@@ -243,6 +692,14 @@ void CGameEventManager::Reset()
 
 	m_GameEvents.Purge();
 	m_Listeners.PurgeAndDeleteElements();
+	m_EventPool.PurgeAndDeleteElements();
+
+	// events still out are no longer tracked; FreeEvent just deletes them
+	while ( m_pLiveEvents )
+	{
+		UnlinkLiveEvent( m_pLiveEvents );
+	}
+
 	m_EventFiles.RemoveAll();
 	m_EventFileNames.RemoveAll();
 	m_EventMap.Purge();
@@ -325,6 +782,9 @@ bool CGameEventManager::ParseEventList(const CSVCMsg_GameEventList& msg)
 		{
 			descriptor->eventid = EventDescriptor.eventid();
 
+			CUtlVector< KeyValues * > liveEvents;
+			SaveLiveEvents( descriptor, liveEvents );
+
 			// remove old definition list
 			if ( descriptor->keys )
 				descriptor->keys->deleteThis();
@@ -338,6 +798,9 @@ bool CGameEventManager::ParseEventList(const CSVCMsg_GameEventList& msg)
 
 				descriptor->keys->SetInt( Key.name().c_str(), Key.type() );
 			}
+
+			descriptor->BuildKeyList();
+			RestoreLiveEvents( descriptor, liveEvents );
 		}
 	}
 
@@ -398,10 +861,89 @@ void CGameEventManager::WriteListenEventList(CCLCMsg_ListenEvents *msg)
 	}
 }
 
-IGameEvent *CGameEventManager::CreateEvent( CGameEventDescriptor *descriptor, const char *name )
+CGameEvent *CGameEventManager::AllocEvent( CGameEventDescriptor *descriptor )
 {
 	AUTO_LOCK_FM( m_mutex );
-	return new CGameEvent ( descriptor, name );
+	const char *pName = m_EventMap.GetElementName( descriptor->elementIndex );
+
+	CGameEvent *event;
+	if ( m_EventPool.Count() )
+	{
+		event = m_EventPool.Tail();
+		m_EventPool.RemoveMultipleFromTail( 1 );
+		event->Init( descriptor, pName );
+	}
+	else
+	{
+		event = new CGameEvent( descriptor, pName );
+	}
+
+	event->m_pPrevLive = NULL;
+	event->m_pNextLive = m_pLiveEvents;
+	if ( m_pLiveEvents )
+	{
+		m_pLiveEvents->m_pPrevLive = event;
+	}
+	m_pLiveEvents = event;
+
+	return event;
+}
+
+void CGameEventManager::UnlinkLiveEvent( CGameEvent *event )
+{
+	if ( event->m_pPrevLive )
+	{
+		event->m_pPrevLive->m_pNextLive = event->m_pNextLive;
+	}
+	else if ( m_pLiveEvents == event )
+	{
+		m_pLiveEvents = event->m_pNextLive;
+	}
+	else
+	{
+		return;	// not linked
+	}
+
+	if ( event->m_pNextLive )
+	{
+		event->m_pNextLive->m_pPrevLive = event->m_pPrevLive;
+	}
+	event->m_pPrevLive = NULL;
+	event->m_pNextLive = NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Events that are alive while their descriptor's keys are redefined still hold
+// values laid out by the old key list, and may have cached data keys and an
+// encoding built from it. Save them by key name before the old keys go away,
+// and lay them out again once the new key list is built.
+//-----------------------------------------------------------------------------
+void CGameEventManager::SaveLiveEvents( CGameEventDescriptor *descriptor, CUtlVector< KeyValues * > &saved )
+{
+	for ( CGameEvent *event = m_pLiveEvents; event; event = event->m_pNextLive )
+	{
+		if ( event->m_pDescriptor != descriptor )
+			continue;
+
+		event->GetDataKeys();
+		saved.AddToTail( event->m_pDataKeys );
+		event->m_pDataKeys = NULL;
+	}
+}
+
+void CGameEventManager::RestoreLiveEvents( CGameEventDescriptor *descriptor, CUtlVector< KeyValues * > &saved )
+{
+	int nSaved = 0;
+	for ( CGameEvent *event = m_pLiveEvents; event && nSaved < saved.Count(); event = event->m_pNextLive )
+	{
+		if ( event->m_pDescriptor != descriptor )
+			continue;
+
+		// Init drops the cached data keys and encoding; SetDataKeys takes ownership
+		event->Init( descriptor, event->m_pName );
+		event->SetDataKeys( saved[ nSaved++ ] );
+	}
+	Assert( nSaved == saved.Count() );
 }
 
 IGameEvent *CGameEventManager::CreateEvent( const char *name, bool bForce, int *pCookie )
@@ -426,7 +968,7 @@ IGameEvent *CGameEventManager::CreateEvent( const char *name, bool bForce, int *
 	}
 
 	// create & return the new event
-	return new CGameEvent ( descriptor, name );
+	return AllocEvent( descriptor );
 }
 
 ConVar display_game_events("display_game_events", "0", FCVAR_CHEAT );
@@ -447,20 +989,15 @@ bool CGameEventManager::FireEventClientSide( IGameEvent *event )
 
 IGameEvent *CGameEventManager::DuplicateEvent( IGameEvent *event )
 {
+	AUTO_LOCK_FM( m_mutex );
 	CGameEvent *gameEvent = dynamic_cast<CGameEvent*>(event);
 
 	if ( !gameEvent )
 		return NULL;
 
-	// create new instance
-	const char *pName = m_EventMap.GetElementName(gameEvent->m_pDescriptor->elementIndex );
-	CGameEvent *newEvent = new CGameEvent ( gameEvent->m_pDescriptor, pName );
-
-	// free keys
-	newEvent->m_pDataKeys->deleteThis();
-
-	// and make copy
-	newEvent->m_pDataKeys = gameEvent->m_pDataKeys->MakeCopy();
+	// create new instance and copy the data over
+	CGameEvent *newEvent = AllocEvent( gameEvent->m_pDescriptor );
+	newEvent->CopyFrom( *gameEvent );
 
 	return newEvent;
 }
@@ -472,23 +1009,20 @@ void CGameEventManager::ConPrintEvent( IGameEvent *event)
 	if ( !descriptor )
 		return;
 
-	KeyValues *key = descriptor->keys->GetFirstSubKey();
+	CGameEvent *gameEvent = static_cast<CGameEvent*>( event );
 
-	while ( key )
+	for ( int i = 0; i < descriptor->numDeclaredKeys; i++ )
 	{
-		const char * keyName = key->GetName();
-
-		int type = key->GetInt();
+		const char * keyName = descriptor->keyList[i].name;
 
-		switch ( type )
+		switch ( descriptor->keyList[i].type )
 		{
-		case TYPE_LOCAL : ConMsg( "- \"%s\" = \"%s\" (local)\n", keyName, event->GetString(keyName) ); break;
-		case TYPE_STRING : ConMsg( "- \"%s\" = \"%s\"\n", keyName, event->GetString(keyName) ); break;
-		case TYPE_WSTRING : ConMsg( "- \"%s\" = \"" PRI_WS_FOR_S "\"\n", keyName, event->GetWString(keyName) ); break;
-		case TYPE_FLOAT : ConMsg( "- \"%s\" = \"%.2f\"\n", keyName, event->GetFloat(keyName) ); break;
-		default: ConMsg( "- \"%s\" = \"%i\"\n", keyName, event->GetInt(keyName) ); break;
+		case TYPE_LOCAL : ConMsg( "- \"%s\" = \"%s\" (local)\n", keyName, gameEvent->GetStringByIndex(i) ); break;
+		case TYPE_STRING : ConMsg( "- \"%s\" = \"%s\"\n", keyName, gameEvent->GetStringByIndex(i) ); break;
+		case TYPE_WSTRING : ConMsg( "- \"%s\" = \"" PRI_WS_FOR_S "\"\n", keyName, gameEvent->GetWStringByIndex(i) ); break;
+		case TYPE_FLOAT : ConMsg( "- \"%s\" = \"%.2f\"\n", keyName, gameEvent->GetFloatByIndex(i) ); break;
+		default: ConMsg( "- \"%s\" = \"%i\"\n", keyName, gameEvent->GetIntByIndex(i) ); break;
 		}
-		key = key->GetNextKey();
 	}
 }
 
@@ -559,8 +1093,6 @@ bool CGameEventManager::FireEventIntern( IGameEvent *event, bool bServerOnly, bo
 		if ( listener->m_nListenerType == CLIENTSTUB && descriptor->local )
 			continue;
 
-		// TODO optimized the serialize event for clients, call only once and not per client
-
 		// fire event in this listener module
 		if ( listener->m_nListenerType == CLIENTSIDE_OLD ||
 			 listener->m_nListenerType == SERVERSIDE_OLD )
@@ -569,7 +1101,7 @@ bool CGameEventManager::FireEventIntern( IGameEvent *event, bool bServerOnly, bo
 			IGameEventListener *pCallback = static_cast<IGameEventListener*>(listener->m_pCallback);
 			CGameEvent *pEvent = static_cast<CGameEvent*>(event);
 
-			pCallback->FireGameEvent( pEvent->m_pDataKeys );
+			pCallback->FireGameEvent( pEvent->GetDataKeys() );
 		}
 		else
 		{
@@ -607,80 +1139,121 @@ bool CGameEventManager::FireEventIntern( IGameEvent *event, bool bServerOnly, bo
 	return true;
 }
 
-bool CGameEventManager::SerializeEvent( IGameEvent *event, CSVCMsg_GameEvent *eventMsg )
+void CGameEventManager::WriteEvent( CGameEvent *event, CGameEventDescriptor *descriptor, CSVCMsg_GameEvent *eventMsg )
 {
-	AUTO_LOCK_FM( m_mutex );
-	CGameEventDescriptor *descriptor = GetEventDescriptor( event );
-
-	Assert( descriptor );
-
 	eventMsg->set_eventid( descriptor->eventid );
 
 	// now iterate trough all fields described in gameevents.res and put them in the buffer
 
-	KeyValues * key = descriptor->keys->GetFirstSubKey();
-
 	if ( net_showevents.GetInt() > 2 )
 	{
 		const char *pName = m_EventMap.GetElementName(descriptor->elementIndex);
 		DevMsg("Serializing event '%s' (%i):\n", pName, descriptor->eventid );
 	}
 
-	while ( key )
+	for ( int i = 0; i < descriptor->numDeclaredKeys; i++ )
 	{
-		const char * keyName = key->GetName();
-
-		int type = key->GetInt();
+		int type = descriptor->keyList[i].type;
 
 		if ( net_showevents.GetInt() > 2 )
 		{
-			DevMsg(" - %s (%s)\n", keyName, s_GameEventTypesMap->GetNameByToken( type ) );
+			DevMsg(" - %s (%s)\n", descriptor->keyList[i].name, s_GameEventTypesMap->GetNameByToken( type ) );
 		}
 
 		if( type != TYPE_LOCAL )
 		{
 			CSVCMsg_GameEvent::key_t *pKey = eventMsg->add_keys();
 
-			//Make sure every key is used in the event
-			// Assert( event->FindKey(keyName) && "GameEvent field not found in passed KeyValues" );
-
 			pKey->set_type( type );
 
 			// see s_GameEventTypesMap for index
 			switch ( type )
 			{
-			case TYPE_STRING: pKey->set_val_string( event->GetString( keyName, "") ); break;
-			case TYPE_FLOAT : pKey->set_val_float( event->GetFloat( keyName, 0.0f) ); break;
-			case TYPE_LONG	: pKey->set_val_long( event->GetInt( keyName, 0) ); break;
-			case TYPE_SHORT	: pKey->set_val_short( event->GetInt( keyName, 0) ); break;
-			case TYPE_BYTE	: pKey->set_val_byte( event->GetInt( keyName, 0) ); break;
-			case TYPE_BOOL	: pKey->set_val_bool( !!event->GetInt( keyName, 0) ); break;
-			case TYPE_UINT64: pKey->set_val_uint64( event->GetUint64( keyName, 0) ); break;
+			case TYPE_STRING: pKey->set_val_string( event->GetStringByIndex( i, "") ); break;
+			case TYPE_FLOAT : pKey->set_val_float( event->GetFloatByIndex( i, 0.0f) ); break;
+			case TYPE_LONG	: pKey->set_val_long( event->GetIntByIndex( i, 0) ); break;
+			case TYPE_SHORT	: pKey->set_val_short( event->GetIntByIndex( i, 0) ); break;
+			case TYPE_BYTE	: pKey->set_val_byte( event->GetIntByIndex( i, 0) ); break;
+			case TYPE_BOOL	: pKey->set_val_bool( !!event->GetIntByIndex( i, 0) ); break;
+			case TYPE_UINT64: pKey->set_val_uint64( event->GetUint64ByIndex( i, 0) ); break;
 			case TYPE_WSTRING:
 				{
-					const wchar_t *pStr = event->GetWString( keyName, L"");
+					const wchar_t *pStr = event->GetWStringByIndex( i, L"");
 					pKey->set_val_wstring( pStr, wcslen( pStr ) + 1 );
 				}
 				break;
-			default: DevMsg(1, "CGameEventManager: unknown type %i for key '%s'.\n", type, key->GetName() ); break;
+			default: DevMsg(1, "CGameEventManager: unknown type %i for key '%s'.\n", type, descriptor->keyList[i].name ); break;
 			}
 		}
-
-		key = key->GetNextKey();
 	}
 
+	int nBytes = eventMsg->ByteSize();
 	if ( net_showevents.GetInt() > 2 )
 	{
-		int nBytes = eventMsg->ByteSize();
 		Msg( " took %d bits, %d bytes\n", nBytes * 8, nBytes );
 	}
+}
 
+bool CGameEventManager::SerializeEvent( IGameEvent *event, CSVCMsg_GameEvent *eventMsg )
+{
+	AUTO_LOCK_FM( m_mutex );
+	CGameEvent *gameEvent = dynamic_cast<CGameEvent*>( event );
+
+	Assert( gameEvent );
+	if ( !gameEvent )
+		return false;
+
+	CGameEventDescriptor *descriptor = gameEvent->m_pDescriptor;
+
+	// reuse the encoding if this event was already sent to someone
+	if ( gameEvent->m_bSerialized )
+	{
+		eventMsg->CopyFrom( *gameEvent->m_pSerialized );
+	}
+	else
+	{
+		WriteEvent( gameEvent, descriptor, eventMsg );
+	}
+
+	// CopyFrom doesn't carry the cached size over
 	descriptor->numSerialized++;
 	descriptor->totalSerializedBits += eventMsg->ByteSize() * 8;
 
 	return true;
 }
 
+const CSVCMsg_GameEvent_t *CGameEventManager::GetSerializedEvent( IGameEvent *event )
+{
+	AUTO_LOCK_FM( m_mutex );
+	CGameEvent *gameEvent = dynamic_cast<CGameEvent*>( event );
+
+	Assert( gameEvent );
+	if ( !gameEvent )
+		return NULL;
+
+	CGameEventDescriptor *descriptor = gameEvent->m_pDescriptor;
+
+	if ( !gameEvent->m_bSerialized )
+	{
+		if ( gameEvent->m_pSerialized )
+		{
+			gameEvent->m_pSerialized->Clear();
+		}
+		else
+		{
+			gameEvent->m_pSerialized = new CSVCMsg_GameEvent_t;
+		}
+
+		WriteEvent( gameEvent, descriptor, gameEvent->m_pSerialized );
+		gameEvent->m_bSerialized = true;
+	}
+
+	descriptor->numSerialized++;
+	descriptor->totalSerializedBits += gameEvent->m_pSerialized->GetCachedSize() * 8;
+
+	return gameEvent->m_pSerialized;
+}
+
 IGameEvent *CGameEventManager::UnserializeEvent( const CSVCMsg_GameEvent& eventMsg )
 {
 	AUTO_LOCK_FM( m_mutex );
@@ -699,38 +1272,30 @@ IGameEvent *CGameEventManager::UnserializeEvent( const CSVCMsg_GameEvent& eventM
 	}
 
 	// create new event
-	const char *pName = m_EventMap.GetElementName(descriptor->elementIndex);
-	IGameEvent *event = CreateEvent( descriptor, pName );
+	CGameEvent *event = AllocEvent( descriptor );
 
-	if ( !event )
-	{
-		DevMsg( "CGameEventManager::UnserializeEvent:: failed to create event %s.\n", pName );
-		return NULL;
-	}
-
-	int nNumKeys = eventMsg.keys_size();
-	KeyValues * key = descriptor->keys->GetFirstSubKey();
+	// the descriptor keys came from the server's event list, so they line up with the message keys
+	int nNumKeys = MIN( eventMsg.keys_size(), descriptor->numDeclaredKeys );
 
-	for( int i = 0; key && ( i < nNumKeys ); i++, key = key->GetNextKey() )
+	for( int i = 0; i < nNumKeys; i++ )
 	{
 		const CSVCMsg_GameEvent::key_t &KeyEvent = eventMsg.keys( i );
-		const char * keyName = key->GetName();
 
 		int type = KeyEvent.type();
 
 		switch ( type )
 		{
 		case TYPE_LOCAL		: break; // ignore
-		case TYPE_STRING	: event->SetString( keyName, KeyEvent.val_string().c_str() ); break;
-		case TYPE_FLOAT		: event->SetFloat( keyName, KeyEvent.val_float() ); break;
-		case TYPE_LONG		: event->SetInt( keyName, KeyEvent.val_long() ); break;
-		case TYPE_SHORT		: event->SetInt( keyName, KeyEvent.val_short() ); break;
-		case TYPE_BYTE		: event->SetInt( keyName, KeyEvent.val_byte() ); break;
-		case TYPE_BOOL		: event->SetInt( keyName, KeyEvent.val_bool() ); break;
-		case TYPE_UINT64	: event->SetUint64( keyName, KeyEvent.val_uint64() ); break;
-		case TYPE_WSTRING	: event->SetWString( keyName, (wchar_t*)KeyEvent.val_wstring().data() ); break;
-
-		default: DevMsg(1, "CGameEventManager: unknown type %i for key '%s' [%s].\n", type, key->GetName(), pName ); break;
+		case TYPE_STRING	: event->SetStringByIndex( i, KeyEvent.val_string().c_str() ); break;
+		case TYPE_FLOAT		: event->SetFloatByIndex( i, KeyEvent.val_float() ); break;
+		case TYPE_LONG		: event->SetIntByIndex( i, KeyEvent.val_long() ); break;
+		case TYPE_SHORT		: event->SetIntByIndex( i, KeyEvent.val_short() ); break;
+		case TYPE_BYTE		: event->SetIntByIndex( i, KeyEvent.val_byte() ); break;
+		case TYPE_BOOL		: event->SetIntByIndex( i, KeyEvent.val_bool() ); break;
+		case TYPE_UINT64	: event->SetUint64ByIndex( i, KeyEvent.val_uint64() ); break;
+		case TYPE_WSTRING	: event->SetWStringByIndex( i, (wchar_t*)KeyEvent.val_wstring().data() ); break;
+
+		default: DevMsg(1, "CGameEventManager: unknown type %i for key '%s' [%s].\n", type, descriptor->keyList[i].name, event->GetName() ); break;
 		}
 	}
 
@@ -964,6 +1529,7 @@ bool CGameEventManager::RegisterEvent( KeyValues * event)
 	const char *name = event->GetName();
 
 	CGameEventDescriptor *descriptor = GetEventDescriptor( name );
+	CUtlVector< KeyValues * > liveEvents;
 
 	if ( !descriptor )
 	{
@@ -976,6 +1542,7 @@ bool CGameEventManager::RegisterEvent( KeyValues * event)
 	else
 	{
 		// descriptor already know, but delete old definitions
+		SaveLiveEvents( descriptor, liveEvents );
 		descriptor->keys->deleteThis();
 	}
 
@@ -1020,6 +1587,9 @@ bool CGameEventManager::RegisterEvent( KeyValues * event)
 		subkey = subkey->GetNextKey();
 	}
 
+	descriptor->BuildKeyList();
+	RestoreLiveEvents( descriptor, liveEvents );
+
 	return true;
 }
 
@@ -1055,6 +1625,20 @@ void CGameEventManager::FreeEvent( IGameEvent *event )
 	if ( !event )
 		return;
 
+	// keep a few events around so firing doesn't have to allocate
+	CGameEvent *gameEvent = dynamic_cast<CGameEvent*>( event );
+	if ( gameEvent )
+	{
+		UnlinkLiveEvent( gameEvent );
+	}
+
+	if ( gameEvent && m_EventPool.Count() < MAX_POOLED_EVENTS )
+	{
+		gameEvent->Clear();
+		m_EventPool.AddToTail( gameEvent );
+		return;
+	}
+
 	delete event;
 }
 
@@ -1232,3 +1816,106 @@ CON_COMMAND_F( net_dumpeventstats, "Dumps out a report of game event network usa
 {
 	s_GameEventManager.DumpEventNetworkStats();
 }
+
+//-----------------------------------------------------------------------------
+// Purpose: Fires a storm of events at a set of fake clients, encoding the
+//			network message per client and once per event, to measure the
+//			cost of event creation and fan-out
+//-----------------------------------------------------------------------------
+CON_COMMAND_F( net_gameevent_benchmark, "Times creating game events and encoding them for clients. Usage: net_gameevent_benchmark [events] [clients]", FCVAR_CHEAT )
+{
+	int nEvents = ( args.ArgC() > 1 ) ? MAX( 1, atoi( args[1] ) ) : 10000;
+	int nClients = ( args.ArgC() > 2 ) ? MAX( 1, atoi( args[2] ) ) : 64;
+
+	static const char *s_pEventNames[] = { "player_hurt", "weapon_fire", "bullet_impact" };
+
+	CUtlVector< CGameEventDescriptor * > descriptors;
+	CUtlVector< const char * > names;
+	for ( int i = 0; i < ARRAYSIZE( s_pEventNames ); i++ )
+	{
+		CGameEventDescriptor *descriptor = s_GameEventManager.GetEventDescriptor( s_pEventNames[i] );
+		if ( descriptor && !descriptor->local )
+		{
+			descriptors.AddToTail( descriptor );
+			names.AddToTail( s_pEventNames[i] );
+		}
+	}
+
+	if ( !descriptors.Count() )
+	{
+		Msg( "net_gameevent_benchmark: none of the benchmark events are registered\n" );
+		return;
+	}
+
+	// don't let the benchmark show up in net_dumpeventstats
+	CUtlVector< int > savedStats;
+	FOR_EACH_VEC( descriptors, i )
+	{
+		savedStats.AddToTail( descriptors[i]->numSerialized );
+		savedStats.AddToTail( descriptors[i]->totalSerializedBits );
+	}
+
+	CUtlVector< byte > scratch;
+	scratch.SetCount( MAX_EVENT_BYTES * 4 );
+	bf_write buf( "net_gameevent_benchmark", scratch.Base(), scratch.Count() );
+
+	for ( int nShared = 0; nShared < 2; nShared++ )
+	{
+		int64 nBytes = 0;
+		double flStartTime = Plat_FloatTime();
+
+		for ( int i = 0; i < nEvents; i++ )
+		{
+			CGameEventDescriptor *descriptor = descriptors[ i % descriptors.Count() ];
+			IGameEvent *event = s_GameEventManager.CreateEvent( names[ i % names.Count() ], true );
+			if ( !event )
+				continue;
+
+			// fill the fields the way game code does, by name
+			for ( int k = 0; k < descriptor->numDeclaredKeys; k++ )
+			{
+				const char *keyName = descriptor->keyList[k].name;
+				switch ( descriptor->keyList[k].type )
+				{
+				case CGameEventManager::TYPE_STRING: event->SetString( keyName, "weapon_ak47" ); break;
+				case CGameEventManager::TYPE_FLOAT: event->SetFloat( keyName, i * 0.25f ); break;
+				case CGameEventManager::TYPE_UINT64: event->SetUint64( keyName, 76561197960265728ull + i ); break;
+				case CGameEventManager::TYPE_BOOL: event->SetBool( keyName, ( i & 1 ) != 0 ); break;
+				case CGameEventManager::TYPE_WSTRING: event->SetWString( keyName, L"benchmark" ); break;
+				case CGameEventManager::TYPE_LOCAL: break;
+				default: event->SetInt( keyName, i & 0x7f ); break;
+				}
+			}
+
+			for ( int c = 0; c < nClients; c++ )
+			{
+				buf.Reset();
+				if ( nShared )
+				{
+					const CSVCMsg_GameEvent_t *pMsg = s_GameEventManager.GetSerializedEvent( event );
+					pMsg->WriteToBuffer( buf );
+				}
+				else
+				{
+					CSVCMsg_GameEvent_t msg;
+					s_GameEventManager.SerializeEvent( event, &msg );
+					msg.WriteToBuffer( buf );
+				}
+				nBytes += buf.GetNumBytesWritten();
+			}
+
+			s_GameEventManager.FreeEvent( event );
+		}
+
+		double flTime = Plat_FloatTime() - flStartTime;
+		Msg( "%s: %d events to %d clients in %.2f ms (%.2f us/event, %.3f us/send, %lld bytes)\n",
+			nShared ? "encode once" : "encode per client", nEvents, nClients, flTime * 1000.0,
+			flTime * 1000000.0 / nEvents, flTime * 1000000.0 / ( (double)nEvents * nClients ), nBytes );
+	}
+
+	FOR_EACH_VEC( descriptors, i )
+	{
+		descriptors[i]->numSerialized = savedStats[ i * 2 ];
+		descriptors[i]->totalSerializedBits = savedStats[ i * 2 + 1 ];
+	}
+}
@@ -19,6 +19,7 @@
 #include <networkstringtabledefs.h>
 #include <utlsymbol.h>
 #include <utldict.h>
+#include <utlhashtable.h>
 #include "netmessages.h"
 
 class CSVCMsg_GameEventList;
@@ -31,6 +32,14 @@ public:
 	int					m_nListenerType;	// client or server side ?
 };
 
+// One field of an event's payload, in descriptor key order
+class CGameEventKey
+{
+public:
+	const char	*name;
+	int			type;		// CGameEventManager::TYPE_*
+};
+
 class CGameEventDescriptor
 {
 public:
@@ -41,6 +50,7 @@ public:
 		local = false;
 		reliable = true;
 		elementIndex = -1;
+		numDeclaredKeys = 0;
 
 		numSerialized = 0;
 		numUnSerialized = 0;
@@ -53,6 +63,15 @@ public:
 	int			elementIndex;
 	KeyValues	*keys;		// KeyValue describing data types, if NULL only name 
     CUtlVector<CGameEventCallback*>	listeners;	// registered listeners
+
+	// Payload layout built from keys: the declared keys followed by the
+	// implicit ones every event carries, and a name -> slot lookup
+	CUtlVector<CGameEventKey>	keyList;
+	int			numDeclaredKeys;
+	CUtlHashtable< const char *, int, CaselessStringHashFunctor, CaselessStringEqualFunctor > keyIndices;
+
+	void BuildKeyList();
+	int FindKey( const char *keyName ) const { UtlHashHandle_t h = keyName ? keyIndices.Find( keyName ) : keyIndices.InvalidHandle(); return ( h != keyIndices.InvalidHandle() ) ? keyIndices[h] : -1; }
 	bool		local;		// local event, never tell clients about that
 	bool		reliable;	// send this event as reliable message
 
@@ -63,12 +82,19 @@ public:
 	int totalUnserializedBits;
 };
 
+// Game events keep their data in a flat array of typed values laid out by the
+// descriptor's key list. Keys the descriptor doesn't know about go to a
+// KeyValues on the side.
 class CGameEvent : public IGameEvent
 {
 public:
 	CGameEvent( CGameEventDescriptor *descriptor, const char *name );
 	virtual ~CGameEvent();
 
+	void Init( CGameEventDescriptor *descriptor, const char *name );
+	void Clear();
+	void CopyFrom( const CGameEvent &src );
+
 	virtual const char *GetName() const OVERRIDE;
 	virtual bool  IsEmpty(const char *keyName = NULL) const OVERRIDE;
 	virtual bool  IsLocal() const OVERRIDE;
@@ -92,8 +118,81 @@ public:
 
 	virtual bool ForEventData( IGameEventVisitor2* visitor ) const OVERRIDE;
 
+	// typed access by descriptor key index, see CGameEventDescriptor::FindKey
+	int   GetIntByIndex( int index, int defaultValue = 0 ) const;
+	uint64 GetUint64ByIndex( int index, uint64 defaultValue = 0 ) const;
+	float GetFloatByIndex( int index, float defaultValue = 0.0f ) const;
+	const char *GetStringByIndex( int index, const char *defaultValue = "" ) const;
+	const wchar_t *GetWStringByIndex( int index, const wchar_t *defaultValue = L"" ) const;
+	const void *GetPtrByIndex( int index ) const;
+
+	void SetIntByIndex( int index, int value );
+	void SetUint64ByIndex( int index, uint64 value );
+	void SetFloatByIndex( int index, float value );
+	void SetStringByIndex( int index, const char *value );
+	void SetWStringByIndex( int index, const wchar_t *value );
+	void SetPtrByIndex( int index, const void *value );
+
+	// legacy listeners still take a KeyValues copy of the data
+	KeyValues *GetDataKeys();
+	void SetDataKeys( KeyValues *keys );
+
+	enum
+	{
+		VALUE_NONE = 0,
+		VALUE_INT,
+		VALUE_FLOAT,
+		VALUE_UINT64,
+		VALUE_STRING,
+		VALUE_WSTRING,
+		VALUE_PTR,
+	};
+
+	struct Value_t
+	{
+		union
+		{
+			int				m_nInt;
+			float			m_flFloat;
+			uint64			m_nUint64;
+			const void		*m_pPtr;
+			const char		*m_pString;
+			const wchar_t	*m_pWString;
+		};
+		mutable const char		*m_pConvertedString;	// GetString() of a non string value
+		mutable const wchar_t	*m_pConvertedWString;
+		int				m_nType;
+	};
+
 	CGameEventDescriptor	*m_pDescriptor;
-	KeyValues				*m_pDataKeys;
+	const char				*m_pName;
+	CUtlVector< Value_t >	m_Values;
+	KeyValues				*m_pExtraKeys;		// keys missing from the descriptor
+	KeyValues				*m_pDataKeys;		// built on demand for legacy listeners
+
+	// encoded once per fire and shared by every client
+	CSVCMsg_GameEvent_t		*m_pSerialized;
+	bool					m_bSerialized;
+
+	// events handed out and not yet freed, so a descriptor reload can re-lay them out
+	CGameEvent				*m_pPrevLive;
+	CGameEvent				*m_pNextLive;
+
+private:
+	Value_t *SetValue( int index, int type );
+	KeyValues *ExtraKeys();
+	const char *AllocString( const char *value ) const;
+	const wchar_t *AllocWString( const wchar_t *value ) const;
+	void *AllocStringSpace( int size ) const;
+
+	// Strings live in a bump allocator so pointers handed out stay valid
+	// for the life of the event
+	enum { INLINE_STRING_BYTES = 512 };
+	mutable uint64			m_InlineStrings[INLINE_STRING_BYTES / sizeof( uint64 )];
+	mutable int				m_nInlineStringsUsed;
+	mutable CUtlVector< char * > m_StringBlocks;
+	mutable int				m_nStringBlockUsed;
+	mutable int				m_nStringBlockSize;
 };
 
 
@@ -149,6 +248,10 @@ public:	// IGameEventManager functions
 	bool SerializeEvent( IGameEvent *event, CSVCMsg_GameEvent *eventMsg );
 	IGameEvent *UnserializeEvent( const CSVCMsg_GameEvent& eventMsg );
 
+	// Returns the network message for an event, encoded on first use and
+	// shared by every client the event is sent to
+	const CSVCMsg_GameEvent_t *GetSerializedEvent( IGameEvent *event );
+
 	virtual KeyValues* GetEventDataTypes( IGameEvent* event );
 
 	void DumpEventNetworkStats();
@@ -179,7 +282,11 @@ public:
 	
 protected:
 
-	IGameEvent *CreateEvent( CGameEventDescriptor *descriptor, const char *name );
+	CGameEvent *AllocEvent( CGameEventDescriptor *descriptor );
+	void UnlinkLiveEvent( CGameEvent *event );
+	void SaveLiveEvents( CGameEventDescriptor *descriptor, CUtlVector< KeyValues * > &saved );
+	void RestoreLiveEvents( CGameEventDescriptor *descriptor, CUtlVector< KeyValues * > &saved );
+	void WriteEvent( CGameEvent *event, CGameEventDescriptor *descriptor, CSVCMsg_GameEvent *eventMsg );
 	bool RegisterEvent( KeyValues * keys );
 	void UnregisterEvent(int index);
 	bool FireEventIntern( IGameEvent *event, bool bServerSide, bool bClientOnly );
@@ -190,6 +297,8 @@ protected:
 	CUtlSymbolTable						m_EventFiles;	// list of all loaded event files
 	CUtlVector<CUtlSymbol>				m_EventFileNames; 
 	CUtlDict<int, int>					m_EventMap;
+	CUtlVector<CGameEvent*>				m_EventPool;	// freed events, reused by CreateEvent
+	CGameEvent							*m_pLiveEvents;	// allocated events not freed yet
 	CThreadFastMutex					m_mutex;		// lock this when modifying the event table
 
 	bool	m_bClientListenersChanged;	// true every time client changed listeners
@@ -14,6 +14,10 @@
 #include "avi/iavi.h"
 #include "snd_op_sys/sos_system.h"
 #include "tier0/cache_hints.h"
+#include "../../cl_splitscreen.h"
+#include "engine/IEngineSound.h"
+#include "vstdlib/jobthread.h"
+#include "vstdlib/random.h"
 
 #ifdef GNUC
 // we don't suport the ASM in this file right now under GCC, fallback to C libs
@@ -93,9 +97,13 @@ portable_samplepair_t *g_paintbuffer;
 // NOTE: this paintbuffer is also used as a copy buffer by interpolating pitch
 // shift routines.  Decreasing TEMP_COPY_BUFFER_SIZE (or PAINTBUFFER_MEM_SIZE)
 // will decrease the maximum pitch level (current 4.0)!
-portable_samplepair_t *g_temppaintbuffer = NULL;
+DECL_THREAD_LOCAL portable_samplepair_t *g_temppaintbuffer = NULL;
 
-paintbuffer_t *g_paintBuffers = NULL;
+DECL_THREAD_LOCAL paintbuffer_t *g_paintBuffers = NULL;
+
+// the buffers the paintbuffer globals point at on the thread running MIX_PaintChannels
+static paintbuffer_t *s_pMainPaintBuffers = NULL;
+static portable_samplepair_t *s_pMainTempPaintBuffer = NULL;
 
 #define IPAINTBUFFER			0
 #define IROOMBUFFER				1
@@ -105,9 +113,9 @@ paintbuffer_t *g_paintBuffers = NULL;
 #define ISPEAKERBUFFER			5
 
 // pointer to current paintbuffer (front and rear), used by all mixing, upsampling and dsp routines
-portable_samplepair_t *g_curpaintbuffer = NULL;
-portable_samplepair_t *g_currearpaintbuffer = NULL;	
-portable_samplepair_t *g_curcenterpaintbuffer = NULL;
+DECL_THREAD_LOCAL portable_samplepair_t *g_curpaintbuffer = NULL;
+DECL_THREAD_LOCAL portable_samplepair_t *g_currearpaintbuffer = NULL;	
+DECL_THREAD_LOCAL portable_samplepair_t *g_curcenterpaintbuffer = NULL;
 
 bool g_bdirectionalfx;
 bool g_bDspOff;
@@ -171,12 +179,39 @@ char* Status_UpdateAudioBuffer()
 }
 
 void MIX_ScalePaintBuffer( int bufferIndex, int count, float fgain );
+static void MIX_FreeMixJobBuffers( void );
+
+//-----------------------------------------------------------------------------
+// Points the calling thread's paintbuffer globals at the main paintbuffers.
+// Mixing can move between threads (snd_mix_async), and mix jobs repoint them.
+//-----------------------------------------------------------------------------
+static bool MIX_BindMainPaintbuffers( void )
+{
+	if ( g_paintBuffers != s_pMainPaintBuffers )
+	{
+		g_paintBuffers = s_pMainPaintBuffers;
+		g_temppaintbuffer = s_pMainTempPaintBuffer;
+		if ( !g_paintBuffers )
+			return false;
+
+		MIX_SetCurrentPaintbuffer( IPAINTBUFFER );
+	}
+	return g_paintBuffers != NULL;
+}
 
 //-----------------------------------------------------------------------------
 // Free allocated memory buffers
 //-----------------------------------------------------------------------------
 void MIX_FreeAllPaintbuffers(void)
 {		
+	MIX_FreeMixJobBuffers();
+
+	// the buffers may have been bound on another thread (snd_mix_async)
+	g_paintBuffers = s_pMainPaintBuffers;
+	g_temppaintbuffer = s_pMainTempPaintBuffer;
+	s_pMainPaintBuffers = NULL;
+	s_pMainTempPaintBuffer = NULL;
+
 	if ( g_paintBuffers )
 	{
 		if ( g_temppaintbuffer )
@@ -244,6 +279,9 @@ bool MIX_InitAllPaintbuffers(void)
 
 	g_paintbuffer = g_paintBuffers[IPAINTBUFFER].pbuf;
 
+	s_pMainPaintBuffers = g_paintBuffers;
+	s_pMainTempPaintBuffer = g_temppaintbuffer;
+
 	// buffer flags
 	g_paintBuffers[IROOMBUFFER].flags = SOUND_BUSS_ROOM;
 	g_paintBuffers[IFACINGBUFFER].flags = SOUND_BUSS_FACING;
@@ -443,6 +481,54 @@ extern ConVar host_timescale;
 
 ConVar snd_pause_all( "snd_pause_all", "1", FCVAR_CHEAT, "Specifies to pause all sounds and not just voice" );
 
+static bool MIX_ShouldMixThreaded( int nChannels );
+static void MIX_MixChannelsThreaded( CChannelList &list, const short *pChannels, int nChannels, int sampleCount, int outputRate, float flGlobalPitchScale );
+
+// Mix (or skip, if quashed) sampleCount samples of a channel into the active paintbuffers.
+// Returns false once the channel has run out of data.
+static bool MIX_MixChannel( CChannelList &list, int i, int sampleCount, int outputRate, float flGlobalPitchScale )
+{
+	channel_t *ch = list.GetChannel( i );
+
+	// mix channel to all active paintbuffers:
+	// mix 'dry' sounds only to dry paintbuffer.
+	// mix 'speaker' sounds only to speaker paintbuffer.
+	// mix all other sounds between room, facing & facingaway paintbuffers
+	// NOTE: must be called once per channel only - consecutive calls retrieve additional data.
+	float flPitch = ch->pitch;
+	ch->pitch *= flGlobalPitchScale;
+
+	if (list.IsQuashed(i))
+	{
+		// If the sound has been silenced as a performance heuristic, quash it.
+		ch->pMixer->SkipSamples( ch, sampleCount, outputRate, 0 );
+		// DevMsg("Quashed channel %d (%s)\n", i, ch->sfx->GetFileName());
+	}
+	else
+	{
+		ch->pMixer->MixDataToDevice( ch, sampleCount, outputRate, 0 );
+	}
+
+	// restore to original pitch settings
+	ch->pitch = flPitch;
+
+	return ch->pMixer->ShouldContinueMixing();
+}
+
+static void MIX_FreeFinishedChannel( CChannelList &list, int i )
+{
+	channel_t *ch = list.GetChannel( i );
+
+	// stopping due to file elapsing
+	if( ch->m_pStackList )
+	{
+		ch->m_pStackList->Execute( CSosOperatorStack::SOS_STOP, ch, &g_scratchpad );
+	}
+
+	S_FreeChannel( ch );
+	list.RemoveChannelFromList(i);
+}
+
 // Mix all channels into active paintbuffers until paintbuffer is full or 'endtime' is reached.
 // endtime: time in 44khz samples to mix
 // rate: ignore samples which are not natively at this rate (for multipass mixing/filtering)
@@ -477,6 +563,10 @@ void MIX_MixChannelsToPaintbuffer( CChannelList &list, int64 endtime, int flags,
 		flGlobalPitchScale = engineClient->GetTimescale();
 	}
 
+	bool bThreaded = MIX_ShouldMixThreaded( list.Count() );
+	short mixChannels[MAX_CHANNELS];
+	int nMixChannels = 0;
+
 	for ( i = list.Count(); --i >= 0; )
 	{
 		channel_t *ch = list.GetChannel( i );
@@ -540,41 +630,23 @@ void MIX_MixChannelsToPaintbuffer( CChannelList &list, int64 endtime, int flags,
 			SND_MoveMouth8(ch, ch->sfx->pSource, sampleCount);
 		}
 
-		// mix channel to all active paintbuffers:
-		// mix 'dry' sounds only to dry paintbuffer.
-		// mix 'speaker' sounds only to speaker paintbuffer.
-		// mix all other sounds between room, facing & facingaway paintbuffers
-		// NOTE: must be called once per channel only - consecutive calls retrieve additional data.
-		float flPitch = ch->pitch;
-		ch->pitch *= flGlobalPitchScale;
-
-		if (list.IsQuashed(i))
-		{
-			// If the sound has been silenced as a performance heuristic, quash it.
-			ch->pMixer->SkipSamples( ch, sampleCount, outputRate, 0 );
-			// DevMsg("Quashed channel %d (%s)\n", i, ch->sfx->GetFileName());
-		}
-		else
+		if ( bThreaded )
 		{
-			ch->pMixer->MixDataToDevice( ch, sampleCount, outputRate, 0 );
+			// mixed below, once every channel for this pass is known
+			mixChannels[nMixChannels++] = i;
+			continue;
 		}
 
-		// restore to original pitch settings
-		ch->pitch = flPitch;
-
-
-		if ( !ch->pMixer->ShouldContinueMixing() )
+		if ( !MIX_MixChannel( list, i, sampleCount, outputRate, flGlobalPitchScale ) )
 		{
-			// stopping due to file elapsing
-			if( ch->m_pStackList )
-			{
-				ch->m_pStackList->Execute( CSosOperatorStack::SOS_STOP, ch, &g_scratchpad );
-			}
-
-			S_FreeChannel( ch );
-			list.RemoveChannelFromList(i);
+			MIX_FreeFinishedChannel( list, i );
 		}
 	}
+
+	if ( bThreaded )
+	{
+		MIX_MixChannelsThreaded( list, mixChannels, nMixChannels, sampleCount, outputRate, flGlobalPitchScale );
+	}
 }
 
 // pass in index -1...count+2, return pointer to source sample in either paintbuffer or delay buffer
@@ -1240,7 +1312,7 @@ void ZeroBuffer( void * pBuffer, int nSize )
 void MIX_ClearAllPaintBuffers( int SampleCount, bool clearFilters )
 {
 	// g_paintBuffers can be NULL with -nosound
-	if( !g_paintBuffers )
+	if( !MIX_BindMainPaintbuffers() )
 	{
 		return;
 	}
@@ -2307,6 +2379,437 @@ void MIX_CompressPaintbuffer(int ipaint, int count)
 
 
 // mix and upsample channels to 44khz 'ipaintbuffer'
+//-----------------------------------------------------------------------------
+// Threaded channel mixing
+//
+// The channels of a mix pass are split across the job pool. Each job mixes its
+// channels into a private copy of the active paintbuffers (the paintbuffer
+// globals are thread local), and the copies are then summed into the real
+// paintbuffers. Paintbuffers hold 32 bit integer sums, so the result doesn't
+// depend on how the channels were split and is identical to the serial mix.
+//
+// Channels that touch state shared with other channels are mixed on the calling
+// thread: mouth output (one mouth per entity), sentences, voice and streamed sources.
+//-----------------------------------------------------------------------------
+ConVar snd_mix_threaded( "snd_mix_threaded", "1", FCVAR_NONE, "Mix sound channels and apply room dsp in parallel on the job pool." );
+ConVar snd_mix_threaded_min_channels( "snd_mix_threaded_min_channels", "8", FCVAR_NONE, "Minimum number of sound channels given to each mix job." );
+
+#define MAX_MIX_JOBS			8
+
+struct mixjobbuffers_t
+{
+	paintbuffer_t paintBuffers[CPAINTBUFFERS];
+	portable_samplepair_t *ptemppaintbuffer;
+};
+
+struct mixjob_t
+{
+	CChannelList *pList;
+	const short *pChannels;				// list indices of the channels to mix
+	int nChannels;
+	int sampleCount;
+	int outputRate;
+	int ipaintcur;						// current paintbuffer of the mixing thread
+	float flGlobalPitchScale;
+	mixjobbuffers_t *pBuffers;
+	bool *pFinished;					// indexed by list index, set for channels that ran out of data
+};
+
+// paintbuffer globals of a thread, saved while a job borrows the thread
+struct mixthreadstate_t
+{
+	paintbuffer_t *pPaintBuffers;
+	portable_samplepair_t *pTempPaintBuffer;
+	portable_samplepair_t *pCurPaintBuffer;
+	portable_samplepair_t *pCurRearPaintBuffer;
+	portable_samplepair_t *pCurCenterPaintBuffer;
+};
+
+static mixjobbuffers_t *s_pMixJobBuffers = NULL;
+static int s_nMixThreadingOverride = -1;		// snd_mix_benchmark forces threading on or off, -1 uses snd_mix_threaded
+
+static void MIX_SaveThreadState( mixthreadstate_t &state )
+{
+	state.pPaintBuffers = g_paintBuffers;
+	state.pTempPaintBuffer = g_temppaintbuffer;
+	state.pCurPaintBuffer = g_curpaintbuffer;
+	state.pCurRearPaintBuffer = g_currearpaintbuffer;
+	state.pCurCenterPaintBuffer = g_curcenterpaintbuffer;
+}
+
+static void MIX_RestoreThreadState( const mixthreadstate_t &state )
+{
+	g_paintBuffers = state.pPaintBuffers;
+	g_temppaintbuffer = state.pTempPaintBuffer;
+	g_curpaintbuffer = state.pCurPaintBuffer;
+	g_currearpaintbuffer = state.pCurRearPaintBuffer;
+	g_curcenterpaintbuffer = state.pCurCenterPaintBuffer;
+}
+
+static void MIX_AllocMixJobBuffers( void )
+{
+	s_pMixJobBuffers = (mixjobbuffers_t *)malloc( MAX_MIX_JOBS*sizeof( mixjobbuffers_t ) );
+	V_memset( s_pMixJobBuffers, 0, MAX_MIX_JOBS*sizeof( mixjobbuffers_t ) );
+
+	for ( int nJob = 0; nJob < MAX_MIX_JOBS; nJob++ )
+	{
+		mixjobbuffers_t *pBuffers = &s_pMixJobBuffers[nJob];
+
+		pBuffers->ptemppaintbuffer = (portable_samplepair_t*)_aligned_malloc( TEMP_COPY_BUFFER_SIZE*sizeof(portable_samplepair_t), 16 );
+		V_memset( pBuffers->ptemppaintbuffer, 0, TEMP_COPY_BUFFER_SIZE*sizeof(portable_samplepair_t) );
+
+		// same layout as the main paintbuffers
+		for ( int i = 0; i < CPAINTBUFFERS; i++ )
+		{
+			pBuffers->paintBuffers[i].pbuf = (portable_samplepair_t *)_aligned_malloc( PAINTBUFFER_MEM_SIZE*sizeof(portable_samplepair_t), 16 );
+			V_memset( pBuffers->paintBuffers[i].pbuf, 0, PAINTBUFFER_MEM_SIZE*sizeof(portable_samplepair_t) );
+
+			if ( s_pMainPaintBuffers[i].pbufrear )
+			{
+				pBuffers->paintBuffers[i].pbufrear = (portable_samplepair_t *)_aligned_malloc( PAINTBUFFER_MEM_SIZE*sizeof(portable_samplepair_t), 16 );
+				V_memset( pBuffers->paintBuffers[i].pbufrear, 0, PAINTBUFFER_MEM_SIZE*sizeof(portable_samplepair_t) );
+			}
+			if ( s_pMainPaintBuffers[i].pbufcenter )
+			{
+				pBuffers->paintBuffers[i].pbufcenter = (portable_samplepair_t *)_aligned_malloc( PAINTBUFFER_MEM_SIZE*sizeof(portable_samplepair_t), 16 );
+				V_memset( pBuffers->paintBuffers[i].pbufcenter, 0, PAINTBUFFER_MEM_SIZE*sizeof(portable_samplepair_t) );
+			}
+		}
+	}
+}
+
+static void MIX_FreeMixJobBuffers( void )
+{
+	if ( !s_pMixJobBuffers )
+		return;
+
+	for ( int nJob = 0; nJob < MAX_MIX_JOBS; nJob++ )
+	{
+		mixjobbuffers_t *pBuffers = &s_pMixJobBuffers[nJob];
+		_aligned_free( pBuffers->ptemppaintbuffer );
+
+		for ( int i = 0; i < CPAINTBUFFERS; i++ )
+		{
+			_aligned_free( pBuffers->paintBuffers[i].pbuf );
+			if ( pBuffers->paintBuffers[i].pbufrear )
+			{
+				_aligned_free( pBuffers->paintBuffers[i].pbufrear );
+			}
+			if ( pBuffers->paintBuffers[i].pbufcenter )
+			{
+				_aligned_free( pBuffers->paintBuffers[i].pbufcenter );
+			}
+		}
+	}
+
+	free( s_pMixJobBuffers );
+	s_pMixJobBuffers = NULL;
+}
+
+static bool MIX_IsThreadingEnabled( void )
+{
+	bool bThreaded = ( s_nMixThreadingOverride >= 0 ) ? ( s_nMixThreadingOverride != 0 ) : snd_mix_threaded.GetBool();
+	return bThreaded && g_pThreadPool && g_pThreadPool->NumThreads() > 0;
+}
+
+static bool MIX_ShouldMixThreaded( int nChannels )
+{
+	return MIX_IsThreadingEnabled() && nChannels >= 2 * MAX( snd_mix_threaded_min_channels.GetInt(), 1 );
+}
+
+// add a job's paintbuffer into a main paintbuffer, two sample pairs at a time.
+// count must be even - paintbuffers are 16 byte aligned and padded past PAINTBUFFER_SIZE.
+static void MIX_AddPaintbuffer( portable_samplepair_t *pDest, const portable_samplepair_t *pSrc, int count )
+{
+	Assert( !( count & 1 ) && count <= PAINTBUFFER_MEM_SIZE );
+
+	samplex4 *pDest4 = (samplex4 *)pDest;
+	const samplex4 *pSrc4 = (const samplex4 *)pSrc;
+	for ( int i = 0; i < count / 2; i++ )
+	{
+		pDest4[i] = AddSignedSIMD( pDest4[i], pSrc4[i] );
+	}
+}
+
+static void MIX_MixChannelsJob( mixjob_t &job )
+{
+	mixthreadstate_t savedState;
+	MIX_SaveThreadState( savedState );
+
+	// mirror the main paintbuffer setup and clear what this pass will mix into
+	int nSamples = ( job.sampleCount + 2 ) & ~1;
+	paintbuffer_t *pPaint = job.pBuffers->paintBuffers;
+	for ( int i = 0; i < CPAINTBUFFERS; i++ )
+	{
+		const paintbuffer_t &mainPaint = s_pMainPaintBuffers[i];
+		pPaint[i].factive = mainPaint.factive;
+		pPaint[i].fsurround = mainPaint.fsurround;
+		pPaint[i].fsurround_center = mainPaint.fsurround_center;
+		pPaint[i].flags = mainPaint.flags;
+
+		if ( !mainPaint.factive )
+			continue;
+
+		ZeroBuffer( pPaint[i].pbuf, nSamples * sizeof(portable_samplepair_t) );
+		if ( pPaint[i].pbufrear )
+		{
+			ZeroBuffer( pPaint[i].pbufrear, nSamples * sizeof(portable_samplepair_t) );
+		}
+		if ( pPaint[i].pbufcenter )
+		{
+			ZeroBuffer( pPaint[i].pbufcenter, nSamples * sizeof(portable_samplepair_t) );
+		}
+	}
+
+	g_paintBuffers = pPaint;
+	g_temppaintbuffer = job.pBuffers->ptemppaintbuffer;
+	MIX_SetCurrentPaintbuffer( job.ipaintcur );
+
+	for ( int i = 0; i < job.nChannels; i++ )
+	{
+		int iChannel = job.pChannels[i];
+		job.pFinished[iChannel] = !MIX_MixChannel( *job.pList, iChannel, job.sampleCount, job.outputRate, job.flGlobalPitchScale );
+	}
+
+	MIX_RestoreThreadState( savedState );
+}
+
+struct mixjobchannel_t
+{
+	CAudioSource	*pSource;
+	short			iChannel;
+};
+
+static int __cdecl MIX_CompareJobChannels( const void *pLeft, const void *pRight )
+{
+	const mixjobchannel_t *pA = (const mixjobchannel_t *)pLeft;
+	const mixjobchannel_t *pB = (const mixjobchannel_t *)pRight;
+	if ( pA->pSource != pB->pSource )
+		return ( pA->pSource < pB->pSource ) ? -1 : 1;
+	return pA->iChannel - pB->iChannel;
+}
+
+// Mix the given channels (indices into list) into the active paintbuffers, splitting
+// them across the job pool. Called by MIX_MixChannelsToPaintbuffer after it has
+// filtered the channels for this pass.
+static void MIX_MixChannelsThreaded( CChannelList &list, const short *pChannels, int nChannels, int sampleCount, int outputRate, float flGlobalPitchScale )
+{
+	VPROF( "MixChannelsThreaded" );
+
+	bool bFinished[MAX_CHANNELS];
+	V_memset( bFinished, 0, sizeof( bFinished ) );
+
+	mixjobchannel_t jobChannels[MAX_CHANNELS];
+	short serialChannels[MAX_CHANNELS];
+	int nJobChannels = 0;
+	int nSerialChannels = 0;
+	for ( int i = 0; i < nChannels; i++ )
+	{
+		channel_t *ch = list.GetChannel( pChannels[i] );
+		CAudioSource *pSource = ch->sfx->pSource;
+		if ( ch->flags.m_bHasMouth || ch->flags.isSentence || pSource->IsVoiceSource() || pSource->IsStreaming() )
+		{
+			serialChannels[nSerialChannels++] = pChannels[i];
+		}
+		else
+		{
+			jobChannels[nJobChannels].pSource = pSource;
+			jobChannels[nJobChannels].iChannel = pChannels[i];
+			nJobChannels++;
+		}
+	}
+
+	int nMinChannels = MAX( snd_mix_threaded_min_channels.GetInt(), 1 );
+	int nJobs = MIN( nJobChannels / nMinChannels, MIN( g_pThreadPool->NumThreads() + 1, MAX_MIX_JOBS ) );
+	if ( nJobs < 2 )
+	{
+		// too few to be worth splitting
+		for ( int i = 0; i < nJobChannels; i++ )
+		{
+			serialChannels[nSerialChannels++] = jobChannels[i].iChannel;
+		}
+	}
+	else
+	{
+		if ( !s_pMixJobBuffers )
+		{
+			MIX_AllocMixJobBuffers();
+		}
+
+		// Channels playing the same source must be mixed by the same job: the source loads and
+		// converts its samples lazily on first use (CAudioSourceMemWave::GetDataPointer), unlocked.
+		qsort( jobChannels, nJobChannels, sizeof( mixjobchannel_t ), MIX_CompareJobChannels );
+		short sortedChannels[MAX_CHANNELS];
+		for ( int i = 0; i < nJobChannels; i++ )
+		{
+			sortedChannels[i] = jobChannels[i].iChannel;
+		}
+
+		mixjob_t jobs[MAX_MIX_JOBS];
+		int ipaintcur = MIX_GetCurrentPaintbufferIndex();
+		int nFirst = 0;
+		for ( int nJob = 0; nJob < nJobs; nJob++ )
+		{
+			int nLast = MAX( nFirst, ( nJobChannels * ( nJob + 1 ) ) / nJobs );
+			while ( nLast > 0 && nLast < nJobChannels && jobChannels[nLast].pSource == jobChannels[nLast - 1].pSource )
+			{
+				nLast++;
+			}
+			jobs[nJob].pList = &list;
+			jobs[nJob].pChannels = sortedChannels + nFirst;
+			jobs[nJob].nChannels = nLast - nFirst;
+			jobs[nJob].sampleCount = sampleCount;
+			jobs[nJob].outputRate = outputRate;
+			jobs[nJob].ipaintcur = ipaintcur;
+			jobs[nJob].flGlobalPitchScale = flGlobalPitchScale;
+			jobs[nJob].pBuffers = &s_pMixJobBuffers[nJob];
+			jobs[nJob].pFinished = bFinished;
+			nFirst = nLast;
+		}
+
+		ParallelProcess( jobs, nJobs, &MIX_MixChannelsJob );
+
+		// sum the job paintbuffers into the active paintbuffers
+		int nSamples = ( sampleCount + 2 ) & ~1;
+		for ( int i = 0; i < CPAINTBUFFERS; i++ )
+		{
+			paintbuffer_t *pPaint = &g_paintBuffers[i];
+			if ( !pPaint->factive )
+				continue;
+
+			for ( int nJob = 0; nJob < nJobs; nJob++ )
+			{
+				const paintbuffer_t *pJobPaint = &s_pMixJobBuffers[nJob].paintBuffers[i];
+				MIX_AddPaintbuffer( pPaint->pbuf, pJobPaint->pbuf, nSamples );
+				if ( pPaint->pbufrear )
+				{
+					MIX_AddPaintbuffer( pPaint->pbufrear, pJobPaint->pbufrear, nSamples );
+				}
+				if ( pPaint->pbufcenter )
+				{
+					MIX_AddPaintbuffer( pPaint->pbufcenter, pJobPaint->pbufcenter, nSamples );
+				}
+			}
+		}
+	}
+
+	for ( int i = 0; i < nSerialChannels; i++ )
+	{
+		int iChannel = serialChannels[i];
+		bFinished[iChannel] = !MIX_MixChannel( list, iChannel, sampleCount, outputRate, flGlobalPitchScale );
+	}
+
+	// free finished channels from the back of the list, like the serial loop does,
+	// so RemoveChannelFromList only ever swaps in channels that were already handled
+	for ( int i = list.Count(); --i >= 0; )
+	{
+		if ( bFinished[i] )
+		{
+			MIX_FreeFinishedChannel( list, i );
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Directional and room dsp. The facing-away filter doesn't depend on the
+// speaker/room chain, so when threading is on the two run as separate jobs.
+// Each dsp_t owns its processors, and the chains touch disjoint paintbuffers.
+//-----------------------------------------------------------------------------
+enum
+{
+	MIX_DSP_JOB_FACINGAWAY = 0,
+	MIX_DSP_JOB_ROOM,
+};
+
+struct mixdspjob_t
+{
+	int nJob;
+	int count;
+	bool bSpeakerChannels;
+	bool bSpatialDelays;
+};
+
+static void MIX_ApplyFacingAwayDSP( int count )
+{
+	// apply 2 or 4ch filtering to IFACINGAWAY buffer
+	Device_ApplyDSPEffects( idsp_facingaway, MIX_GetPFrontFromIPaint(IFACINGAWAYBUFFER), MIX_GetPRearFromIPaint(IFACINGAWAYBUFFER), MIX_GetPCenterFromIPaint(IFACINGAWAYBUFFER), count );
+}
+
+static void MIX_ApplyRoomDSP( int count, bool bSpeakerChannels, bool bSpatialDelays )
+{
+	if ( !g_bDspOff && bSpeakerChannels )
+	{
+		// apply 1ch filtering to ISPEAKERBUFFER
+		Device_ApplyDSPEffects( idsp_speaker, MIX_GetPFrontFromIPaint(ISPEAKERBUFFER), MIX_GetPRearFromIPaint(ISPEAKERBUFFER), MIX_GetPCenterFromIPaint(ISPEAKERBUFFER), count );
+		
+		// mix ISPEAKERBUFFER with IROOMBUFFER and IFACINGBUFFER
+		MIX_ScalePaintBuffer( ISPEAKERBUFFER, count, 0.7 );
+
+		MIX_MixPaintbuffers( ISPEAKERBUFFER, IFACINGBUFFER, IFACINGBUFFER, count, 1.0 );	// +70% dry speaker
+
+		MIX_ScalePaintBuffer( ISPEAKERBUFFER, count, 0.43 );
+
+		MIX_MixPaintbuffers( ISPEAKERBUFFER, IROOMBUFFER, IROOMBUFFER, count, 1.0 );		// +30% wet speaker
+	}
+
+	// apply dsp_room effects to room buffer
+	Device_ApplyDSPEffects( Get_idsp_room(), MIX_GetPFrontFromIPaint(IROOMBUFFER), MIX_GetPRearFromIPaint(IROOMBUFFER), MIX_GetPCenterFromIPaint(IROOMBUFFER), count );
+
+	// apply left/center/right/lrear/rrear spatial delays to room buffer
+	if ( bSpatialDelays )
+	{
+		// upgrade mono room buffer to surround status so we can apply spatial delays to all channels
+		MIX_ConvertBufferToSurround( IROOMBUFFER );
+		Device_ApplyDSPEffects( idsp_spatial, MIX_GetPFrontFromIPaint(IROOMBUFFER),  MIX_GetPRearFromIPaint(IROOMBUFFER), MIX_GetPCenterFromIPaint(IROOMBUFFER), count );
+	}
+}
+
+static void MIX_ApplyDSPJob( mixdspjob_t &job )
+{
+	// the jobs work on the main paintbuffers directly
+	mixthreadstate_t savedState;
+	MIX_SaveThreadState( savedState );
+	g_paintBuffers = s_pMainPaintBuffers;
+	g_temppaintbuffer = NULL;
+	MIX_SetCurrentPaintbuffer( IPAINTBUFFER );
+
+	if ( job.nJob == MIX_DSP_JOB_FACINGAWAY )
+	{
+		MIX_ApplyFacingAwayDSP( job.count );
+	}
+	else
+	{
+		MIX_ApplyRoomDSP( job.count, job.bSpeakerChannels, job.bSpatialDelays );
+	}
+
+	MIX_RestoreThreadState( savedState );
+}
+
+static void MIX_ApplyAllDSP( int count, bool bSpeakerChannels, bool bSpatialDelays )
+{
+	VPROF( "MixApplyAllDSP" );
+
+	if ( g_bdirectionalfx && MIX_IsThreadingEnabled() )
+	{
+		mixdspjob_t jobs[2];
+		for ( int i = 0; i < 2; i++ )
+		{
+			jobs[i].nJob = i;
+			jobs[i].count = count;
+			jobs[i].bSpeakerChannels = bSpeakerChannels;
+			jobs[i].bSpatialDelays = bSpatialDelays;
+		}
+		ParallelProcess( jobs, 2, &MIX_ApplyDSPJob );
+		return;
+	}
+
+	if ( g_bdirectionalfx )
+	{
+		MIX_ApplyFacingAwayDSP( count );
+	}
+	MIX_ApplyRoomDSP( count, bSpeakerChannels, bSpatialDelays );
+}
+
 // mix channels matching 'flags' (SOUND_MIX_DRY, SOUND_MIX_WET, SOUND_MIX_SPEAKER) into specified paintbuffer
 // upsamples 11khz, 22khz channels to 44khz.
 
@@ -2767,6 +3270,21 @@ extern ConVar dsp_vol_2ch;
 
 extern void MXR_SetCurrentSoundMixer( const char *szsoundmixer );
 extern ConVar snd_soundmixer;
+// snd_mix_benchmark captures the final mix here: clipped to 16 bits, before master volume
+static CUtlVector< short > *s_pMixCapture = NULL;
+
+static void MIX_CapturePaintbuffer( int count )
+{
+	const portable_samplepair_t *pbuf = MIX_GetPFrontFromIPaint( IPAINTBUFFER );
+	int nFirst = s_pMixCapture->AddMultipleToTail( count * 2 );
+	short *pOut = s_pMixCapture->Base() + nFirst;
+	for ( int i = 0; i < count; i++ )
+	{
+		pOut[i * 2] = pbuf[i].left;
+		pOut[i * 2 + 1] = pbuf[i].right;
+	}
+}
+
 ConVar snd_mix_dry_volume("snd_mix_dry_volume", "1.0", FCVAR_NONE );
 ConVar snd_mix_test1( "snd_mix_test1", "1.0", FCVAR_NONE );
 ConVar snd_mix_test2( "snd_mix_test2", "1.0", FCVAR_NONE );
@@ -2794,6 +3312,10 @@ void MIX_PaintChannels( int64 endtime, bool bIsUnderwater )
 
 	bool room_fsurround_sav;
 	bool room_fsurround_center_sav;
+
+	if ( !MIX_BindMainPaintbuffers() )
+		return;
+
 	paintbuffer_t	*proom = MIX_GetPPaintFromIPaint(IROOMBUFFER);
 
 	CheckNewDspPresets();
@@ -2860,42 +3382,13 @@ void MIX_PaintChannels( int64 endtime, bool bIsUnderwater )
 		// IROOMBUFFER, IFACINGBUFFER, IFACINGAWAYBUFFER, IDRYBUFFER, ISPEAKERBUFFER
 		MIX_UpsampleAllPaintbuffers( list, end, count );
 
-		// apply appropriate dsp fx to each buffer, remix buffers into single quad output buffer
-		// apply 2 or 4ch filtering to IFACINGAWAY buffer
-		if ( g_bdirectionalfx )
-		{
-			Device_ApplyDSPEffects( idsp_facingaway, MIX_GetPFrontFromIPaint(IFACINGAWAYBUFFER), MIX_GetPRearFromIPaint(IFACINGAWAYBUFFER), MIX_GetPCenterFromIPaint(IFACINGAWAYBUFFER), count );
-		}
-
-		if ( !g_bDspOff && list.m_hasSpeakerChannels )
-		{
-			// apply 1ch filtering to ISPEAKERBUFFER
-			Device_ApplyDSPEffects( idsp_speaker, MIX_GetPFrontFromIPaint(ISPEAKERBUFFER), MIX_GetPRearFromIPaint(ISPEAKERBUFFER), MIX_GetPCenterFromIPaint(ISPEAKERBUFFER), count );
-			
-			// mix ISPEAKERBUFFER with IROOMBUFFER and IFACINGBUFFER
-			MIX_ScalePaintBuffer( ISPEAKERBUFFER, count, 0.7 );
-
-			MIX_MixPaintbuffers( ISPEAKERBUFFER, IFACINGBUFFER, IFACINGBUFFER, count, 1.0 );	// +70% dry speaker
-
-			MIX_ScalePaintBuffer( ISPEAKERBUFFER, count, 0.43 );
-
-			MIX_MixPaintbuffers( ISPEAKERBUFFER, IROOMBUFFER, IROOMBUFFER, count, 1.0 );		// +30% wet speaker
-		}
-
-		// apply dsp_room effects to room buffer
-		Device_ApplyDSPEffects( Get_idsp_room(), MIX_GetPFrontFromIPaint(IROOMBUFFER), MIX_GetPRearFromIPaint(IROOMBUFFER), MIX_GetPCenterFromIPaint(IROOMBUFFER), count );
-		
 		// save room buffer surround status, in case we upconvert it
 		room_fsurround_sav = proom->fsurround;
 		room_fsurround_center_sav = proom->fsurround_center;
-		
-		// apply left/center/right/lrear/rrear spatial delays to room buffer
-		if ( b_spatial_delays && !g_bDspOff && !DSP_RoomDSPIsOff() )
-		{
-			// upgrade mono room buffer to surround status so we can apply spatial delays to all channels
-			MIX_ConvertBufferToSurround( IROOMBUFFER );
-			Device_ApplyDSPEffects( idsp_spatial, MIX_GetPFrontFromIPaint(IROOMBUFFER),  MIX_GetPRearFromIPaint(IROOMBUFFER), MIX_GetPCenterFromIPaint(IROOMBUFFER), count );
-		}
+
+		// apply appropriate dsp fx to each buffer: facing away filter, speaker and room dsp, 
+		// and spatial delays to the room buffer. then remix buffers into single quad output buffer
+		MIX_ApplyAllDSP( count, list.m_hasSpeakerChannels, b_spatial_delays && !g_bDspOff && !DSP_RoomDSPIsOff() );
 
 		if ( g_bdirectionalfx )		// KDB: perf
 		{
@@ -2956,6 +3449,11 @@ void MIX_PaintChannels( int64 endtime, bool bIsUnderwater )
 		// NOTE: This is required - the hardware buffer transfer routines no longer perform clipping.
 		MIX_CompressPaintbuffer( IPAINTBUFFER, count );
 
+		if ( s_pMixCapture )
+		{
+			MIX_CapturePaintbuffer( count );
+		}
+
 		// transfer IPAINTBUFFER paintbuffer out to DMA buffer
 		MIX_SetCurrentPaintbuffer( IPAINTBUFFER );
 
@@ -5424,3 +5922,228 @@ void SND_RecordBuffer( void )
 	g_nMovieSamples += ( snd_linear_count >> 1 );
 	//Msg( "%d %f %f sound file time %f\n", host_tickcount, host_time, host_time - g_moviestart, (double)g_nMovieSamples/(double)44100);
 }
+
+
+//-----------------------------------------------------------------------------
+// Mixer benchmark and golden output check. Starts a repeatable set of channels
+// around the listener and renders them offline through MIX_PaintChannels, once
+// serially and once threaded. The two captures must match exactly; the result
+// can be written out as, or compared against, a golden .wav.
+//-----------------------------------------------------------------------------
+static const char *s_pBenchmarkSounds[] =
+{
+	"ambient/atmosphere/cs_metalscrapeverb10.wav",
+	"player/suit_denydevice.wav",
+	"UI/buttonclick.wav",
+};
+
+static int MIX_StartBenchmarkChannels( CSfxTable * const *ppSfx, int nSfx, int nChannels )
+{
+	S_StopAllSounds( true );
+
+	CUniformRandomStream random;
+	random.SetSeed( 1 );
+
+	int nSlot = GET_ACTIVE_SPLITSCREEN_SLOT();
+	for ( int i = 0; i < nChannels; i++ )
+	{
+		StartSoundParams_t params;
+		// only MAX_DYNAMIC_CHANNELS dynamic sounds play at once, the rest need static channels
+		params.staticsound = ( i >= MAX_DYNAMIC_CHANNELS );
+		params.soundsource = SOUND_FROM_WORLD;
+		params.entchannel = params.staticsound ? CHAN_STATIC : CHAN_AUTO;
+		params.pSfx = ppSfx[ i % nSfx ];
+		params.origin = listener_origin[ nSlot ] + Vector( random.RandomFloat( -1024.0f, 1024.0f ), random.RandomFloat( -1024.0f, 1024.0f ), random.RandomFloat( -128.0f, 128.0f ) );
+		params.bUpdatePositions = false;
+		params.fvol = random.RandomFloat( 0.25f, 1.0f );
+		params.soundlevel = SNDLVL_NORM;
+		params.pitch = random.RandomInt( 70, 130 );		// exercise the resampling mixers
+		S_StartSound( params );
+	}
+
+	CChannelList list;
+	MIX_BuildChannelList( list );
+	return list.Count();
+}
+
+static double MIX_RenderBenchmark( CUtlVector< short > &output, CSfxTable * const *ppSfx, int nSfx, int nChannels, int nSamples, bool bThreaded, int *pChannelsPlaying )
+{
+	int64 psav = g_paintedtime;
+	*pChannelsPlaying = MIX_StartBenchmarkChannels( ppSfx, nSfx, nChannels );
+
+	output.RemoveAll();
+	output.EnsureCapacity( nSamples * 2 );
+	s_pMixCapture = &output;
+	s_nMixThreadingOverride = bThreaded ? 1 : 0;
+
+	double flStart = Plat_FloatTime();
+	MIX_PaintChannels( g_paintedtime + nSamples, false );
+	double flElapsed = Plat_FloatTime() - flStart;
+
+	s_nMixThreadingOverride = -1;
+	s_pMixCapture = NULL;
+	S_StopAllSounds( true );
+	g_paintedtime = psav;
+
+	return flElapsed;
+}
+
+// returns the number of samples that differ, counting any length difference
+static int MIX_CompareCaptures( const CUtlVector< short > &a, const CUtlVector< short > &b, int *pMaxDiff )
+{
+	int nCount = MIN( a.Count(), b.Count() );
+	int nDiffs = abs( a.Count() - b.Count() );
+	*pMaxDiff = 0;
+	for ( int i = 0; i < nCount; i++ )
+	{
+		int nDiff = abs( a[i] - b[i] );
+		if ( nDiff )
+		{
+			nDiffs++;
+			*pMaxDiff = MAX( *pMaxDiff, nDiff );
+		}
+	}
+	return nDiffs;
+}
+
+// golden files are written with WaveCreateTmpFile, which forces a .WAV extension
+static void MIX_GetGoldenWaveName( const char *pName, char *pOut, int nOutSize )
+{
+	Q_StripExtension( pName, pOut, nOutSize );
+	Q_DefaultExtension( pOut, ".WAV", nOutSize );
+}
+
+static void MIX_WriteGoldenWave( const char *pName, CUtlVector< short > &samples )
+{
+	WaveCreateTmpFile( pName, SOUND_DMA_SPEED, 16, 2 );
+	WaveAppendTmpFile( pName, samples.Base(), 16, samples.Count() );
+	WaveFixupTmpFile( pName );
+}
+
+static bool MIX_ReadGoldenWave( const char *pName, CUtlVector< short > &samples )
+{
+	char filename[MAX_PATH];
+	MIX_GetGoldenWaveName( pName, filename, sizeof( filename ) );
+
+	CUtlBuffer buf;
+	if ( !g_pFileSystem->ReadFile( filename, NULL, buf ) )
+		return false;
+
+	if ( buf.TellPut() < 12 || LittleLong( buf.GetInt() ) != RIFF_ID )
+		return false;
+	buf.GetInt();
+	if ( LittleLong( buf.GetInt() ) != RIFF_WAVE )
+		return false;
+
+	// walk the chunks to the pcm data
+	while ( buf.GetBytesRemaining() >= 8 )
+	{
+		int chunkid = LittleLong( buf.GetInt() );
+		int chunksize = LittleLong( buf.GetInt() );
+		if ( chunkid == WAVE_DATA )
+		{
+			int nSamples = MIN( chunksize, buf.GetBytesRemaining() ) / sizeof( short );
+			samples.SetCount( nSamples );
+			buf.Get( samples.Base(), nSamples * sizeof( short ) );
+			for ( int i = 0; i < nSamples; i++ )
+			{
+				samples[i] = LittleShort( samples[i] );
+			}
+			return true;
+		}
+		buf.SeekGet( CUtlBuffer::SEEK_CURRENT, ( chunksize + 1 ) & ~1 );
+	}
+	return false;
+}
+
+CON_COMMAND_F( snd_mix_benchmark, "Mix channels offline, serially and threaded, and check the output. Usage: snd_mix_benchmark [channels=128] [seconds=4] [-sound <wav>] [-golden <wav>] [-writegolden] [-dsp]", FCVAR_CHEAT )
+{
+	if ( !g_AudioDevice || !g_AudioDevice->IsActive() || !s_pMainPaintBuffers )
+	{
+		Warning( "snd_mix_benchmark: no active sound device\n" );
+		return;
+	}
+
+	if ( snd_mix_async.GetBool() )
+	{
+		// the mix thread would be painting at the same time
+		Warning( "snd_mix_benchmark: set snd_mix_async 0 first\n" );
+		return;
+	}
+
+	int nChannels = ( args.ArgC() > 1 && V_isdigit( args[1][0] ) ) ? clamp( atoi( args[1] ), 1, MAX_CHANNELS ) : MAX_CHANNELS;
+	float flSeconds = ( args.ArgC() > 2 && V_isdigit( args[2][0] ) ) ? clamp( atof( args[2] ), 0.1f, 60.0f ) : 4.0f;
+	int nSamples = (int)( flSeconds * SOUND_DMA_SPEED ) & ~3;		// MIX_PaintChannels wants multiples of 4
+
+	CSfxTable *pSfx[ ARRAYSIZE( s_pBenchmarkSounds ) ];
+	int nSfx = 0;
+	if ( const char *pSound = args.FindArg( "-sound" ) )
+	{
+		pSfx[nSfx++] = S_PrecacheSound( pSound );
+	}
+	else
+	{
+		for ( int i = 0; i < ARRAYSIZE( s_pBenchmarkSounds ); i++ )
+		{
+			pSfx[nSfx++] = S_PrecacheSound( s_pBenchmarkSounds[i] );
+		}
+	}
+	for ( int i = 0; i < nSfx; i++ )
+	{
+		if ( !pSfx[i] )
+		{
+			Warning( "snd_mix_benchmark: couldn't load benchmark sounds\n" );
+			return;
+		}
+	}
+
+	// dsp delay lines carry state from one render to the next, which would make the captures differ
+	int nSaveDspOff = dsp_off.GetInt();
+	if ( !args.FindArg( "-dsp" ) )
+	{
+		dsp_off.SetValue( 1 );
+	}
+
+	CUtlVector< short > serialOutput, threadedOutput;
+	int nPlaying;
+
+	// the first render pulls the sound data in
+	MIX_RenderBenchmark( serialOutput, pSfx, nSfx, nChannels, nSamples, false, &nPlaying );
+
+	double flSerial = MIX_RenderBenchmark( serialOutput, pSfx, nSfx, nChannels, nSamples, false, &nPlaying );
+	double flThreaded = MIX_RenderBenchmark( threadedOutput, pSfx, nSfx, nChannels, nSamples, true, &nPlaying );
+
+	dsp_off.SetValue( nSaveDspOff );
+
+	int nMaxDiff;
+	int nDiffs = MIX_CompareCaptures( serialOutput, threadedOutput, &nMaxDiff );
+
+	float flAudioSeconds = (float)nSamples / SOUND_DMA_SPEED;
+	Msg( "%d of %d channels playing, %.2f seconds of audio, %d job threads\n", nPlaying, nChannels, flAudioSeconds, g_pThreadPool ? g_pThreadPool->NumThreads() : 0 );
+	Msg( "  serial    %8.2f ms per second of audio\n", flSerial * 1000.0 / flAudioSeconds );
+	Msg( "  threaded  %8.2f ms per second of audio (%.2fx)\n", flThreaded * 1000.0 / flAudioSeconds, flThreaded > 0.0 ? flSerial / flThreaded : 0.0 );
+	Msg( "  serial vs threaded: %d samples differ (max %d)\n", nDiffs, nMaxDiff );
+
+	if ( const char *pGolden = args.FindArg( "-golden" ) )
+	{
+		char filename[MAX_PATH];
+		MIX_GetGoldenWaveName( pGolden, filename, sizeof( filename ) );
+
+		if ( args.FindArg( "-writegolden" ) )
+		{
+			MIX_WriteGoldenWave( filename, threadedOutput );
+			Msg( "  wrote %s\n", filename );
+		}
+		else
+		{
+			CUtlVector< short > goldenOutput;
+			if ( !MIX_ReadGoldenWave( filename, goldenOutput ) )
+			{
+				Warning( "snd_mix_benchmark: couldn't read %s\n", filename );
+				return;
+			}
+			nDiffs = MIX_CompareCaptures( goldenOutput, threadedOutput, &nMaxDiff );
+			Msg( "  %s: %d samples differ (max %d)\n", filename, nDiffs, nMaxDiff );
+		}
+	}
+}
@@ -62,10 +62,13 @@ extern "C"
 
 extern portable_samplepair_t *g_paintbuffer;
 
+// The paintbuffer set and temp paintbuffer are thread local so that mix jobs can paint
+// channels into their own buffers, see MIX_MixChannelsThreaded.
+
 // temp paintbuffer - not included in main list of paintbuffers
-extern portable_samplepair_t *g_temppaintbuffer;
+extern DECL_THREAD_LOCAL portable_samplepair_t *g_temppaintbuffer;
 	
-extern paintbuffer_t *g_paintBuffers;
+extern DECL_THREAD_LOCAL paintbuffer_t *g_paintBuffers;
 
 extern void MIX_SetCurrentPaintbuffer( int ipaintbuffer );
 extern int MIX_GetCurrentPaintbufferIndex( void );
@@ -74,9 +77,9 @@ extern void MIX_ClearAllPaintBuffers( int SampleCount, bool clearFilters );
 extern bool MIX_InitAllPaintbuffers(void);
 extern void MIX_FreeAllPaintbuffers(void);
 	
-extern portable_samplepair_t *g_curpaintbuffer;
-extern portable_samplepair_t *g_currearpaintbuffer;
-extern portable_samplepair_t *g_curcenterpaintbuffer;
+extern DECL_THREAD_LOCAL portable_samplepair_t *g_curpaintbuffer;
+extern DECL_THREAD_LOCAL portable_samplepair_t *g_currearpaintbuffer;
+extern DECL_THREAD_LOCAL portable_samplepair_t *g_curcenterpaintbuffer;
 
 };
 
@@ -810,16 +810,23 @@ void CBaseClient::Disconnect( const char *fmt )
 
 void CBaseClient::FireGameEvent( IGameEvent *event, bool bPassthrough )
 {
-	CSVCMsg_GameEvent_t eventMsg;
-
-	// create bitstream from KeyValues
-	if ( g_GameEventManager.SerializeEvent( event, &eventMsg ) )
+	// the message is encoded once per event and shared by all clients
+	const CSVCMsg_GameEvent_t *pEventMsg = g_GameEventManager.GetSerializedEvent( event );
+	if ( pEventMsg )
 	{
 		if ( m_NetChannel )
 		{
 			if ( bPassthrough )
-				eventMsg.set_passthrough( 1 );
-			m_NetChannel->SendNetMsg( eventMsg, event->IsReliable() );
+			{
+				CSVCMsg_GameEvent_t passthroughMsg;
+				passthroughMsg.CopyFrom( *pEventMsg );
+				passthroughMsg.set_passthrough( 1 );
+				m_NetChannel->SendNetMsg( passthroughMsg, event->IsReliable() );
+			}
+			else
+			{
+				m_NetChannel->SendNetMsg( *pEventMsg, event->IsReliable() );
+			}
 
 			// This is our last chance to deliver this message out since the
 			// secure channels will be closed!
@@ -36,6 +36,7 @@
 #include "edict.h"
 #include "debugoverlay.h"
 #include "engine/IEngineTrace.h"
+#include "mapcache.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -357,11 +358,13 @@ cmodel_t *CM_LoadMap( const char *pPathName, bool allowReusePrevious, texinfo_t
 
 	// read in the collision model data
 	CMapLoadHelper::Init( 0, pPathName );
+	MapCache_Begin( pPathName );
 	CollisionBSPData_Load( pPathName, pBSPData, pTexinfo, texinfoCount );
 	CMapLoadHelper::Shutdown( );
 
     // Push the displacement bounding boxes down the tree and set leaf data.
     CM_DispTreeLeafnum( pBSPData );
+	MapCache_End();
 
 	CM_InitPortalOpenState( pBSPData );
 	FloodAreaConnections( pBSPData );
@@ -23,6 +23,13 @@
 #include "vphysics_interface.h"
 #include "sys_dll.h"
 #include "tier3/tier3.h"
+#include "mapcache.h"
+#include "host.h"
+#include "filesystem_engine.h"
+#include "checksum_crc.h"
+#include "tier0/fasttimer.h"
+#include "tier1/utlbuffer.h"
+#include "vstdlib/jobthread.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -520,6 +527,7 @@ void CollisionBSPData_LoadLeafs( CCollisionBSPData *pBSPData )
 {
 	pBSPData->allcontents = MASK_ALL;
 	CMapLoadHelper lh( LUMP_LEAFS );
+	MapCache_HashLump( lh );
 	switch( lh.LumpVersion() )
 	{
 	case 0:
@@ -579,6 +587,7 @@ void CollisionBSPData_LoadLeafBrushes( CCollisionBSPData *pBSPData )
 void CollisionBSPData_LoadPlanes( CCollisionBSPData *pBSPData )
 {
 	CMapLoadHelper lh( LUMP_PLANES );
+	MapCache_HashLump( lh );
 
 	int			i, j;
 	dplane_t 	*in;
@@ -857,6 +866,7 @@ void CollisionBSPData_LoadSubmodels( CCollisionBSPData *pBSPData )
 void CollisionBSPData_LoadNodes( CCollisionBSPData *pBSPData )
 {
 	CMapLoadHelper lh( LUMP_NODES );
+	MapCache_HashLump( lh );
 
 	dnode_t		*in;
 	int			i, j, count;
@@ -1042,184 +1052,280 @@ void CollisionBSPData_LoadPhysics( CCollisionBSPData *pBSPData )
 
 
 //-----------------------------------------------------------------------------
+// Displacement collision trees
+//
+// Tessellating each displacement's CCoreDispInfo and building its AABB tree is
+// independent per displacement, so it runs on the job pool.
+// CollisionBSPData_PrepareDispTrees walks the dispinfo on the main thread,
+// resolves each displacement's base face and lump ranges and sizes its tree;
+// that keeps the hunk allocations in disp order, so the layout is the same as
+// a serial load. The jobs only write to their own tree. Everything that
+// touches materials or other shared state runs afterwards, in disp order.
+// DispInfo_LoadDisplacements does the same for the render side's
+// CCoreDispInfo::Create and shares mod_disp_parallel_build.
 //-----------------------------------------------------------------------------
-void CollisionBSPData_LoadDispInfo( CCollisionBSPData *pBSPData, texinfo_t *pTexinfo, int texinfoCount )
-{
-	// How many displacements in the map?
-	CMapLoadHelper lhDispInfo( LUMP_DISPINFO );
-	int coreDispCount = lhDispInfo.LumpSize() / sizeof( ddispinfo_t );
-	if ( coreDispCount == 0 )
-		return;	
+static ConVar mod_disp_parallel_build( "mod_disp_parallel_build", "1", 0, "Build displacements (collision trees and render surfaces) on the job pool at map load." );
 
-    //
-    // get the vertex data
-    //
- 	CMapLoadHelper lhv( LUMP_VERTEXES );
-	dvertex_t *pVerts = ( dvertex_t* )lhv.LumpBase();
-	if ( lhv.LumpSize() % sizeof( dvertex_t ) )
+// Every lump the trees are built from
+struct dispcolllumps_t
+{
+	explicit dispcolllumps_t( int nFaceLump );
+
+	CMapLoadHelper	m_DispInfo;
+	CMapLoadHelper	m_Verts;
+	CMapLoadHelper	m_Edges;
+	CMapLoadHelper	m_SurfEdges;
+	CMapLoadHelper	m_Faces;
+	CMapLoadHelper	m_DispVerts;
+	CMapLoadHelper	m_DispTris;
+	CMapLoadHelper	m_DispMultiBlend;
+};
+
+dispcolllumps_t::dispcolllumps_t( int nFaceLump ) :
+	m_DispInfo( LUMP_DISPINFO ),
+	m_Verts( LUMP_VERTEXES ),
+	m_Edges( LUMP_EDGES ),
+	m_SurfEdges( LUMP_SURFEDGES ),
+	m_Faces( nFaceLump ),
+	m_DispVerts( LUMP_DISP_VERTS ),
+	m_DispTris( LUMP_DISP_TRIS ),
+	m_DispMultiBlend( LUMP_DISP_MULTIBLEND )
+{
+	if ( m_Verts.LumpSize() % sizeof( dvertex_t ) )
 		Sys_Error( "CMod_LoadDispInfo: bad vertex lump size!" );
+	if ( m_Edges.LumpSize() % sizeof( dedge_t ) )
+		Sys_Error( "CMod_LoadDispInfo: bad edge lump size!" );
+	if ( m_SurfEdges.LumpSize() % sizeof( int ) )
+		Sys_Error( "CMod_LoadDispInfo: bad surf edge lump size!" );
+	if ( m_Faces.LumpSize() % sizeof( dface_t ) )
+		Sys_Error( "CMod_LoadDispInfo: bad face lump size!" );
+}
 
-    //
-    // get the edge data
-    //
- 	CMapLoadHelper lhe( LUMP_EDGES );
-    dedge_t *pEdges = ( dedge_t* )lhe.LumpBase();
-    if ( lhe.LumpSize() % sizeof( dedge_t ) )
-        Sys_Error( "CMod_LoadDispInfo: bad edge lump size!" );
-
-    //
-    // get surf edges data
-    //
- 	CMapLoadHelper lhs( LUMP_SURFEDGES );
-    int *pSurfEdges = ( int* )lhs.LumpBase();
-    if ( lhs.LumpSize() % sizeof( int ) )
-        Sys_Error( "CMod_LoadDispInfo: bad surf edge lump size!" );
-
-    //
-    // get face data
-    //
-	int face_lump_to_load = LUMP_FACES;
+static int CollisionBSPData_DispFaceLump()
+{
 	if ( g_pMaterialSystemHardwareConfig->GetHDRType() != HDR_TYPE_NONE &&
 		CMapLoadHelper::LumpSize( LUMP_FACES_HDR ) > 0 )
 	{
-		face_lump_to_load = LUMP_FACES_HDR;
+		return LUMP_FACES_HDR;
 	}
-	CMapLoadHelper lhf( face_lump_to_load );
-    dface_t *pFaces = ( dface_t* )lhf.LumpBase();
-    if ( lhf.LumpSize() % sizeof( dface_t ) )
-        Sys_Error( "CMod_LoadDispInfo: bad face lump size!" );
-    int faceCount = lhf.LumpSize() / sizeof( dface_t );
-
-	dface_t *pFaceList = pFaces;
-	if ( !pFaceList )
-		return;
+	return LUMP_FACES;
+}
 
-	// allocate displacement collision trees
-	g_DispCollTreeCount = coreDispCount;
-	g_pDispCollTrees = DispCollTrees_Alloc( g_DispCollTreeCount );
-	g_pDispBounds = (alignedbbox_t *)Hunk_AllocName( g_DispCollTreeCount * sizeof(alignedbbox_t), va( "%s [%s]", lhDispInfo.GetLoadName(), "DispInfo" ), false );
+// Build the inverse mapping from disp index to face (0xFFFF for none)
+static void CollisionBSPData_MapDispsToFaces( dispcolllumps_t &lumps, int nDispCount, unsigned short *pDispIndexToFaceIndex )
+{
+	memset( pDispIndexToFaceIndex, 0xFF, nDispCount * sizeof( unsigned short ) );
 
-	// Build the inverse mapping from disp index to face
-	int nMemSize = coreDispCount * sizeof(unsigned short);
-	unsigned short *pDispIndexToFaceIndex = (unsigned short*)stackalloc( nMemSize );
-	memset( pDispIndexToFaceIndex, 0xFF, nMemSize );
-	
-	int i;
-    for ( i = 0; i < faceCount; ++i, ++pFaces )
-    {
-        // check face for displacement data
-        if ( pFaces->dispinfo == -1 )
-            continue;
-
-        // get the current displacement build surface
-		if ( pFaces->dispinfo >= coreDispCount )
+	const dface_t *pFaces = ( const dface_t* )lumps.m_Faces.LumpBase();
+	int faceCount = lumps.m_Faces.LumpSize() / sizeof( dface_t );
+	for ( int i = 0; i < faceCount; ++i, ++pFaces )
+	{
+		// check face for displacement data
+		if ( pFaces->dispinfo == -1 || pFaces->dispinfo >= nDispCount )
 			continue;
 
 		pDispIndexToFaceIndex[pFaces->dispinfo] = (unsigned short)i;
-    }
+	}
+}
+
+struct dispcollbuildjob_t
+{
+	CDispCollTree			*m_pTree;
+	ddispinfo_t				m_DispInfo;
+	const CDispVert			*m_pVerts;
+	const CDispTri			*m_pTris;
+	const CDispMultiBlend	*m_pMultiBlend;		// NULL unless the displacement has multiblend data
+	Vector					m_vecSurfPoints[4];
+	unsigned short			m_nFaceIndex;
+};
+
+static void CollisionBSPData_PrepareDispTrees( dispcolllumps_t &lumps, CDispCollTree *pTrees, int nDispCount,
+	const unsigned short *pDispIndexToFaceIndex, CUtlVector<dispcollbuildjob_t> &jobs )
+{
+	const dvertex_t *pVerts = ( const dvertex_t* )lumps.m_Verts.LumpBase();
+	const dedge_t *pEdges = ( const dedge_t* )lumps.m_Edges.LumpBase();
+	const int *pSurfEdges = ( const int* )lumps.m_SurfEdges.LumpBase();
+	const dface_t *pFaceList = ( const dface_t* )lumps.m_Faces.LumpBase();
+	int nDispVerts = lumps.m_DispVerts.LumpSize() / sizeof( CDispVert );
+	int nDispTris = lumps.m_DispTris.LumpSize() / sizeof( CDispTri );
+	int nDispMultiBlends = lumps.m_DispMultiBlend.LumpSize() / sizeof( CDispMultiBlend );
 
-	// Load one dispinfo from disk at a time and set it up.
 	int iCurVert = 0;
 	int iCurTri = 0;
 	int iCurMultiBlend = 0;
-	CDispVert tempVerts[MAX_DISPVERTS];
-	CDispTri  tempTris[MAX_DISPTRIS];
-	CDispMultiBlend tempMultiBlend[MAX_DISPVERTS];
-
-
-	int nSize = 0;
-	int nCacheSize = 0;
-	int nPowerCount[3] = { 0, 0, 0 };
-
-	CMapLoadHelper lhDispVerts( LUMP_DISP_VERTS );
-	CMapLoadHelper lhDispTris( LUMP_DISP_TRIS );
-	CMapLoadHelper lhDispMultiBLend( LUMP_DISP_MULTIBLEND );
 
-	for ( i = 0; i < coreDispCount; ++i )
+	jobs.EnsureCapacity( nDispCount );
+	for ( int i = 0; i < nDispCount; ++i )
 	{
 		// Find the face associated with this dispinfo
 		unsigned short nFaceIndex = pDispIndexToFaceIndex[i];
 		if ( nFaceIndex == 0xFFFF )
 			continue;
 
-		// Load up the dispinfo and create the CCoreDispInfo from it.
 		ddispinfo_t dispInfo;
-		lhDispInfo.LoadLumpElement( i, sizeof(ddispinfo_t), &dispInfo );
+		lumps.m_DispInfo.LoadLumpElement( i, sizeof(ddispinfo_t), &dispInfo );
 
-		// Read in the vertices.
+		// The lump ranges advance for every displacement with a face, built or not
 		int nVerts = NUM_DISP_POWER_VERTS( dispInfo.power );
-		lhDispVerts.LoadLumpData( iCurVert * sizeof(CDispVert), nVerts*sizeof(CDispVert), tempVerts );
-		iCurVert += nVerts;
-		
-		// Read in the tris.
 		int nTris = NUM_DISP_POWER_TRIS( dispInfo.power );
-		lhDispTris.LoadLumpData( iCurTri * sizeof( CDispTri ), nTris*sizeof( CDispTri), tempTris );
+		int iFirstVert = iCurVert;
+		int iFirstTri = iCurTri;
+		int iFirstMultiBlend = -1;
+		iCurVert += nVerts;
 		iCurTri += nTris;
-
-		int nFlags = 0;
 		if ( ( dispInfo.minTess & DISP_INFO_FLAG_HAS_MULTIBLEND ) != 0 )
 		{
-			lhDispMultiBLend.LoadLumpData( iCurMultiBlend * sizeof( CDispMultiBlend ), nVerts * sizeof( CDispMultiBlend ), tempMultiBlend );
+			iFirstMultiBlend = iCurMultiBlend;
 			iCurMultiBlend += nVerts;
-			nFlags = DISP_INFO_FLAG_HAS_MULTIBLEND;
 		}
 
-		CCoreDispInfo coreDisp;
-		CCoreDispSurface *pDispSurf = coreDisp.GetSurface();
-		pDispSurf->SetPointStart( dispInfo.startPosition );
-		pDispSurf->SetContents( dispInfo.contents );
-	
-		coreDisp.InitDispInfo( dispInfo.power, dispInfo.minTess, dispInfo.smoothingAngle, tempVerts, tempTris, nFlags, tempMultiBlend );
-
-		// Hook the disp surface to the face
-		pFaces = &pFaceList[ nFaceIndex ];
-		pDispSurf->SetHandle( nFaceIndex );
+		//
+		// check for null faces, should have been taken care of in vbsp!!!
+		//
+		const dface_t *pFace = &pFaceList[nFaceIndex];
+		pTrees[i].SetPower( 0 );
+		if ( pFace->numedges != 4 )
+			continue;
 
-		// get points
-		if ( pFaces->numedges > 4 )
+		if ( dispInfo.power < MIN_MAP_DISP_POWER || dispInfo.power > MAX_MAP_DISP_POWER ||
+			iCurVert > nDispVerts || iCurTri > nDispTris || iCurMultiBlend > nDispMultiBlends )
+		{
+			// out of range
+			Assert( 0 );
 			continue;
+		}
+
+		dispcollbuildjob_t &job = jobs[ jobs.AddToTail() ];
+		job.m_pTree = &pTrees[i];
+		job.m_DispInfo = dispInfo;
+		job.m_pVerts = ( const CDispVert* )lumps.m_DispVerts.LumpBase() + iFirstVert;
+		job.m_pTris = ( const CDispTri* )lumps.m_DispTris.LumpBase() + iFirstTri;
+		job.m_pMultiBlend = ( iFirstMultiBlend >= 0 ) ? ( const CDispMultiBlend* )lumps.m_DispMultiBlend.LumpBase() + iFirstMultiBlend : NULL;
+		job.m_nFaceIndex = nFaceIndex;
 
-		Vector surfPoints[4];
-		pDispSurf->SetPointCount( pFaces->numedges );
-		int j;
-		for ( j = 0; j < pFaces->numedges; j++ )
+		// get points
+		for ( int j = 0; j < 4; j++ )
 		{
-			int eIndex = pSurfEdges[pFaces->firstedge+j];
+			int eIndex = pSurfEdges[pFace->firstedge+j];
 			if ( eIndex < 0 )
 			{
-				VectorCopy( pVerts[pEdges[-eIndex].v[1]].point, surfPoints[j] );
+				VectorCopy( pVerts[pEdges[-eIndex].v[1]].point, job.m_vecSurfPoints[j] );
 			}
 			else
 			{
-				VectorCopy( pVerts[pEdges[eIndex].v[0]].point, surfPoints[j] );
+				VectorCopy( pVerts[pEdges[eIndex].v[0]].point, job.m_vecSurfPoints[j] );
 			}
 		}
 
-		for ( j = 0; j < 4; j++ )
-		{
-			pDispSurf->SetPoint( j, surfPoints[j] );
-		}
+		pTrees[i].PreallocateTree( dispInfo.power );
+	}
+}
 
-		pDispSurf->FindSurfPointStartIndex();
-		pDispSurf->AdjustSurfPointData();
+static void CollisionBSPData_BuildDispTree( dispcollbuildjob_t &job )
+{
+	CCoreDispInfo coreDisp;
+	CCoreDispSurface *pDispSurf = coreDisp.GetSurface();
+	pDispSurf->SetPointStart( job.m_DispInfo.startPosition );
+	pDispSurf->SetContents( job.m_DispInfo.contents );
+
+	int nFlags = job.m_pMultiBlend ? DISP_INFO_FLAG_HAS_MULTIBLEND : 0;
+	coreDisp.InitDispInfo( job.m_DispInfo.power, job.m_DispInfo.minTess, job.m_DispInfo.smoothingAngle, job.m_pVerts, job.m_pTris, nFlags, job.m_pMultiBlend );
+
+	// Hook the disp surface to the face
+	pDispSurf->SetHandle( job.m_nFaceIndex );
+	pDispSurf->SetPointCount( 4 );
+	for ( int j = 0; j < 4; j++ )
+	{
+		pDispSurf->SetPoint( j, job.m_vecSurfPoints[j] );
+	}
 
-		//
-		// generate the collision displacement surfaces
-		//
-		CDispCollTree *pDispTree = &g_pDispCollTrees[i];
-		pDispTree->SetPower( 0 );
+	pDispSurf->FindSurfPointStartIndex();
+	pDispSurf->AdjustSurfPointData();
 
-		//
-		// check for null faces, should have been taken care of in vbsp!!!
-		//
-		int pointCount = pDispSurf->GetPointCount();
-		if ( pointCount != 4 )
+	coreDisp.Create();
+
+	// new collision
+	job.m_pTree->Create( &coreDisp );
+}
+
+static void CollisionBSPData_BuildDispTrees( CUtlVector<dispcollbuildjob_t> &jobs, bool bParallel )
+{
+	ParallelProcess( jobs.Base(), jobs.Count(), &CollisionBSPData_BuildDispTree, NULL, NULL, bParallel ? INT_MAX : 0 );
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+void CollisionBSPData_LoadDispInfo( CCollisionBSPData *pBSPData, texinfo_t *pTexinfo, int texinfoCount )
+{
+	// How many displacements in the map?
+	int coreDispCount = CMapLoadHelper::LumpSize( LUMP_DISPINFO ) / sizeof( ddispinfo_t );
+	if ( coreDispCount == 0 )
+		return;	
+
+	dispcolllumps_t lumps( CollisionBSPData_DispFaceLump() );
+	dface_t *pFaceList = ( dface_t* )lumps.m_Faces.LumpBase();
+	if ( !pFaceList )
+		return;
+
+	// allocate displacement collision trees
+	g_DispCollTreeCount = coreDispCount;
+	g_pDispCollTrees = DispCollTrees_Alloc( g_DispCollTreeCount );
+	g_pDispBounds = (alignedbbox_t *)Hunk_AllocName( g_DispCollTreeCount * sizeof(alignedbbox_t), va( "%s [%s]", lumps.m_DispInfo.GetLoadName(), "DispInfo" ), false );
+
+	int nMemSize = coreDispCount * sizeof(unsigned short);
+	unsigned short *pDispIndexToFaceIndex = (unsigned short*)stackalloc( nMemSize );
+	CollisionBSPData_MapDispsToFaces( lumps, coreDispCount, pDispIndexToFaceIndex );
+
+	// Everything the trees are built from goes into the cache key
+	MapCache_HashLump( lumps.m_DispInfo );
+	MapCache_HashLump( lumps.m_Verts );
+	MapCache_HashLump( lumps.m_Edges );
+	MapCache_HashLump( lumps.m_SurfEdges );
+	MapCache_HashLump( lumps.m_Faces );
+	MapCache_HashLump( lumps.m_DispVerts );
+	MapCache_HashLump( lumps.m_DispTris );
+	MapCache_HashLump( lumps.m_DispMultiBlend );
+	bool bCachedTrees = MapCache_LoadDispTrees( coreDispCount );
+
+	if ( !bCachedTrees )
+	{
+		CUtlVector<dispcollbuildjob_t> jobs;
+		COM_TimestampedLog( "  CollisionBSPData_PrepareDispTrees" );
+		CollisionBSPData_PrepareDispTrees( lumps, g_pDispCollTrees, coreDispCount, pDispIndexToFaceIndex, jobs );
+
+		COM_TimestampedLog( "  CollisionBSPData_BuildDispTrees (%d)", jobs.Count() );
+		CollisionBSPData_BuildDispTrees( jobs, mod_disp_parallel_build.GetBool() );
+	}
+
+	COM_TimestampedLog( "  CollisionBSPData_FinishDispTrees" );
+
+	int nSize = 0;
+	int nCacheSize = 0;
+	int nPowerCount[3] = { 0, 0, 0 };
+
+	// Merge in disp order: bounds, load cache and the material dependent setup
+	for ( int i = 0; i < coreDispCount; ++i )
+	{
+		unsigned short nFaceIndex = pDispIndexToFaceIndex[i];
+		if ( nFaceIndex == 0xFFFF )
 			continue;
 
-		coreDisp.Create();
+		CDispCollTree *pDispTree = &g_pDispCollTrees[i];
+		if ( bCachedTrees )
+		{
+			if ( !MapCache_RestoreDispTree( i, pDispTree ) )
+				continue;
+		}
+		else
+		{
+			// Never built
+			if ( pDispTree->GetPower() == 0 )
+				continue;
+
+			MapCache_StoreDispTree( i, pDispTree );
+		}
+		dface_t *pFaces = &pFaceList[ nFaceIndex ];
 
-		// new collision
-		pDispTree->Create( &coreDisp );
 		g_pDispBounds[i].Init(pDispTree->m_mins, pDispTree->m_maxs, pDispTree->m_iCounter, pDispTree->GetContents());
 		nSize += pDispTree->GetMemorySize();
 		nCacheSize += pDispTree->GetCacheMemorySize();
@@ -1278,6 +1384,151 @@ void CollisionBSPData_LoadDispInfo( CCollisionBSPData *pBSPData, texinfo_t *pTex
 }
 
 
+//-----------------------------------------------------------------------------
+// Benchmark for the displacement collision build. Runs the same prepare/build
+// steps as the map loader into scratch trees for each map, once serially and
+// once on the job pool, and checks that both produce identical trees.
+//-----------------------------------------------------------------------------
+struct disptreebench_t
+{
+	int		m_nDisps;
+	int		m_nBuilt;
+	float	m_flReadMs;
+	float	m_flPrepareMs;
+	float	m_flBuildMs[2];		// serial, job pool (best of the iterations)
+	CRC32_t	m_TreeCRC[2];
+};
+
+static CRC32_t CollisionBSPData_CRCDispTrees( CDispCollTree *pTrees, int nDispCount )
+{
+	CUtlBuffer data;
+	CRC32_t crc;
+	CRC32_Init( &crc );
+	for ( int i = 0; i < nDispCount; ++i )
+	{
+		if ( pTrees[i].GetPower() == 0 )
+			continue;
+
+		dispcolltreerecord_t record;
+		pTrees[i].SaveToCache( record, data );
+		CRC32_ProcessBuffer( &crc, &record, sizeof( record ) );
+	}
+	CRC32_ProcessBuffer( &crc, data.Base(), data.TellPut() );
+	CRC32_Final( &crc );
+	return crc;
+}
+
+static void CollisionBSPData_BenchmarkDispTrees( const char *pPathName, int nIterations, disptreebench_t &result )
+{
+	V_memset( &result, 0, sizeof( result ) );
+	result.m_flBuildMs[0] = result.m_flBuildMs[1] = FLT_MAX;
+
+	CMapLoadHelper::Init( 0, pPathName );
+	result.m_nDisps = CMapLoadHelper::LumpSize( LUMP_DISPINFO ) / sizeof( ddispinfo_t );
+	if ( result.m_nDisps )
+	{
+		CFastTimer timer;
+		timer.Start();
+		dispcolllumps_t lumps( CollisionBSPData_DispFaceLump() );
+		timer.End();
+		result.m_flReadMs = timer.GetDuration().GetMillisecondsF();
+
+		CUtlVector<unsigned short> dispIndexToFaceIndex;
+		dispIndexToFaceIndex.SetCount( result.m_nDisps );
+		CollisionBSPData_MapDispsToFaces( lumps, result.m_nDisps, dispIndexToFaceIndex.Base() );
+
+		result.m_flPrepareMs = FLT_MAX;
+		for ( int nPass = 0; nPass < 2; ++nPass )
+		{
+			for ( int nIteration = 0; nIteration < nIterations; ++nIteration )
+			{
+				int nHunkMark = Hunk_LowMark();
+				CDispCollTree *pTrees = new CDispCollTree[ result.m_nDisps ];
+				CUtlVector<dispcollbuildjob_t> jobs;
+
+				timer.Start();
+				CollisionBSPData_PrepareDispTrees( lumps, pTrees, result.m_nDisps, dispIndexToFaceIndex.Base(), jobs );
+				timer.End();
+				result.m_flPrepareMs = MIN( result.m_flPrepareMs, timer.GetDuration().GetMillisecondsF() );
+
+				timer.Start();
+				CollisionBSPData_BuildDispTrees( jobs, nPass != 0 );
+				timer.End();
+				result.m_flBuildMs[nPass] = MIN( result.m_flBuildMs[nPass], timer.GetDuration().GetMillisecondsF() );
+
+				if ( nIteration == 0 )
+				{
+					result.m_nBuilt = jobs.Count();
+					result.m_TreeCRC[nPass] = CollisionBSPData_CRCDispTrees( pTrees, result.m_nDisps );
+				}
+
+				delete [] pTrees;
+				Hunk_FreeToLowMark( nHunkMark );
+			}
+		}
+	}
+	CMapLoadHelper::Shutdown();
+}
+
+CON_COMMAND_F( map_disp_benchmark, "Times the displacement collision build, serial vs. job pool, for the given maps or a set of stock maps.\n  map_disp_benchmark [map ...] [-iterations N]", FCVAR_CHEAT )
+{
+	// Scratch trees live in the hunk, which is only safe to roll back with no map loaded
+	if ( host_state.worldmodel || CMapLoadHelper::GetRefCount() )
+	{
+		Msg( "map_disp_benchmark: disconnect first\n" );
+		return;
+	}
+
+	static const char *s_pStockMaps[] =
+	{
+		"de_dust2", "de_inferno", "de_mirage", "de_nuke", "de_overpass", "de_train", "de_vertigo", "de_cache", "cs_office", "cs_italy",
+	};
+
+	int nIterations = clamp( args.FindArgInt( "-iterations", 3 ), 1, 100 );
+	CUtlVector<const char *> maps;
+	for ( int i = 1; i < args.ArgC(); ++i )
+	{
+		if ( !V_stricmp( args[i], "-iterations" ) )
+		{
+			++i;
+			continue;
+		}
+		maps.AddToTail( args[i] );
+	}
+	if ( !maps.Count() )
+	{
+		maps.CopyArray( s_pStockMaps, ARRAYSIZE( s_pStockMaps ) );
+	}
+
+	Msg( "%d job pool threads, best of %d\n", g_pThreadPool ? g_pThreadPool->NumThreads() : 0, nIterations );
+	Msg( "%-20s %6s %6s %9s %10s %10s %10s %8s %s\n", "map", "disps", "built", "read ms", "prepare ms", "serial ms", "jobs ms", "speedup", "match" );
+	for ( int i = 0; i < maps.Count(); ++i )
+	{
+		char szPathName[MAX_PATH];
+		V_snprintf( szPathName, sizeof( szPathName ), "maps/%s", maps[i] );
+		V_DefaultExtension( szPathName, ".bsp", sizeof( szPathName ) );
+		if ( !g_pFileSystem->FileExists( szPathName, "GAME" ) )
+		{
+			Msg( "%-20s (not found)\n", maps[i] );
+			continue;
+		}
+
+		disptreebench_t result;
+		CollisionBSPData_BenchmarkDispTrees( szPathName, nIterations, result );
+		if ( !result.m_nDisps )
+		{
+			Msg( "%-20s (no displacements)\n", maps[i] );
+			continue;
+		}
+
+		Msg( "%-20s %6d %6d %9.2f %10.2f %10.2f %10.2f %7.2fx %s\n", maps[i], result.m_nDisps, result.m_nBuilt,
+			result.m_flReadMs, result.m_flPrepareMs, result.m_flBuildMs[0], result.m_flBuildMs[1],
+			result.m_flBuildMs[1] > 0.0f ? result.m_flBuildMs[0] / result.m_flBuildMs[1] : 0.0f,
+			( result.m_TreeCRC[0] == result.m_TreeCRC[1] ) ? "yes" : "NO" );
+	}
+}
+
+
 //=============================================================================
 //
 // Collision Count Functions
@@ -17,6 +17,7 @@
 #include "vphysics_interface.h"
 #include "vphysics/virtualmesh.h"
 #include "zone.h"
+#include "mapcache.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -197,6 +198,9 @@ void CM_DispTreeLeafnum( CCollisionBSPData *pBSPData )
 	if( g_DispCollTreeCount == 0 )
 		return;
 
+	if ( MapCache_RestoreDispLeafList( pBSPData ) )
+		return;
+
 	for ( int i = 0; i < pBSPData->numleafs; i++ )
 	{
 		pBSPData->map_leafs[i].dispCount = 0;
@@ -214,6 +218,7 @@ void CM_DispTreeLeafnum( CCollisionBSPData *pBSPData )
 	pBSPData->map_dispList.Attach( count, (unsigned short*)Hunk_AllocName( sizeof(unsigned short) * count, "CM_DispTreeLeafnum", false ) );
 	pBSPData->numdisplist = count;
 	leafBuilder.WriteLeafList( pBSPData->map_dispList.Base() );
+	MapCache_StoreDispLeafList( pBSPData );
 }
 
 //-----------------------------------------------------------------------------
@@ -25,6 +25,7 @@
 #include "con_nprint.h"
 #include "tier2/tier2.h"
 #include "tier0/dbg.h"
+#include "vstdlib/jobthread.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -457,9 +458,12 @@ void DispInfo_CreateEmptyStaticBuffers( model_t *pWorld, const ddispinfo_t *pMap
 // Information: Setup the CCoreDispInfo using the ddispinfo_t and have it translate the data
 // into a format we'll copy into the rendering structures. This roundaboutness is because
 // of legacy code. It should all just be stored in the map file, but it's not a high priority right now.
+// The CCoreDispInfo gets built in three steps: DispInfo_InitCoreDisp and DispInfo_CreateCoreDisp
+// (which only touches the core disp and runs on the job pool), then DispInfo_SetupFromCoreDisp
+// copies the result into the CDispInfo.
 //-----------------------------------------------------------------------------
-bool DispInfo_CreateFromMapDisp( model_t *pWorld, int iDisp, const ddispinfo_t *pMapDisp, CCoreDispInfo *pCoreDisp, const CDispVert *pVerts,
-								 const CDispTri *pTris, const CDispMultiBlend *pMultiBlend, const MaterialSystem_SortInfo_t *pSortInfos, bool bRestoring )
+static void DispInfo_InitCoreDisp( model_t *pWorld, int iDisp, const ddispinfo_t *pMapDisp, CCoreDispInfo *pCoreDisp, const CDispVert *pVerts,
+								   const CDispTri *pTris, const CDispMultiBlend *pMultiBlend )
 {
 	// Get the matching CDispInfo to fill in.
 	CDispInfo *pDisp = GetModelDisp( pWorld, iDisp );
@@ -478,8 +482,24 @@ bool DispInfo_CreateFromMapDisp( model_t *pWorld, int iDisp, const ddispinfo_t *
 
 	// Build the reset of the intermediate data from the initial map displacement data.
 	BuildDispSurfInit( pWorld, pCoreDisp, pDisp->GetParent() );	
-	if ( !pCoreDisp->Create() )
-		return false;
+}
+
+struct dispcorecreate_t
+{
+	CCoreDispInfo	*m_pCoreDisp;
+	bool			m_bCreated;
+};
+
+static void DispInfo_CreateCoreDisp( dispcorecreate_t &create )
+{
+	create.m_bCreated = create.m_pCoreDisp->Create();
+}
+
+static bool DispInfo_SetupFromCoreDisp( model_t *pWorld, int iDisp, const ddispinfo_t *pMapDisp, CCoreDispInfo *pCoreDisp,
+										const MaterialSystem_SortInfo_t *pSortInfos, bool bRestoring )
+{
+	// Get the matching CDispInfo to fill in.
+	CDispInfo *pDisp = GetModelDisp( pWorld, iDisp );
 
 	// Save the point start index - needed for overlays.
 	pDisp->m_iPointStart = pCoreDisp->GetSurface()->GetPointStartIndex();
@@ -709,11 +729,31 @@ bool DispInfo_LoadDisplacements( model_t *pWorld, bool bRestoring )
 		lhDispTris.LoadLumpData( iCurTri * sizeof(CDispTri), nTris*sizeof(CDispTri), tempTris );
 		iCurTri += nTris;
 
-		// Now create the CoreDispInfo and the base CDispInfo.
-		if ( !DispInfo_CreateFromMapDisp( pWorld, iDisp, pMapDisp, aCoreDisps[iDisp], tempVerts, tempTris, tempMultiBlend, pSortInfos, bRestoring ) )
-			return false;
+		// Now initialize the CoreDispInfo.
+		DispInfo_InitCoreDisp( pWorld, iDisp, pMapDisp, aCoreDisps[iDisp], tempVerts, tempTris, tempMultiBlend );
 	}	
 
+	// Tessellate the core displacements, they're independent of each other until smoothing.
+	static ConVarRef mod_disp_parallel_build( "mod_disp_parallel_build" );
+	CUtlVector<dispcorecreate_t> coreCreates;
+	coreCreates.SetCount( nDisplacements );
+	for ( iDisp = 0; iDisp < nDisplacements; ++iDisp )
+	{
+		coreCreates[iDisp].m_pCoreDisp = aCoreDisps[iDisp];
+		coreCreates[iDisp].m_bCreated = false;
+	}
+	ParallelProcess( coreCreates.Base(), nDisplacements, &DispInfo_CreateCoreDisp, NULL, NULL, mod_disp_parallel_build.GetBool() ? INT_MAX : 0 );
+
+	// And set up the base CDispInfos in disp order.
+	for ( iDisp = 0; iDisp < nDisplacements; ++iDisp )
+	{
+		if ( !coreCreates[iDisp].m_bCreated )
+			return false;
+
+		if ( !DispInfo_SetupFromCoreDisp( pWorld, iDisp, &tempDisps[iDisp], aCoreDisps[iDisp], pSortInfos, bRestoring ) )
+			return false;
+	}
+
 	// Smooth Normals.
 	SmoothDispSurfNormals( aCoreDisps.Base(), nDisplacements );
 
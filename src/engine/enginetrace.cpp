@@ -14,6 +14,7 @@
 #include "cmodel_engine.h"
 #include "dispcoll_common.h"
 #include "staticpropmgr.h"
+#include "staticpropbvh.h"
 #include "server.h"
 #include "edict.h"
 #include "gl_model_private.h"
@@ -197,6 +198,7 @@ private:
 
 	friend void RayBench( const CCommand &args );
 	friend void RayBatchBench( const CCommand &args );
+	friend class CStaticPropsAlongRay;
 };
 
 extern void FlushOcclusionQueries();
@@ -1483,9 +1485,10 @@ public:
 
 	enum { MAX_ENTITIES_ALONGRAY = 1024 };
 
-	CEntityListAlongRay() 
+	CEntityListAlongRay( bool bSkipStaticProps = false ) 
 	{
 		m_nCount = 0;
+		m_bSkipStaticProps = bSkipStaticProps;
 	}
 
 	void Reset()
@@ -1500,6 +1503,9 @@ public:
 
 	IterationRetval_t EnumElement( IHandleEntity *pHandleEntity )
 	{
+		if ( m_bSkipStaticProps && StaticPropMgr()->IsStaticProp( pHandleEntity ) )
+			return ITERATION_CONTINUE;
+
 		if ( m_nCount < MAX_ENTITIES_ALONGRAY )
 		{
 			m_EntityHandles[m_nCount] = pHandleEntity;
@@ -1514,9 +1520,44 @@ public:
 	}
 
 	int m_nCount;
+	bool m_bSkipStaticProps;
 	IHandleEntity	*m_EntityHandles[MAX_ENTITIES_ALONGRAY];
 };
 
+//-----------------------------------------------------------------------------
+// Clips a trace to the static props the static prop tree finds along a ray,
+// shortening the tree walk as the trace gets clipped
+//-----------------------------------------------------------------------------
+class CStaticPropsAlongRay : public IStaticPropBVHEnumerator
+{
+public:
+	CStaticPropsAlongRay( CEngineTrace *pEngineTrace, const Ray_t &ray, unsigned int fMask, ITraceFilter *pTraceFilter, trace_t *pTrace ) :
+		m_pEngineTrace( pEngineTrace ), m_Ray( ray ), m_fMask( fMask ), m_pTraceFilter( pTraceFilter ), m_pTrace( pTrace )
+	{
+	}
+
+	virtual bool EnumStaticProp( IHandleEntity *pHandleEntity, float *pflMaxFraction )
+	{
+		if ( m_pTraceFilter && !m_pTraceFilter->ShouldHitEntity( pHandleEntity, m_fMask ) )
+			return true;
+
+		trace_t tr;
+		m_pEngineTrace->ClipRayToCollideable( m_Ray, m_fMask, StaticPropMgr()->GetStaticProp( pHandleEntity ), &tr );
+		m_pEngineTrace->ClipTraceToTrace( tr, m_pTrace );
+		*pflMaxFraction = m_pTrace->fraction;
+
+		// Stop if we're in allsolid
+		return !m_pTrace->allsolid;
+	}
+
+private:
+	CEngineTrace	*m_pEngineTrace;
+	const Ray_t		&m_Ray;
+	unsigned int	m_fMask;
+	ITraceFilter	*m_pTraceFilter;
+	trace_t			*m_pTrace;
+};
+
 //-----------------------------------------------------------------------------
 // Makes sure the final trace is clipped to the clip trace
 // Returns true if clipping occurred
@@ -2880,17 +2921,21 @@ void CEngineTrace::TraceRay( const Ray_t &ray, unsigned int fMask, ITraceFilter
 		pTrace->fraction = 1.0;
 	}
 
+	bool bNoStaticProps = pTraceFilter->GetTraceType() == TRACE_ENTITIES_ONLY;
+	bool bFilterStaticProps = pTraceFilter->GetTraceType() == TRACE_EVERYTHING_FILTER_PROPS;
+
+	// Static props come from the static prop tree when it's available,
+	// so the partition only needs to produce the entities
+	bool bStaticPropTree = !bNoStaticProps && StaticPropMgr()->UseStaticPropTree();
+
 	// Collide with entities along the ray
 	// FIXME: Hitbox code causes this to be re-entrant for the IK stuff.
 	// If we could eliminate that, this could be static and therefore
 	// not have to reallocate memory all the time
-	CEntityListAlongRay enumerator;
+	CEntityListAlongRay enumerator( bNoStaticProps || bStaticPropTree );
 	enumerator.Reset();
 	SpatialPartition()->EnumerateElementsAlongRay( SpatialPartitionMask(), entityRay, false, &enumerator );
 
-	bool bNoStaticProps = pTraceFilter->GetTraceType() == TRACE_ENTITIES_ONLY;
-	bool bFilterStaticProps = pTraceFilter->GetTraceType() == TRACE_EVERYTHING_FILTER_PROPS;
-
 	trace_t tr;
 	ICollideable *pCollideable;
 	int nCount = enumerator.Count();
@@ -2938,6 +2983,13 @@ void CEngineTrace::TraceRay( const Ray_t &ray, unsigned int fMask, ITraceFilter
 			break;
 	}
 
+	if ( bStaticPropTree && !pTrace->allsolid )
+	{
+		VPROF( "CEngineTrace::TraceRay - static props" );
+		CStaticPropsAlongRay staticPropEnum( this, entityRay, fMask, bFilterStaticProps ? pTraceFilter : NULL, pTrace );
+		StaticPropMgr()->EnumerateStaticPropsAlongRay( entityRay, pTrace->fraction, &staticPropEnum );
+	}
+
 	// Fix up the fractions so they are appropriate given the original
 	// unclipped-to-world ray
 	pTrace->fraction *= flWorldFraction;
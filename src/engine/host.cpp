@@ -105,6 +105,7 @@
 #include "cl_main.h"
 #include "hltvserver.h"
 #include "hltvtest.h"
+#include "net_loadgen.h"
 #if defined( REPLAY_ENABLED )
 #include "replayserver.h"
 #include "replayhistorymanager.h"
@@ -3483,6 +3484,11 @@ void _Host_RunFrame (float time)
 				hltvtest->RunFrame();
 			}
 
+			if ( netloadgen )
+			{
+				netloadgen->RunFrame();
+			}
+
 #if defined( REPLAY_ENABLED )
 			// run replay if active
 			if ( replay )
@@ -4203,6 +4209,12 @@ void HLTV_Shutdown()
 		delete hltvtest;
 		hltvtest = NULL;
 	}
+
+	if ( netloadgen )
+	{
+		delete netloadgen;
+		netloadgen = NULL;
+	}
 }
 
 void InstallConVarHook( void );
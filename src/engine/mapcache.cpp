@@ -0,0 +1,552 @@
+//========= Copyright  1996-2005, Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Per-map on-disk cache of collision data derived from the BSP.
+//
+// Building the displacement collision trees (CCoreDispInfo tessellation and
+// the AABB trees) and pushing the displacements down the BSP tree is a large
+// part of CM_LoadMap on displacement heavy maps, and it produces the same
+// result every time. The first load writes the result to
+// maps/cache/<map>.bspcache under DEFAULT_WRITE_PATH; later loads map that
+// file and copy the arrays straight into the hunk.
+//
+// The file is relocatable: a fixed header followed by sections that are
+// addressed by offset and 16-byte aligned (CDispCollNode holds FourVectors).
+// It is keyed by a CRC of every source lump that feeds the cached data plus
+// the engine build, and each section carries its own CRC. Anything that
+// doesn't match falls back to building (and rewriting) the data. Material
+// driven state (surface props, texinfo flags) and the vphysics displacement
+// collision are still set up on every load.
+//
+//=============================================================================//
+
+#include "mapcache.h"
+#include "cmodel_engine.h"
+#include "cmodel_private.h"
+#include "dispcoll_common.h"
+#include "modelloader.h"
+#include "host.h"
+#include "filesystem.h"
+#include "filesystem_engine.h"
+#include "checksum_crc.h"
+#include "tier1/utlbuffer.h"
+#include "tier1/convar.h"
+#include "tier0/fasttimer.h"
+
+#ifdef POSIX
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+static ConVar mod_load_cache( "mod_load_cache", "1", 0, "Cache displacement collision trees and leaf lists per map in maps/cache instead of rebuilding them on every load." );
+
+#define MAPCACHE_IDENT		( ( 'C' << 24 ) + ( 'L' << 16 ) + ( 'M' << 8 ) + 'V' )	// little-endian "VMLC"
+#define MAPCACHE_VERSION	1
+#define MAPCACHE_DIR		"maps/cache"
+
+enum
+{
+	MAPCACHE_SECTION_DISPTREES = 0,		// dispcolltreerecord_t per displacement
+	MAPCACHE_SECTION_DISPDATA,			// tree arrays, addressed by the records
+	MAPCACHE_SECTION_LEAFDISPS,			// mapcacheleafdisps_t per leaf
+	MAPCACHE_SECTION_DISPLIST,			// unsigned short per leaf/displacement reference
+
+	MAPCACHE_SECTION_COUNT
+};
+
+struct mapcachesection_t
+{
+	int			m_nOffset;
+	int			m_nSize;
+	int			m_nCount;
+	CRC32_t		m_CRC;
+};
+
+struct mapcacheheader_t
+{
+	int					m_nIdent;
+	int					m_nVersion;
+	int					m_nBuild;
+	CRC32_t				m_MapKey;
+	int					m_nStructSizes[5];		// layout check for everything stored raw
+	int					m_nFileSize;
+	mapcachesection_t	m_Sections[MAPCACHE_SECTION_COUNT];
+};
+
+struct mapcacheleafdisps_t
+{
+	unsigned short	m_nStart;
+	unsigned short	m_nCount;
+};
+
+static void MapCache_GetStructSizes( int *pSizes )
+{
+	pSizes[0] = sizeof( dispcolltreerecord_t );
+	pSizes[1] = sizeof( Vector );
+	pSizes[2] = sizeof( CDispCollTri );
+	pSizes[3] = sizeof( CDispCollNode );
+	pSizes[4] = sizeof( CDispCollLeaf );
+}
+
+
+//-----------------------------------------------------------------------------
+// Cache state for the map currently being loaded
+//-----------------------------------------------------------------------------
+class CMapLoadCache
+{
+public:
+	CMapLoadCache();
+
+	void Begin( const char *pMapPathName );
+	void End();
+
+	void HashLump( CMapLoadHelper &lh );
+	bool LoadDispTrees( int nDispCount );
+
+	bool RestoreDispTree( int iDisp, CDispCollTree *pTree );
+	void StoreDispTree( int iDisp, CDispCollTree *pTree );
+	bool RestoreDispLeafList( CCollisionBSPData *pBSPData );
+	void StoreDispLeafList( CCollisionBSPData *pBSPData );
+
+private:
+	void Reset();
+	bool MapFile();
+	void UnmapFile();
+	bool ValidateFile();
+	const byte *Section( int nSection, int *pCount = NULL ) const;
+	void WriteFile();
+
+	bool				m_bActive;			// between Begin and End with the cache enabled
+	bool				m_bKeyed;			// MapCache_LoadDispTrees ran, m_Key is final
+	bool				m_bBuilding;		// no usable file, collect data for WriteFile
+	int					m_nDispCount;
+	CRC32_t				m_Key;
+	char				m_szFileName[MAX_PATH];
+	float				m_flLoadMs;
+
+	// The mapped (or read) cache file
+	const byte			*m_pFile;
+	int					m_nFileSize;
+	bool				m_bMapped;
+	CUtlBuffer			m_FileBuffer;
+
+	// Data collected while building
+	CUtlVector<dispcolltreerecord_t>	m_DispRecords;
+	CUtlBuffer							m_DispData;
+	CUtlVector<mapcacheleafdisps_t>		m_LeafDisps;
+	CUtlVector<unsigned short>			m_DispList;
+};
+
+static CMapLoadCache s_MapLoadCache;
+
+CMapLoadCache::CMapLoadCache()
+{
+	m_bActive = false;
+	m_bKeyed = false;
+	m_bBuilding = false;
+	m_nDispCount = 0;
+	m_Key = 0;
+	m_szFileName[0] = 0;
+	m_flLoadMs = 0.0f;
+	m_pFile = NULL;
+	m_nFileSize = 0;
+	m_bMapped = false;
+}
+
+void CMapLoadCache::Begin( const char *pMapPathName )
+{
+	// A load that errored out never reached End
+	Reset();
+	m_flLoadMs = 0.0f;
+
+	// Nothing worth caching without displacements
+	if ( !mod_load_cache.GetBool() || CMapLoadHelper::LumpSize( LUMP_DISPINFO ) <= 0 )
+		return;
+
+	char szBase[MAX_PATH];
+	V_FileBase( pMapPathName, szBase, sizeof( szBase ) );
+	V_snprintf( m_szFileName, sizeof( m_szFileName ), "%s/%s.bspcache", MAPCACHE_DIR, szBase );
+
+	CRC32_Init( &m_Key );
+	int nBuild = build_number();
+	CRC32_ProcessBuffer( &m_Key, &nBuild, sizeof( nBuild ) );
+	m_bActive = true;
+}
+
+void CMapLoadCache::HashLump( CMapLoadHelper &lh )
+{
+	if ( !m_bActive )
+		return;
+
+	// Hashing after the key is final would silently leave the lump out of it
+	Assert( !m_bKeyed );
+
+	int nDesc[2] = { lh.LumpSize(), lh.LumpVersion() };
+	CRC32_ProcessBuffer( &m_Key, nDesc, sizeof( nDesc ) );
+	if ( nDesc[0] > 0 )
+	{
+		CRC32_ProcessBuffer( &m_Key, lh.LumpBase(), nDesc[0] );
+	}
+}
+
+bool CMapLoadCache::LoadDispTrees( int nDispCount )
+{
+	if ( !m_bActive )
+		return false;
+
+	m_bKeyed = true;
+	m_nDispCount = nDispCount;
+	CRC32_Final( &m_Key );
+
+	CFastTimer timer;
+	timer.Start();
+	bool bLoaded = MapFile() && ValidateFile();
+	int nRecords = 0;
+	if ( bLoaded )
+	{
+		Section( MAPCACHE_SECTION_DISPTREES, &nRecords );
+		bLoaded = ( nRecords == nDispCount );
+	}
+	timer.End();
+	m_flLoadMs = timer.GetDuration().GetMillisecondsF();
+
+	if ( !bLoaded )
+	{
+		UnmapFile();
+		m_bBuilding = true;
+		m_DispRecords.RemoveAll();
+		m_DispData.Purge();
+		m_LeafDisps.RemoveAll();
+		m_DispList.RemoveAll();
+		return false;
+	}
+
+	COM_TimestampedLog( "  MapCache: using %s", m_szFileName );
+	return true;
+}
+
+bool CMapLoadCache::RestoreDispTree( int iDisp, CDispCollTree *pTree )
+{
+	int nRecords;
+	const dispcolltreerecord_t *pRecords = (const dispcolltreerecord_t *)Section( MAPCACHE_SECTION_DISPTREES, &nRecords );
+	if ( !pRecords || iDisp >= nRecords || pRecords[iDisp].m_nPower == 0 )
+		return false;
+
+	int nDataSize;
+	const byte *pData = Section( MAPCACHE_SECTION_DISPDATA, &nDataSize );
+	return pTree->LoadFromCache( pRecords[iDisp], pData, nDataSize );
+}
+
+void CMapLoadCache::StoreDispTree( int iDisp, CDispCollTree *pTree )
+{
+	if ( !m_bBuilding )
+		return;
+
+	// Displacements that never get a tree stay zeroed (power 0)
+	while ( m_DispRecords.Count() <= iDisp )
+	{
+		int i = m_DispRecords.AddToTail();
+		V_memset( &m_DispRecords[i], 0, sizeof( dispcolltreerecord_t ) );
+	}
+	pTree->SaveToCache( m_DispRecords[iDisp], m_DispData );
+}
+
+bool CMapLoadCache::RestoreDispLeafList( CCollisionBSPData *pBSPData )
+{
+	int nLeafs, nDispList;
+	const mapcacheleafdisps_t *pLeafDisps = (const mapcacheleafdisps_t *)Section( MAPCACHE_SECTION_LEAFDISPS, &nLeafs );
+	const unsigned short *pDispList = (const unsigned short *)Section( MAPCACHE_SECTION_DISPLIST, &nDispList );
+	if ( !pLeafDisps || nLeafs != pBSPData->numleafs || ( nDispList && !pDispList ) )
+		return false;
+
+	// Validate everything before touching the leaves so a bad file falls back to a rebuild
+	for ( int i = 0; i < nLeafs; i++ )
+	{
+		if ( (int)pLeafDisps[i].m_nStart + (int)pLeafDisps[i].m_nCount > nDispList )
+			return false;
+	}
+	for ( int i = 0; i < nDispList; i++ )
+	{
+		if ( pDispList[i] >= g_DispCollTreeCount )
+			return false;
+	}
+
+	for ( int i = 0; i < nLeafs; i++ )
+	{
+		pBSPData->map_leafs[i].dispListStart = pLeafDisps[i].m_nStart;
+		pBSPData->map_leafs[i].dispCount = pLeafDisps[i].m_nCount;
+	}
+	pBSPData->map_dispList.Attach( nDispList, (unsigned short*)Hunk_AllocName( sizeof(unsigned short) * nDispList, "CM_DispTreeLeafnum", false ) );
+	pBSPData->numdisplist = nDispList;
+	if ( nDispList )
+	{
+		V_memcpy( pBSPData->map_dispList.Base(), pDispList, sizeof(unsigned short) * nDispList );
+	}
+	return true;
+}
+
+void CMapLoadCache::StoreDispLeafList( CCollisionBSPData *pBSPData )
+{
+	if ( !m_bBuilding )
+		return;
+
+	m_LeafDisps.SetCount( pBSPData->numleafs );
+	for ( int i = 0; i < pBSPData->numleafs; i++ )
+	{
+		m_LeafDisps[i].m_nStart = pBSPData->map_leafs[i].dispListStart;
+		m_LeafDisps[i].m_nCount = pBSPData->map_leafs[i].dispCount;
+	}
+	m_DispList.CopyArray( pBSPData->map_dispList.Base(), pBSPData->numdisplist );
+}
+
+void CMapLoadCache::End()
+{
+	if ( m_bActive )
+	{
+		if ( m_bBuilding && m_DispRecords.Count() && m_LeafDisps.Count() )
+		{
+			WriteFile();
+		}
+		else if ( m_pFile )
+		{
+			DevMsg( "MapCache: loaded %s (%d KB, %.2f ms to map and validate)\n", m_szFileName, m_nFileSize / 1024, m_flLoadMs );
+		}
+	}
+
+	Reset();
+}
+
+void CMapLoadCache::Reset()
+{
+	UnmapFile();
+	m_DispRecords.Purge();
+	m_DispData.Purge();
+	m_LeafDisps.Purge();
+	m_DispList.Purge();
+	m_bActive = false;
+	m_bKeyed = false;
+	m_bBuilding = false;
+	m_nDispCount = 0;
+}
+
+//-----------------------------------------------------------------------------
+// The file only ever gets copied out of, so map it read only where we can
+//-----------------------------------------------------------------------------
+bool CMapLoadCache::MapFile()
+{
+	UnmapFile();
+
+#ifdef POSIX
+	char szFullPath[MAX_PATH];
+	if ( g_pFileSystem->RelativePathToFullPath( m_szFileName, "DEFAULT_WRITE_PATH", szFullPath, sizeof( szFullPath ) ) )
+	{
+		int fd = open( szFullPath, O_RDONLY );
+		if ( fd < 0 )
+			return false;
+
+		struct stat st;
+		void *pMapped = MAP_FAILED;
+		if ( fstat( fd, &st ) == 0 && st.st_size >= (off_t)sizeof( mapcacheheader_t ) && st.st_size < INT_MAX )
+		{
+			pMapped = mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+		}
+		close( fd );
+		if ( pMapped == MAP_FAILED )
+			return false;
+
+		m_pFile = (const byte *)pMapped;
+		m_nFileSize = (int)st.st_size;
+		m_bMapped = true;
+		return true;
+	}
+#endif
+
+	if ( !g_pFileSystem->ReadFile( m_szFileName, "DEFAULT_WRITE_PATH", m_FileBuffer ) || m_FileBuffer.TellPut() < (int)sizeof( mapcacheheader_t ) )
+	{
+		m_FileBuffer.Purge();
+		return false;
+	}
+
+	m_pFile = (const byte *)m_FileBuffer.Base();
+	m_nFileSize = m_FileBuffer.TellPut();
+	m_bMapped = false;
+	return true;
+}
+
+void CMapLoadCache::UnmapFile()
+{
+#ifdef POSIX
+	if ( m_pFile && m_bMapped )
+	{
+		munmap( (void *)m_pFile, m_nFileSize );
+	}
+#endif
+	m_FileBuffer.Purge();
+	m_pFile = NULL;
+	m_nFileSize = 0;
+	m_bMapped = false;
+}
+
+bool CMapLoadCache::ValidateFile()
+{
+	const mapcacheheader_t *pHeader = (const mapcacheheader_t *)m_pFile;
+	if ( pHeader->m_nIdent != MAPCACHE_IDENT || pHeader->m_nVersion != MAPCACHE_VERSION )
+		return false;
+
+	if ( pHeader->m_nBuild != build_number() || pHeader->m_MapKey != m_Key || pHeader->m_nFileSize != m_nFileSize )
+	{
+		DevMsg( "MapCache: %s is stale, rebuilding\n", m_szFileName );
+		return false;
+	}
+
+	int nStructSizes[ARRAYSIZE( pHeader->m_nStructSizes )];
+	MapCache_GetStructSizes( nStructSizes );
+	if ( V_memcmp( nStructSizes, pHeader->m_nStructSizes, sizeof( nStructSizes ) ) )
+		return false;
+
+	static const int s_nElementSizes[MAPCACHE_SECTION_COUNT] = { sizeof( dispcolltreerecord_t ), 1, sizeof( mapcacheleafdisps_t ), sizeof( unsigned short ) };
+	for ( int i = 0; i < MAPCACHE_SECTION_COUNT; ++i )
+	{
+		const mapcachesection_t &section = pHeader->m_Sections[i];
+		if ( section.m_nOffset < (int)sizeof( mapcacheheader_t ) || ( section.m_nOffset & 15 ) ||
+			section.m_nSize < 0 || section.m_nSize > m_nFileSize - section.m_nOffset ||
+			section.m_nCount < 0 || section.m_nCount * s_nElementSizes[i] != section.m_nSize ||
+			CRC32_ProcessSingleBuffer( m_pFile + section.m_nOffset, section.m_nSize ) != section.m_CRC )
+		{
+			Warning( "MapCache: %s is corrupt, rebuilding\n", m_szFileName );
+			return false;
+		}
+	}
+	return true;
+}
+
+const byte *CMapLoadCache::Section( int nSection, int *pCount ) const
+{
+	if ( !m_pFile )
+		return NULL;
+
+	const mapcachesection_t &section = ( (const mapcacheheader_t *)m_pFile )->m_Sections[nSection];
+	if ( pCount )
+	{
+		*pCount = section.m_nCount;
+	}
+	return m_pFile + section.m_nOffset;
+}
+
+//-----------------------------------------------------------------------------
+// Lay out header + sections and write it in one go
+//-----------------------------------------------------------------------------
+void CMapLoadCache::WriteFile()
+{
+	CFastTimer timer;
+	timer.Start();
+
+	// Trailing displacements that never got a tree
+	while ( m_DispRecords.Count() < m_nDispCount )
+	{
+		int i = m_DispRecords.AddToTail();
+		V_memset( &m_DispRecords[i], 0, sizeof( dispcolltreerecord_t ) );
+	}
+
+	mapcacheheader_t header;
+	V_memset( &header, 0, sizeof( header ) );
+	header.m_nIdent = MAPCACHE_IDENT;
+	header.m_nVersion = MAPCACHE_VERSION;
+	header.m_nBuild = build_number();
+	header.m_MapKey = m_Key;
+	MapCache_GetStructSizes( header.m_nStructSizes );
+
+	struct
+	{
+		const void	*m_pData;
+		int			m_nSize;
+		int			m_nCount;
+	} sections[MAPCACHE_SECTION_COUNT] =
+	{
+		{ m_DispRecords.Base(), m_DispRecords.Count() * (int)sizeof( dispcolltreerecord_t ), m_DispRecords.Count() },
+		{ m_DispData.Base(), m_DispData.TellPut(), m_DispData.TellPut() },
+		{ m_LeafDisps.Base(), m_LeafDisps.Count() * (int)sizeof( mapcacheleafdisps_t ), m_LeafDisps.Count() },
+		{ m_DispList.Base(), m_DispList.Count() * (int)sizeof( unsigned short ), m_DispList.Count() },
+	};
+
+	static const byte s_Pad[16] = { 0 };
+	CUtlBuffer buf;
+	buf.Put( &header, sizeof( header ) );
+	for ( int i = 0; i < MAPCACHE_SECTION_COUNT; ++i )
+	{
+		buf.Put( s_Pad, AlignValue( buf.TellPut(), 16 ) - buf.TellPut() );
+
+		mapcachesection_t &section = header.m_Sections[i];
+		section.m_nOffset = buf.TellPut();
+		section.m_nSize = sections[i].m_nSize;
+		section.m_nCount = sections[i].m_nCount;
+		section.m_CRC = CRC32_ProcessSingleBuffer( sections[i].m_pData, sections[i].m_nSize );
+		if ( sections[i].m_nSize )
+		{
+			buf.Put( sections[i].m_pData, sections[i].m_nSize );
+		}
+	}
+	header.m_nFileSize = buf.TellPut();
+	V_memcpy( buf.Base(), &header, sizeof( header ) );
+
+	g_pFileSystem->CreateDirHierarchy( MAPCACHE_DIR, "DEFAULT_WRITE_PATH" );
+	bool bWritten = g_pFileSystem->WriteFile( m_szFileName, "DEFAULT_WRITE_PATH", buf );
+
+	timer.End();
+	if ( bWritten )
+	{
+		DevMsg( "MapCache: wrote %s (%d KB, %.2f ms)\n", m_szFileName, buf.TellPut() / 1024, timer.GetDuration().GetMillisecondsF() );
+	}
+	else
+	{
+		Warning( "MapCache: couldn't write %s\n", m_szFileName );
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Public interface
+//-----------------------------------------------------------------------------
+void MapCache_Begin( const char *pMapPathName )
+{
+	s_MapLoadCache.Begin( pMapPathName );
+}
+
+void MapCache_End( void )
+{
+	s_MapLoadCache.End();
+}
+
+void MapCache_HashLump( CMapLoadHelper &lh )
+{
+	s_MapLoadCache.HashLump( lh );
+}
+
+bool MapCache_LoadDispTrees( int nDispCount )
+{
+	return s_MapLoadCache.LoadDispTrees( nDispCount );
+}
+
+bool MapCache_RestoreDispTree( int iDisp, CDispCollTree *pTree )
+{
+	return s_MapLoadCache.RestoreDispTree( iDisp, pTree );
+}
+
+void MapCache_StoreDispTree( int iDisp, CDispCollTree *pTree )
+{
+	s_MapLoadCache.StoreDispTree( iDisp, pTree );
+}
+
+bool MapCache_RestoreDispLeafList( CCollisionBSPData *pBSPData )
+{
+	return s_MapLoadCache.RestoreDispLeafList( pBSPData );
+}
+
+void MapCache_StoreDispLeafList( CCollisionBSPData *pBSPData )
+{
+	s_MapLoadCache.StoreDispLeafList( pBSPData );
+}
@@ -0,0 +1,35 @@
+//========= Copyright  1996-2005, Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Per-map on-disk cache of collision data derived from the BSP
+//			(displacement collision trees and displacement leaf lists).
+//
+//=============================================================================//
+#ifndef MAPCACHE_H
+#define MAPCACHE_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+class CMapLoadHelper;
+class CDispCollTree;
+class CCollisionBSPData;
+
+// Loading context, opened by CM_LoadMap around the collision loaders
+void MapCache_Begin( const char *pMapPathName );
+void MapCache_End( void );
+
+// Adds a source lump to the cache key. Everything that goes into the cached
+// structures must be hashed before MapCache_LoadDispTrees.
+void MapCache_HashLump( CMapLoadHelper &lh );
+
+// Finalizes the key and maps the cache file. Returns true if it holds trees
+// for nDispCount displacements, in which case MapCache_RestoreDispTree is used
+// instead of building them (and MapCache_StoreDispTree is a no-op).
+bool MapCache_LoadDispTrees( int nDispCount );
+bool MapCache_RestoreDispTree( int iDisp, CDispCollTree *pTree );
+void MapCache_StoreDispTree( int iDisp, CDispCollTree *pTree );
+
+bool MapCache_RestoreDispLeafList( CCollisionBSPData *pBSPData );
+void MapCache_StoreDispLeafList( CCollisionBSPData *pBSPData );
+
+#endif // MAPCACHE_H
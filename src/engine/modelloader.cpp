@@ -55,6 +55,7 @@
 #include "callqueue.h"
 #include "color.h"
 #include "tier1/lzmaDecoder.h"
+#include "vstdlib/jobthread.h"
 #include "eiface.h"
 #include "server.h"
 #include "ifilelist.h"
@@ -553,6 +554,381 @@ char *GetMapPathNameOnDisk( char *pDiskName, const char *pFullMapName, unsigned
 	return pDiskName;
 }
 
+//-----------------------------------------------------------------------------
+// Lump prefetching
+//
+// Map_LoadModelGuts (and CM_LoadMap inside it) parse the lumps one loader at a
+// time on the main thread. s_MapLumpGraph lists those loaders in the order
+// they run together with the lumps each one reads. Map_StartLumpPrefetch walks
+// it and reads (and on consoles LZMA decodes) the upcoming lumps on the job
+// pool, staying within mod_lump_prefetch_budget, so disk I/O and decompression
+// overlap with parsing. CMapLoadHelper picks a prefetched lump up instead of
+// reading it, and the buffer is freed once every loader that lists the lump is
+// done with it, which lets the next lumps stream in.
+//-----------------------------------------------------------------------------
+static ConVar mod_lump_prefetch( "mod_lump_prefetch", "1", 0, "Read and decompress BSP lumps on the job pool ahead of the loaders that parse them." );
+static ConVar mod_lump_prefetch_budget( "mod_lump_prefetch_budget", "96", 0, "Megabytes of BSP lumps that may be prefetched but not yet parsed.", true, 0, true, 1024 );
+
+struct maplumpstep_t
+{
+	const char	*m_pName;
+	int			m_nRequiredLump;	// the step only runs if this lump has data, -1 if it always runs
+	int			m_nLumps[8];	// -1 terminated. LUMP_FACES, LUMP_LIGHTING, LUMP_WORLDLIGHTS and the leaf ambient lumps resolve to their HDR versions when those get used
+};
+
+static const maplumpstep_t s_MapLumpGraph[] =
+{
+	{ "Mod_LoadTexinfo",				-1, { LUMP_TEXINFO, -1 } },
+	{ "CollisionBSPData_LoadTextures",	-1, { LUMP_TEXDATA, LUMP_TEXDATA_STRING_DATA, LUMP_TEXDATA_STRING_TABLE, -1 } },
+	{ "CollisionBSPData_LoadLeafs",		-1, { LUMP_LEAFS, LUMP_LEAFBRUSHES, -1 } },
+	{ "CollisionBSPData_LoadPlanes",	-1, { LUMP_PLANES, -1 } },
+	{ "CollisionBSPData_LoadBrushes",	-1, { LUMP_BRUSHES, LUMP_BRUSHSIDES, -1 } },
+	{ "CollisionBSPData_LoadSubmodels",	-1, { LUMP_MODELS, -1 } },
+	{ "CollisionBSPData_LoadNodes",		-1, { LUMP_NODES, -1 } },
+	{ "CollisionBSPData_LoadAreas",		-1, { LUMP_AREAS, LUMP_AREAPORTALS, -1 } },
+	{ "CollisionBSPData_LoadVisibility",	-1, { LUMP_VISIBILITY, -1 } },
+	{ "CollisionBSPData_LoadEntityString",	-1, { LUMP_ENTITIES, -1 } },
+	{ "CollisionBSPData_LoadPhysics",	-1, { LUMP_PHYSCOLLIDE, -1 } },
+	{ "CollisionBSPData_LoadDispInfo",	LUMP_DISPINFO, { LUMP_DISPINFO, LUMP_VERTEXES, LUMP_EDGES, LUMP_SURFEDGES, LUMP_FACES, LUMP_DISP_VERTS, LUMP_DISP_TRIS, LUMP_DISP_MULTIBLEND } },
+	{ "CollisionBSPData_LoadDispInfo",	LUMP_DISPINFO, { LUMP_PHYSDISP, -1 } },
+	{ "Mod_LoadVertices",				-1, { LUMP_VERTEXES, -1 } },
+	{ "Mod_LoadEdges",					-1, { LUMP_EDGES, LUMP_SURFEDGES, -1 } },
+	{ "Mod_LoadPlanes",					-1, { LUMP_PLANES, -1 } },
+	{ "Mod_LoadOcclusion",				-1, { LUMP_OCCLUSION, -1 } },
+	{ "Mod_LoadLighting",				-1, { LUMP_LIGHTING, -1 } },
+	{ "Mod_LoadPrimitives",				-1, { LUMP_PRIMITIVES, LUMP_PRIMVERTS, LUMP_PRIMINDICES, -1 } },
+	{ "Mod_LoadFaces",					-1, { LUMP_FACES, LUMP_FACEBRUSHLIST, LUMP_FACEBRUSHES, -1 } },
+	{ "Mod_LoadVertNormals",			-1, { LUMP_VERTNORMALS, LUMP_VERTNORMALINDICES, -1 } },
+	{ "Mod_LoadLeafs",					-1, { LUMP_LEAFS, LUMP_LEAF_AMBIENT_LIGHTING, LUMP_LEAF_AMBIENT_INDEX, -1 } },
+	{ "Mod_LoadMarksurfaces",			-1, { LUMP_LEAFFACES, -1 } },
+	{ "Mod_LoadNodes",					-1, { LUMP_NODES, -1 } },
+	{ "Mod_LoadLeafWaterData",			-1, { LUMP_LEAFWATERDATA, -1 } },
+#ifndef DEDICATED
+	{ "OverlayMgr()->LoadOverlays",		-1, { LUMP_OVERLAYS, LUMP_WATEROVERLAYS, LUMP_OVERLAY_FADES, LUMP_OVERLAY_SYSTEM_LEVELS, -1 } },
+#endif
+	{ "Mod_LoadLeafMinDistToWater",		-1, { LUMP_LEAFMINDISTTOWATER, -1 } },
+	{ "Mod_LoadLump",					-1, { LUMP_CLIPPORTALVERTS, LUMP_AREAPORTALS, LUMP_AREAS, -1 } },
+	{ "Mod_LoadWorldlights",			-1, { LUMP_WORLDLIGHTS, -1 } },
+	{ "Mod_LoadCubemapSamples",			-1, { LUMP_CUBEMAPS, -1 } },
+	{ "Mod_LoadGameLumpDict",			-1, { LUMP_GAME_LUMP, -1 } },
+	{ "Mod_LoadSubmodels",				-1, { LUMP_MODELS, -1 } },
+};
+
+struct maplumpprefetch_t
+{
+	const char	*m_pFirstUser;
+	CJob		*m_pJob;
+	byte		*m_pData;
+	int			m_nSize;			// uncompressed size, what CMapLoadHelper reports
+	int			m_nFileSize;
+	int			m_nFileOffset;
+	int			m_nUsesLeft;		// loaders in the graph that have yet to read it
+	int			m_nActiveHelpers;
+	bool		m_bIssued;
+	bool		m_bLumpFile;
+	bool		m_bFailed;
+	float		m_flReadMs;
+	float		m_flDecompressMs;
+	float		m_flWaitMs;
+	char		m_szFileName[MAX_PATH];
+};
+
+static maplumpprefetch_t s_LumpPrefetch[ HEADER_LUMPS ];
+static int s_LumpPrefetchOrder[ HEADER_LUMPS ];
+static int s_nLumpPrefetchCount;
+static int s_nLumpPrefetchNext;
+static int s_nLumpPrefetchBytes;		// issued and not yet freed
+static int s_nLumpPrefetchSyncReads;
+static bool s_bLumpPrefetchActive;
+
+static int Map_ResolvePrefetchLump( int nLump )
+{
+	bool bHDR = g_pMaterialSystemHardwareConfig->GetHDRType() != HDR_TYPE_NONE;
+	switch ( nLump )
+	{
+	case LUMP_FACES:
+		return ( bHDR && CMapLoadHelper::LumpSize( LUMP_FACES_HDR ) > 0 ) ? LUMP_FACES_HDR : LUMP_FACES;
+	case LUMP_LIGHTING:
+		return ( bHDR && CMapLoadHelper::LumpSize( LUMP_LIGHTING_HDR ) > 0 ) ? LUMP_LIGHTING_HDR : LUMP_LIGHTING;
+	case LUMP_WORLDLIGHTS:
+		return ( bHDR && CMapLoadHelper::LumpSize( LUMP_WORLDLIGHTS_HDR ) > 0 ) ? LUMP_WORLDLIGHTS_HDR : LUMP_WORLDLIGHTS;
+	case LUMP_LEAF_AMBIENT_LIGHTING:
+		return ( bHDR && CMapLoadHelper::LumpSize( LUMP_LEAF_AMBIENT_LIGHTING_HDR ) > 0 ) ? LUMP_LEAF_AMBIENT_LIGHTING_HDR : LUMP_LEAF_AMBIENT_LIGHTING;
+	case LUMP_LEAF_AMBIENT_INDEX:
+		return ( bHDR && CMapLoadHelper::LumpSize( LUMP_LEAF_AMBIENT_LIGHTING_HDR ) > 0 ) ? LUMP_LEAF_AMBIENT_INDEX_HDR : LUMP_LEAF_AMBIENT_INDEX;
+	default:
+		return nLump;
+	}
+}
+
+// Runs on the job pool; only touches its own entry
+static void Map_PrefetchLumpJob( maplumpprefetch_t *pLump )
+{
+	CFastTimer timer;
+	timer.Start();
+
+	FileHandle_t hFile;
+	if ( pLump->m_bLumpFile )
+	{
+		hFile = g_pFileSystem->Open( pLump->m_szFileName, "rb" );
+	}
+	else
+	{
+		hFile = g_pFileSystem->OpenEx( pLump->m_szFileName, "rb", IsGameConsole() ? FSOPEN_NEVERINPACK : 0, IsGameConsole() ? "GAME" : NULL );
+	}
+
+	if ( hFile == FILESYSTEM_INVALID_HANDLE )
+	{
+		pLump->m_bFailed = true;
+		return;
+	}
+
+	byte *pData = (byte *)malloc( pLump->m_nFileSize );
+	g_pFileSystem->Seek( hFile, pLump->m_nFileOffset, FILESYSTEM_SEEK_HEAD );
+	int nRead = g_pFileSystem->Read( pData, pLump->m_nFileSize, hFile );
+	g_pFileSystem->Close( hFile );
+
+	timer.End();
+	pLump->m_flReadMs = timer.GetDuration().GetMillisecondsF();
+
+	if ( nRead != pLump->m_nFileSize )
+	{
+		free( pData );
+		pLump->m_bFailed = true;
+		return;
+	}
+
+	pLump->m_nSize = pLump->m_nFileSize;
+	if ( IsGameConsole() )
+	{
+		CLZMA lzma;
+		if ( lzma.IsCompressed( pData ) )
+		{
+			timer.Start();
+			int nSize = lzma.GetActualSize( pData );
+			byte *pUncompressed = (byte *)malloc( nSize );
+			int nDecoded = lzma.Uncompress( pData, pUncompressed );
+			free( pData );
+			timer.End();
+			pLump->m_flDecompressMs = timer.GetDuration().GetMillisecondsF();
+
+			if ( nDecoded != nSize )
+			{
+				free( pUncompressed );
+				pLump->m_bFailed = true;
+				return;
+			}
+			pData = pUncompressed;
+			pLump->m_nSize = nSize;
+		}
+	}
+
+	pLump->m_pData = pData;
+}
+
+static void Map_IssueLumpPrefetch( maplumpprefetch_t &lump )
+{
+	Assert( !lump.m_bIssued );
+	lump.m_bIssued = true;
+	s_nLumpPrefetchBytes += lump.m_nFileSize;
+	lump.m_pJob = g_pThreadPool->QueueCall( Map_PrefetchLumpJob, &lump );
+}
+
+// Keeps the job pool busy with the next lumps in graph order, within budget
+static void Map_PumpLumpPrefetch( void )
+{
+	int nBudget = mod_lump_prefetch_budget.GetInt() * 1024 * 1024;
+	while ( s_nLumpPrefetchNext < s_nLumpPrefetchCount )
+	{
+		maplumpprefetch_t &lump = s_LumpPrefetch[ s_LumpPrefetchOrder[ s_nLumpPrefetchNext ] ];
+		if ( !lump.m_bIssued )
+		{
+			// Always allow one lump in flight, however big it is
+			if ( s_nLumpPrefetchBytes && s_nLumpPrefetchBytes + lump.m_nFileSize > nBudget )
+				break;
+			Map_IssueLumpPrefetch( lump );
+		}
+		++s_nLumpPrefetchNext;
+	}
+}
+
+static void Map_FreePrefetchedLump( maplumpprefetch_t &lump )
+{
+	if ( lump.m_pJob )
+	{
+		lump.m_pJob->WaitForFinishAndRelease();
+		lump.m_pJob = NULL;
+	}
+
+	if ( lump.m_pData )
+	{
+		free( lump.m_pData );
+		lump.m_pData = NULL;
+	}
+
+	if ( lump.m_bIssued && lump.m_nFileSize )
+	{
+		s_nLumpPrefetchBytes -= lump.m_nFileSize;
+		lump.m_nFileSize = 0;
+	}
+}
+
+static void Map_StartLumpPrefetch( void )
+{
+	V_memset( s_LumpPrefetch, 0, sizeof( s_LumpPrefetch ) );
+	s_nLumpPrefetchCount = 0;
+	s_nLumpPrefetchNext = 0;
+	s_nLumpPrefetchBytes = 0;
+	s_nLumpPrefetchSyncReads = 0;
+	s_bLumpPrefetchActive = false;
+
+	// Nothing to overlap if the bsp is already in memory
+	if ( !mod_lump_prefetch.GetBool() || s_MapBuffer.GetUsed() || s_MapFileHandle == FILESYSTEM_INVALID_HANDLE || !g_pThreadPool || g_pThreadPool->NumThreads() == 0 )
+		return;
+
+	char szNameOnDisk[MAX_PATH];
+	GetMapPathNameOnDisk( szNameOnDisk, s_szMapPathName, sizeof( szNameOnDisk ) );
+
+	for ( int i = 0; i < ARRAYSIZE( s_MapLumpGraph ); ++i )
+	{
+		const maplumpstep_t &step = s_MapLumpGraph[ i ];
+		if ( step.m_nRequiredLump >= 0 && CMapLoadHelper::LumpSize( step.m_nRequiredLump ) <= 0 )
+			continue;
+
+		for ( int j = 0; j < ARRAYSIZE( step.m_nLumps ) && step.m_nLumps[ j ] >= 0; ++j )
+		{
+			int nLump = Map_ResolvePrefetchLump( step.m_nLumps[ j ] );
+			maplumpprefetch_t &lump = s_LumpPrefetch[ nLump ];
+			if ( !lump.m_nUsesLeft )
+			{
+				if ( IsPC() && s_MapLumpFiles[ nLump ].file != FILESYSTEM_INVALID_HANDLE )
+				{
+					lump.m_bLumpFile = true;
+					lump.m_nFileSize = s_MapLumpFiles[ nLump ].header.lumpLength;
+					lump.m_nFileOffset = s_MapLumpFiles[ nLump ].header.lumpOffset;
+					GenerateLumpFileName( s_szMapPathName, lump.m_szFileName, sizeof( lump.m_szFileName ), s_MapLumpFiles[ nLump ].lumpfileindex );
+				}
+				else
+				{
+					lump.m_nFileSize = s_MapHeader.lumps[ nLump ].filelen;
+					lump.m_nFileOffset = s_MapHeader.lumps[ nLump ].fileofs;
+					V_strncpy( lump.m_szFileName, szNameOnDisk, sizeof( lump.m_szFileName ) );
+				}
+
+				if ( lump.m_nFileSize <= 0 )
+					continue;
+
+				lump.m_pFirstUser = step.m_pName;
+				s_LumpPrefetchOrder[ s_nLumpPrefetchCount++ ] = nLump;
+			}
+			++lump.m_nUsesLeft;
+		}
+	}
+
+	s_bLumpPrefetchActive = true;
+	Map_PumpLumpPrefetch();
+}
+
+static void Map_StopLumpPrefetch( void )
+{
+	if ( !s_bLumpPrefetchActive )
+		return;
+
+	for ( int i = 0; i < s_nLumpPrefetchCount; ++i )
+	{
+		maplumpprefetch_t &lump = s_LumpPrefetch[ s_LumpPrefetchOrder[ i ] ];
+		Assert( !lump.m_nActiveHelpers );
+		Map_FreePrefetchedLump( lump );
+	}
+	s_bLumpPrefetchActive = false;
+}
+
+static void Map_LogLumpPrefetch( void )
+{
+	if ( !s_bLumpPrefetchActive )
+		return;
+
+	float flReadMs = 0.0f, flDecompressMs = 0.0f, flWaitMs = 0.0f;
+	int nBytes = 0;
+	for ( int i = 0; i < s_nLumpPrefetchCount; ++i )
+	{
+		int nLump = s_LumpPrefetchOrder[ i ];
+		const maplumpprefetch_t &lump = s_LumpPrefetch[ nLump ];
+		if ( !lump.m_bIssued )
+			continue;
+
+		COM_TimestampedLog( "    lump %2d (%s): %d bytes, read %.2f ms, decompress %.2f ms, waited %.2f ms%s",
+			nLump, lump.m_pFirstUser, lump.m_nSize, lump.m_flReadMs, lump.m_flDecompressMs, lump.m_flWaitMs, lump.m_bFailed ? ", failed" : "" );
+		flReadMs += lump.m_flReadMs;
+		flDecompressMs += lump.m_flDecompressMs;
+		flWaitMs += lump.m_flWaitMs;
+		nBytes += lump.m_nSize;
+	}
+
+	COM_TimestampedLog( "  Map lump prefetch: %d lumps, %.1f MB, read %.1f ms, decompress %.1f ms, main thread waited %.1f ms, %d synchronous reads",
+		s_nLumpPrefetchCount, nBytes / ( 1024.0f * 1024.0f ), flReadMs, flDecompressMs, flWaitMs, s_nLumpPrefetchSyncReads );
+}
+
+// Hands a prefetched lump to a CMapLoadHelper, waiting for its job if needed
+static bool Map_TakePrefetchedLump( int nLump, byte **ppData, int *pnSize )
+{
+	if ( !s_bLumpPrefetchActive )
+		return false;
+
+	maplumpprefetch_t &lump = s_LumpPrefetch[ nLump ];
+	if ( lump.m_nUsesLeft <= 0 )
+	{
+		// Not in the graph, or read more often than the graph says
+		++s_nLumpPrefetchSyncReads;
+		return false;
+	}
+
+	// Loaders ran ahead of the budget
+	if ( !lump.m_bIssued )
+	{
+		Map_IssueLumpPrefetch( lump );
+	}
+
+	if ( lump.m_pJob )
+	{
+		CFastTimer timer;
+		timer.Start();
+		lump.m_pJob->WaitForFinishAndRelease();
+		lump.m_pJob = NULL;
+		timer.End();
+		lump.m_flWaitMs += timer.GetDuration().GetMillisecondsF();
+	}
+
+	--lump.m_nUsesLeft;
+	if ( lump.m_bFailed || !lump.m_pData )
+	{
+		// Let the regular path read it (and report any error)
+		++s_nLumpPrefetchSyncReads;
+		if ( lump.m_nUsesLeft <= 0 && !lump.m_nActiveHelpers )
+		{
+			Map_FreePrefetchedLump( lump );
+			Map_PumpLumpPrefetch();
+		}
+		return false;
+	}
+
+	++lump.m_nActiveHelpers;
+	*ppData = lump.m_pData;
+	*pnSize = lump.m_nSize;
+	return true;
+}
+
+static void Map_ReleasePrefetchedLump( int nLump )
+{
+	maplumpprefetch_t &lump = s_LumpPrefetch[ nLump ];
+	Assert( lump.m_nActiveHelpers > 0 );
+	if ( --lump.m_nActiveHelpers == 0 && lump.m_nUsesLeft <= 0 )
+	{
+		Map_FreePrefetchedLump( lump );
+		Map_PumpLumpPrefetch();
+	}
+}
+
 //-----------------------------------------------------------------------------
 // Returns the ref count for this bsp
 //-----------------------------------------------------------------------------
@@ -737,6 +1113,8 @@ void CMapLoadHelper::Shutdown( void )
 		return;
 	}
 
+	Map_StopLumpPrefetch();
+
 	if ( s_MapFileHandle != FILESYSTEM_INVALID_HANDLE )
 	{
 		g_pFileSystem->Close( s_MapFileHandle );
@@ -915,6 +1293,7 @@ CMapLoadHelper::CMapLoadHelper( int lumpToLoad, bool bUncompress )
 	m_pUncompressedData = NULL;
 	m_nUncompressedLumpSize = 0;
 	m_bUncompressedDataExternal = false;
+	m_bPrefetched = false;
 	
 	// Load raw lump from disk
 	lump_t *lump = &s_MapHeader.lumps[ lumpToLoad ];
@@ -944,6 +1323,14 @@ CMapLoadHelper::CMapLoadHelper( int lumpToLoad, bool bUncompress )
 		return;
 	}
 
+	// already read (and decompressed) on the job pool
+	if ( Map_TakePrefetchedLump( lumpToLoad, &m_pData, &m_nLumpSize ) )
+	{
+		m_bPrefetched = true;
+		m_nUncompressedLumpSize = m_nLumpSize;
+		return;
+	}
+
 	if ( s_MapBuffer.GetUsed() )
 	{
 		// bsp is in memory
@@ -1016,6 +1403,10 @@ CMapLoadHelper::~CMapLoadHelper( void )
 	{
 		g_pFileSystem->FreeOptimalReadBuffer( m_pRawData );
 	}
+	if ( m_bPrefetched )
+	{
+		Map_ReleasePrefetchedLump( m_nLumpID );
+	}
 }
 
 //-----------------------------------------------------------------------------
@@ -5087,6 +5478,10 @@ void CModelLoader::Map_LoadModelGuts( model_t *mod )
 		Warning( "Map '%s' lacks exepected HDR data! 360 does not support accurate LDR visuals.\n", mod->szPathName );
 	}
 
+	// start streaming the lumps in ahead of the loaders below
+	COM_TimestampedLog( "  Map_StartLumpPrefetch" );
+	Map_StartLumpPrefetch();
+
 	// load the texinfo lump (used by many subsequent lumps in raw form)
 	CMapLoadHelper lhTexinfo( LUMP_TEXINFO );
 	texinfo_t *pTexinfo = (texinfo_t *)lhTexinfo.LumpBase();
@@ -5360,6 +5755,7 @@ void CModelLoader::Map_LoadModelGuts( model_t *mod )
 		COM_TimestampedLog( "  Map_SetRenderInfoAllocated" );
 		Map_SetRenderInfoAllocated( false );
 	}
+	Map_LogLumpPrefetch();
 }
 
 void CModelLoader::Map_UnloadCubemapSamples( model_t *mod )
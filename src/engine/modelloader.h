@@ -221,6 +221,7 @@ private:
 	byte				*m_pUncompressedData;
 	int					m_nUncompressedLumpSize;
 	bool				m_bUncompressedDataExternal;
+	bool				m_bPrefetched;
 
 	// Handling for lump files
 	int					m_nLumpID;
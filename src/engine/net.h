@@ -155,6 +155,9 @@ void NET_TerminateConnection(int sock, const ns_address &peer );
 void NET_TerminateSteamConnection(int sock, uint64 uSteamID );
 
 void NET_SleepUntilMessages( int nMilliseconds );
+// Dedicated tick scheduler: sleeps until flDeadline (Plat_FloatTime) and, if bStagePackets,
+// receives packets arriving in the meantime so NET_GetPacket can hand them out next tick
+void NET_WaitForTickDeadline( double flDeadline, bool bStagePackets );
 
 // If net_public_adr convar is set then returns that, otherwise, checks with steam if we are a dedicated server (eventually will work for the client) and returns that
 // Returns false if not able to deduce address
@@ -0,0 +1,626 @@
+//========= Copyright  1996-2005, Valve Corporation, All rights reserved. ============//
+//
+// Purpose: 
+//
+// $NoKeywords: $
+//
+//=============================================================================//
+// net_loadgen.cpp: drives many simulated players against a server over real
+// UDP netchannels, so netchan, snapshot delta packing and GOTV fan-out can be
+// measured from a second headless process on the same box:
+//
+//   srcds ... +net_loadgen_start 200 127.0.0.1:27015
+//
+// Unlike fake clients these go through challenge/connect, rate limiting,
+// choke and acks exactly like a real client does.
+//////////////////////////////////////////////////////////////////////
+#include <netmessages.h>
+#include "net_loadgen.h"
+#include "quakedef.h"
+#include "cmd.h"
+#include "convar.h"
+#include "host.h"
+#include "net.h"
+#include "net_chan.h"
+#include "dt_send_eng.h"
+#include "filesystem_engine.h"
+#include "tier1/bitbuf.h"
+#include "tier0/vprof.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+CNetLoadGenSystem *netloadgen = NULL;
+
+static ConVar net_loadgen_cmdrate( "net_loadgen_cmdrate", "64", FCVAR_RELEASE, "Usercmd packets per second sent by each load generator client (sent to the server as cl_cmdrate)." );
+static ConVar net_loadgen_updaterate( "net_loadgen_updaterate", "64", FCVAR_RELEASE, "Snapshot rate requested by each load generator client (sent to the server as cl_updaterate)." );
+static ConVar net_loadgen_rate( "net_loadgen_rate", "196608", FCVAR_RELEASE, "Max bytes/sec requested by each load generator client (sent to the server as rate)." );
+static ConVar net_loadgen_connectrate( "net_loadgen_connectrate", "50", FCVAR_RELEASE, "Load generator clients that start connecting per second, so signon is not one burst." );
+
+//-----------------------------------------------------------------------------
+// CNetLoadGenClientState
+//-----------------------------------------------------------------------------
+CNetLoadGenClientState::CNetLoadGenClientState( int nIndex ) : m_nIndex( nIndex )
+{
+	Q_snprintf( m_szName, sizeof( m_szName ), "loadgen%03d", nIndex );
+
+	// the server only checks the hash length, but keep them unique per client
+	Q_snprintf( m_szCDKeyHash, sizeof( m_szCDKeyHash ), "4C4F414447454E00%08X%08X", nIndex, ( unsigned int )Plat_MSTime() );
+
+	m_flTickInterval = 0.0f;
+	m_nCommandNumber = 0;
+	m_flConnectStartTime = 0;
+
+	ResetStats();
+}
+
+CNetLoadGenClientState::~CNetLoadGenClientState()
+{
+}
+
+void CNetLoadGenClientState::ResetStats( void )
+{
+	m_flSignonTime = -1.0f;
+	m_nLastIncomingSequence = -1;
+	m_nPacketsReceived = 0;
+	m_nPacketsDropped = 0;
+	m_nSnapshots = 0;
+	m_nDeltaSnapshots = 0;
+	m_nEntityBytes = 0;
+	m_nUsercmdsSent = 0;
+	m_nBytesInBase = m_NetChannel ? m_NetChannel->GetTotalData( FLOW_INCOMING ) : 0;
+	m_nBytesOutBase = m_NetChannel ? m_NetChannel->GetTotalData( FLOW_OUTGOING ) : 0;
+	m_flSnapshotOffsetBase = 0;
+	m_SnapshotOffsets.RemoveAll();
+
+	if ( m_nSignonState == SIGNONSTATE_FULL )
+	{
+		// already in game, keep the signon time from being reported as pending
+		m_flSignonTime = 0.0f;
+	}
+}
+
+bool CNetLoadGenClientState::SetSignonState ( int state, int count, const CNETMsg_SignonState *msg )
+{
+	if ( !CBaseClientState::SetSignonState( state, count, msg ) )
+		return false;
+
+	switch ( m_nSignonState )
+	{
+		case SIGNONSTATE_CONNECTED	:	{
+											m_NetChannel->SetTimeout( SIGNON_TIME_OUT );
+											m_NetChannel->Clear();
+
+											// userinfo the server uses for rate limiting and snapshot rate
+											CNETMsg_SetConVar_t convars;
+											convars.AddToTail( "name", m_szName );
+											convars.AddToTail( "rate", net_loadgen_rate.GetString() );
+											convars.AddToTail( "cl_updaterate", net_loadgen_updaterate.GetString() );
+											convars.AddToTail( "cl_cmdrate", net_loadgen_cmdrate.GetString() );
+											m_NetChannel->SendNetMsg( convars );
+										}
+										break;
+
+		case SIGNONSTATE_NEW		:	SendClientInfo();
+										break;
+
+		case SIGNONSTATE_FULL		:	m_NetChannel->SetTimeout( 30.0f );
+										m_flSignonTime = net_time - m_flConnectStartTime;
+										break;
+
+		case SIGNONSTATE_CHANGELEVEL:	m_NetChannel->SetTimeout( SIGNON_TIME_OUT );
+										break;
+	}
+
+	if ( m_nSignonState >= SIGNONSTATE_CONNECTED )
+	{
+		// tell server that we entered now that state
+		CNETMsg_SignonState_t signonState( m_nSignonState, count );
+		m_NetChannel->SendNetMsg( signonState );
+	}
+
+	return true;
+}
+
+void CNetLoadGenClientState::SendClientInfo( void )
+{
+	CCLCMsg_ClientInfo_t info;
+
+	info.set_send_table_crc( SendTable_GetCRC() );
+	info.set_server_count( m_nServerCount );
+	info.set_is_hltv( false );
+#if defined( REPLAY_ENABLED )
+	info.set_is_replay( false );
+#endif
+	info.set_friends_id( 0 );
+
+	m_NetChannel->SendNetMsg( info );
+}
+
+//-----------------------------------------------------------------------------
+// Writes a single usercmd in the delta format of WriteUsercmd() in
+// game/shared/usercmd.cpp, deltaed against a zeroed command. Only the fields
+// shared by every game are written; the trailing zero bits read back as
+// "unchanged" for whatever fields the game appends after them.
+//-----------------------------------------------------------------------------
+void CNetLoadGenClientState::SendMove( void )
+{
+	byte data[64];
+	bf_write buf( data, sizeof( data ) );
+
+	++m_nCommandNumber;
+
+	// walk in a slow circle so player movement, not just netchan, is exercised
+	float flYaw = AngleNormalize( m_nIndex * 37.0f + m_nCommandNumber * 0.5f );
+
+	buf.WriteOneBit( 1 );	// command_number
+	buf.WriteUBitLong( m_nCommandNumber, 32 );
+	buf.WriteOneBit( 1 );	// tick_count
+	buf.WriteUBitLong( GetServerTickCount(), 32 );
+	buf.WriteOneBit( 0 );	// viewangles[0]
+	buf.WriteOneBit( 1 );	// viewangles[1]
+	buf.WriteFloat( flYaw );
+	buf.WriteOneBit( 0 );	// viewangles[2]
+	buf.WriteOneBit( 0 );	// aimdirection[0]
+	buf.WriteOneBit( 0 );	// aimdirection[1]
+	buf.WriteOneBit( 0 );	// aimdirection[2]
+	buf.WriteOneBit( 1 );	// forwardmove
+	buf.WriteFloat( 250.0f );
+	buf.WriteOneBit( 0 );	// sidemove
+	buf.WriteOneBit( 0 );	// upmove
+	buf.WriteUBitLong( 0, 32 );	// buttons, impulse, weaponselect, mousedx/dy and anything game specific
+
+	// a single new command and no backups, the padding would be misread as the next command otherwise
+	CCLCMsg_Move_t moveMsg;
+	moveMsg.set_num_backup_commands( 0 );
+	moveMsg.set_num_new_commands( 1 );
+	moveMsg.set_data( ( const char * )buf.GetData(), buf.GetNumBytesWritten() );
+	m_NetChannel->SendNetMsg( moveMsg );
+
+	++m_nUsercmdsSent;
+}
+
+void CNetLoadGenClientState::SendPacket( void )
+{
+	if ( !IsConnected() )
+		return;
+
+	if ( ( net_time < m_flNextCmdTime ) || !m_NetChannel->CanPacket() )
+		return;
+
+	if ( IsActive() )
+	{
+		// ack the last snapshot so the server deltas from it
+		CNETMsg_Tick_t tick( m_nDeltaTick, host_frameendtime_computationduration, host_frametime_stddeviation, host_framestarttime_stddeviation );
+		m_NetChannel->SendNetMsg( tick );
+
+		SendMove();
+	}
+
+	m_NetChannel->SendDatagram( NULL );
+
+	if ( IsActive() )
+	{
+		float commandInterval = 1.0f / MAX( net_loadgen_cmdrate.GetFloat(), 1.0f );
+		float maxDelta = m_flTickInterval > 0.0f ? MIN( m_flTickInterval, commandInterval ) : commandInterval;
+		float delta = clamp( net_time - m_flNextCmdTime, 0.0f, maxDelta );
+		m_flNextCmdTime = net_time + commandInterval - delta;
+	}
+	else
+	{
+		// during signon process send only 5 packets/second
+		m_flNextCmdTime = net_time + ( 1.0f / 5.0f );
+	}
+}
+
+void CNetLoadGenClientState::RunFrame( void )
+{
+	CBaseClientState::RunFrame();
+
+	if ( m_NetChannel && m_NetChannel->IsTimedOut() && IsConnected() )
+	{
+		ConMsg( "%s: connection timed out.\n", m_szName );
+		Disconnect();
+	}
+}
+
+void CNetLoadGenClientState::PacketStart( int incoming_sequence, int outgoing_acknowledged )
+{
+	if ( m_nLastIncomingSequence >= 0 && incoming_sequence > m_nLastIncomingSequence + 1 )
+	{
+		m_nPacketsDropped += incoming_sequence - m_nLastIncomingSequence - 1;
+	}
+
+	m_nLastIncomingSequence = incoming_sequence;
+	++m_nPacketsReceived;
+}
+
+bool CNetLoadGenClientState::NETMsg_StringCmd( const CNETMsg_StringCmd& msg )
+{
+	// never execute server stuffed commands in the load generator process
+	return true;
+}
+
+bool CNetLoadGenClientState::NETMsg_SetConVar( const CNETMsg_SetConVar& msg )
+{
+	// replicated convars would otherwise be applied to this process once per client
+	return true;
+}
+
+bool CNetLoadGenClientState::SVCMsg_ServerInfo( const CSVCMsg_ServerInfo& msg )
+{
+	// Reset client state
+	Clear();
+
+	if ( msg.max_clients() < 1 || msg.max_clients() > ABSOLUTE_PLAYER_LIMIT )
+	{
+		ConMsg( "%s: bad maxclients (%u) from server.\n", m_szName, msg.max_clients() );
+		Disconnect();
+		return false;
+	}
+
+	if ( msg.tick_interval() < MINIMUM_TICK_INTERVAL || msg.tick_interval() > MAXIMUM_TICK_INTERVAL )
+	{
+		ConMsg( "%s: interval_per_tick %f out of range.\n", m_szName, msg.tick_interval() );
+		Disconnect();
+		return false;
+	}
+
+	m_nServerCount = msg.server_count();
+	m_nMaxClients = msg.max_clients();
+	m_nServerClasses = msg.max_classes();
+	m_nServerClassBits = Q_log2( m_nServerClasses ) + 1;
+	m_nPlayerSlot = msg.player_slot();
+	m_nViewEntity = msg.player_slot() + 1;
+	m_flTickInterval = msg.tick_interval();
+	m_nDeltaTick = -1;
+
+	Q_strncpy( m_szLevelNameShort, msg.map_name().c_str(), sizeof( m_szLevelNameShort ) );
+
+	return true;
+}
+
+bool CNetLoadGenClientState::SVCMsg_ClassInfo( const CSVCMsg_ClassInfo& msg )
+{
+	// entity data is never decoded, so no class tables are needed
+	return true;
+}
+
+bool CNetLoadGenClientState::SVCMsg_CreateStringTable( const CSVCMsg_CreateStringTable& msg )
+{
+	return true;
+}
+
+bool CNetLoadGenClientState::SVCMsg_UpdateStringTable( const CSVCMsg_UpdateStringTable& msg )
+{
+	return true;
+}
+
+bool CNetLoadGenClientState::SVCMsg_GameEventList( const CSVCMsg_GameEventList &msg )
+{
+	// the event list is global, don't let every client reparse it
+	return true;
+}
+
+bool CNetLoadGenClientState::SVCMsg_PacketEntities( const CSVCMsg_PacketEntities &msg )
+{
+	++m_nSnapshots;
+	if ( msg.is_delta() )
+	{
+		++m_nDeltaSnapshots;
+	}
+	m_nEntityBytes += msg.entity_data().size();
+
+	// Both ends run on the same box, but the server's tick clock isn't sent, so
+	// latency is arrival time minus tick time, relative to the first snapshot.
+	// Report() normalizes against the fastest snapshot seen.
+	double flOffset = net_time - GetServerTickCount() * m_flTickInterval;
+	if ( m_SnapshotOffsets.Count() == 0 )
+	{
+		m_flSnapshotOffsetBase = flOffset;
+	}
+	m_SnapshotOffsets.AddToTail( ( float )( flOffset - m_flSnapshotOffsetBase ) );
+
+	if ( msg.update_baseline() )
+	{
+		// the server keeps resending the baseline until it is acked
+		CCLCMsg_BaselineAck_t baseline;
+		baseline.set_baseline_tick( GetServerTickCount() );
+		baseline.set_baseline_nr( msg.baseline() );
+		m_NetChannel->SendNetMsg( baseline, true );
+	}
+
+	// handles the final signon step and takes this tick as the new delta reference
+	return CBaseClientState::SVCMsg_PacketEntities( msg );
+}
+
+//-----------------------------------------------------------------------------
+// CNetLoadGenSystem
+//-----------------------------------------------------------------------------
+CNetLoadGenSystem::CNetLoadGenSystem( void )
+{
+	m_szAddress[0] = 0;
+	m_nConnected = 0;
+	m_flStartTime = 0;
+	m_flStatsTime = 0;
+}
+
+CNetLoadGenSystem::~CNetLoadGenSystem( void )
+{
+	StopTest();
+}
+
+bool CNetLoadGenSystem::StartTest( int nClients, const char *pszAddress )
+{
+	Assert( m_Clients.Count() == 0 );
+
+	Q_strncpy( m_szAddress, pszAddress, sizeof( m_szAddress ) );
+
+	while ( m_Clients.Count() < nClients )
+	{
+		CNetLoadGenClientState *pClient = new CNetLoadGenClientState( m_Clients.Count() );
+		pClient->m_Socket = NET_AddExtraSocket( PORT_ANY );
+		m_Clients.AddToTail( pClient );
+	}
+
+	m_nConnected = 0;
+	m_flStartTime = m_flStatsTime = Plat_FloatTime();
+
+	return true;
+}
+
+bool CNetLoadGenSystem::StopTest()
+{
+	FOR_EACH_VEC( m_Clients, i )
+	{
+		m_Clients[i]->Disconnect();
+	}
+
+	m_Clients.PurgeAndDeleteElements();
+	m_nConnected = 0;
+
+	NET_RemoveAllExtraSockets();
+
+	return true;
+}
+
+void CNetLoadGenSystem::RunFrame()
+{
+	VPROF_BUDGET( "CNetLoadGenSystem::RunFrame", VPROF_BUDGETGROUP_OTHER_NETWORKING );
+
+	double flNow = Plat_FloatTime();
+
+	// update network time etc
+	NET_RunFrame( flNow );
+
+	// stagger connects so the server sees a steady stream of challenges
+	int nWanted = 1 + ( int )( ( flNow - m_flStartTime ) * MAX( net_loadgen_connectrate.GetFloat(), 1.0f ) );
+	while ( m_nConnected < MIN( nWanted, m_Clients.Count() ) )
+	{
+		CNetLoadGenClientState *pClient = m_Clients[m_nConnected++];
+		pClient->m_flConnectStartTime = net_time;
+		pClient->Connect( m_szAddress, m_szAddress, "LoadGen" );
+	}
+
+	FOR_EACH_VEC( m_Clients, i )
+	{
+		CNetLoadGenClientState *pClient = m_Clients[i];
+		if ( pClient->m_nSignonState <= SIGNONSTATE_NONE )
+			continue;
+
+		// process data from net socket
+		NET_ProcessSocket( pClient->m_Socket, pClient );
+
+		pClient->RunFrame();
+
+		pClient->SendPacket();
+	}
+}
+
+void CNetLoadGenSystem::ResetStats()
+{
+	FOR_EACH_VEC( m_Clients, i )
+	{
+		m_Clients[i]->ResetStats();
+	}
+
+	m_flStatsTime = Plat_FloatTime();
+}
+
+static int __cdecl SortLoadGenFloat( const float *a, const float *b )
+{
+	return ( *a < *b ) ? -1 : ( ( *a > *b ) ? 1 : 0 );
+}
+
+static float LoadGenPercentile( const CUtlVector< float > &sorted, float flPercent )
+{
+	if ( !sorted.Count() )
+		return 0.0f;
+
+	// nearest rank
+	int nRank = ( int )ceilf( flPercent * 0.01f * sorted.Count() );
+	return sorted[ clamp( nRank - 1, 0, sorted.Count() - 1 ) ];
+}
+
+void CNetLoadGenSystem::Report( const char *pszFile )
+{
+	double flElapsed = MAX( Plat_FloatTime() - m_flStatsTime, 0.001 );
+
+	FileHandle_t hFile = FILESYSTEM_INVALID_HANDLE;
+	if ( pszFile && pszFile[0] )
+	{
+		hFile = g_pFileSystem->Open( pszFile, "w", "DEFAULT_WRITE_PATH" );
+		if ( hFile == FILESYSTEM_INVALID_HANDLE )
+		{
+			Warning( "net_loadgen_report: couldn't open %s for writing.\n", pszFile );
+		}
+		else
+		{
+			g_pFileSystem->FPrintf( hFile, "client,signon_state,signon_sec,snapshots,delta_snapshots,latency_p50_ms,latency_p99_ms,latency_max_ms,packets_in,packets_dropped,avg_loss,avg_choke,rtt_ms,bytes_in,bytes_out,entity_bytes,usercmds\n" );
+		}
+	}
+
+	CUtlVector< float > allLatencies;
+	CUtlVector< float > clientLatencies;
+	int nFull = 0, nConnecting = 0;
+	int64 nBytesIn = 0, nBytesOut = 0, nEntityBytes = 0;
+	int nPacketsIn = 0, nPacketsDropped = 0, nSnapshots = 0, nUsercmds = 0;
+	float flSignonSum = 0.0f, flSignonMax = 0.0f, flChokeSum = 0.0f, flRTTSum = 0.0f;
+	int nSignonTimes = 0;
+
+	FOR_EACH_VEC( m_Clients, i )
+	{
+		CNetLoadGenClientState *pClient = m_Clients[i];
+		INetChannel *pChan = pClient->m_NetChannel;
+
+		if ( pClient->m_nSignonState == SIGNONSTATE_FULL )
+			++nFull;
+		else if ( pClient->m_nSignonState > SIGNONSTATE_NONE )
+			++nConnecting;
+
+		if ( pClient->m_flSignonTime > 0.0f )
+		{
+			flSignonSum += pClient->m_flSignonTime;
+			flSignonMax = MAX( flSignonMax, pClient->m_flSignonTime );
+			++nSignonTimes;
+		}
+
+		// latency relative to this client's fastest snapshot
+		clientLatencies.CopyArray( pClient->m_SnapshotOffsets.Base(), pClient->m_SnapshotOffsets.Count() );
+		clientLatencies.Sort( SortLoadGenFloat );
+		float flMinOffset = clientLatencies.Count() ? clientLatencies[0] : 0.0f;
+		FOR_EACH_VEC( clientLatencies, j )
+		{
+			clientLatencies[j] = ( clientLatencies[j] - flMinOffset ) * 1000.0f;
+		}
+		allLatencies.AddVectorToTail( clientLatencies );
+
+		int nClientBytesIn = pChan ? MAX( pChan->GetTotalData( FLOW_INCOMING ) - pClient->m_nBytesInBase, 0 ) : 0;
+		int nClientBytesOut = pChan ? MAX( pChan->GetTotalData( FLOW_OUTGOING ) - pClient->m_nBytesOutBase, 0 ) : 0;
+		float flLoss = pChan ? pChan->GetAvgLoss( FLOW_INCOMING ) : 0.0f;
+		float flChoke = pChan ? pChan->GetAvgChoke( FLOW_INCOMING ) : 0.0f;
+		float flRTT = pChan ? pChan->GetAvgLatency( FLOW_OUTGOING ) : 0.0f;
+
+		nBytesIn += nClientBytesIn;
+		nBytesOut += nClientBytesOut;
+		nEntityBytes += pClient->m_nEntityBytes;
+		nPacketsIn += pClient->m_nPacketsReceived;
+		nPacketsDropped += pClient->m_nPacketsDropped;
+		nSnapshots += pClient->m_nSnapshots;
+		nUsercmds += pClient->m_nUsercmdsSent;
+		flChokeSum += flChoke;
+		flRTTSum += flRTT;
+
+		if ( hFile != FILESYSTEM_INVALID_HANDLE )
+		{
+			g_pFileSystem->FPrintf( hFile, "%s,%d,%.3f,%d,%d,%.2f,%.2f,%.2f,%d,%d,%.4f,%.4f,%.2f,%d,%d,%lld,%d\n",
+				pClient->m_szName, pClient->m_nSignonState, pClient->m_flSignonTime,
+				pClient->m_nSnapshots, pClient->m_nDeltaSnapshots,
+				LoadGenPercentile( clientLatencies, 50 ), LoadGenPercentile( clientLatencies, 99 ), LoadGenPercentile( clientLatencies, 100 ),
+				pClient->m_nPacketsReceived, pClient->m_nPacketsDropped, flLoss, flChoke, flRTT * 1000.0f,
+				nClientBytesIn, nClientBytesOut, pClient->m_nEntityBytes, pClient->m_nUsercmdsSent );
+		}
+	}
+
+	if ( hFile != FILESYSTEM_INVALID_HANDLE )
+	{
+		g_pFileSystem->Close( hFile );
+		Msg( "net_loadgen_report: wrote per-client stats to %s\n", pszFile );
+	}
+
+	allLatencies.Sort( SortLoadGenFloat );
+
+	int nClients = MAX( m_Clients.Count(), 1 );
+	Msg( "Load generator: %d clients to %s, %d in game, %d connecting, %.1f sec sampled\n", m_Clients.Count(), m_szAddress, nFull, nConnecting, flElapsed );
+	Msg( "  signon:    avg %.2f sec, max %.2f sec (%d clients)\n", nSignonTimes ? flSignonSum / nSignonTimes : 0.0f, flSignonMax, nSignonTimes );
+	Msg( "  snapshots: %d (%.1f/sec per client), %.1f kB entity data\n", nSnapshots, nSnapshots / flElapsed / nClients, nEntityBytes / 1024.0f );
+	Msg( "  latency:   p50 %.2f ms, p95 %.2f ms, p99 %.2f ms, max %.2f ms (above each client's fastest snapshot)\n",
+		LoadGenPercentile( allLatencies, 50 ), LoadGenPercentile( allLatencies, 95 ), LoadGenPercentile( allLatencies, 99 ), LoadGenPercentile( allLatencies, 100 ) );
+	Msg( "  loss:      %d of %d packets dropped (%.2f%%), avg choke %.2f%%, avg rtt %.2f ms\n",
+		nPacketsDropped, nPacketsIn + nPacketsDropped, ( nPacketsIn + nPacketsDropped ) ? 100.0f * nPacketsDropped / ( nPacketsIn + nPacketsDropped ) : 0.0f,
+		100.0f * flChokeSum / nClients, 1000.0f * flRTTSum / nClients );
+	Msg( "  bytes:     in %.1f kB/sec (%.2f kB/sec per client), out %.1f kB/sec, %d usercmds\n",
+		nBytesIn / 1024.0f / flElapsed, nBytesIn / 1024.0f / flElapsed / nClients, nBytesOut / 1024.0f / flElapsed, nUsercmds );
+}
+
+CON_COMMAND( net_loadgen_start, "Connects simulated clients over real UDP netchannels to a server.\n  net_loadgen_start <number> <ip:port>" )
+{
+	if ( args.ArgC() < 3 )
+	{
+		Msg( "Usage: net_loadgen_start <number> <ip:port>\n" );
+		return;
+	}
+
+	int nClients = Q_atoi( args[1] );
+
+	char address[MAX_PATH];
+	
+	if ( args.ArgC() == 3 )
+	{
+		Q_strncpy( address, args[2], MAX_PATH );
+	}
+	else
+	{
+		Q_snprintf( address, MAX_PATH, "%s:%s", args[2], args[4] );
+	}
+
+	// loopback would short circuit the sockets we want to measure
+	if ( StringHasPrefixCaseSensitive( address, "localhost" ) )
+	{
+		Msg( "Load generator can't connect to localhost, use 127.0.0.1 instead.\n" );
+		return;
+	}
+
+	if ( nClients <= 0 )
+	{
+		Msg( "net_loadgen_start: need at least one client.\n" );
+		return;
+	}
+
+	if ( !netloadgen )
+	{
+		netloadgen = new CNetLoadGenSystem();
+	}
+	else
+	{
+		// stop old test
+		netloadgen->StopTest();
+	}
+
+	// start networking
+	NET_SetMultiplayer( true );	
+
+	netloadgen->StartTest( nClients, address );
+}
+
+CON_COMMAND( net_loadgen_stop, "Disconnects all load generator clients." )
+{
+	if ( netloadgen )
+	{
+		netloadgen->StopTest();
+	}
+}
+
+CON_COMMAND( net_loadgen_reset, "Clears the load generator stats, e.g. once every client finished signon." )
+{
+	if ( netloadgen )
+	{
+		netloadgen->ResetStats();
+	}
+	else
+	{
+		Msg( "No load generator running.\n" );
+	}
+}
+
+CON_COMMAND( net_loadgen_report, "Prints snapshot latency, loss and bytes for the load generator clients.\n  net_loadgen_report [csv file for per-client stats]" )
+{
+	if ( netloadgen )
+	{
+		netloadgen->Report( args.ArgC() >= 2 ? args[1] : NULL );
+	}
+	else
+	{
+		Msg( "No load generator running.\n" );
+	}
+}
@@ -0,0 +1,117 @@
+//========= Copyright  1996-2005, Valve Corporation, All rights reserved. ============//
+//
+// Purpose: 
+//
+// $NoKeywords: $
+//
+//=============================================================================//
+// net_loadgen.h: headless netchan load generator
+//
+//////////////////////////////////////////////////////////////////////
+
+#ifndef NET_LOADGEN_H
+#define NET_LOADGEN_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "baseclientstate.h"
+#include "utlvector.h"
+
+//-----------------------------------------------------------------------------
+// A simulated player that speaks the real connect/netchan protocol from its own
+// UDP socket. It completes signon, acks every snapshot without decoding it and
+// sends usercmds at the requested cmdrate, recording what the server sent back.
+//-----------------------------------------------------------------------------
+class CNetLoadGenClientState : public CBaseClientState
+{
+public:
+	CNetLoadGenClientState( int nIndex );
+	virtual ~CNetLoadGenClientState();
+
+public:
+	const char *GetCDKeyHash() { return m_szCDKeyHash; }
+	virtual const char *GetClientName() { return m_szName; }
+
+	bool SetSignonState ( int state, int count, const CNETMsg_SignonState *msg ) OVERRIDE;
+	void SendClientInfo( void );
+	void SendPacket( void );
+	void RunFrame( void );
+	void ResetStats( void );
+
+	virtual void PacketStart( int incoming_sequence, int outgoing_acknowledged );
+	virtual void ReadPacketEntities( CEntityReadInfo &u ) {}
+
+public: // IServerMessageHandlers
+
+	virtual bool NETMsg_StringCmd( const CNETMsg_StringCmd& msg ) OVERRIDE;
+	virtual bool NETMsg_SetConVar( const CNETMsg_SetConVar& msg ) OVERRIDE;
+	virtual bool SVCMsg_ServerInfo( const CSVCMsg_ServerInfo& msg ) OVERRIDE;
+	virtual bool SVCMsg_ClassInfo( const CSVCMsg_ClassInfo& msg ) OVERRIDE;
+	virtual bool SVCMsg_CreateStringTable( const CSVCMsg_CreateStringTable& msg ) OVERRIDE;
+	virtual bool SVCMsg_UpdateStringTable( const CSVCMsg_UpdateStringTable& msg ) OVERRIDE;
+	virtual bool SVCMsg_GameEventList( const CSVCMsg_GameEventList &msg ) OVERRIDE;
+	virtual bool SVCMsg_PacketEntities( const CSVCMsg_PacketEntities &msg ) OVERRIDE;
+
+	virtual bool SVCMsg_VoiceInit( const CSVCMsg_VoiceInit& msg ) OVERRIDE { return true; }
+	virtual bool SVCMsg_VoiceData( const CSVCMsg_VoiceData& msg ) OVERRIDE { return true; }
+	virtual bool SVCMsg_FixAngle( const CSVCMsg_FixAngle& msg ) OVERRIDE { return true; }
+	virtual bool SVCMsg_Prefetch( const CSVCMsg_Prefetch& msg ) OVERRIDE { return true; }
+	virtual bool SVCMsg_CrosshairAngle( const CSVCMsg_CrosshairAngle& msg ) OVERRIDE { return true; }
+	virtual bool SVCMsg_BSPDecal( const CSVCMsg_BSPDecal& msg ) OVERRIDE { return true; }
+	virtual bool SVCMsg_UserMessage( const CSVCMsg_UserMessage& msg ) OVERRIDE { return true; }
+	virtual bool SVCMsg_PaintmapData( const CSVCMsg_PaintmapData& msg ) OVERRIDE { return true; }
+	virtual bool SVCMsg_GameEvent( const CSVCMsg_GameEvent& msg ) OVERRIDE { return true; }
+	virtual bool SVCMsg_TempEntities( const CSVCMsg_TempEntities& msg ) OVERRIDE { return true; }
+	virtual bool SVCMsg_Sounds( const CSVCMsg_Sounds& msg ) OVERRIDE { return true; }
+	virtual bool SVCMsg_EntityMsg( const CSVCMsg_EntityMsg& msg ) OVERRIDE { return true; }
+
+protected:
+	void SendMove( void );
+
+public:
+	int				m_nIndex;
+	char			m_szName[MAX_PLAYER_NAME_LENGTH];
+	char			m_szCDKeyHash[33];
+	float			m_flTickInterval;
+	int				m_nCommandNumber;
+
+	// stats since the last reset
+	double			m_flConnectStartTime;
+	float			m_flSignonTime;			// seconds from connect to SIGNONSTATE_FULL, -1 until then
+	int				m_nLastIncomingSequence;
+	int				m_nPacketsReceived;
+	int				m_nPacketsDropped;
+	int				m_nSnapshots;
+	int				m_nDeltaSnapshots;
+	int64			m_nEntityBytes;
+	int				m_nUsercmdsSent;
+	int				m_nBytesInBase;			// netchan totals at the last reset
+	int				m_nBytesOutBase;
+	double			m_flSnapshotOffsetBase;	// arrival time minus tick time of the first snapshot
+	CUtlVector< float > m_SnapshotOffsets;	// arrival minus tick time, relative to m_flSnapshotOffsetBase
+};
+
+class CNetLoadGenSystem
+{
+public:
+	CNetLoadGenSystem( void );
+	~CNetLoadGenSystem( void );
+
+	void RunFrame();
+	bool StartTest( int nClients, const char *pszAddress );
+	bool StopTest();
+	void ResetStats();
+	void Report( const char *pszFile );
+
+protected:
+	CUtlVector< CNetLoadGenClientState * >	m_Clients;
+	char		m_szAddress[MAX_PATH];
+	int			m_nConnected;		// clients that have started connecting so far
+	double		m_flStartTime;
+	double		m_flStatsTime;
+};
+
+extern CNetLoadGenSystem *netloadgen;	// NULL unless net_loadgen_start was used
+
+#endif // NET_LOADGEN_H
@@ -32,6 +32,11 @@
 #include <cell/sysmodule.h>
 #endif
 
+#if defined( LINUX )
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#endif
+
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -231,6 +236,20 @@ static CUtlVectorMT< CUtlVector< pendingsocket_t > >	s_PendingSockets;
 CTSQueue<loopback_t *> s_LoopBacks[LOOPBACK_SOCKETS];
 static netpacket_t*	s_pLagData[MAX_SOCKETS];  // List of lag structures, if fakelag is set.
 
+// Packets received between ticks by the dedicated tick scheduler, handed out by NET_GetPacket
+// before the socket is read again
+struct stagedpackets_t
+{
+	netpacket_t	*pHead;
+	netpacket_t	*pTail;
+	int			nCount;
+};
+static CUtlVector<stagedpackets_t>	s_StagedPackets;
+static CThreadFastMutex				s_StagedPacketsMutex;
+static int							s_nSocketGeneration = 0;	// bumped whenever a socket is opened or closed
+
+static ConVar net_tick_staging_max( "net_tick_staging_max", "512", FCVAR_RELEASE, "Max packets per socket the dedicated tick scheduler receives ahead of the next tick." );
+
 unsigned short NET_HostToNetShort( unsigned short us_in )
 {
 	return htons( us_in );
@@ -329,6 +348,52 @@ void NET_ClearLagData( int sock )
 	}
 }
 
+static void NET_ClearStagedPackets( int sock )
+{
+	if ( !s_StagedPackets.IsValidIndex( sock ) )
+		return;
+
+	AUTO_LOCK_FM( s_StagedPacketsMutex );
+	stagedpackets_t &staged = s_StagedPackets[sock];
+	NET_ClearLaggedList( &staged.pHead );
+	staged.pTail = NULL;
+	staged.nCount = 0;
+}
+
+static bool NET_GetStagedPacket( int sock, netpacket_t *packet )
+{
+	if ( !s_StagedPackets.IsValidIndex( sock ) || !s_StagedPackets[sock].nCount )
+		return false;
+
+	AUTO_LOCK_FM( s_StagedPacketsMutex );
+	stagedpackets_t &staged = s_StagedPackets[sock];
+	netpacket_t *p = staged.pHead;
+	if ( !p )
+		return false;
+
+	staged.pHead = p->pNext;
+	if ( !staged.pHead )
+	{
+		staged.pTail = NULL;
+	}
+	--staged.nCount;
+
+	// copy & adjust content, same as a packet coming off the lag list
+	packet->source	= p->source;
+	packet->from	= p->from;
+	packet->pNext	= NULL;
+	packet->received = net_time;
+	packet->size	= p->size;
+	packet->wiresize = p->wiresize;
+	packet->stream	= p->stream;
+
+	Q_memcpy( packet->data, p->data, p->size );
+
+	delete[] p->data;
+	delete p;
+	return true;
+}
+
 /*
 =============
 NET_StringToAdr
@@ -401,6 +466,8 @@ void NET_CloseSocket( int hSocket, int sock = -1)
 	if ( !hSocket )
 		return;
 
+	++s_nSocketGeneration;
+
 	// close socket handle
 	if ( !OnlyUseSteamSockets() )
 	{
@@ -1719,8 +1786,8 @@ netpacket_t *NET_GetPacket (int sock, byte *scratch )
 			return NULL;
 		}
 
-		// then check UDP data 
-		if ( !NET_ReceiveDatagram( sock, &inpacket ) )
+		// then anything the tick scheduler received since the last tick, then UDP data
+		if ( !NET_GetStagedPacket( sock, &inpacket ) && !NET_ReceiveDatagram( sock, &inpacket ) )
 		{
 			// at last check if the lag system has a packet for us
 			if ( !NET_LagPacket (false, &inpacket) )
@@ -2724,6 +2791,7 @@ void NET_CloseAllSockets (void)
 		{
 			NET_CloseSocket( net_sockets[i].hUDP );
 			NET_CloseSocket( net_sockets[i].hTCP );
+			NET_ClearStagedPackets( i );
 
 			net_sockets[i].nPort = 0;
 			net_sockets[i].bListening = false;
@@ -2906,6 +2974,7 @@ static void OpenSocketInternal( int nModule, int nSetPort, int nDefaultPort, con
 		}
 
 		net_sockets[nModule].nPort = port;
+		++s_nSocketGeneration;
 	}
 	else
 	{
@@ -2976,6 +3045,7 @@ int NET_AddExtraSocket( int port )
 
 	net_packets.EnsureCount( newSocket+1 );
 	net_splitpackets.EnsureCount( newSocket+1 );
+	s_StagedPackets.EnsureCount( newSocket+1 );
 
 	return newSocket;
 }
@@ -2989,6 +3059,7 @@ void NET_RemoveAllExtraSockets()
 			NET_CloseSocket( net_sockets[i].hUDP );
 			NET_CloseSocket( net_sockets[i].hTCP );
 		}
+		NET_ClearStagedPackets( i );
 	}
 	net_sockets.RemoveMultiple( MAX_SOCKETS, net_sockets.Count()-MAX_SOCKETS );
 
@@ -3906,6 +3977,7 @@ void NET_Init( bool bIsDedicated )
 	net_sockets.EnsureCount( MAX_SOCKETS );
 	net_packets.EnsureCount( MAX_SOCKETS );
 	net_splitpackets.EnsureCount( MAX_SOCKETS );
+	s_StagedPackets.EnsureCount( MAX_SOCKETS );
 
 	for ( int i = 0; i < MAX_SOCKETS; ++i )
 	{
@@ -3956,6 +4028,10 @@ NET_Shutdown
 
 ====================
 */
+#if defined( LINUX )
+static void NET_CloseTickEpoll();
+#endif
+
 void NET_Shutdown (void)
 {
 	int nError = 0;
@@ -3965,6 +4041,11 @@ void NET_Shutdown (void)
 		NET_ClearLaggedList( &s_pLagData[i] );
 	}
 
+	for ( int i = 0; i < s_StagedPackets.Count(); i++ )
+	{
+		NET_ClearStagedPackets( i );
+	}
+
 	g_pQueuedPackedSender->Shutdown();
 
 	net_multiplayer = false;
@@ -3973,6 +4054,10 @@ void NET_Shutdown (void)
 	NET_CloseAllSockets();
 	NET_ConfigLoopbackBuffers( false );
 
+#if defined( LINUX )
+	NET_CloseTickEpoll();
+#endif
+
 #if defined(_WIN32)
 	if ( !net_noip )
 	{
@@ -4181,8 +4266,238 @@ bool NET_BufferToBufferDecompress( char *dest, unsigned int *destLen, char *sour
 	return true;
 }
 
+//-----------------------------------------------------------------------------
+// Receives everything waiting on a socket into its staged list so the next tick
+// only has to copy packets out. Returns false once the list is full.
+//-----------------------------------------------------------------------------
+static bool NET_StagePackets( int sock )
+{
+	if ( !s_StagedPackets.IsValidIndex( sock ) || !net_packets.IsValidIndex( sock ) )
+		return false;
+
+	stagedpackets_t &staged = s_StagedPackets[sock];
+	int nMaxStaged = net_tick_staging_max.GetInt();
+
+	net_scratchbuffer_t scratch;
+	netpacket_t packet;
+
+	while ( staged.nCount < nMaxStaged )
+	{
+		packet.from.Clear();
+		packet.received = net_time;
+		packet.source = sock;
+		packet.data = scratch.GetBuffer();
+		packet.size = 0;
+		packet.wiresize = 0;
+		packet.stream = false;
+		packet.pNext = NULL;
+
+		if ( !NET_ReceiveDatagram( sock, &packet ) )
+			return true;
+
+		netpacket_t *pStaged = new netpacket_t;
+		(*pStaged) = packet;
+		pStaged->data = new unsigned char[ packet.size ];
+		Q_memcpy( pStaged->data, packet.data, packet.size );
+		pStaged->pNext = NULL;
+
+		AUTO_LOCK_FM( s_StagedPacketsMutex );
+		if ( staged.pTail )
+		{
+			staged.pTail->pNext = pStaged;
+		}
+		else
+		{
+			staged.pHead = pStaged;
+		}
+		staged.pTail = pStaged;
+		++staged.nCount;
+	}
+
+	return false;
+}
+
+#if defined( LINUX )
+
+#define TICK_TIMER_EVENT	0xFFFFFFFF
+
+static int s_hTickEpoll = -1;
+static int s_hTickTimer = -1;
+static int s_nTickEpollGeneration = -1;
+
+static void NET_CloseTickEpoll()
+{
+	if ( s_hTickEpoll >= 0 )
+	{
+		close( s_hTickEpoll );
+		s_hTickEpoll = -1;
+	}
+
+	if ( s_hTickTimer >= 0 )
+	{
+		close( s_hTickTimer );
+		s_hTickTimer = -1;
+	}
+
+	s_nTickEpollGeneration = -1;
+}
+
+//-----------------------------------------------------------------------------
+// The epoll set watches the tick timer plus the UDP handle of every open socket
+// (game, HLTV and extra sockets). It is rebuilt whenever a socket opened or closed,
+// since a closed descriptor silently drops out of the set.
+//-----------------------------------------------------------------------------
+static bool NET_UpdateTickEpoll()
+{
+	if ( s_hTickTimer < 0 )
+	{
+		s_hTickTimer = timerfd_create( CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC );
+		if ( s_hTickTimer < 0 )
+		{
+			Warning( "NET_UpdateTickEpoll: timerfd_create failed (%s)\n", strerror( errno ) );
+			return false;
+		}
+	}
+
+	if ( s_hTickEpoll >= 0 && s_nTickEpollGeneration == s_nSocketGeneration )
+		return true;
+
+	if ( s_hTickEpoll >= 0 )
+	{
+		close( s_hTickEpoll );
+	}
+
+	s_hTickEpoll = epoll_create1( EPOLL_CLOEXEC );
+	if ( s_hTickEpoll < 0 )
+	{
+		Warning( "NET_UpdateTickEpoll: epoll_create1 failed (%s)\n", strerror( errno ) );
+		return false;
+	}
+
+	struct epoll_event ev;
+	Q_memset( &ev, 0, sizeof( ev ) );
+	ev.events = EPOLLIN;
+	ev.data.u32 = TICK_TIMER_EVENT;
+	epoll_ctl( s_hTickEpoll, EPOLL_CTL_ADD, s_hTickTimer, &ev );
+
+	if ( !OnlyUseSteamSockets() )
+	{
+		for ( int i = 0; i < net_sockets.Count(); i++ )
+		{
+			if ( !net_sockets[i].hUDP )
+				continue;
+
+			// Edge triggered: a socket we don't drain (or whose staged list is full) must not keep waking us
+			ev.events = EPOLLIN | EPOLLET;
+			ev.data.u32 = i;
+			if ( epoll_ctl( s_hTickEpoll, EPOLL_CTL_ADD, net_sockets[i].hUDP, &ev ) != 0 )
+			{
+				DevMsg( "NET_UpdateTickEpoll: couldn't watch socket %d (%s)\n", i, strerror( errno ) );
+			}
+		}
+	}
+
+	s_nTickEpollGeneration = s_nSocketGeneration;
+	return true;
+}
+
+#endif // LINUX
+
+//-----------------------------------------------------------------------------
+// Sleeps until flDeadline (Plat_FloatTime) on a CLOCK_MONOTONIC timerfd, waking on
+// packet arrival in the meantime to receive and stage the packets for the next tick.
+//-----------------------------------------------------------------------------
+void NET_WaitForTickDeadline( double flDeadline, bool bStagePackets )
+{
+	double flRemaining = flDeadline - Plat_FloatTime();
+	if ( flRemaining <= 0.0 )
+		return;
+
+#if defined( LINUX )
+	if ( NET_UpdateTickEpoll() )
+	{
+		// Plat_FloatTime is wall clock based, so arm the timer the same distance from now on the monotonic clock
+		struct timespec now;
+		clock_gettime( CLOCK_MONOTONIC, &now );
+		int64 nDeadlineNS = (int64)now.tv_sec * 1000000000LL + now.tv_nsec + (int64)( flRemaining * 1000000000.0 );
+
+		struct itimerspec its;
+		Q_memset( &its, 0, sizeof( its ) );
+		its.it_value.tv_sec = nDeadlineNS / 1000000000LL;
+		its.it_value.tv_nsec = nDeadlineNS % 1000000000LL;
+		if ( timerfd_settime( s_hTickTimer, TFD_TIMER_ABSTIME, &its, NULL ) == 0 )
+		{
+			struct epoll_event events[ 16 ];
+			for ( ;; )
+			{
+				int nEvents = epoll_wait( s_hTickEpoll, events, ARRAYSIZE( events ), -1 );
+				if ( nEvents < 0 )
+				{
+					if ( errno == EINTR )
+						continue;
+					break;
+				}
+
+				bool bDeadline = false;
+				for ( int i = 0; i < nEvents; i++ )
+				{
+					if ( events[i].data.u32 == TICK_TIMER_EVENT )
+					{
+						uint64 nExpirations;
+						read( s_hTickTimer, &nExpirations, sizeof( nExpirations ) );
+						bDeadline = true;
+					}
+					else if ( bStagePackets )
+					{
+						NET_StagePackets( events[i].data.u32 );
+					}
+				}
+
+				if ( bDeadline )
+					return;
+			}
+		}
+	}
+#endif
+
+	// No timerfd/epoll: select on the server socket and stage whatever arrives until the deadline
+	while ( ( flRemaining = flDeadline - Plat_FloatTime() ) > 0.0 )
+	{
+		int nSocket = net_sockets.IsValidIndex( NS_SERVER ) ? net_sockets[NS_SERVER].hUDP : 0;
+		if ( !nSocket || OnlyUseSteamSockets() )
+		{
+			ThreadNanoSleep( (unsigned)( flRemaining * 1000000000.0 ) );
+			return;
+		}
+
+		fd_set fdset;
+		FD_ZERO( &fdset );
+		FD_SET( (unsigned int)nSocket, &fdset );
+		struct timeval tv;
+		tv.tv_sec = 0;
+		tv.tv_usec = (long)( flRemaining * 1000000.0 );
+		if ( select( nSocket + 1, &fdset, NULL, NULL, &tv ) > 0 && bStagePackets )
+		{
+			if ( !NET_StagePackets( NS_SERVER ) )
+			{
+				bStagePackets = false;
+			}
+		}
+	}
+}
+
 void NET_SleepUntilMessages( int nMilliseconds )
 {
+#if defined( LINUX )
+	// Wake on any socket, not just NS_SERVER; the tick timer stays disarmed here
+	if ( NET_UpdateTickEpoll() )
+	{
+		struct epoll_event events[ 16 ];
+		epoll_wait( s_hTickEpoll, events, ARRAYSIZE( events ), nMilliseconds );
+		return;
+	}
+#endif
+
 	fd_set fdset;
 	FD_ZERO(&fdset);
 
@@ -32,6 +32,9 @@
 #include "bitvec.h"
 #include "host.h"
 #include "tier1/mempool.h"
+#include "tier0/cache_hints.h"
+#include "vstdlib/random.h"
+#include "vstdlib/jobthread.h"
 
 #ifdef _PS3
 #include "tls_ps3.h"
@@ -52,7 +55,6 @@ class CIntersectSweptBox;
 
 #define SPHASH_HANDLELIST_BLOCK		256
 #define SPHASH_LEAFLIST_BLOCK		512
-#define SPHASH_ENTITYLIST_BLOCK		256
 #define SPHASH_BUCKET_COUNT			512
 
 #define SPHASH_EPS					0.03125f
@@ -94,6 +96,7 @@ enum EntityInfoFlags_t
 	ENTITY_HIDDEN	=	( 1 << 0 ),
 	IN_CLIENT_TREE	=	( 1 << 1 ),
 	IN_SERVER_TREE	=	( 1 << 2 ),
+	WRITE_PENDING	=	( 1 << 3 ),	// Has writes queued behind a read phase (see CSpatialPartition::DeferWrite)
 };
 
 
@@ -115,7 +118,7 @@ struct EntityInfo_t
 struct LeafListData_t
 {
 	UtlHashFixedHandle_t		m_hVoxel;	// Voxel handle the entity is in.
-	intp					m_iEntity;	// Entity list index for voxel
+	intp					m_iEntity;	// Slot of the entity in the voxel's bucket
 };
 
 typedef CUtlFixedLinkedList<LeafListData_t>	CLeafList;
@@ -155,12 +158,134 @@ inline Voxel_t ConvertToNextLevel( Voxel_t v )
 	return res;
 }
 
-class CSpatialEntry
+//-----------------------------------------------------------------------------
+// Bounds of four voxel elements, one lane per element
+//-----------------------------------------------------------------------------
+struct VoxelBounds4_t
+{
+	fltx4 m_f4MinX, m_f4MinY, m_f4MinZ;
+	fltx4 m_f4MaxX, m_f4MaxY, m_f4MaxZ;
+};
+
+//-----------------------------------------------------------------------------
+// The elements of a single voxel. Bounds are stored SoA so box and point
+// queries test four elements per compare; unused lanes of the last block
+// hold inverted bounds that never pass an intersection test.
+//-----------------------------------------------------------------------------
+class CVoxelBucket
 {
 public:
-	SpatialPartitionHandle_t m_handle;
-	uint16 m_nListMask;
+	int Count() const	{ return m_Handles.Count(); }
+
+	int AddElement( SpatialPartitionHandle_t hPartition, uint16 nListMask, const Vector &vecMin, const Vector &vecMax );
+
+	// Swap-removes a slot; returns the leaf of the element moved into it (or CLeafList::InvalidIndex())
+	intp RemoveElement( int iSlot );
+
+	void SetBounds( int iSlot, const Vector &vecMin, const Vector &vecMax );
+	void RemoveAll();
+
+	CUtlVector< VoxelBounds4_t, CUtlMemoryAligned< VoxelBounds4_t, 16 > >	m_Bounds;
+	CUtlVector< SpatialPartitionHandle_t >	m_Handles;
+	CUtlVector< uint16 >					m_ListMasks;
+	CUtlVector< intp >						m_LeafIndex;	// Leaf list entry (m_aLeafList) that points back at each slot
+};
+
+inline void CVoxelBucket::SetBounds( int iSlot, const Vector &vecMin, const Vector &vecMax )
+{
+	VoxelBounds4_t &bounds = m_Bounds[ iSlot >> 2 ];
+	int nLane = iSlot & 3;
+	SubFloat( bounds.m_f4MinX, nLane ) = vecMin.x;
+	SubFloat( bounds.m_f4MinY, nLane ) = vecMin.y;
+	SubFloat( bounds.m_f4MinZ, nLane ) = vecMin.z;
+	SubFloat( bounds.m_f4MaxX, nLane ) = vecMax.x;
+	SubFloat( bounds.m_f4MaxY, nLane ) = vecMax.y;
+	SubFloat( bounds.m_f4MaxZ, nLane ) = vecMax.z;
+}
+
+inline int CVoxelBucket::AddElement( SpatialPartitionHandle_t hPartition, uint16 nListMask, const Vector &vecMin, const Vector &vecMax )
+{
+	int iSlot = m_Handles.AddToTail( hPartition );
+	m_ListMasks.AddToTail( nListMask );
+	m_LeafIndex.AddToTail( CLeafList::InvalidIndex() );
+
+	if ( ( iSlot & 3 ) == 0 )
+	{
+		VoxelBounds4_t &bounds = m_Bounds[ m_Bounds.AddToTail() ];
+		bounds.m_f4MinX = bounds.m_f4MinY = bounds.m_f4MinZ = Four_FLT_MAX;
+		bounds.m_f4MaxX = bounds.m_f4MaxY = bounds.m_f4MaxZ = Four_Negative_FLT_MAX;
+	}
+
+	SetBounds( iSlot, vecMin, vecMax );
+	return iSlot;
+}
+
+inline intp CVoxelBucket::RemoveElement( int iSlot )
+{
+	int iLast = m_Handles.Count() - 1;
+	Assert( iSlot >= 0 && iSlot <= iLast );
+
+	intp iMovedLeaf = CLeafList::InvalidIndex();
+	const VoxelBounds4_t &last = m_Bounds[ iLast >> 2 ];
+	int nLastLane = iLast & 3;
+	if ( iSlot != iLast )
+	{
+		Vector vecMin( SubFloat( last.m_f4MinX, nLastLane ), SubFloat( last.m_f4MinY, nLastLane ), SubFloat( last.m_f4MinZ, nLastLane ) );
+		Vector vecMax( SubFloat( last.m_f4MaxX, nLastLane ), SubFloat( last.m_f4MaxY, nLastLane ), SubFloat( last.m_f4MaxZ, nLastLane ) );
+		SetBounds( iSlot, vecMin, vecMax );
+		m_Handles[iSlot] = m_Handles[iLast];
+		m_ListMasks[iSlot] = m_ListMasks[iLast];
+		m_LeafIndex[iSlot] = m_LeafIndex[iLast];
+		iMovedLeaf = m_LeafIndex[iSlot];
+	}
+
+	if ( nLastLane == 0 )
+	{
+		m_Bounds.Remove( m_Bounds.Count() - 1 );
+	}
+	else
+	{
+		SetBounds( iLast, Vector( FLT_MAX, FLT_MAX, FLT_MAX ), Vector( -FLT_MAX, -FLT_MAX, -FLT_MAX ) );
+	}
+
+	m_Handles.Remove( iLast );
+	m_ListMasks.Remove( iLast );
+	m_LeafIndex.Remove( iLast );
+	return iMovedLeaf;
+}
+
+inline void CVoxelBucket::RemoveAll()
+{
+	m_Bounds.RemoveAll();
+	m_Handles.RemoveAll();
+	m_ListMasks.RemoveAll();
+	m_LeafIndex.RemoveAll();
+}
+
+
+//-----------------------------------------------------------------------------
+// Enumeration output: either a caller's enumerator or a flat list of elements
+//-----------------------------------------------------------------------------
+struct PartitionElementList_t
+{
+	IHandleEntity **m_pList;
+	int m_nCount;
+	int m_nMaxCount;
 };
+
+inline bool EmitPartitionElement( IPartitionEnumerator *pIterator, IHandleEntity *pHandleEntity )
+{
+	return ( pIterator->EnumElement( pHandleEntity ) != ITERATION_STOP );
+}
+
+inline bool EmitPartitionElement( PartitionElementList_t &list, IHandleEntity *pHandleEntity )
+{
+	list.m_pList[list.m_nCount++] = pHandleEntity;
+	return ( list.m_nCount < list.m_nMaxCount );
+}
+
+class CIntersectBoxSIMD;
+
 //-----------------------------------------------------------------------------
 // A single voxel hash
 //-----------------------------------------------------------------------------
@@ -176,15 +301,16 @@ public:
 	void Shutdown();
 
 	// Gets all entities in a particular volume...
-	// returns false if the enumerator broke early
-	bool EnumerateElementsInBox( SpatialPartitionListMask_t listMask, Voxel_t vmin, Voxel_t vmax, const Vector& mins, const Vector& maxs, IPartitionEnumerator* pIterator );
+	// returns false if the output broke early
+	template <class OUTPUT> bool EnumerateElementsInBox( SpatialPartitionListMask_t listMask, Voxel_t vmin, Voxel_t vmax, const Vector& mins, const Vector& maxs, bool bSIMD, OUTPUT &output );
 	bool EnumerateElementsAlongRay( SpatialPartitionListMask_t listMask, const Ray_t& ray, const Vector &vecInvDelta, const Vector &vecEnd, IPartitionEnumerator* pIterator );
-	bool EnumerateElementsAtPoint( SpatialPartitionListMask_t listMask, Voxel_t v, const Vector& pt, IPartitionEnumerator* pIterator );
+	template <class OUTPUT> bool EnumerateElementsAtPoint( SpatialPartitionListMask_t listMask, Voxel_t v, const Vector& pt, bool bSIMD, OUTPUT &output );
 	
 	// Inserts/Removes a handle from the tree.
 	void InsertIntoTree( SpatialPartitionHandle_t hPartition, Voxel_t voxelMin, Voxel_t voxelMax );
 	void RemoveFromTree( SpatialPartitionHandle_t hPartition );
 	void UpdateListMask( SpatialPartitionHandle_t hPartition );
+	void UpdateBounds( SpatialPartitionHandle_t hPartition );
 
 	// Debug!
 	void RenderAllObjectsInTree( float flTime );
@@ -219,10 +345,13 @@ public:
 	void LeafListExtrudedRaySetup( const Ray_t &ray, const Vector &vecInvDelta, const Vector &vecMin, const Vector &vecMax, int iVoxelMin[3], int iVoxelMax[3], int *pStep, float *pMin, float *pMax, float *pDelta );
 
 	// Main enumeration method
-	template <class T> bool EnumerateElementsInVoxel( Voxel_t voxel, const T &intersectTest, SpatialPartitionListMask_t listMask, IPartitionEnumerator* pIterator );
+	template <class T, class OUTPUT> bool EnumerateElementsInVoxel( Voxel_t voxel, const T &intersectTest, SpatialPartitionListMask_t listMask, OUTPUT &output );
 
 	// Enumeration method when only 1 voxel is ever visited
-	template <class T> bool EnumerateElementsInSingleVoxel( Voxel_t voxel, const T &intersectTest, SpatialPartitionListMask_t listMask, IPartitionEnumerator* pIterator );
+	template <class T, class OUTPUT> bool EnumerateElementsInSingleVoxel( Voxel_t voxel, const T &intersectTest, SpatialPartitionListMask_t listMask, OUTPUT &output );
+
+	// Box/point enumeration testing four elements at a time
+	template <bool bVisit, class OUTPUT> bool EnumerateElementsInVoxelSIMD( Voxel_t voxel, const CIntersectBoxSIMD &intersectTest, SpatialPartitionListMask_t listMask, OUTPUT &output );
 
 	bool EnumerateElementsAlongRay_ExtrudedRaySlice( SpatialPartitionListMask_t listMask, IPartitionEnumerator *pIterator, const CIntersectSweptBox &intersectSweptBox,	int voxelMin[3], int voxelMax[3], int iAxis, int *pStep );
 private:
@@ -231,12 +360,17 @@ private:
 
 	inline void PackVoxel( int iX, int iY, int iZ, Voxel_t &voxel );
 
+	inline CVoxelBucket *Bucket( UtlHashFixedHandle_t hHash )	{ return (CVoxelBucket*)m_aVoxelHash.Element( hHash ); }
+	CVoxelBucket *AllocBucket();
+	void FreeBucket( CVoxelBucket *pBucket );
+	void PurgeBuckets();
+
     typedef CUtlHashFixed<intp, SPHASH_BUCKET_COUNT, CUtlHashFixedGenericHash<SPHASH_BUCKET_COUNT> > CHashTable;
 
 	Vector											m_vecVoxelOrigin;	// Voxel space (hash) origin.
-	CHashTable										m_aVoxelHash;		// Voxel tree (hash) - data = entity list head handle (m_aEntityList)
+	CHashTable										m_aVoxelHash;		// Voxel tree (hash) - data = CVoxelBucket of the voxel's entities
 	int												m_nVoxelDelta[3];	// Voxel world - width(Dx), height(Dy), depth(Dz)
-	CUtlFixedLinkedList<CSpatialEntry>				m_aEntityList;	// Pool - Linked list(multilist) of entities per leaf.
+	CUtlVector<CVoxelBucket*>						m_FreeBuckets;		// Buckets of emptied voxels, kept with their capacity for reuse.
 	CVoxelTree										*m_pTree;
 	int												m_nLevel;
 	float											m_flVoxelSize;
@@ -296,6 +430,15 @@ public:
 	void LockForRead()		{ m_lock.LockForRead(); }
 	void UnlockRead()		{ m_lock.UnlockRead(); }
 
+	// Read phases (see ISpatialPartition::BeginReadPhase)
+	void BeginReadPhase( bool bLockFree );
+	bool EndReadPhase();
+	bool InReadPhase() const	{ return ( m_nReadPhase != 0 ); }
+
+	// Queries lock through here; inside a lock-free read phase they skip m_lock
+	void LockForQuery();
+	void UnlockQuery();
+
 	// Ray casting
 	bool EnumerateElementsAlongRay_Ray( SpatialPartitionListMask_t listMask, const Ray_t &ray, const Vector &vecInvDelta, const Vector &vecEnd, IPartitionEnumerator *pIterator );
 	bool EnumerateElementsAlongRay_ExtrudedRay( SpatialPartitionListMask_t listMask, 
@@ -306,6 +449,10 @@ public:
 	// Purpose:
 	void ComputeSweptRayBounds( const Ray_t &ray, const Vector &vecStartMin, const Vector &vecStartMax, Vector *pVecMin, Vector *pVecMax );
 
+	// Box/point queries into any enumeration output, optionally using the scalar element test
+	template <class OUTPUT> void EnumerateBoxElements( SpatialPartitionListMask_t listMask, const Vector& vecMins, const Vector& vecMaxs, bool bSIMD, OUTPUT &output );
+	template <class OUTPUT> void EnumeratePointElements( SpatialPartitionListMask_t listMask, const Vector& pt, bool bSIMD, OUTPUT &output );
+
 private:
 
 	int									m_nLevelCount;
@@ -318,6 +465,15 @@ private:
 	unsigned short						m_nNextVisitBit;
 	CTSPool<CPartitionVisits>			m_FreeVisits;
 	CThreadSpinRWLock					m_lock;
+
+	struct ReaderSlot_t
+	{
+		int32 volatile					m_nLockFreeDepth;
+		byte							m_Pad[CACHE_LINE_SIZE - sizeof( int32 )];
+	};
+	int									m_nReadPhaseDepth;							// Begin/EndReadPhase nesting (writing thread only)
+	int32 volatile						m_nReadPhase;								// Set while queries may skip m_lock
+	ReaderSlot_t						m_ReaderSlots[MAX_THREADS_SUPPORTED];		// Per-thread lock-free query depth, a cache line apiece
 };
 
 //-----------------------------------------------------------------------------
@@ -376,11 +532,21 @@ public:
 	virtual void EnumerateElementsAlongRay( SpatialPartitionListMask_t listMask, const Ray_t& ray, bool coarseTest, IPartitionEnumerator* pIterator );
 	virtual void EnumerateElementsAtPoint( SpatialPartitionListMask_t listMask, const Vector& pt, bool coarseTest, IPartitionEnumerator* pIterator );
 
+	virtual int GetElementsInBox( SpatialPartitionListMask_t listMask, const Vector& mins, const Vector& maxs, IHandleEntity **pList, int nMaxCount );
+	virtual int GetElementsAtPoint( SpatialPartitionListMask_t listMask, const Vector& pt, IHandleEntity **pList, int nMaxCount );
+
 	virtual void RenderAllObjectsInTree( float flTime );
 	virtual void RenderObjectsInPlayerLeafs( const Vector &vecPlayerMin, const Vector &vecPlayerMax, float flTime );
 	virtual void ReportStats( const char *pFileName );
 	virtual void DrawDebugOverlays();
 
+	virtual void BeginReadPhase( SpatialPartitionListMask_t listMask );
+	virtual void EndReadPhase( SpatialPartitionListMask_t listMask );
+	void BeginReadPhase( SpatialPartitionListMask_t listMask, bool bLockFree );
+
+	// Times box/point queries through the scalar and SIMD element tests
+	void RunQueryBenchmark( SpatialPartitionListMask_t listMask, int nQueries, float flRadius );
+
 	// Gets entity info (for enumerations).
 	EntityInfo_t &EntityInfo( SpatialPartitionHandle_t hPartition );
 
@@ -395,11 +561,35 @@ protected:
 	// Invokes the pre-query callbacks.
 	void InvokeQueryCallbacks( SpatialPartitionListMask_t listMask, bool = false );
 
+	enum DeferredWriteType_t
+	{
+		DEFERRED_WRITE_LISTS,
+		DEFERRED_WRITE_MOVE,
+		DEFERRED_WRITE_INSERT,
+		DEFERRED_WRITE_REMOVE,
+		DEFERRED_WRITE_DESTROY,
+	};
+
+	struct DeferredWrite_t
+	{
+		SpatialPartitionHandle_t	m_hPartition;
+		uint8						m_nType;
+		uint16						m_nRemoveMask;
+		uint16						m_nInsertMask;
+		Vector						m_vecMins;
+		Vector						m_vecMaxs;
+	};
+
+	// Queues writes that would touch a tree in a read phase; published when the phase ends
+	bool DeferWrite( SpatialPartitionHandle_t hPartition, DeferredWriteType_t nType, uint16 nRemoveMask = 0, uint16 nInsertMask = 0, const Vector &vecMins = vec3_origin, const Vector &vecMaxs = vec3_origin );
+	void PublishDeferredWrites();
+
 	typedef CUtlLinkedList<EntityInfo_t, SpatialPartitionHandle_t, false, SpatialPartitionHandle_t, CUtlMemoryStack<UtlLinkedListElem_t< EntityInfo_t, SpatialPartitionHandle_t >, SpatialPartitionHandle_t, 0xffff, 1024> > CHandleList;
 
 private:
 	CHandleList												m_aHandles;  								// Stores all unique elements (1 per entity in tree).
 	CThreadFastMutex										m_HandlesMutex;
+	CUtlVector<DeferredWrite_t>								m_DeferredWrites;							// Writes held back by read phases (m_HandlesMutex).
 
 	CVoxelTree												m_VoxelTrees[NUM_TREES];
 
@@ -464,6 +654,49 @@ inline void CVoxelTree::EndVisit( CPartitionVisits *pPrev )
 	m_pVisits[nThread] = pPrev;
 }
 
+//-----------------------------------------------------------------------------
+// Queries inside a lock-free read phase only mark their thread's slot. Nothing
+// writes to the tree during the phase, and EndReadPhase waits for the marked
+// slots to clear before any deferred write is applied.
+//-----------------------------------------------------------------------------
+inline void CVoxelTree::LockForQuery()
+{
+	ReaderSlot_t &slot = m_ReaderSlots[g_nThreadID];
+	if ( slot.m_nLockFreeDepth )
+	{
+		++slot.m_nLockFreeDepth;
+		return;
+	}
+
+	if ( m_nReadPhase )
+	{
+		// Publish the slot before re-checking, so EndReadPhase either sees us or we see it
+		ThreadInterlockedExchange( &slot.m_nLockFreeDepth, 1 );
+		if ( m_nReadPhase )
+			return;
+		ThreadInterlockedExchange( &slot.m_nLockFreeDepth, 0 );
+	}
+	m_lock.LockForRead();
+}
+
+inline void CVoxelTree::UnlockQuery()
+{
+	ReaderSlot_t &slot = m_ReaderSlots[g_nThreadID];
+	if ( slot.m_nLockFreeDepth )
+	{
+		if ( slot.m_nLockFreeDepth == 1 )
+		{
+			ThreadInterlockedExchange( &slot.m_nLockFreeDepth, 0 );
+		}
+		else
+		{
+			--slot.m_nLockFreeDepth;
+		}
+		return;
+	}
+	m_lock.UnlockRead();
+}
+
 inline CVoxelTree *CSpatialPartition::VoxelTree( SpatialPartitionListMask_t listMask )
 {
 	int iTree = ( ( listMask & PARTITION_ALL_CLIENT_EDICTS ) == 0 ) ? SERVER_TREE : CLIENT_TREE;
@@ -674,16 +907,8 @@ void CVoxelHash::Init( CVoxelTree *pPartition, const Vector &worldmin, const Vec
 	Assert( ( m_nVoxelDelta[1] >= 0 ) && ( m_nVoxelDelta[1] <= ( 1 << 10 ) ) );
 	Assert( ( m_nVoxelDelta[2] >= 0 ) && ( m_nVoxelDelta[2] <= ( 1 << 9 ) ) );
 
+	PurgeBuckets();
 	m_aVoxelHash.RemoveAll();
-
-	// Setup the entity list pool.
-	int nGrowSize = SPHASH_ENTITYLIST_BLOCK >> nLevel;
-	if ( nGrowSize < 16 )
-	{
-		nGrowSize = 16;
-	}
-	m_aEntityList.Purge();
-	m_aEntityList.SetGrowSize( nGrowSize );
 }
 
 
@@ -692,11 +917,47 @@ void CVoxelHash::Init( CVoxelTree *pPartition, const Vector &worldmin, const Vec
 //-----------------------------------------------------------------------------
 void CVoxelHash::Shutdown( void )
 {
-	m_aEntityList.Purge();
+	PurgeBuckets();
 	m_aVoxelHash.Purge();
 }
 
 
+//-----------------------------------------------------------------------------
+// Voxel bucket pool
+//-----------------------------------------------------------------------------
+CVoxelBucket *CVoxelHash::AllocBucket()
+{
+	if ( m_FreeBuckets.Count() )
+	{
+		CVoxelBucket *pBucket = m_FreeBuckets.Tail();
+		m_FreeBuckets.Remove( m_FreeBuckets.Count() - 1 );
+		return pBucket;
+	}
+	return new CVoxelBucket;
+}
+
+void CVoxelHash::FreeBucket( CVoxelBucket *pBucket )
+{
+	Assert( pBucket->Count() == 0 );
+	pBucket->RemoveAll();
+	m_FreeBuckets.AddToTail( pBucket );
+}
+
+void CVoxelHash::PurgeBuckets()
+{
+	for ( int iBucket = 0; iBucket < SPHASH_BUCKET_COUNT; ++iBucket )
+	{
+		UtlPtrLinkedListIndex_t hHash = m_aVoxelHash.m_aBuckets[iBucket].Head();
+		while ( hHash != m_aVoxelHash.m_aBuckets[iBucket].InvalidIndex() )
+		{
+			delete (CVoxelBucket*)m_aVoxelHash.m_aBuckets[iBucket][hHash].m_Data;
+			hHash = m_aVoxelHash.m_aBuckets[iBucket].Next( hHash );
+		}
+	}
+	m_FreeBuckets.PurgeAndDeleteElements();
+}
+
+
 //-----------------------------------------------------------------------------
 // Purpose: Insert the object into the voxel hash.
 //-----------------------------------------------------------------------------
@@ -734,28 +995,22 @@ void CVoxelHash::InsertIntoTree( SpatialPartitionHandle_t hPartition, Voxel_t vo
 				RenderVoxel( voxel );
 #endif
 
-				// Entity list.
-				intp iEntity = m_aEntityList.Alloc( true );
-				m_aEntityList[iEntity].m_handle = hPartition;
-				m_aEntityList[iEntity].m_nListMask = nListMask;
-				
 				UtlHashFixedHandle_t hHash = m_aVoxelHash.Find( voxel.uiVoxel );
 				if ( hHash == m_aVoxelHash.InvalidHandle() )
 				{
 					// Add voxel(leaf) to hash.
-					hHash = m_aVoxelHash.FastInsert( voxel.uiVoxel, iEntity );
-				}
-				else
-				{
-					intp iHead = m_aVoxelHash.Element( hHash );
-					m_aEntityList.LinkBefore( iHead, iEntity );
-					m_aVoxelHash[hHash] = iEntity;
+					hHash = m_aVoxelHash.FastInsert( voxel.uiVoxel, (intp)AllocBucket() );
 				}
+
+				// Voxel bucket.
+				CVoxelBucket *pBucket = Bucket( hHash );
+				int iEntity = pBucket->AddElement( hPartition, nListMask, info.m_vecMin, info.m_vecMax );
 				
 				// Leaf list.
 				intp iLeafList = leafList.Alloc( true );
 				leafList[iLeafList].m_hVoxel = hHash;
 				leafList[iLeafList].m_iEntity = iEntity;
+				pBucket->m_LeafIndex[iEntity] = iLeafList;
 				
 				if ( info.m_iLeafList[treeId] == leafList.InvalidIndex() )
 				{
@@ -796,25 +1051,21 @@ void CVoxelHash::RemoveFromTree( SpatialPartitionHandle_t hPartition )
 			continue;
 		}
 
-		// Get the head of the entity list for the voxel.
+		// Remove the entity from the voxel's bucket, fixing up the leaf of the element that fills its slot.
+		CVoxelBucket *pBucket = Bucket( hHash );
 		intp iEntity = leafList[iLeaf].m_iEntity;
-		intp iEntityHead = m_aVoxelHash[hHash];
+		Assert( pBucket->m_Handles[iEntity] == hPartition );
+		intp iMovedLeaf = pBucket->RemoveElement( iEntity );
+		if ( iMovedLeaf != leafList.InvalidIndex() )
+		{
+			leafList[iMovedLeaf].m_iEntity = iEntity;
+		}
 
-		if ( iEntityHead == iEntity )
+		if ( pBucket->Count() == 0 )
 		{
-			intp iEntityNext = m_aEntityList.Next( iEntityHead );
-			if ( iEntityNext == m_aEntityList.InvalidIndex() )
-			{
-				m_aVoxelHash.Remove( hHash );
-			}
-			else
-			{
-				m_aVoxelHash[hHash] = iEntityNext;
-			}
+			m_aVoxelHash.Remove( hHash );
+			FreeBucket( pBucket );
 		}
-		
-		// Remove the entity from the entity list for the voxel.
-		m_aEntityList.Remove( iEntity );
 
 		// Remove from the leaf list.
 		leafList.Remove( iLeaf );		
@@ -827,59 +1078,29 @@ void CVoxelHash::RemoveFromTree( SpatialPartitionHandle_t hPartition )
 void CVoxelHash::UpdateListMask( SpatialPartitionHandle_t hPartition )
 {
 	EntityInfo_t &data = m_pTree->EntityInfo( hPartition );
+	CLeafList &leafList = m_pTree->LeafList();
 	uint16 nListMask = data.m_fList;
 
-	Voxel_t vmin = data.m_voxelMin;
-	Voxel_t vmax = data.m_voxelMax;
-	
-	// single voxel
-	if ( vmin.uiVoxel == vmax.uiVoxel )
+	// The leaf list knows the entity's slot in every voxel it touches
+	for ( intp iLeaf = data.m_iLeafList[m_pTree->GetTreeId()]; iLeaf != leafList.InvalidIndex(); iLeaf = leafList.Next( iLeaf ) )
 	{
-		UtlHashFixedHandle_t hHash = m_aVoxelHash.Find( vmin.uiVoxel );
-		if ( hHash != m_aVoxelHash.InvalidHandle() )
-		{
-			for ( intp i = m_aVoxelHash.Element( hHash ); i != m_aEntityList.InvalidIndex(); i = m_aEntityList.Next(i) )
-			{
-				SpatialPartitionHandle_t handle = m_aEntityList[i].m_handle;
-				if ( handle != hPartition )
-					continue;
-
-				m_aEntityList[i].m_nListMask = nListMask;
-				break;
-			}
-		}
+		CVoxelBucket *pBucket = Bucket( leafList[iLeaf].m_hVoxel );
+		Assert( pBucket->m_Handles[leafList[iLeaf].m_iEntity] == hPartition );
+		pBucket->m_ListMasks[leafList[iLeaf].m_iEntity] = nListMask;
 	}
+}
 
-	// spans voxels
-	Voxel_t vdelta;
-	vdelta.uiVoxel = vmax.uiVoxel - vmin.uiVoxel;
-	int cx = vdelta.bitsVoxel.x;
-	int cy = vdelta.bitsVoxel.y;
-	int cz = vdelta.bitsVoxel.z;
-	Voxel_t voxel;
-	voxel.bitsVoxel.x = vmin.bitsVoxel.x;
-	for ( int iX = 0; iX <= cx; ++iX, ++voxel.bitsVoxel.x )
-	{
-		voxel.bitsVoxel.y = vmin.bitsVoxel.y;
-		for ( int iY = 0; iY <= cy; ++iY, ++voxel.bitsVoxel.y )
-		{
-			voxel.bitsVoxel.z = vmin.bitsVoxel.z;
-			for ( int iZ = 0; iZ <= cz; ++iZ, ++voxel.bitsVoxel.z )
-			{
-				UtlHashFixedHandle_t hHash = m_aVoxelHash.Find( voxel.uiVoxel );
-				if ( hHash != m_aVoxelHash.InvalidHandle() )
-				{
-					for ( intp i = m_aVoxelHash.Element( hHash ); i != m_aEntityList.InvalidIndex(); i = m_aEntityList.Next(i) )
-					{
-						if ( m_aEntityList[i].m_handle != hPartition )
-							continue;
+//-----------------------------------------------------------------------------
+// Purpose: Copies the entity's (re-set) bounds into the voxel buckets it is in.
+//-----------------------------------------------------------------------------
+void CVoxelHash::UpdateBounds( SpatialPartitionHandle_t hPartition )
+{
+	EntityInfo_t &data = m_pTree->EntityInfo( hPartition );
+	CLeafList &leafList = m_pTree->LeafList();
 
-						m_aEntityList[i].m_nListMask = nListMask;
-						break;
-					}
-				}
-			}
-		}
+	for ( intp iLeaf = data.m_iLeafList[m_pTree->GetTreeId()]; iLeaf != leafList.InvalidIndex(); iLeaf = leafList.Next( iLeaf ) )
+	{
+		Bucket( leafList[iLeaf].m_hVoxel )->SetBounds( leafList[iLeaf].m_iEntity, data.m_vecMin, data.m_vecMax );
 	}
 }
 
@@ -1038,6 +1259,37 @@ private:
 	const Vector &m_vecMaxs;
 };
 
+
+//-----------------------------------------------------------------------------
+// Box test against a block of four voxel elements; a point is a zero-size box
+//-----------------------------------------------------------------------------
+class CIntersectBoxSIMD : public CPartitionVisitor
+{
+public:
+	CIntersectBoxSIMD( CVoxelTree *pPartition, const Vector &vecMins, const Vector &vecMaxs ) : CPartitionVisitor( pPartition )
+	{
+		m_f4MinX = ReplicateX4( vecMins.x );
+		m_f4MinY = ReplicateX4( vecMins.y );
+		m_f4MinZ = ReplicateX4( vecMins.z );
+		m_f4MaxX = ReplicateX4( vecMaxs.x );
+		m_f4MaxY = ReplicateX4( vecMaxs.y );
+		m_f4MaxZ = ReplicateX4( vecMaxs.z );
+	}
+
+	// Returns a bit per lane whose bounds overlap the box
+	int Intersects4( const VoxelBounds4_t &bounds ) const
+	{
+		bi32x4 b4X = AndSIMD( CmpLeSIMD( bounds.m_f4MinX, m_f4MaxX ), CmpGeSIMD( bounds.m_f4MaxX, m_f4MinX ) );
+		bi32x4 b4Y = AndSIMD( CmpLeSIMD( bounds.m_f4MinY, m_f4MaxY ), CmpGeSIMD( bounds.m_f4MaxY, m_f4MinY ) );
+		bi32x4 b4Z = AndSIMD( CmpLeSIMD( bounds.m_f4MinZ, m_f4MaxZ ), CmpGeSIMD( bounds.m_f4MaxZ, m_f4MinZ ) );
+		return TestSignSIMD( AndSIMD( AndSIMD( b4X, b4Y ), b4Z ) );
+	}
+
+private:
+	fltx4 m_f4MinX, m_f4MinY, m_f4MinZ;
+	fltx4 m_f4MaxX, m_f4MaxY, m_f4MaxZ;
+};
+
 class CIntersectRay : public CPartitionVisitor
 {
 public:
@@ -1102,18 +1354,20 @@ private:
 //-----------------------------------------------------------------------------
 // Purpose:
 //-----------------------------------------------------------------------------
-template <class T> 
-bool CVoxelHash::EnumerateElementsInVoxel( Voxel_t voxel, const T &intersectTest, SpatialPartitionListMask_t listMask, IPartitionEnumerator* pIterator )
+template <class T, class OUTPUT> 
+bool CVoxelHash::EnumerateElementsInVoxel( Voxel_t voxel, const T &intersectTest, SpatialPartitionListMask_t listMask, OUTPUT &output )
 {
 	// If the voxel doesn't exist, nothing to iterate over
 	UtlHashFixedHandle_t hHash = m_aVoxelHash.Find( voxel.uiVoxel );
 	if ( hHash == m_aVoxelHash.InvalidHandle() )
 		return true;
 
-	for ( intp i = m_aVoxelHash.Element( hHash ); i != m_aEntityList.InvalidIndex(); i = m_aEntityList.Next(i) )
+	const CVoxelBucket &bucket = *Bucket( hHash );
+	int nCount = bucket.Count();
+	for ( int i = 0; i < nCount; ++i )
 	{
-		SpatialPartitionHandle_t handle = m_aEntityList[i].m_handle;
-		SpatialPartitionListMask_t nListMask = m_aEntityList[i].m_nListMask;
+		SpatialPartitionHandle_t handle = bucket.m_Handles[i];
+		SpatialPartitionListMask_t nListMask = bucket.m_ListMasks[i];
 		if ( handle == PARTITION_INVALID_HANDLE )
 			continue;
 
@@ -1136,7 +1390,7 @@ bool CVoxelHash::EnumerateElementsInVoxel( Voxel_t voxel, const T &intersectTest
 			continue;
 
 		// Okay, this one is good...
-		if ( pIterator->EnumElement( hInfo.m_pHandleEntity ) == ITERATION_STOP )
+		if ( !EmitPartitionElement( output, hInfo.m_pHandleEntity ) )
 			return false;
 	}
 
@@ -1147,22 +1401,21 @@ bool CVoxelHash::EnumerateElementsInVoxel( Voxel_t voxel, const T &intersectTest
 //-----------------------------------------------------------------------------
 // Enumeration method when only 1 voxel is ever visited
 //-----------------------------------------------------------------------------
-template <class T> 
+template <class T, class OUTPUT> 
 bool CVoxelHash::EnumerateElementsInSingleVoxel( Voxel_t voxel, const T &intersectTest, 
-	SpatialPartitionListMask_t listMask, IPartitionEnumerator* pIterator )
+	SpatialPartitionListMask_t listMask, OUTPUT &output )
 {
 	// NOTE: We don't have to do the enum id checking, nor do we have to up the
 	// nesting level, since this only visits 1 voxel.
-	intp iEntityList;
 	UtlHashFixedHandle_t hHash = m_aVoxelHash.Find( voxel.uiVoxel );
 	if ( hHash != m_aVoxelHash.InvalidHandle() )
 	{
-		iEntityList = m_aVoxelHash.Element( hHash );
-		while ( iEntityList != m_aEntityList.InvalidIndex() )
+		const CVoxelBucket &bucket = *Bucket( hHash );
+		int nCount = bucket.Count();
+		for ( int i = 0; i < nCount; ++i )
 		{
-			SpatialPartitionHandle_t handle = m_aEntityList[iEntityList].m_handle;
-			SpatialPartitionListMask_t nListMask = m_aEntityList[iEntityList].m_nListMask;
-			iEntityList = m_aEntityList.Next( iEntityList );
+			SpatialPartitionHandle_t handle = bucket.m_Handles[i];
+			SpatialPartitionListMask_t nListMask = bucket.m_ListMasks[i];
 			if ( handle == PARTITION_INVALID_HANDLE )
 				continue;
 
@@ -1179,19 +1432,74 @@ bool CVoxelHash::EnumerateElementsInSingleVoxel( Voxel_t voxel, const T &interse
 				continue;
 
 			// Okay, this one is good...
-			if ( pIterator->EnumElement( hInfo.m_pHandleEntity ) == ITERATION_STOP )
+			if ( !EmitPartitionElement( output, hInfo.m_pHandleEntity ) )
 				return false;
 		}
 	}
 	return true;
 }
 
+
+//-----------------------------------------------------------------------------
+// Box/point enumeration over a voxel's SoA bounds. The bounds test runs first,
+// four elements at a time, so list mask, hidden and visit checks only touch
+// the elements that actually overlap.
+//-----------------------------------------------------------------------------
+template <bool bVisit, class OUTPUT> 
+bool CVoxelHash::EnumerateElementsInVoxelSIMD( Voxel_t voxel, const CIntersectBoxSIMD &intersectTest, 
+	SpatialPartitionListMask_t listMask, OUTPUT &output )
+{
+	UtlHashFixedHandle_t hHash = m_aVoxelHash.Find( voxel.uiVoxel );
+	if ( hHash == m_aVoxelHash.InvalidHandle() )
+		return true;
+
+	const CVoxelBucket &bucket = *Bucket( hHash );
+	int nBlockCount = bucket.m_Bounds.Count();
+	for ( int iBlock = 0; iBlock < nBlockCount; ++iBlock )
+	{
+		int nHitMask = intersectTest.Intersects4( bucket.m_Bounds[iBlock] );
+		if ( !nHitMask )
+			continue;
+
+		for ( int nLane = 0; nLane < 4; ++nLane )
+		{
+			if ( !( nHitMask & ( 1 << nLane ) ) )
+				continue;
+
+			// Padding lanes have inverted bounds and never get here
+			int i = ( iBlock << 2 ) + nLane;
+			Assert( i < bucket.Count() );
+
+			// Keep going if this dude isn't in the list
+			if ( !( listMask & bucket.m_ListMasks[i] ) )
+				continue;
+
+			SpatialPartitionHandle_t handle = bucket.m_Handles[i];
+			EntityInfo_t &hInfo = m_pTree->EntityInfo( handle );
+			Assert( hInfo.m_fList == bucket.m_ListMasks[i] );
+
+			if ( hInfo.m_flags & ENTITY_HIDDEN )
+				continue;
+
+			// Has this handle already been visited?
+			if ( bVisit && !intersectTest.Visit( handle, hInfo ) )
+				continue;
+
+			// Okay, this one is good...
+			if ( !EmitPartitionElement( output, hInfo.m_pHandleEntity ) )
+				return false;
+		}
+	}
+
+	return true;
+}
 	
 //-----------------------------------------------------------------------------
 // Purpose:
 //-----------------------------------------------------------------------------
+template <class OUTPUT>
 bool CVoxelHash::EnumerateElementsInBox( SpatialPartitionListMask_t listMask, 
-	Voxel_t vmin, Voxel_t vmax, const Vector& mins, const Vector& maxs, IPartitionEnumerator* pIterator )
+	Voxel_t vmin, Voxel_t vmax, const Vector& mins, const Vector& maxs, bool bSIMD, OUTPUT &output )
 {
 	VPROF( "BoxTest/SphereTest" );
 
@@ -1202,10 +1510,15 @@ bool CVoxelHash::EnumerateElementsInBox( SpatialPartitionListMask_t listMask,
 	// Create the intersection object
 	bool bSingleVoxel = ( vmin.uiVoxel == vmax.uiVoxel );
 	CIntersectBox rect( m_pTree, mins, maxs );
+	CIntersectBoxSIMD rect4( m_pTree, mins, maxs );
 
 	// In the same voxel
 	if ( bSingleVoxel )
-		return EnumerateElementsInSingleVoxel( vmin, rect, listMask, pIterator );
+	{
+		if ( bSIMD )
+			return EnumerateElementsInVoxelSIMD<false>( vmin, rect4, listMask, output );
+		return EnumerateElementsInSingleVoxel( vmin, rect, listMask, output );
+	}
 
 	// Iterate over all voxels
 	Voxel_t vdelta;
@@ -1233,7 +1546,9 @@ bool CVoxelHash::EnumerateElementsInBox( SpatialPartitionListMask_t listMask,
 			voxel.bitsVoxel.z = vmin.bitsVoxel.z;
 			for ( int iZ = 0; iZ <= cz; ++iZ, ++voxel.bitsVoxel.z )
 			{
-				if ( !EnumerateElementsInVoxel( voxel, rect, listMask, pIterator ) )
+				bool bContinue = bSIMD ? EnumerateElementsInVoxelSIMD<true>( voxel, rect4, listMask, output ) :
+					EnumerateElementsInVoxel( voxel, rect, listMask, output );
+				if ( !bContinue )
 					return false;
 			}
 		}
@@ -1599,42 +1914,20 @@ bool CVoxelHash::EnumerateElementsAlongRay_ExtrudedRaySlice( SpatialPartitionLis
 //-----------------------------------------------------------------------------
 // Purpose:
 //-----------------------------------------------------------------------------
+template <class OUTPUT>
 bool CVoxelHash::EnumerateElementsAtPoint( SpatialPartitionListMask_t listMask,
-	Voxel_t v, const Vector& pt, IPartitionEnumerator* pIterator )
+	Voxel_t v, const Vector& pt, bool bSIMD, OUTPUT &output )
 {
 	// NOTE: We don't have to do the enum id checking, nor do we have to up the
 	// nesting level, since this only visits 1 voxel.
-	intp iEntityList;
-	UtlHashFixedHandle_t hHash = m_aVoxelHash.Find( v.uiVoxel );
-	if ( hHash != m_aVoxelHash.InvalidHandle() )
+	if ( bSIMD )
 	{
-		iEntityList = m_aVoxelHash.Element( hHash );
-		while ( iEntityList != m_aEntityList.InvalidIndex() )
-		{
-			SpatialPartitionHandle_t handle = m_aEntityList[iEntityList].m_handle;
-			SpatialPartitionListMask_t nListMask = m_aEntityList[iEntityList].m_nListMask;
-			iEntityList = m_aEntityList.Next( iEntityList );
-			if ( handle == PARTITION_INVALID_HANDLE )
-				continue;
-
-			// Keep going if this dude isn't in the list
-			if ( !( listMask & nListMask ) )
-				continue;
-
-			EntityInfo_t &hInfo = m_pTree->EntityInfo( handle );
-			if ( hInfo.m_flags & ENTITY_HIDDEN )
-				continue;
-
-			// Keep going if there's no collision
-			if ( !IsPointInBox( pt, hInfo.m_vecMin, hInfo.m_vecMax ) )
-				continue;
-
-			// Okay, this one is good...
-			if ( pIterator->EnumElement( hInfo.m_pHandleEntity ) == ITERATION_STOP )
-				return false;
-		}
+		CIntersectBoxSIMD point4( m_pTree, pt, pt );
+		return EnumerateElementsInVoxelSIMD<false>( v, point4, listMask, output );
 	}
-	return true;
+
+	CIntersectPoint point( m_pTree, pt );
+	return EnumerateElementsInSingleVoxel( v, point, listMask, output );
 }
 
 
@@ -1743,12 +2036,10 @@ void CVoxelHash::RenderObjectsInVoxel( Voxel_t voxel, CPartitionVisitor *pVisito
 	if ( hHash == m_aVoxelHash.InvalidHandle() )
 		return;
 
-	intp iEntityList = m_aVoxelHash.Element( hHash );
-	while ( iEntityList != m_aEntityList.InvalidIndex() )
+	const CVoxelBucket &bucket = *Bucket( hHash );
+	for ( int i = 0; i < bucket.Count(); ++i )
 	{
-		SpatialPartitionHandle_t hPartition = m_aEntityList[iEntityList].m_handle;
-		RenderObjectInVoxel( hPartition, pVisitor, flTime );					
-		iEntityList = m_aEntityList.Next( iEntityList );
+		RenderObjectInVoxel( bucket.m_Handles[i], pVisitor, flTime );
 	}
 
 	if ( bRenderVoxel )
@@ -1774,12 +2065,8 @@ int CVoxelHash::EntityCount()
 	
 		while ( hHash != m_aVoxelHash.m_aBuckets[iBucket].InvalidIndex() )
 		{
-			intp iEntity = m_aVoxelHash.m_aBuckets[iBucket][hHash].m_Data;
-			while ( iEntity!= m_aEntityList.InvalidIndex() )
-			{
-				++nCount;
-				iEntity = m_aEntityList.Next( iEntity );
-			}
+			const CVoxelBucket *pBucket = (const CVoxelBucket*)m_aVoxelHash.m_aBuckets[iBucket][hHash].m_Data;
+			nCount += pBucket->Count();
 
 			hHash = m_aVoxelHash.m_aBuckets[iBucket].Next( hHash );
 		}
@@ -1855,12 +2142,10 @@ void CVoxelHash::RenderAllObjectsInTree( float flTime )
 
 		while ( hHash != m_aVoxelHash.m_aBuckets[iBucket].InvalidIndex() )
 		{
-			intp iEntity = m_aVoxelHash.m_aBuckets[iBucket][hHash].m_Data;
-			while ( iEntity!= m_aEntityList.InvalidIndex() )
+			const CVoxelBucket *pBucket = (const CVoxelBucket*)m_aVoxelHash.m_aBuckets[iBucket][hHash].m_Data;
+			for ( int i = 0; i < pBucket->Count(); ++i )
 			{
-				SpatialPartitionHandle_t hPartition = m_aEntityList[iEntity].m_handle;
-				RenderObjectInVoxel( hPartition, &visitor, flTime );
-				iEntity = m_aEntityList.Next( iEntity );
+				RenderObjectInVoxel( pBucket->m_Handles[i], &visitor, flTime );
 			}
 
 			hHash = m_aVoxelHash.m_aBuckets[iBucket].Next( hHash );
@@ -1908,8 +2193,10 @@ void CVoxelHash::RenderObjectsInPlayerLeafs( const Vector &vecPlayerMin, const V
 // Purpose: Constructor
 //-----------------------------------------------------------------------------
 
-CVoxelTree::CVoxelTree() : m_pVoxelHash( NULL ), m_pOwner( NULL ), m_nNextVisitBit( 0 )
+CVoxelTree::CVoxelTree() : m_pVoxelHash( NULL ), m_pOwner( NULL ), m_nNextVisitBit( 0 ), m_nReadPhaseDepth( 0 ), m_nReadPhase( 0 )
 {
+	memset( m_ReaderSlots, 0, sizeof( m_ReaderSlots ) );
+
 	// Compute max number of levels
 	m_nLevelCount = 0;
 	while ( CVoxelHash::ComputeVoxelCountAtLevel( m_nLevelCount ) > 2 )
@@ -2029,7 +2316,12 @@ void CVoxelTree::InsertIntoTree( SpatialPartitionHandle_t hPartition, const Vect
 	info.m_vecMin = vecMin;
 	info.m_vecMax = vecMax;
 
-	if ( bDoInsert )
+	if ( !bDoInsert )
+	{
+		// Same voxels; the buckets keep their own copy of the bounds for the SIMD tests
+		m_pVoxelHash[info.m_nLevel[m_TreeId]].UpdateBounds( hPartition );
+	}
+	else
 	{
 		bool bWasReading = ( m_pVisits[g_nThreadID] != NULL );
 		if ( bWasReading )
@@ -2105,15 +2397,52 @@ void CVoxelTree::UpdateListMask( SpatialPartitionHandle_t hPartition )
 
 
 //-----------------------------------------------------------------------------
-// Called when an element moves
+// Read phases: see LockForQuery. Only the thread that writes to the partition
+// opens and closes them, and never from inside a query.
 //-----------------------------------------------------------------------------
-void CVoxelTree::ElementMoved( SpatialPartitionHandle_t hPartition, const Vector& mins, const Vector& maxs )
+void CVoxelTree::BeginReadPhase( bool bLockFree )
 {
-	if ( hPartition != PARTITION_INVALID_HANDLE )
+	if ( m_nReadPhaseDepth++ || !bLockFree )
+		return;
+
+	// Let a write already in progress on another thread finish first
+	m_lock.LockForWrite();
+	ThreadInterlockedExchange( &m_nReadPhase, 1 );
+	m_lock.UnlockWrite();
+}
+
+// Returns true when a lock-free phase closed and its deferred writes may be applied
+bool CVoxelTree::EndReadPhase()
+{
+	Assert( m_nReadPhaseDepth > 0 );
+	if ( --m_nReadPhaseDepth || !m_nReadPhase )
+		return false;
+
+	Assert( m_ReaderSlots[g_nThreadID].m_nLockFreeDepth == 0 );
+	ThreadInterlockedExchange( &m_nReadPhase, 0 );
+
+	// Grace period: wait out the queries that started inside the phase
+	for ( int i = 0; i < MAX_THREADS_SUPPORTED; ++i )
 	{
-		// If it doesn't already exist in the tree - add it.
-		EntityInfo_t &info = EntityInfo( hPartition );
-		if ( info.m_iLeafList[GetTreeId()] == CLeafList::InvalidIndex() )
+		while ( m_ReaderSlots[i].m_nLockFreeDepth )
+		{
+			ThreadPause();
+		}
+	}
+	return true;
+}
+
+
+//-----------------------------------------------------------------------------
+// Called when an element moves
+//-----------------------------------------------------------------------------
+void CVoxelTree::ElementMoved( SpatialPartitionHandle_t hPartition, const Vector& mins, const Vector& maxs )
+{
+	if ( hPartition != PARTITION_INVALID_HANDLE )
+	{
+		// If it doesn't already exist in the tree - add it.
+		EntityInfo_t &info = EntityInfo( hPartition );
+		if ( info.m_iLeafList[GetTreeId()] == CLeafList::InvalidIndex() )
 		{
 			InsertIntoTree( hPartition, mins, maxs, false );
 			return;
@@ -2125,12 +2454,15 @@ void CVoxelTree::ElementMoved( SpatialPartitionHandle_t hPartition, const Vector
 }
 
 
+static ConVar spatialpartition_simd( "spatialpartition_simd", "1", 0, "Test spatial partition box and point queries against four elements at a time. 0 uses the per-element test." );
+
 //-----------------------------------------------------------------------------
 // Purpose:
 //-----------------------------------------------------------------------------
-void CVoxelTree::EnumerateElementsInBox( SpatialPartitionListMask_t listMask, 
-										const Vector& vecMins, const Vector& vecMaxs, 
-										bool coarseTest, IPartitionEnumerator* pIterator )
+template <class OUTPUT>
+void CVoxelTree::EnumerateBoxElements( SpatialPartitionListMask_t listMask, 
+									  const Vector& vecMins, const Vector& vecMaxs, 
+									  bool bSIMD, OUTPUT &output )
 {
 	VPROF( "BoxTest/SphereTest" );
 
@@ -2152,42 +2484,49 @@ void CVoxelTree::EnumerateElementsInBox( SpatialPartitionListMask_t listMask,
 	// Callbacks.
 	CPartitionVisits *pPrevVisits = BeginVisit();
 
-	m_lock.LockForRead();
+	LockForQuery();
 	Voxel_t vs = m_pVoxelHash[0].VoxelIndexFromPoint( mins );
 	Voxel_t ve = m_pVoxelHash[0].VoxelIndexFromPoint( maxs );
-	if ( !m_pVoxelHash[0].EnumerateElementsInBox( listMask, vs, ve, mins, maxs, pIterator ) )
+	if ( !m_pVoxelHash[0].EnumerateElementsInBox( listMask, vs, ve, mins, maxs, bSIMD, output ) )
 	{
-		m_lock.UnlockRead();
+		UnlockQuery();
 		EndVisit( pPrevVisits );
 		return;
 	}
 
 	vs = ConvertToNextLevel( vs );
 	ve = ConvertToNextLevel( ve );
-	if ( !m_pVoxelHash[1].EnumerateElementsInBox( listMask, vs, ve, mins, maxs, pIterator ) )
+	if ( !m_pVoxelHash[1].EnumerateElementsInBox( listMask, vs, ve, mins, maxs, bSIMD, output ) )
 	{
-		m_lock.UnlockRead();
+		UnlockQuery();
 		EndVisit( pPrevVisits );
 		return;
 	}
 
 	vs = ConvertToNextLevel( vs );
 	ve = ConvertToNextLevel( ve );
-	if ( !m_pVoxelHash[2].EnumerateElementsInBox( listMask, vs, ve, mins, maxs, pIterator ) )
+	if ( !m_pVoxelHash[2].EnumerateElementsInBox( listMask, vs, ve, mins, maxs, bSIMD, output ) )
 	{
-		m_lock.UnlockRead();
+		UnlockQuery();
 		EndVisit( pPrevVisits );
 		return;
 	}
 
 	vs = ConvertToNextLevel( vs );
 	ve = ConvertToNextLevel( ve );
-	m_pVoxelHash[3].EnumerateElementsInBox( listMask, vs, ve, mins, maxs, pIterator );
+	m_pVoxelHash[3].EnumerateElementsInBox( listMask, vs, ve, mins, maxs, bSIMD, output );
 
-	m_lock.UnlockRead();
+	UnlockQuery();
 	EndVisit( pPrevVisits );
 }
 
+void CVoxelTree::EnumerateElementsInBox( SpatialPartitionListMask_t listMask, 
+										const Vector& vecMins, const Vector& vecMaxs, 
+										bool coarseTest, IPartitionEnumerator* pIterator )
+{
+	EnumerateBoxElements( listMask, vecMins, vecMaxs, spatialpartition_simd.GetBool(), pIterator );
+}
+
 
 //-----------------------------------------------------------------------------
 // Purpose:
@@ -2597,7 +2936,7 @@ void CVoxelTree::EnumerateElementsAlongRay( SpatialPartitionListMask_t listMask,
 
 	CPartitionVisits *pPrevVisits = BeginVisit();
 
-	m_lock.LockForRead();
+	LockForQuery();
 	if ( ray.m_IsRay )
 	{
 		EnumerateElementsAlongRay_Ray( listMask, clippedRay, vecInvDelta, vecEnd, pIterator );
@@ -2607,7 +2946,7 @@ void CVoxelTree::EnumerateElementsAlongRay( SpatialPartitionListMask_t listMask,
 		EnumerateElementsAlongRay_ExtrudedRay( listMask, clippedRay, vecInvDelta, vecEnd, pIterator );
 	}
 
-	m_lock.UnlockRead();
+	UnlockQuery();
 	EndVisit( pPrevVisits );
 }
 
@@ -2615,8 +2954,9 @@ void CVoxelTree::EnumerateElementsAlongRay( SpatialPartitionListMask_t listMask,
 //-----------------------------------------------------------------------------
 // Purpose:
 //-----------------------------------------------------------------------------
-void CVoxelTree::EnumerateElementsAtPoint( SpatialPartitionListMask_t listMask, 
-										  const Vector& pt, bool coarseTest, IPartitionEnumerator* pIterator )
+template <class OUTPUT>
+void CVoxelTree::EnumeratePointElements( SpatialPartitionListMask_t listMask, 
+										const Vector& pt, bool bSIMD, OUTPUT &output )
 {
 	// If this assertion fails, you're using a list at a point where the spatial partition elements aren't set up!
 	//	Assert( ( listMask & m_nSuppressedListMask ) == 0 );
@@ -2625,32 +2965,38 @@ void CVoxelTree::EnumerateElementsAtPoint( SpatialPartitionListMask_t listMask,
 	if ( listMask == 0 )
 		return;
 
-	m_lock.LockForRead();
+	LockForQuery();
 	// Callbacks.
 	Voxel_t v = m_pVoxelHash[0].VoxelIndexFromPoint( pt );
-	if ( !m_pVoxelHash[0].EnumerateElementsAtPoint( listMask, v, pt, pIterator ) )
+	if ( !m_pVoxelHash[0].EnumerateElementsAtPoint( listMask, v, pt, bSIMD, output ) )
 	{
-		m_lock.UnlockRead();
+		UnlockQuery();
 		return;
 	}
 
 	v = ConvertToNextLevel( v );
-	if ( !m_pVoxelHash[1].EnumerateElementsAtPoint( listMask, v, pt, pIterator ) )
+	if ( !m_pVoxelHash[1].EnumerateElementsAtPoint( listMask, v, pt, bSIMD, output ) )
 	{
-		m_lock.UnlockRead();
+		UnlockQuery();
 		return;
 	}
 
 	v = ConvertToNextLevel( v );
-	if ( !m_pVoxelHash[2].EnumerateElementsAtPoint( listMask, v, pt, pIterator ) )
+	if ( !m_pVoxelHash[2].EnumerateElementsAtPoint( listMask, v, pt, bSIMD, output ) )
 	{
-		m_lock.UnlockRead();
+		UnlockQuery();
 		return;
 	}
 
 	v = ConvertToNextLevel( v );
-	m_pVoxelHash[3].EnumerateElementsAtPoint( listMask, v, pt, pIterator );
-	m_lock.UnlockRead();
+	m_pVoxelHash[3].EnumerateElementsAtPoint( listMask, v, pt, bSIMD, output );
+	UnlockQuery();
+}
+
+void CVoxelTree::EnumerateElementsAtPoint( SpatialPartitionListMask_t listMask, 
+										  const Vector& pt, bool coarseTest, IPartitionEnumerator* pIterator )
+{
+	EnumeratePointElements( listMask, pt, spatialpartition_simd.GetBool(), pIterator );
 }
 
 
@@ -2837,6 +3183,9 @@ void CSpatialPartition::DestroyHandle( SpatialPartitionHandle_t hPartition )
 {
 	if ( hPartition != PARTITION_INVALID_HANDLE )
 	{
+		if ( DeferWrite( hPartition, DEFERRED_WRITE_DESTROY ) )
+			return;
+
 		RemoveFromTree( hPartition );
 		m_HandlesMutex.Lock();
 //		memset( &m_aHandles[hPartition], 0xcd, sizeof(EntityInfo_t) );
@@ -2893,6 +3242,8 @@ void CSpatialPartition::Insert( SpatialPartitionListMask_t listId, SpatialPartit
 {
 	Assert( m_aHandles.IsValidIndex( handle ) );
 	Assert( listId <= USHRT_MAX );
+	if ( DeferWrite( handle, DEFERRED_WRITE_LISTS, 0, listId ) )
+		return;
 	UpdateListMask( handle, m_aHandles[handle].m_fList | listId );
 }
 
@@ -2905,6 +3256,8 @@ void CSpatialPartition::Remove( SpatialPartitionListMask_t listId, SpatialPartit
 {
 	Assert( m_aHandles.IsValidIndex( handle ) );
 	Assert( listId <= USHRT_MAX );
+	if ( DeferWrite( handle, DEFERRED_WRITE_LISTS, listId, 0 ) )
+		return;
 	UpdateListMask( handle, m_aHandles[handle].m_fList & ~listId );
 }
 
@@ -2917,6 +3270,8 @@ void CSpatialPartition::RemoveAndInsert( SpatialPartitionListMask_t removeMask,
 	Assert( m_aHandles.IsValidIndex( handle ) );
 	Assert( removeMask <= USHRT_MAX );
 	Assert( insertMask <= USHRT_MAX );
+	if ( DeferWrite( handle, DEFERRED_WRITE_LISTS, removeMask, insertMask ) )
+		return;
 	uint16 nOriginalListMask = m_aHandles[handle].m_fList;
 	uint16 nListMask = (nOriginalListMask & ~removeMask) | insertMask;
 	UpdateListMask( handle, nListMask );
@@ -2929,6 +3284,8 @@ void CSpatialPartition::RemoveAndInsert( SpatialPartitionListMask_t removeMask,
 void CSpatialPartition::Remove( SpatialPartitionHandle_t handle )
 {
 	Assert( m_aHandles.IsValidIndex( handle ) );
+	if ( DeferWrite( handle, DEFERRED_WRITE_LISTS, USHRT_MAX, 0 ) )
+		return;
 	UpdateListMask( handle, 0 );
 }
 
@@ -2992,6 +3349,9 @@ SpatialPartitionListMask_t CSpatialPartition::GetSuppressedLists( void )
 //-----------------------------------------------------------------------------
 void CSpatialPartition::ElementMoved( SpatialPartitionHandle_t handle, const Vector& mins, const Vector& maxs )
 {
+	if ( DeferWrite( handle, DEFERRED_WRITE_MOVE, 0, 0, mins, maxs ) )
+		return;
+
 	EntityInfo_t &entityInfo = EntityInfo( handle );
 	SpatialPartitionListMask_t listMask = entityInfo.m_fList;
 
@@ -3024,9 +3384,16 @@ void CSpatialPartition::EnumerateElementsInBox( SpatialPartitionListMask_t listM
 {
 	MDLCACHE_CRITICAL_SECTION_(g_pMDLCache);
 	CVoxelTree *pTree = VoxelTree( listMask );
-	InvokeQueryCallbacks( listMask );
+	bool bCallbacks = !pTree->InReadPhase();
+	if ( bCallbacks )
+	{
+		InvokeQueryCallbacks( listMask );
+	}
 	pTree->EnumerateElementsInBox( listMask, mins, maxs, coarseTest, pIterator );
-	InvokeQueryCallbacks( listMask, true );
+	if ( bCallbacks )
+	{
+		InvokeQueryCallbacks( listMask, true );
+	}
 }
 
 //-----------------------------------------------------------------------------
@@ -3036,9 +3403,16 @@ void CSpatialPartition::EnumerateElementsInSphere( SpatialPartitionListMask_t li
 {
 	MDLCACHE_CRITICAL_SECTION_(g_pMDLCache);
 	CVoxelTree *pTree = VoxelTree( listMask );
-	InvokeQueryCallbacks( listMask );
+	bool bCallbacks = !pTree->InReadPhase();
+	if ( bCallbacks )
+	{
+		InvokeQueryCallbacks( listMask );
+	}
 	pTree->EnumerateElementsInSphere( listMask, origin, radius, coarseTest, pIterator );
-	InvokeQueryCallbacks( listMask, true );
+	if ( bCallbacks )
+	{
+		InvokeQueryCallbacks( listMask, true );
+	}
 }
 
 //-----------------------------------------------------------------------------
@@ -3048,9 +3422,16 @@ void CSpatialPartition::EnumerateElementsAlongRay( SpatialPartitionListMask_t li
 {
 	MDLCACHE_CRITICAL_SECTION_(g_pMDLCache);
 	CVoxelTree *pTree = VoxelTree( listMask );
-	InvokeQueryCallbacks( listMask );
+	bool bCallbacks = !pTree->InReadPhase();
+	if ( bCallbacks )
+	{
+		InvokeQueryCallbacks( listMask );
+	}
 	pTree->EnumerateElementsAlongRay( listMask, ray, coarseTest, pIterator );
-	InvokeQueryCallbacks( listMask, true );
+	if ( bCallbacks )
+	{
+		InvokeQueryCallbacks( listMask, true );
+	}
 }
 
 //-----------------------------------------------------------------------------
@@ -3060,9 +3441,66 @@ void CSpatialPartition::EnumerateElementsAtPoint( SpatialPartitionListMask_t lis
 {
 	MDLCACHE_CRITICAL_SECTION_(g_pMDLCache);
 	CVoxelTree *pTree = VoxelTree( listMask );
-	InvokeQueryCallbacks( listMask );
+	bool bCallbacks = !pTree->InReadPhase();
+	if ( bCallbacks )
+	{
+		InvokeQueryCallbacks( listMask );
+	}
 	pTree->EnumerateElementsAtPoint( listMask, pt, coarseTest, pIterator );
-	InvokeQueryCallbacks( listMask, true );
+	if ( bCallbacks )
+	{
+		InvokeQueryCallbacks( listMask, true );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Batch box query; fills pList with up to nMaxCount elements and
+//			returns how many were written.
+//-----------------------------------------------------------------------------
+int CSpatialPartition::GetElementsInBox( SpatialPartitionListMask_t listMask, const Vector& mins, const Vector& maxs, IHandleEntity **pList, int nMaxCount )
+{
+	if ( nMaxCount <= 0 )
+		return 0;
+
+	MDLCACHE_CRITICAL_SECTION_(g_pMDLCache);
+	CVoxelTree *pTree = VoxelTree( listMask );
+	bool bCallbacks = !pTree->InReadPhase();
+	if ( bCallbacks )
+	{
+		InvokeQueryCallbacks( listMask );
+	}
+	PartitionElementList_t list = { pList, 0, nMaxCount };
+	pTree->EnumerateBoxElements( listMask, mins, maxs, spatialpartition_simd.GetBool(), list );
+	if ( bCallbacks )
+	{
+		InvokeQueryCallbacks( listMask, true );
+	}
+	return list.m_nCount;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Batch point query; fills pList with up to nMaxCount elements and
+//			returns how many were written.
+//-----------------------------------------------------------------------------
+int CSpatialPartition::GetElementsAtPoint( SpatialPartitionListMask_t listMask, const Vector& pt, IHandleEntity **pList, int nMaxCount )
+{
+	if ( nMaxCount <= 0 )
+		return 0;
+
+	MDLCACHE_CRITICAL_SECTION_(g_pMDLCache);
+	CVoxelTree *pTree = VoxelTree( listMask );
+	bool bCallbacks = !pTree->InReadPhase();
+	if ( bCallbacks )
+	{
+		InvokeQueryCallbacks( listMask );
+	}
+	PartitionElementList_t list = { pList, 0, nMaxCount };
+	pTree->EnumeratePointElements( listMask, pt, spatialpartition_simd.GetBool(), list );
+	if ( bCallbacks )
+	{
+		InvokeQueryCallbacks( listMask, true );
+	}
+	return list.m_nCount;
 }
 
 
@@ -3071,6 +3509,9 @@ void CSpatialPartition::EnumerateElementsAtPoint( SpatialPartitionListMask_t lis
 //-----------------------------------------------------------------------------
 void CSpatialPartition::InsertIntoTree( SpatialPartitionHandle_t hPartition, const Vector& mins, const Vector& maxs ) 
 {
+	if ( DeferWrite( hPartition, DEFERRED_WRITE_INSERT, 0, 0, mins, maxs ) )
+		return;
+
 	EntityInfo_t &entityInfo = EntityInfo( hPartition );
 	SpatialPartitionListMask_t listMask = entityInfo.m_fList;
 
@@ -3100,6 +3541,9 @@ void CSpatialPartition::InsertIntoTree( SpatialPartitionHandle_t hPartition, con
 //-----------------------------------------------------------------------------
 void CSpatialPartition::RemoveFromTree( SpatialPartitionHandle_t hPartition ) 
 { 
+	if ( DeferWrite( hPartition, DEFERRED_WRITE_REMOVE ) )
+		return;
+
 	EntityInfo_t &entityInfo = EntityInfo( hPartition );
 
 	if ( entityInfo.m_flags & IN_CLIENT_TREE )
@@ -3115,6 +3559,139 @@ void CSpatialPartition::RemoveFromTree( SpatialPartitionHandle_t hPartition )
 	}
 }
 
+static ConVar spatialpartition_lockfree_reads( "spatialpartition_lockfree_reads", "1", 0, "Let spatial partition queries made during parallel jobs skip the partition lock. Moves made while the jobs run are applied once they finish." );
+
+//-----------------------------------------------------------------------------
+// Purpose: Queues a write that would touch a tree in a lock-free read phase;
+//			PublishDeferredWrites applies it when the phase ends. Once a handle
+//			has a queued write, its later writes queue behind it to stay in order.
+//-----------------------------------------------------------------------------
+bool CSpatialPartition::DeferWrite( SpatialPartitionHandle_t hPartition, DeferredWriteType_t nType, 
+	uint16 nRemoveMask, uint16 nInsertMask, const Vector &vecMins, const Vector &vecMaxs )
+{
+	bool bClientReadPhase = m_VoxelTrees[CLIENT_TREE].InReadPhase();
+	bool bServerReadPhase = m_VoxelTrees[SERVER_TREE].InReadPhase();
+	if ( !bClientReadPhase && !bServerReadPhase )
+		return false;
+
+	EntityInfo_t &info = EntityInfo( hPartition );
+	SpatialPartitionListMask_t listMask = info.m_fList | nInsertMask;
+	bool bClient = ( listMask & PARTITION_ALL_CLIENT_EDICTS ) || ( info.m_flags & IN_CLIENT_TREE );
+	bool bServer = ( listMask & ~PARTITION_ALL_CLIENT_EDICTS ) || ( info.m_flags & IN_SERVER_TREE );
+
+	m_HandlesMutex.Lock();
+	bool bDefer = ( info.m_flags & WRITE_PENDING ) || ( bClient && bClientReadPhase ) || ( bServer && bServerReadPhase );
+	if ( bDefer )
+	{
+		DeferredWrite_t &write = m_DeferredWrites[ m_DeferredWrites.AddToTail() ];
+		write.m_hPartition = hPartition;
+		write.m_nType = nType;
+		write.m_nRemoveMask = nRemoveMask;
+		write.m_nInsertMask = nInsertMask;
+		write.m_vecMins = vecMins;
+		write.m_vecMaxs = vecMaxs;
+		info.m_flags |= WRITE_PENDING;
+
+		// Readers in the phase must not hand out an element that is being destroyed
+		if ( nType == DEFERRED_WRITE_DESTROY )
+		{
+			info.m_flags |= ENTITY_HIDDEN;
+		}
+	}
+	m_HandlesMutex.Unlock();
+	return bDefer;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Applies the writes queued during read phases, in order. Writes for
+//			a tree that is still in a read phase queue up again.
+//-----------------------------------------------------------------------------
+void CSpatialPartition::PublishDeferredWrites()
+{
+	CUtlVector<DeferredWrite_t> writes;
+	m_HandlesMutex.Lock();
+	writes.Swap( m_DeferredWrites );
+	FOR_EACH_VEC( writes, i )
+	{
+		m_aHandles[ writes[i].m_hPartition ].m_flags &= ~WRITE_PENDING;
+	}
+	m_HandlesMutex.Unlock();
+
+	FOR_EACH_VEC( writes, i )
+	{
+		const DeferredWrite_t &write = writes[i];
+		switch ( write.m_nType )
+		{
+		case DEFERRED_WRITE_LISTS:
+			RemoveAndInsert( write.m_nRemoveMask, write.m_nInsertMask, write.m_hPartition );
+			break;
+		case DEFERRED_WRITE_MOVE:
+			ElementMoved( write.m_hPartition, write.m_vecMins, write.m_vecMaxs );
+			break;
+		case DEFERRED_WRITE_INSERT:
+			InsertIntoTree( write.m_hPartition, write.m_vecMins, write.m_vecMaxs );
+			break;
+		case DEFERRED_WRITE_REMOVE:
+			RemoveFromTree( write.m_hPartition );
+			break;
+		case DEFERRED_WRITE_DESTROY:
+			DestroyHandle( write.m_hPartition );
+			break;
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Opens a read phase on the trees holding listMask.
+//-----------------------------------------------------------------------------
+void CSpatialPartition::BeginReadPhase( SpatialPartitionListMask_t listMask )
+{
+	BeginReadPhase( listMask, spatialpartition_lockfree_reads.GetBool() );
+}
+
+void CSpatialPartition::BeginReadPhase( SpatialPartitionListMask_t listMask, bool bLockFree )
+{
+	bool bClient = ( listMask & PARTITION_ALL_CLIENT_EDICTS ) != 0;
+	bool bServer = ( listMask & ~PARTITION_ALL_CLIENT_EDICTS ) != 0;
+
+	// Let the game flush its dirty elements now; nothing moves again until the phase ends
+	if ( ( bClient && !m_VoxelTrees[CLIENT_TREE].InReadPhase() ) || ( bServer && !m_VoxelTrees[SERVER_TREE].InReadPhase() ) )
+	{
+		InvokeQueryCallbacks( listMask );
+		InvokeQueryCallbacks( listMask, true );
+	}
+
+	if ( bClient )
+	{
+		m_VoxelTrees[CLIENT_TREE].BeginReadPhase( bLockFree );
+	}
+	if ( bServer )
+	{
+		m_VoxelTrees[SERVER_TREE].BeginReadPhase( bLockFree );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Closes a read phase and publishes the writes it held back.
+//-----------------------------------------------------------------------------
+void CSpatialPartition::EndReadPhase( SpatialPartitionListMask_t listMask )
+{
+	bool bPublish = false;
+	if ( listMask & PARTITION_ALL_CLIENT_EDICTS )
+	{
+		bPublish |= m_VoxelTrees[CLIENT_TREE].EndReadPhase();
+	}
+	if ( listMask & ~PARTITION_ALL_CLIENT_EDICTS )
+	{
+		bPublish |= m_VoxelTrees[SERVER_TREE].EndReadPhase();
+	}
+
+	if ( bPublish )
+	{
+		PublishDeferredWrites();
+	}
+}
+
 //-----------------------------------------------------------------------------
 // Purpose:
 //-----------------------------------------------------------------------------
@@ -3204,6 +3781,292 @@ void CSpatialPartition::DrawDebugOverlays()
 	}
 }
 
+//-----------------------------------------------------------------------------
+// Query benchmark: the same seeded box and point queries through the
+// per-element test, the SIMD test, and the SIMD batch output
+//-----------------------------------------------------------------------------
+class CPartitionCountEnumerator : public IPartitionEnumerator
+{
+public:
+	CPartitionCountEnumerator() : m_nCount( 0 ) {}
+
+	virtual IterationRetval_t EnumElement( IHandleEntity *pHandleEntity )
+	{
+		++m_nCount;
+		return ITERATION_CONTINUE;
+	}
+
+	int m_nCount;
+};
+
+#define SPATIALPARTITION_BENCHMARK_LIST_SIZE	1024
+
+void CSpatialPartition::RunQueryBenchmark( SpatialPartitionListMask_t listMask, int nQueries, float flRadius )
+{
+	// Center the queries on existing elements so they land where the partition is populated
+	CUtlVector< Vector > centers;
+	m_HandlesMutex.Lock();
+	for ( SpatialPartitionHandle_t h = m_aHandles.Head(); h != m_aHandles.InvalidIndex(); h = m_aHandles.Next( h ) )
+	{
+		const EntityInfo_t &info = m_aHandles[h];
+		if ( ( info.m_fList & listMask ) && !( info.m_flags & ENTITY_HIDDEN ) )
+		{
+			centers.AddToTail( ( info.m_vecMin + info.m_vecMax ) * 0.5f );
+		}
+	}
+	m_HandlesMutex.Unlock();
+
+	if ( !centers.Count() )
+	{
+		Msg( "spatialpartition_benchmark: no elements in the queried lists (is a map loaded?)\n" );
+		return;
+	}
+
+	CUniformRandomStream random;
+	random.SetSeed( 0x5EED );
+	CUtlVector< Vector > mins, maxs, points;
+	mins.SetCount( nQueries );
+	maxs.SetCount( nQueries );
+	points.SetCount( nQueries );
+	for ( int i = 0; i < nQueries; ++i )
+	{
+		const Vector &vecCenter = centers[ random.RandomInt( 0, centers.Count() - 1 ) ];
+		Vector vecOffset( random.RandomFloat( -flRadius, flRadius ), random.RandomFloat( -flRadius, flRadius ), random.RandomFloat( -flRadius, flRadius ) );
+		float flExtent = random.RandomFloat( 8.0f, flRadius );
+		mins[i] = vecCenter + vecOffset - Vector( flExtent, flExtent, flExtent );
+		maxs[i] = vecCenter + vecOffset + Vector( flExtent, flExtent, flExtent );
+		points[i] = vecCenter + vecOffset * 0.125f;
+	}
+
+	MDLCACHE_CRITICAL_SECTION_(g_pMDLCache);
+	CVoxelTree *pTree = VoxelTree( listMask );
+	bool bCallbacks = !pTree->InReadPhase();
+	if ( bCallbacks )
+	{
+		InvokeQueryCallbacks( listMask );
+	}
+
+	Msg( "spatialpartition_benchmark: %d elements, %d box and %d point queries, radius %.0f\n", centers.Count(), nQueries, nQueries, flRadius );
+
+	IHandleEntity *pList[SPATIALPARTITION_BENCHMARK_LIST_SIZE];
+	static const char *s_pModeNames[] = { "scalar", "simd", "simd batch" };
+	for ( int nShape = 0; nShape < 2; ++nShape )
+	{
+		int64 nHits[3];
+		for ( int nMode = 0; nMode < 3; ++nMode )
+		{
+			bool bSIMD = ( nMode != 0 );
+			int nTruncated = 0;
+			nHits[nMode] = 0;
+			double flStartTime = Plat_FloatTime();
+			for ( int i = 0; i < nQueries; ++i )
+			{
+				if ( nMode == 2 )
+				{
+					PartitionElementList_t list = { pList, 0, SPATIALPARTITION_BENCHMARK_LIST_SIZE };
+					if ( nShape == 0 )
+					{
+						pTree->EnumerateBoxElements( listMask, mins[i], maxs[i], bSIMD, list );
+					}
+					else
+					{
+						pTree->EnumeratePointElements( listMask, points[i], bSIMD, list );
+					}
+					nHits[nMode] += list.m_nCount;
+					nTruncated += ( list.m_nCount == SPATIALPARTITION_BENCHMARK_LIST_SIZE ) ? 1 : 0;
+				}
+				else
+				{
+					CPartitionCountEnumerator counter;
+					IPartitionEnumerator *pIterator = &counter;
+					if ( nShape == 0 )
+					{
+						pTree->EnumerateBoxElements( listMask, mins[i], maxs[i], bSIMD, pIterator );
+					}
+					else
+					{
+						pTree->EnumeratePointElements( listMask, points[i], bSIMD, pIterator );
+					}
+					nHits[nMode] += counter.m_nCount;
+				}
+			}
+			double flElapsed = Plat_FloatTime() - flStartTime;
+
+			Msg( "  %-5s %-10s: %8.2f ms  %7.3f us/query  %lld hits%s\n", nShape ? "point" : "box", s_pModeNames[nMode],
+				flElapsed * 1000.0, flElapsed * 1e6 / nQueries, nHits[nMode], nTruncated ? " (some lists truncated)" : "" );
+		}
+
+		if ( nHits[0] != nHits[1] || ( nHits[0] != nHits[2] ) )
+		{
+			Warning( "spatialpartition_benchmark: %s query hit counts differ between modes\n", nShape ? "point" : "box" );
+		}
+	}
+
+	if ( bCallbacks )
+	{
+		InvokeQueryCallbacks( listMask, true );
+	}
+}
+
+CON_COMMAND_F( spatialpartition_benchmark, "Times spatial partition box and point queries through the per-element and SIMD tests. Usage: spatialpartition_benchmark [queries] [radius] [client]", FCVAR_CHEAT )
+{
+	int nQueries = ( args.ArgC() > 1 ) ? MAX( 1, atoi( args[1] ) ) : 20000;
+	float flRadius = ( args.ArgC() > 2 ) ? MAX( 8.0f, (float)atof( args[2] ) ) : 128.0f;
+	bool bClient = ( args.ArgC() > 3 ) && !V_stricmp( args[3], "client" );
+	SpatialPartitionListMask_t listMask = bClient ? PARTITION_ALL_CLIENT_EDICTS : ( PARTITION_SERVER_GAME_EDICTS | PARTITION_ENGINE_STATIC_PROPS );
+	g_SpatialPartition.RunQueryBenchmark( listMask, nQueries, flRadius );
+}
+
+//-----------------------------------------------------------------------------
+// Contention benchmark: reader jobs run box queries against a scratch partition
+// while one job keeps moving its elements, first with every query taking the
+// tree lock and then with the moves batched into lock-free read phases
+//-----------------------------------------------------------------------------
+#define SPATIALPARTITION_CONTENTION_WORLD_SIZE	4096.0f
+#define SPATIALPARTITION_CONTENTION_EXTENT		24.0f
+#define SPATIALPARTITION_CONTENTION_BATCH		64
+
+class CContentionHandleEntity : public IHandleEntity
+{
+public:
+	virtual void SetRefEHandle( const CBaseHandle &handle ) {}
+	virtual const CBaseHandle& GetRefEHandle() const { return s_hRefEHandle; }
+
+private:
+	static CBaseHandle s_hRefEHandle;
+};
+
+CBaseHandle CContentionHandleEntity::s_hRefEHandle;
+
+class CPartitionContentionBenchmark
+{
+public:
+	struct Task_t
+	{
+		int m_nIndex;
+		int64 m_nOps;
+	};
+
+	void Run( float flSeconds, int nReaders, int nElements, bool bLockFree, int64 &nQueries, int64 &nMoves );
+	void Process( Task_t &task );
+
+	CSpatialPartition *m_pPartition;
+	CUtlVector< SpatialPartitionHandle_t > m_Handles;
+	CUtlVector< Vector > m_Centers;
+	double m_flEndTime;
+	bool m_bLockFree;
+
+private:
+	Vector RandomPoint( CUniformRandomStream &random ) const;
+};
+
+Vector CPartitionContentionBenchmark::RandomPoint( CUniformRandomStream &random ) const
+{
+	const float flHalf = SPATIALPARTITION_CONTENTION_WORLD_SIZE * 0.5f;
+	return Vector( random.RandomFloat( -flHalf, flHalf ), random.RandomFloat( -flHalf, flHalf ), random.RandomFloat( -flHalf, flHalf ) );
+}
+
+void CPartitionContentionBenchmark::Process( Task_t &task )
+{
+	CUniformRandomStream random;
+	random.SetSeed( 0x5EED + task.m_nIndex );
+	task.m_nOps = 0;
+
+	const Vector vecExtent( SPATIALPARTITION_CONTENTION_EXTENT, SPATIALPARTITION_CONTENTION_EXTENT, SPATIALPARTITION_CONTENTION_EXTENT );
+	if ( task.m_nIndex == 0 )
+	{
+		// The mover owns the writes, and so the read phases
+		while ( Plat_FloatTime() < m_flEndTime )
+		{
+			m_pPartition->BeginReadPhase( PARTITION_ENGINE_SOLID_EDICTS, m_bLockFree );
+			for ( int i = 0; i < SPATIALPARTITION_CONTENTION_BATCH; ++i )
+			{
+				int nElement = random.RandomInt( 0, m_Handles.Count() - 1 );
+				Vector vecCenter = m_Centers[nElement] + Vector( random.RandomFloat( -64.0f, 64.0f ), random.RandomFloat( -64.0f, 64.0f ), 0.0f );
+				m_pPartition->ElementMoved( m_Handles[nElement], vecCenter - vecExtent, vecCenter + vecExtent );
+			}
+			m_pPartition->EndReadPhase( PARTITION_ENGINE_SOLID_EDICTS );
+			task.m_nOps += SPATIALPARTITION_CONTENTION_BATCH;
+		}
+		return;
+	}
+
+	CPartitionCountEnumerator counter;
+	const Vector vecQueryExtent( 128.0f, 128.0f, 128.0f );
+	while ( Plat_FloatTime() < m_flEndTime )
+	{
+		for ( int i = 0; i < SPATIALPARTITION_CONTENTION_BATCH; ++i )
+		{
+			Vector vecCenter = RandomPoint( random );
+			m_pPartition->EnumerateElementsInBox( PARTITION_ENGINE_SOLID_EDICTS, vecCenter - vecQueryExtent, vecCenter + vecQueryExtent, false, &counter );
+		}
+		task.m_nOps += SPATIALPARTITION_CONTENTION_BATCH;
+	}
+}
+
+void CPartitionContentionBenchmark::Run( float flSeconds, int nReaders, int nElements, bool bLockFree, int64 &nQueries, int64 &nMoves )
+{
+	const float flHalf = SPATIALPARTITION_CONTENTION_WORLD_SIZE * 0.5f;
+	m_pPartition = static_cast< CSpatialPartition* >( CreateSpatialPartition( Vector( -flHalf, -flHalf, -flHalf ), Vector( flHalf, flHalf, flHalf ) ) );
+	m_bLockFree = bLockFree;
+
+	CUniformRandomStream random;
+	random.SetSeed( 0x5EED );
+	CContentionHandleEntity *pEntities = new CContentionHandleEntity[nElements];
+	const Vector vecExtent( SPATIALPARTITION_CONTENTION_EXTENT, SPATIALPARTITION_CONTENTION_EXTENT, SPATIALPARTITION_CONTENTION_EXTENT );
+	m_Handles.SetCount( nElements );
+	m_Centers.SetCount( nElements );
+	for ( int i = 0; i < nElements; ++i )
+	{
+		m_Centers[i] = RandomPoint( random );
+		m_Handles[i] = m_pPartition->CreateHandle( &pEntities[i], PARTITION_ENGINE_SOLID_EDICTS, m_Centers[i] - vecExtent, m_Centers[i] + vecExtent );
+	}
+
+	CUtlVector< Task_t > tasks;
+	tasks.SetCount( nReaders + 1 );
+	for ( int i = 0; i < tasks.Count(); ++i )
+	{
+		tasks[i].m_nIndex = i;
+		tasks[i].m_nOps = 0;
+	}
+
+	m_flEndTime = Plat_FloatTime() + flSeconds;
+	ParallelProcess( tasks.Base(), tasks.Count(), this, &CPartitionContentionBenchmark::Process );
+
+	nMoves = tasks[0].m_nOps;
+	nQueries = 0;
+	for ( int i = 1; i < tasks.Count(); ++i )
+	{
+		nQueries += tasks[i].m_nOps;
+	}
+
+	for ( int i = 0; i < nElements; ++i )
+	{
+		m_pPartition->DestroyHandle( m_Handles[i] );
+	}
+	DestroySpatialPartition( m_pPartition );
+	m_pPartition = NULL;
+	delete[] pEntities;
+}
+
+CON_COMMAND_F( spatialpartition_contention_benchmark, "Times spatial partition queries from job threads while elements move, with and without lock-free read phases. Usage: spatialpartition_contention_benchmark [seconds] [readers] [elements]", FCVAR_CHEAT )
+{
+	float flSeconds = ( args.ArgC() > 1 ) ? clamp( (float)atof( args[1] ), 0.1f, 60.0f ) : 2.0f;
+	int nMaxReaders = g_pThreadPool ? MAX( 1, g_pThreadPool->NumThreads() ) : 1;
+	int nReaders = ( args.ArgC() > 2 ) ? clamp( atoi( args[2] ), 1, nMaxReaders ) : nMaxReaders;
+	int nElements = ( args.ArgC() > 3 ) ? clamp( atoi( args[3] ), 1, 32768 ) : 4096;
+
+	Msg( "spatialpartition_contention_benchmark: %d readers, %d elements, %.1fs per mode\n", nReaders, nElements, flSeconds );
+	static const char *s_pModeNames[] = { "locked", "lock-free" };
+	for ( int nMode = 0; nMode < 2; ++nMode )
+	{
+		CPartitionContentionBenchmark benchmark;
+		int64 nQueries, nMoves;
+		benchmark.Run( flSeconds, nReaders, nElements, ( nMode != 0 ), nQueries, nMoves );
+		Msg( "  %-10s %10.0f queries/s %10.0f moves/s\n", s_pModeNames[nMode], nQueries / flSeconds, nMoves / flSeconds );
+	}
+}
+
 //=============================================================================
 ISpatialPartition *CreateSpatialPartition( const Vector& worldmin, const Vector& worldmax )
 {
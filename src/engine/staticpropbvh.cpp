@@ -0,0 +1,335 @@
+//========= Copyright  1996-2005, Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Static bounding volume hierarchy over the static props.
+//
+// Static props never move, so the engine traces don't need to find them
+// through the voxel partition (which is built for things that do move). The
+// tree is built top down at level load by splitting the props at the median
+// of their box centers along the widest axis, twice per level, which gives
+// four children per node and a depth of log4(props). Queries walk it nearest
+// child first and let the caller shrink the ray as it clips to props, so the
+// props behind the first hit are never looked at.
+//
+//=============================================================================//
+
+#include "staticpropbvh.h"
+#include "cmodel.h"
+
+#include <algorithm>
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+
+// The boxes are grown slightly so that a hit which vphysics pulls back by its
+// collision epsilon is never culled as being in front of a box
+#define STATICPROP_BVH_BOX_BLOAT	1.0f
+
+// Deep enough for a balanced 4-wide tree over far more props than a map can hold
+#define STATICPROP_BVH_MAX_STACK	256
+
+
+//-----------------------------------------------------------------------------
+// Reciprocal for the slab tests. Zero components get a huge finite value so the
+// slab degenerates to an overlap test on that axis without producing NaNs.
+//-----------------------------------------------------------------------------
+static inline float StaticPropBVH_Reciprocal( float flDelta )
+{
+	return ( fabs( flDelta ) > 1e-12f ) ? 1.0f / flDelta : FLT_MAX;
+}
+
+
+//-----------------------------------------------------------------------------
+// Constructor
+//-----------------------------------------------------------------------------
+CStaticPropBVH::CStaticPropBVH() : m_nDepth( 0 )
+{
+}
+
+void CStaticPropBVH::Purge()
+{
+	m_Nodes.Purge();
+	m_Props.Purge();
+	m_nDepth = 0;
+}
+
+
+//-----------------------------------------------------------------------------
+// Build
+//-----------------------------------------------------------------------------
+void CStaticPropBVH::Build( const CUtlVector< StaticPropBVHProp_t > &props )
+{
+	Purge();
+	if ( !props.Count() )
+		return;
+
+	m_Props.CopyArray( props.Base(), props.Count() );
+
+	CUtlVector< BuildProp_t > buildProps;
+	buildProps.SetCount( props.Count() );
+	for ( int i = 0; i < props.Count(); ++i )
+	{
+		StaticPropBVHProp_t &prop = m_Props[i];
+		Vector vecBloat( STATICPROP_BVH_BOX_BLOAT, STATICPROP_BVH_BOX_BLOAT, STATICPROP_BVH_BOX_BLOAT );
+		prop.m_vecWorldMins -= vecBloat;
+		prop.m_vecWorldMaxs += vecBloat;
+		prop.m_vecPropMins -= vecBloat;
+		prop.m_vecPropMaxs += vecBloat;
+
+		buildProps[i].m_vecCenter = ( prop.m_vecWorldMins + prop.m_vecWorldMaxs ) * 0.5f;
+		buildProps[i].m_nProp = i;
+	}
+
+	// A tree over n props has at most n / 3 + 1 nodes
+	m_Nodes.EnsureCapacity( props.Count() / 3 + 1 );
+	BuildNode_r( buildProps.Base(), buildProps.Count(), 1 );
+}
+
+void CStaticPropBVH::ComputeBounds( const BuildProp_t *pProps, int nCount, Vector &vecMins, Vector &vecMaxs ) const
+{
+	ClearBounds( vecMins, vecMaxs );
+	for ( int i = 0; i < nCount; ++i )
+	{
+		const StaticPropBVHProp_t &prop = m_Props[ pProps[i].m_nProp ];
+		VectorMin( vecMins, prop.m_vecWorldMins, vecMins );
+		VectorMax( vecMaxs, prop.m_vecWorldMaxs, vecMaxs );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Partitions the props so the first nSplit have centers below the rest along
+// the axis where the centers are spread the widest
+//-----------------------------------------------------------------------------
+struct StaticPropBVHAxisLess_t
+{
+	int m_nAxis;
+	template< class T > bool operator()( const T &a, const T &b ) const
+	{
+		return a.m_vecCenter[m_nAxis] < b.m_vecCenter[m_nAxis];
+	}
+};
+
+void CStaticPropBVH::SplitProps( BuildProp_t *pProps, int nCount, int nSplit )
+{
+	if ( nSplit <= 0 || nSplit >= nCount )
+		return;
+
+	Vector vecMins, vecMaxs;
+	ClearBounds( vecMins, vecMaxs );
+	for ( int i = 0; i < nCount; ++i )
+	{
+		AddPointToBounds( pProps[i].m_vecCenter, vecMins, vecMaxs );
+	}
+
+	Vector vecSize = vecMaxs - vecMins;
+	StaticPropBVHAxisLess_t less;
+	less.m_nAxis = ( vecSize.x >= vecSize.y ) ? ( ( vecSize.x >= vecSize.z ) ? 0 : 2 ) : ( ( vecSize.y >= vecSize.z ) ? 1 : 2 );
+	std::nth_element( pProps, pProps + nSplit, pProps + nCount, less );
+}
+
+int CStaticPropBVH::BuildNode_r( BuildProp_t *pProps, int nCount, int nDepth )
+{
+	Assert( nCount > 0 );
+	m_nDepth = MAX( m_nDepth, nDepth );
+
+	// Up to four groups; small sets get one prop per child
+	int nGroupStart[5];
+	int nGroups;
+	if ( nCount <= 4 )
+	{
+		nGroups = nCount;
+		for ( int i = 0; i <= nCount; ++i )
+		{
+			nGroupStart[i] = i;
+		}
+	}
+	else
+	{
+		int nHalf = nCount / 2;
+		SplitProps( pProps, nCount, nHalf );
+		SplitProps( pProps, nHalf, nHalf / 2 );
+		SplitProps( pProps + nHalf, nCount - nHalf, ( nCount - nHalf ) / 2 );
+
+		nGroups = 4;
+		nGroupStart[0] = 0;
+		nGroupStart[1] = nHalf / 2;
+		nGroupStart[2] = nHalf;
+		nGroupStart[3] = nHalf + ( nCount - nHalf ) / 2;
+		nGroupStart[4] = nCount;
+	}
+
+	int nNode = m_Nodes.AddToTail();
+
+	// NOTE: Children are built before the node is filled in; m_Nodes may grow underneath us
+	int nChild[4];
+	ALIGN16 float flBounds[6][4] ALIGN16_POST;
+	for ( int i = 0; i < 4; ++i )
+	{
+		nChild[i] = -1;
+		for ( int j = 0; j < 6; ++j )
+		{
+			flBounds[j][i] = 0.0f;
+		}
+	}
+
+	for ( int i = 0; i < nGroups; ++i )
+	{
+		BuildProp_t *pGroup = pProps + nGroupStart[i];
+		int nGroupCount = nGroupStart[i+1] - nGroupStart[i];
+
+		Vector vecMins, vecMaxs;
+		ComputeBounds( pGroup, nGroupCount, vecMins, vecMaxs );
+		nChild[i] = ( nGroupCount == 1 ) ? ~pGroup->m_nProp : BuildNode_r( pGroup, nGroupCount, nDepth + 1 );
+
+		flBounds[0][i] = vecMins.x; flBounds[1][i] = vecMins.y; flBounds[2][i] = vecMins.z;
+		flBounds[3][i] = vecMaxs.x; flBounds[4][i] = vecMaxs.y; flBounds[5][i] = vecMaxs.z;
+	}
+
+	Node_t &node = m_Nodes[nNode];
+	node.m_MinX = LoadAlignedSIMD( flBounds[0] );
+	node.m_MinY = LoadAlignedSIMD( flBounds[1] );
+	node.m_MinZ = LoadAlignedSIMD( flBounds[2] );
+	node.m_MaxX = LoadAlignedSIMD( flBounds[3] );
+	node.m_MaxY = LoadAlignedSIMD( flBounds[4] );
+	node.m_MaxZ = LoadAlignedSIMD( flBounds[5] );
+	for ( int i = 0; i < 4; ++i )
+	{
+		node.m_nChild[i] = nChild[i];
+	}
+	node.m_nChildCount = nGroups;
+	node.m_nPad[0] = node.m_nPad[1] = node.m_nPad[2] = 0;
+	return nNode;
+}
+
+
+//-----------------------------------------------------------------------------
+// Tests the ray against the prop's box in prop space, grown by the ray's box
+// projected onto the prop axes
+//-----------------------------------------------------------------------------
+bool CStaticPropBVH::RayTouchesProp( const StaticPropBVHProp_t &prop, const Ray_t &ray, const Vector &vecExtents, float flMaxFraction ) const
+{
+	const matrix3x4_t &m = prop.m_PropToWorld;
+
+	Vector vecStart, vecDelta;
+	VectorITransform( ray.m_Start, m, vecStart );
+	VectorIRotate( ray.m_Delta, m, vecDelta );
+
+	float flNear = 0.0f;
+	float flFar = flMaxFraction;
+	for ( int i = 0; i < 3; ++i )
+	{
+		float flExtent = fabs( m[0][i] ) * vecExtents.x + fabs( m[1][i] ) * vecExtents.y + fabs( m[2][i] ) * vecExtents.z;
+
+		float flInvDelta = StaticPropBVH_Reciprocal( vecDelta[i] );
+		float t1 = ( prop.m_vecPropMins[i] - flExtent - vecStart[i] ) * flInvDelta;
+		float t2 = ( prop.m_vecPropMaxs[i] + flExtent - vecStart[i] ) * flInvDelta;
+		flNear = MAX( flNear, MIN( t1, t2 ) );
+		flFar = MIN( flFar, MAX( t1, t2 ) );
+		if ( flNear > flFar )
+			return false;
+	}
+	return true;
+}
+
+
+//-----------------------------------------------------------------------------
+// Query
+//-----------------------------------------------------------------------------
+void CStaticPropBVH::EnumerateAlongRay( const Ray_t &ray, float flMaxFraction, IStaticPropBVHEnumerator *pEnum ) const
+{
+	if ( !m_Nodes.Count() )
+		return;
+
+	// World aligned half size of the swept box
+	Vector vecExtents = ray.m_Extents;
+	if ( ray.m_pWorldAxisTransform )
+	{
+		const matrix3x4_t &m = *ray.m_pWorldAxisTransform;
+		for ( int i = 0; i < 3; ++i )
+		{
+			vecExtents[i] = fabs( m[i][0] ) * ray.m_Extents.x + fabs( m[i][1] ) * ray.m_Extents.y + fabs( m[i][2] ) * ray.m_Extents.z;
+		}
+	}
+
+	// Growing the boxes by the extents and moving them to the ray start folds into
+	// two offsets per axis: ( min - ext ) - start and ( max + ext ) - start
+	fltx4 f4LoX = ReplicateX4( ray.m_Start.x + vecExtents.x );
+	fltx4 f4LoY = ReplicateX4( ray.m_Start.y + vecExtents.y );
+	fltx4 f4LoZ = ReplicateX4( ray.m_Start.z + vecExtents.z );
+	fltx4 f4HiX = ReplicateX4( ray.m_Start.x - vecExtents.x );
+	fltx4 f4HiY = ReplicateX4( ray.m_Start.y - vecExtents.y );
+	fltx4 f4HiZ = ReplicateX4( ray.m_Start.z - vecExtents.z );
+	fltx4 f4InvX = ReplicateX4( StaticPropBVH_Reciprocal( ray.m_Delta.x ) );
+	fltx4 f4InvY = ReplicateX4( StaticPropBVH_Reciprocal( ray.m_Delta.y ) );
+	fltx4 f4InvZ = ReplicateX4( StaticPropBVH_Reciprocal( ray.m_Delta.z ) );
+
+	struct StackEntry_t
+	{
+		int		m_nChild;
+		float	m_flNear;
+	};
+	StackEntry_t stack[STATICPROP_BVH_MAX_STACK];
+	int nStack = 1;
+	stack[0].m_nChild = 0;
+	stack[0].m_flNear = 0.0f;
+
+	while ( nStack > 0 )
+	{
+		StackEntry_t entry = stack[--nStack];
+		if ( entry.m_flNear > flMaxFraction )
+			continue;
+
+		int nChild = entry.m_nChild;
+		if ( nChild < 0 )
+		{
+			const StaticPropBVHProp_t &prop = m_Props[ ~nChild ];
+			if ( !RayTouchesProp( prop, ray, vecExtents, flMaxFraction ) )
+				continue;
+
+			if ( !pEnum->EnumStaticProp( prop.m_pHandleEntity, &flMaxFraction ) )
+				return;
+			continue;
+		}
+
+		const Node_t &node = m_Nodes[nChild];
+
+		fltx4 t1x = MulSIMD( SubSIMD( node.m_MinX, f4LoX ), f4InvX );
+		fltx4 t2x = MulSIMD( SubSIMD( node.m_MaxX, f4HiX ), f4InvX );
+		fltx4 t1y = MulSIMD( SubSIMD( node.m_MinY, f4LoY ), f4InvY );
+		fltx4 t2y = MulSIMD( SubSIMD( node.m_MaxY, f4HiY ), f4InvY );
+		fltx4 t1z = MulSIMD( SubSIMD( node.m_MinZ, f4LoZ ), f4InvZ );
+		fltx4 t2z = MulSIMD( SubSIMD( node.m_MaxZ, f4HiZ ), f4InvZ );
+
+		fltx4 f4Near = MaxSIMD( MaxSIMD( MinSIMD( t1x, t2x ), MinSIMD( t1y, t2y ) ), MaxSIMD( MinSIMD( t1z, t2z ), Four_Zeros ) );
+		fltx4 f4Far = MinSIMD( MinSIMD( MaxSIMD( t1x, t2x ), MaxSIMD( t1y, t2y ) ), MinSIMD( MaxSIMD( t1z, t2z ), ReplicateX4( flMaxFraction ) ) );
+		int nHitMask = TestSignSIMD( CmpLeSIMD( f4Near, f4Far ) ) & ( ( 1 << node.m_nChildCount ) - 1 );
+		if ( !nHitMask )
+			continue;
+
+		ALIGN16 float flNear[4] ALIGN16_POST;
+		StoreAlignedSIMD( flNear, f4Near );
+
+		// Push the hits farthest first so the nearest is popped first
+		int nHits = 0;
+		StackEntry_t hits[4];
+		for ( int i = 0; i < 4; ++i )
+		{
+			if ( !( nHitMask & ( 1 << i ) ) )
+				continue;
+
+			int j = nHits++;
+			for ( ; j > 0 && hits[j-1].m_flNear < flNear[i]; --j )
+			{
+				hits[j] = hits[j-1];
+			}
+			hits[j].m_nChild = node.m_nChild[i];
+			hits[j].m_flNear = flNear[i];
+		}
+
+		Assert( nStack + nHits <= STATICPROP_BVH_MAX_STACK );
+		for ( int i = 0; i < nHits && nStack < STATICPROP_BVH_MAX_STACK; ++i )
+		{
+			stack[nStack++] = hits[i];
+		}
+	}
+}
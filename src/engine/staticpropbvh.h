@@ -0,0 +1,100 @@
+//========= Copyright  1996-2005, Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Static bounding volume hierarchy over the static props, used by
+//			the engine traces for the static prop part of a ray query.
+//
+//=============================================================================//
+#ifndef STATICPROPBVH_H
+#define STATICPROPBVH_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "mathlib/vector.h"
+#include "mathlib/mathlib.h"
+#include "mathlib/ssemath.h"
+#include "tier1/utlvector.h"
+
+class IHandleEntity;
+struct Ray_t;
+
+
+//-----------------------------------------------------------------------------
+// What the tree needs to know about a prop: the world space box it occupies
+// (the same box it's registered in the spatial partition with) and its
+// collision box in prop space, so rays can be rejected against the rotated
+// box before anyone touches vphysics
+//-----------------------------------------------------------------------------
+struct StaticPropBVHProp_t
+{
+	IHandleEntity	*m_pHandleEntity;
+	matrix3x4_t		m_PropToWorld;
+	Vector			m_vecPropMins;
+	Vector			m_vecPropMaxs;
+	Vector			m_vecWorldMins;
+	Vector			m_vecWorldMaxs;
+};
+
+
+//-----------------------------------------------------------------------------
+// Receives the props along a ray, nearest box first
+//-----------------------------------------------------------------------------
+abstract_class IStaticPropBVHEnumerator
+{
+public:
+	// Lower *pflMaxFraction to skip props whose boxes start beyond it
+	// (e.g. after clipping the ray to a hit). Return false to stop.
+	virtual bool EnumStaticProp( IHandleEntity *pHandleEntity, float *pflMaxFraction ) = 0;
+};
+
+
+//-----------------------------------------------------------------------------
+// 4-wide BVH, built once at level load and never modified afterwards, so any
+// number of threads can query it. Each node holds the boxes of up to four
+// children in SoA form so a ray is tested against all of them at once; a
+// child is either another node or a single prop.
+//-----------------------------------------------------------------------------
+class CStaticPropBVH
+{
+public:
+	CStaticPropBVH();
+
+	void Build( const CUtlVector< StaticPropBVHProp_t > &props );
+	void Purge();
+
+	bool IsEmpty() const { return m_Nodes.Count() == 0; }
+	int PropCount() const { return m_Props.Count(); }
+	int NodeCount() const { return m_Nodes.Count(); }
+	int Depth() const { return m_nDepth; }
+
+	// Walks every prop whose collision box the (swept) ray touches before flMaxFraction
+	void EnumerateAlongRay( const Ray_t &ray, float flMaxFraction, IStaticPropBVHEnumerator *pEnum ) const;
+
+private:
+	struct ALIGN16 Node_t
+	{
+		fltx4	m_MinX, m_MinY, m_MinZ;
+		fltx4	m_MaxX, m_MaxY, m_MaxZ;
+		int32	m_nChild[4];		// >= 0 is a node index, < 0 is ~prop index
+		int32	m_nChildCount;
+		int32	m_nPad[3];
+	} ALIGN16_POST;
+
+	struct BuildProp_t
+	{
+		Vector	m_vecCenter;
+		int		m_nProp;
+	};
+
+	int BuildNode_r( BuildProp_t *pProps, int nCount, int nDepth );
+	void SplitProps( BuildProp_t *pProps, int nCount, int nSplit );
+	void ComputeBounds( const BuildProp_t *pProps, int nCount, Vector &vecMins, Vector &vecMaxs ) const;
+	bool RayTouchesProp( const StaticPropBVHProp_t &prop, const Ray_t &ray, const Vector &vecExtents, float flMaxFraction ) const;
+
+	CUtlVector< Node_t, CUtlMemoryAligned< Node_t, 16 > >	m_Nodes;
+	CUtlVector< StaticPropBVHProp_t >						m_Props;
+	int														m_nDepth;
+};
+
+
+#endif // STATICPROPBVH_H
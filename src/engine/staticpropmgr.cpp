@@ -11,6 +11,7 @@
 
 
 #include "staticpropmgr.h"
+#include "staticpropbvh.h"
 #include "convar.h"
 #include "vcollide_parse.h"
 #include "engine/ICollideable.h"
@@ -51,6 +52,8 @@
 #include "shaderapi/ishaderapi.h"
 #include "iclientalphaproperty.h"
 #include "vgui_baseui_interface.h"
+#include "tier0/fasttimer.h"
+#include "vstdlib/random.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -65,6 +68,7 @@ static ConVar r_colorstaticprops( "r_colorstaticprops", "0", FCVAR_CHEAT );
 ConVar r_staticpropinfo( "r_staticpropinfo", "0" );
 ConVar  r_drawmodeldecals( "r_drawmodeldecals", "1" );
 ConVar disableStaticPropLoading( "disable_static_prop_loading", "0", FCVAR_CHEAT, "If non-zero when a map loads, static props won't be loaded" );
+static ConVar trace_staticprop_bvh( "trace_staticprop_bvh", "1", 0, "Trace static props through the static prop BVH built at map load instead of the spatial partition" );
 extern ConVar mat_fullbright;
 static bool g_MakingDevShots = false;
 ConVar r_shadow_deferred( "r_shadow_deferred", "0", FCVAR_CHEAT, "Toggle deferred shadow rendering");
@@ -346,6 +350,10 @@ private:
 	Vector					m_WorldRenderBBoxMin;
 	Vector					m_WorldRenderBBoxMax;
 
+	// The box the prop is registered in the spatial partition with
+	Vector					m_WorldCollisionBBoxMin;
+	Vector					m_WorldCollisionBBoxMax;
+
 	// FIXME: This sucks. Need to store the lighting origin off
 	// because the time at which the static props are unserialized
 	// doesn't necessarily match the time at which we can initialize the light cache
@@ -411,6 +419,11 @@ public:
 	virtual void GetLightingOrigins( Vector *pLightingOrigins, int nOriginStride, int nCount, IClientRenderable **ppRenderable, int nRenderableStride ); 
 	virtual void ConfigureSystemLevel( int nCPULevel, int nGPULevel );
 	virtual void RestoreStaticProps();
+	virtual bool UseStaticPropTree() const;
+	virtual void EnumerateStaticPropsAlongRay( const Ray_t &ray, float flMaxFraction, IStaticPropBVHEnumerator *pEnum ) const;
+
+	// Times TraceRay with the static props coming from the partition vs. the tree
+	void BenchmarkStaticPropTraces( int nRays, int nIterations );
 
 	// Internal methods
 	const Vector &ViewOrigin() const { return m_vecLastViewOrigin; }
@@ -432,6 +445,9 @@ private:
 	void UnserializeModels( CUtlBuffer& buf );
 	void UnserializeStaticProps();
 
+	// Builds the static prop collision tree from the solid props
+	void BuildStaticPropTree();
+
 	int HandleEntityToIndex( IHandleEntity *pHandleEntity ) const;
 
 private:
@@ -442,6 +458,9 @@ private:
 	CUtlVector <CStaticProp>		m_StaticProps;
 	CUtlVector <StaticPropLeafLump_t> m_StaticPropLeaves;
 
+	// Collision tree over the solid props, for traces
+	CStaticPropBVH					m_StaticPropTree;
+
 	bool							m_bLevelInitialized;
 	bool							m_bClientInitialized;
 	Vector							m_vecLastViewOrigin;
@@ -1217,6 +1236,9 @@ void CStaticProp::InsertPropIntoKDTree()
 		}
 	}
 
+	m_WorldCollisionBBoxMin = mins;
+	m_WorldCollisionBBoxMax = maxs;
+
 	// add the entity to the KD tree so we will collide against it
 	m_Partition = SpatialPartition()->CreateHandle( this, 
 		PARTITION_CLIENT_SOLID_EDICTS | PARTITION_CLIENT_STATIC_PROPS | 
@@ -1636,6 +1658,8 @@ void CStaticPropMgr::UnserializeStaticProps()
 		UnserializeLeafList( buf );
 		COM_TimestampedLog( "UnserializeModels" );
 		UnserializeModels( buf );
+		COM_TimestampedLog( "BuildStaticPropTree" );
+		BuildStaticPropTree();
 	}
 
 	COM_TimestampedLog( "UnserializeStaticProps - end");
@@ -1676,6 +1700,7 @@ void CStaticPropMgr::LevelShutdown()
 
 	m_bLevelInitialized = false;
 
+	m_StaticPropTree.Purge();
 	m_StaticProps.Purge();
 
 	FOR_EACH_VEC( m_StaticPropDict, i )
@@ -1755,6 +1780,162 @@ void CStaticPropMgr::LevelShutdownClient()
 	m_bClientInitialized = false;
 }
 
+//-----------------------------------------------------------------------------
+// Static prop collision tree
+//-----------------------------------------------------------------------------
+void CStaticPropMgr::BuildStaticPropTree()
+{
+	m_StaticPropTree.Purge();
+
+	CUtlVector< StaticPropBVHProp_t > props;
+	props.EnsureCapacity( m_StaticProps.Count() );
+	for ( int i = 0; i < m_StaticProps.Count(); ++i )
+	{
+		CStaticProp &prop = m_StaticProps[i];
+		if ( prop.m_Partition == PARTITION_INVALID_HANDLE )
+			continue;
+
+		StaticPropBVHProp_t &entry = props[ props.AddToTail() ];
+		entry.m_pHandleEntity = &prop;
+		entry.m_vecWorldMins = prop.m_WorldCollisionBBoxMin;
+		entry.m_vecWorldMaxs = prop.m_WorldCollisionBBoxMax;
+
+		// vphysics props get tested against the box of their collision hull in prop
+		// space; bbox props collide as an axial box, which is their partition box
+		vcollide_t *pCollide = ( prop.m_nSolidType == SOLID_VPHYSICS ) ? CM_VCollideForModel( -1, prop.m_pModel ) : NULL;
+		if ( pCollide && pCollide->solidCount )
+		{
+			physcollision->CollideGetAABB( &entry.m_vecPropMins, &entry.m_vecPropMaxs, pCollide->solids[0], vec3_origin, vec3_angle );
+			AngleMatrix( prop.m_Angles, prop.m_Origin, entry.m_PropToWorld );
+		}
+		else
+		{
+			SetIdentityMatrix( entry.m_PropToWorld );
+			entry.m_vecPropMins = prop.m_WorldCollisionBBoxMin;
+			entry.m_vecPropMaxs = prop.m_WorldCollisionBBoxMax;
+		}
+	}
+
+	m_StaticPropTree.Build( props );
+	DevMsg( 2, "Static prop tree: %d props, %d nodes, depth %d\n", m_StaticPropTree.PropCount(), m_StaticPropTree.NodeCount(), m_StaticPropTree.Depth() );
+}
+
+bool CStaticPropMgr::UseStaticPropTree() const
+{
+	return !m_StaticPropTree.IsEmpty() && trace_staticprop_bvh.GetBool();
+}
+
+void CStaticPropMgr::EnumerateStaticPropsAlongRay( const Ray_t &ray, float flMaxFraction, IStaticPropBVHEnumerator *pEnum ) const
+{
+	m_StaticPropTree.EnumerateAlongRay( ray, flMaxFraction, pEnum );
+}
+
+
+//-----------------------------------------------------------------------------
+// Trace benchmark. The rays go from just above one solid prop to the center of
+// another, half of them as player sized hulls, which is about what visibility
+// and movement traces look like on a prop heavy map.
+//-----------------------------------------------------------------------------
+void CStaticPropMgr::BenchmarkStaticPropTraces( int nRays, int nIterations )
+{
+	CUtlVector< CStaticProp * > solidProps;
+	for ( int i = 0; i < m_StaticProps.Count(); ++i )
+	{
+		if ( m_StaticProps[i].m_Partition != PARTITION_INVALID_HANDLE )
+		{
+			solidProps.AddToTail( &m_StaticProps[i] );
+		}
+	}
+	if ( !solidProps.Count() || m_StaticPropTree.IsEmpty() )
+	{
+		Msg( "staticprop_trace_benchmark: no solid static props on this map\n" );
+		return;
+	}
+
+	CUniformRandomStream random;
+	random.SetSeed( 0 );
+
+	CUtlVector< Ray_t > rays;
+	rays.SetCount( nRays );
+	for ( int i = 0; i < nRays; ++i )
+	{
+		const CStaticProp *pFrom = solidProps[ random.RandomInt( 0, solidProps.Count() - 1 ) ];
+		const CStaticProp *pTo = solidProps[ random.RandomInt( 0, solidProps.Count() - 1 ) ];
+
+		Vector vecStart = ( pFrom->m_WorldCollisionBBoxMin + pFrom->m_WorldCollisionBBoxMax ) * 0.5f;
+		vecStart.z = pFrom->m_WorldCollisionBBoxMax.z + 8.0f;
+		Vector vecEnd = ( pTo->m_WorldCollisionBBoxMin + pTo->m_WorldCollisionBBoxMax ) * 0.5f;
+		if ( i & 1 )
+		{
+			rays[i].Init( vecStart, vecEnd, Vector( -16, -16, 0 ), Vector( 16, 16, 72 ) );
+		}
+		else
+		{
+			rays[i].Init( vecStart, vecEnd );
+		}
+	}
+
+	// 0 = spatial partition, 1 = static prop tree
+	CUtlVector< trace_t > traces[2];
+	float flBestMs[2] = { FLT_MAX, FLT_MAX };
+	bool bOldValue = trace_staticprop_bvh.GetBool();
+	for ( int nMode = 0; nMode < 2; ++nMode )
+	{
+		trace_staticprop_bvh.SetValue( nMode );
+		traces[nMode].SetCount( nRays );
+		for ( int nIteration = 0; nIteration < nIterations; ++nIteration )
+		{
+			CFastTimer timer;
+			timer.Start();
+			for ( int i = 0; i < nRays; ++i )
+			{
+				g_pEngineTraceServer->TraceRay( rays[i], MASK_SOLID, NULL, &traces[nMode][i] );
+			}
+			timer.End();
+			flBestMs[nMode] = MIN( flBestMs[nMode], timer.GetDuration().GetMillisecondsF() );
+		}
+	}
+	trace_staticprop_bvh.SetValue( bOldValue );
+
+	int nPropHits = 0;
+	int nMismatches = 0;
+	for ( int i = 0; i < nRays; ++i )
+	{
+		const trace_t &a = traces[0][i];
+		const trace_t &b = traces[1][i];
+		if ( b.DidHit() && b.hitbox > 0 )
+		{
+			++nPropHits;
+		}
+		if ( fabs( a.fraction - b.fraction ) > 1e-4f || a.startsolid != b.startsolid || a.allsolid != b.allsolid || a.hitbox != b.hitbox )
+		{
+			++nMismatches;
+		}
+	}
+
+	Msg( "%d solid static props, tree: %d nodes, depth %d\n", solidProps.Count(), m_StaticPropTree.NodeCount(), m_StaticPropTree.Depth() );
+	Msg( "%d rays (%d hit static props), best of %d\n", nRays, nPropHits, nIterations );
+	for ( int nMode = 0; nMode < 2; ++nMode )
+	{
+		Msg( "  %-10s %9.2f ms %12.0f traces/s\n", nMode ? "tree" : "partition", flBestMs[nMode], flBestMs[nMode] > 0.0f ? nRays * 1000.0f / flBestMs[nMode] : 0.0f );
+	}
+	Msg( "  speedup %.2fx, %d results differ\n", flBestMs[1] > 0.0f ? flBestMs[0] / flBestMs[1] : 0.0f, nMismatches );
+}
+
+CON_COMMAND_F( staticprop_trace_benchmark, "Times TraceRay on the current map with static props found through the spatial partition vs. the static prop tree.\n  staticprop_trace_benchmark [-rays N] [-iterations N]", FCVAR_CHEAT )
+{
+	if ( !sv.IsActive() )
+	{
+		Msg( "staticprop_trace_benchmark: needs a map loaded on a local server\n" );
+		return;
+	}
+
+	int nRays = clamp( args.FindArgInt( "-rays", 20000 ), 1, 1000000 );
+	int nIterations = clamp( args.FindArgInt( "-iterations", 5 ), 1, 100 );
+	s_StaticPropMgr.BenchmarkStaticPropTraces( nRays, nIterations );
+}
+
+
 //-----------------------------------------------------------------------------
 // Create physics representations of props
 //-----------------------------------------------------------------------------
@@ -23,6 +23,7 @@
 // foward declarations
 //-----------------------------------------------------------------------------
 class ICollideable;
+class IStaticPropBVHEnumerator;
 FORWARD_DECLARE_HANDLE( LightCacheHandle_t );
 class IPooledVBAllocator;
 
@@ -75,6 +76,13 @@ public:
 	virtual void ConfigureSystemLevel( int nCPULevel, int nGPULevel ) = 0;
 
 	virtual void RestoreStaticProps() = 0;
+
+	// Is the static prop collision tree built and enabled? When it is, traces get the
+	// static props from EnumerateStaticPropsAlongRay instead of the spatial partition
+	virtual bool UseStaticPropTree() const = 0;
+
+	// Enumerates the solid static props along a ray, nearest first
+	virtual void EnumerateStaticPropsAlongRay( const Ray_t &ray, float flMaxFraction, IStaticPropBVHEnumerator *pEnum ) const = 0;
 };
 
 
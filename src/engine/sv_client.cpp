@@ -58,7 +58,12 @@ static ConVar	sv_allowupload ("sv_allowupload", "1", FCVAR_RELEASE, "Allow clien
 	   ConVar	spec_replay_message_time( "spec_replay_message_time", "9.5", FCVAR_RELEASE | FCVAR_REPLICATED, "How long to show the message about Killer Replay after death. The best setting is a bit shorter than spec_replay_autostart_delay + spec_replay_leadup_time + spec_replay_winddown_time" );
 	   ConVar	spec_replay_rate_limit( "spec_replay_rate_limit", "3", FCVAR_RELEASE | FCVAR_REPLICATED, "Minimum allowable pause between replay requests in seconds" );
 
-static ConVar	ss_voice_hearpartner( "ss_voice_hearpartner", "0", 0, "Route voice between splitscreen players on same system." );
+static void OnVoiceHearPartnerChanged( IConVar *var, const char *pOldValue, float flOldValue )
+{
+	SV_InvalidateVoiceRoutes();
+}
+
+static ConVar	ss_voice_hearpartner( "ss_voice_hearpartner", "0", 0, "Route voice between splitscreen players on same system.", OnVoiceHearPartnerChanged );
 
 ConVar sv_max_dropped_packets_to_process( "sv_max_dropped_packets_to_process", "10", FCVAR_RELEASE, "Max dropped packets to process. Lower settings prevent lagged players from simulating too far in the past. Setting of 0 disables cap." );
 
@@ -808,6 +813,7 @@ void CGameClient::Inactivate( void )
 	}
 	m_VoiceStreams.ClearAll();
 	m_VoiceProximity.ClearAll();
+	SV_InvalidateVoiceRoutes();
 
 
 	DeleteClientFrames( -1 ); // delete all
@@ -867,6 +873,7 @@ void CGameClient::Clear()
 	}
 	m_VoiceStreams.ClearAll();
 	m_VoiceProximity.ClearAll();
+	SV_InvalidateVoiceRoutes();
 	edict = NULL;
 	m_pViewEntity = NULL;
 	m_bVoiceLoopback = false;
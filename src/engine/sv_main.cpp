@@ -2320,24 +2320,330 @@ void SV_WriteVoiceCodec(bf_write &pBuf)
 
 // Gets voice data from a client and forwards it to anyone who can hear this client.
 ConVar voice_debugfeedbackfrom( "voice_debugfeedbackfrom", "0" );
+ConVar sv_voice_batch( "sv_voice_batch", "1", FCVAR_RELEASE, "Queue incoming voice and relay it once per server frame through the cached voice routing table." );
 
-void SV_BroadcastVoiceData(IClient * cl, const CCLCMsg_VoiceData& msg )
+//-----------------------------------------------------------------------------
+// Voice relay
+//
+// Incoming voice frames are queued by SV_BroadcastVoiceData and relayed once
+// per server frame by SV_FlushVoiceData. Who hears whom comes from a routing
+// table that is only rebuilt when the listening state changes, either through
+// SV_InvalidateVoiceRoutes or because a slot's activity, split screen setup,
+// loopback or proxy state differs from the snapshot the table was built from.
+// Recipients of a speaker that would get identical messages share a group; a
+// group's message is serialized once and its bits are copied into the voice
+// stream of every recipient in it. HLTV and replay proxies get groups of their
+// own and are sent the message itself, since the HLTV server inspects it.
+//-----------------------------------------------------------------------------
+enum VoiceRoute_t
 {
-    ConVarRef voice_verbose( "voice_verbose" );
+	VOICE_ROUTE_SEND = 0,
+	VOICE_ROUTE_INACTIVE,
+	VOICE_ROUTE_SPLITSCREEN,
+	VOICE_ROUTE_SELF,
+	VOICE_ROUTE_NOT_HEARING,
+};
 
-    // Disable voice?
-    if( !sv_voiceenable.GetInt() )
-    {
-        if ( voice_verbose.GetBool() )
-        {
-            Msg( "* SV_BroadcastVoiceData:  Dropping all voice.  sv_voiceenable is not set.\n" );
-        }
-        return;
-    }
+struct VoiceRouteGroup_t
+{
+	int		m_nAudibleMask;
+	bool	m_bProximity;
+	bool	m_bEmpty;			// speaker's own slot without loopback, gets a zero length message
+	bool	m_bProxy;			// HLTV/replay recipients, sent the CSVCMsg_VoiceData_t rather than its encoding
+	int		m_nFirstRecipient;
+	int		m_nRecipientCount;
+};
 
-    // Build voice message once
-	CSVCMsg_VoiceData_t voiceData;
-	voiceData.set_client( cl->GetPlayerSlot() );
+struct VoiceRouteSlotState_t
+{
+	int					m_nUserID;
+	bool				m_bActive;
+	bool				m_bSplitScreenUser;
+	bool				m_bLoopback;
+	bool				m_bProxy;
+	const CBaseClient	*m_pSplitScreenUsers[ MAX_SPLITSCREEN_CLIENTS ];
+};
+
+struct VoiceRelayStats_t
+{
+	int64	m_nFrames;
+	int64	m_nEncodes;
+	int64	m_nSends;
+	int64	m_nBitsSent;
+	int64	m_nRouteBuilds;
+};
+
+static VoiceRelayStats_t s_VoiceRelayStats;
+
+class CVoiceRouteTable
+{
+public:
+	CVoiceRouteTable() : m_nClients( 0 ), m_bDirty( true ) {}
+
+	void Invalidate() { m_bDirty = true; }
+
+	// Rebuilds the table if anything it depends on has changed
+	void Update();
+
+	int GetGroupCount( int nSpeaker ) const { return m_Speakers[ nSpeaker ].m_nGroupCount; }
+	const VoiceRouteGroup_t &GetGroup( int nSpeaker, int i ) const { return m_Groups[ m_Speakers[ nSpeaker ].m_nFirstGroup + i ]; }
+	int GetRecipient( const VoiceRouteGroup_t &group, int i ) const { return m_Recipients[ group.m_nFirstRecipient + i ]; }
+	VoiceRoute_t GetRoute( int nSpeaker, int nDest ) const { return ( VoiceRoute_t )m_Routes[ nSpeaker * m_nClients + nDest ]; }
+
+private:
+	struct SpeakerRoutes_t
+	{
+		int m_nFirstGroup;
+		int m_nGroupCount;
+	};
+
+	static void GetSlotState( int nSlot, VoiceRouteSlotState_t &state );
+	void Build();
+
+	int										m_nClients;
+	bool									m_bDirty;
+	CUtlVector< VoiceRouteSlotState_t >		m_SlotStates;
+	CUtlVector< SpeakerRoutes_t >			m_Speakers;
+	CUtlVector< VoiceRouteGroup_t >			m_Groups;
+	CUtlVector< int >						m_Recipients;
+	CUtlVector< uint8 >						m_Routes;	// VoiceRoute_t for each speaker/destination pair
+};
+
+static CVoiceRouteTable s_VoiceRoutes;
+
+void SV_InvalidateVoiceRoutes( void )
+{
+	s_VoiceRoutes.Invalidate();
+}
+
+void CVoiceRouteTable::GetSlotState( int nSlot, VoiceRouteSlotState_t &state )
+{
+	CGameClient *pClient = sv.Client( nSlot );
+
+	V_memset( &state, 0, sizeof( state ) );
+	state.m_nUserID = pClient->GetUserID();
+	state.m_bActive = pClient->IsActive();
+	state.m_bSplitScreenUser = pClient->IsSplitScreenUser();
+	state.m_bLoopback = pClient->m_bVoiceLoopback;
+	state.m_bProxy = pClient->IsHLTV() || pClient->IsReplay();
+	for ( int i = 0; i < ARRAYSIZE( state.m_pSplitScreenUsers ); ++i )
+	{
+		state.m_pSplitScreenUsers[ i ] = pClient->m_SplitScreenUsers[ i ];
+	}
+}
+
+void CVoiceRouteTable::Update()
+{
+	if ( !m_bDirty )
+	{
+		if ( m_nClients != sv.GetClientCount() )
+		{
+			m_bDirty = true;
+		}
+		else
+		{
+			for ( int i = 0; i < m_nClients; ++i )
+			{
+				VoiceRouteSlotState_t state;
+				GetSlotState( i, state );
+				if ( V_memcmp( &state, &m_SlotStates[ i ], sizeof( state ) ) )
+				{
+					m_bDirty = true;
+					break;
+				}
+			}
+		}
+	}
+
+	if ( m_bDirty )
+	{
+		Build();
+	}
+}
+
+void CVoiceRouteTable::Build()
+{
+	VPROF_BUDGET( "CVoiceRouteTable::Build", VPROF_BUDGETGROUP_OTHER_NETWORKING );
+
+	m_bDirty = false;
+	m_nClients = sv.GetClientCount();
+	++s_VoiceRelayStats.m_nRouteBuilds;
+
+	m_SlotStates.SetCount( m_nClients );
+	for ( int i = 0; i < m_nClients; ++i )
+	{
+		GetSlotState( i, m_SlotStates[ i ] );
+	}
+
+	m_Speakers.SetCount( m_nClients );
+	m_Routes.SetCount( m_nClients * m_nClients );
+	m_Groups.RemoveAll();
+	m_Recipients.RemoveAll();
+
+	CUtlVector< int > destGroups;
+	destGroups.SetCount( m_nClients );
+
+	for ( int nSpeaker = 0; nSpeaker < m_nClients; ++nSpeaker )
+	{
+		SpeakerRoutes_t &speaker = m_Speakers[ nSpeaker ];
+		speaker.m_nFirstGroup = m_Groups.Count();
+		speaker.m_nGroupCount = 0;
+
+		uint8 *pRoutes = &m_Routes[ nSpeaker * m_nClients ];
+
+		for ( int nDest = 0; nDest < m_nClients; ++nDest )
+		{
+			destGroups[ nDest ] = -1;
+
+			CGameClient *pDestClient = sv.Client( nDest );
+			bool bSelf = ( nDest == nSpeaker );
+
+			// Only send voice to active clients
+			if ( !pDestClient->IsActive() )
+			{
+				pRoutes[ nDest ] = VOICE_ROUTE_INACTIVE;
+				continue;
+			}
+
+			// We'll check these guys later when we're on the host of them
+			if ( pDestClient->IsSplitScreenUser() )
+			{
+				pRoutes[ nDest ] = VOICE_ROUTE_SPLITSCREEN;
+				continue;
+			}
+
+			// Does the game code want the speaker sending to this client?
+			bool bHearsPlayer = pDestClient->IsHearingClient( nSpeaker );
+			int nAudibleMask = bHearsPlayer;
+			bool bProximity = pDestClient->IsProximityHearingClient( nSpeaker );
+
+			// If any of the parasites of the host can hear it, send it to the host
+			for ( int i = 1; i < ARRAYSIZE( pDestClient->m_SplitScreenUsers ); ++i )
+			{
+				nAudibleMask |= ( i << 1 );
+				CBaseClient *splitUser = pDestClient->m_SplitScreenUsers[ i ];
+				if ( splitUser )
+				{
+					bHearsPlayer |= splitUser->IsHearingClient( nSpeaker );
+					if ( splitUser->IsProximityHearingClient( nSpeaker ) )
+					{
+						bProximity = true;
+					}
+				}
+			}
+
+			if ( IsGameConsole() && bSelf )
+			{
+				pRoutes[ nDest ] = VOICE_ROUTE_SELF;
+				continue;
+			}
+
+			if ( !bHearsPlayer && !bSelf )
+			{
+				pRoutes[ nDest ] = VOICE_ROUTE_NOT_HEARING;
+				continue;
+			}
+
+			pRoutes[ nDest ] = VOICE_ROUTE_SEND;
+
+			// Is loopback enabled? If not the speaker still gets an empty message
+			bool bEmpty = !bHearsPlayer;
+			bool bProxy = m_SlotStates[ nDest ].m_bProxy;
+
+			int nGroup = speaker.m_nFirstGroup;
+			for ( ; nGroup < m_Groups.Count(); ++nGroup )
+			{
+				const VoiceRouteGroup_t &group = m_Groups[ nGroup ];
+				if ( group.m_nAudibleMask == nAudibleMask && group.m_bProximity == bProximity && group.m_bEmpty == bEmpty && group.m_bProxy == bProxy )
+					break;
+			}
+
+			if ( nGroup == m_Groups.Count() )
+			{
+				VoiceRouteGroup_t &group = m_Groups[ m_Groups.AddToTail() ];
+				group.m_nAudibleMask = nAudibleMask;
+				group.m_bProximity = bProximity;
+				group.m_bEmpty = bEmpty;
+				group.m_bProxy = bProxy;
+				group.m_nFirstRecipient = 0;
+				group.m_nRecipientCount = 0;
+				++speaker.m_nGroupCount;
+			}
+
+			++m_Groups[ nGroup ].m_nRecipientCount;
+			destGroups[ nDest ] = nGroup;
+		}
+
+		// Lay the recipients out contiguously per group, in slot order
+		for ( int nGroup = speaker.m_nFirstGroup; nGroup < m_Groups.Count(); ++nGroup )
+		{
+			VoiceRouteGroup_t &group = m_Groups[ nGroup ];
+			group.m_nFirstRecipient = m_Recipients.Count();
+			for ( int nDest = 0; nDest < m_nClients; ++nDest )
+			{
+				if ( destGroups[ nDest ] == nGroup )
+				{
+					m_Recipients.AddToTail( nDest );
+				}
+			}
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+// A message that has already been serialized, so the same bits can be handed
+// to several net channels without encoding the protobuf again.
+//-----------------------------------------------------------------------------
+class CEncodedNetMessage : public INetMessage
+{
+public:
+	CEncodedNetMessage( const INetMessage &source, const bf_write &encoded ) :
+		m_Source( source ), m_Encoded( encoded )
+	{
+	}
+
+	virtual void SetReliable( bool state ) { Assert( !state ); }
+	virtual bool ReadFromBuffer( bf_read &buffer ) { Assert( 0 ); return false; }
+	virtual bool WriteToBuffer( bf_write &buffer ) const
+	{
+		// Won't fit
+		if ( m_Encoded.GetNumBitsWritten() > buffer.GetNumBitsLeft() )
+			return false;
+
+		return buffer.WriteBits( m_Encoded.GetData(), m_Encoded.GetNumBitsWritten() );
+	}
+	virtual bool IsReliable( void ) const { return m_Source.IsReliable(); }
+	virtual int GetType( void ) const { return m_Source.GetType(); }
+	virtual int GetGroup( void ) const { return m_Source.GetGroup(); }
+	virtual const char *GetName( void ) const { return m_Source.GetName(); }
+	virtual const char *ToString( void ) const { return m_Source.ToString(); }
+	virtual size_t GetSize() const { return m_Source.GetSize(); }
+
+private:
+	const INetMessage	&m_Source;
+	const bf_write		&m_Encoded;
+};
+
+// Sends a voice message to a client, or into its entry of pSinks when the relay is being load tested
+static void SV_SendVoiceMsg( CBaseClient *pDestClient, INetMessage &msg, bf_write *pSinks )
+{
+	++s_VoiceRelayStats.m_nSends;
+
+	if ( pSinks )
+	{
+		bf_write &sink = pSinks[ pDestClient->GetPlayerSlot() ];
+		int nStartBit = sink.GetNumBitsWritten();
+		msg.WriteToBuffer( sink );
+		s_VoiceRelayStats.m_nBitsSent += sink.GetNumBitsWritten() - nStartBit;
+		return;
+	}
+
+	pDestClient->SendNetMsg( msg, false, true );
+}
+
+static void SV_BuildVoiceDataMsg( CSVCMsg_VoiceData_t &voiceData, int nSpeaker, const CCLCMsg_VoiceData &msg )
+{
+	voiceData.set_client( nSpeaker );
 	voiceData.set_voice_data( msg.data().c_str(), msg.data().size() );
 	if ( msg.xuid() )
 	{
@@ -2347,11 +2653,17 @@ void SV_BroadcastVoiceData(IClient * cl, const CCLCMsg_VoiceData& msg )
 	voiceData.set_sequence_bytes( msg.sequence_bytes() );
 	voiceData.set_section_number( msg.section_number() );
 	voiceData.set_uncompressed_sample_offset( msg.uncompressed_sample_offset() );
+}
 
-	if ( voice_debugfeedbackfrom.GetBool() )
-	{
-		Msg( "Sending voice from: %s - playerslot: %d [ xuid %llx ]\n", cl->GetClientName(), cl->GetPlayerSlot() + 1, msg.xuid() );
-	}
+// Relays one voice frame right away, building and encoding the message for every recipient
+static void SV_RelayVoiceDataImmediate( IClient * cl, const CCLCMsg_VoiceData& msg, bf_write *pSinks )
+{
+    ConVarRef voice_verbose( "voice_verbose" );
+
+    // Build voice message once
+	CSVCMsg_VoiceData_t voiceData;
+	SV_BuildVoiceDataMsg( voiceData, cl->GetPlayerSlot(), msg );
+	++s_VoiceRelayStats.m_nFrames;
 
     for(int i=0; i < sv.GetClientCount(); i++)
     {
@@ -2441,12 +2753,13 @@ void SV_BroadcastVoiceData(IClient * cl, const CCLCMsg_VoiceData& msg )
 				emptyVoiceMsg.set_xuid( voiceData.xuid() );
 			}
 
-			pDestClient->SendNetMsg( emptyVoiceMsg, false, true );
+			SV_SendVoiceMsg( pDestClient, emptyVoiceMsg, pSinks );
 		}
 		else
 		{
-			pDestClient->SendNetMsg( voiceData, false, true );
+			SV_SendVoiceMsg( pDestClient, voiceData, pSinks );
 		}
+		++s_VoiceRelayStats.m_nEncodes;
 
         if ( voice_verbose.GetBool() )
         {
@@ -2455,6 +2768,387 @@ void SV_BroadcastVoiceData(IClient * cl, const CCLCMsg_VoiceData& msg )
     }
 }
 
+//-----------------------------------------------------------------------------
+// Voice frames received this server frame. The payloads live back to back in
+// s_VoiceQueuePayload so queuing a frame doesn't allocate once it's warm.
+//-----------------------------------------------------------------------------
+struct QueuedVoiceFrame_t
+{
+	int		m_nSpeaker;
+	int		m_nUserID;
+	uint64	m_nXUID;
+	int		m_nFormat;
+	int		m_nSequenceBytes;
+	uint32	m_nSectionNumber;
+	uint32	m_nUncompressedSampleOffset;
+	int		m_nPayloadOffset;
+	int		m_nPayloadSize;
+};
+
+static CUtlVector< QueuedVoiceFrame_t > s_VoiceQueue;
+static CUtlVector< char > s_VoiceQueuePayload;
+
+static void SV_QueueVoiceData( IClient *cl, const CCLCMsg_VoiceData& msg )
+{
+	QueuedVoiceFrame_t &frame = s_VoiceQueue[ s_VoiceQueue.AddToTail() ];
+	frame.m_nSpeaker = cl->GetPlayerSlot();
+	frame.m_nUserID = cl->GetUserID();
+	frame.m_nXUID = msg.xuid();
+	frame.m_nFormat = msg.format();
+	frame.m_nSequenceBytes = msg.sequence_bytes();
+	frame.m_nSectionNumber = msg.section_number();
+	frame.m_nUncompressedSampleOffset = msg.uncompressed_sample_offset();
+	frame.m_nPayloadOffset = s_VoiceQueuePayload.Count();
+	frame.m_nPayloadSize = msg.data().size();
+	s_VoiceQueuePayload.AddMultipleToTail( frame.m_nPayloadSize, msg.data().data() );
+}
+
+static void SV_PrintVoiceRouteDrop( VoiceRoute_t route, CBaseClient *cl, CBaseClient *pDestClient, int nBytes )
+{
+	switch ( route )
+	{
+	case VOICE_ROUTE_INACTIVE:
+		Msg( "* SV_BroadcastVoiceData:  Not active (SignonState %d).  Dropping %d bytes from %s (%s) to %s (%s)\n", 
+			pDestClient->GetSignonState(), nBytes, 
+			cl->GetClientName(), 
+			cl->GetNetChannel() ? cl->GetNetChannel()->GetAddress() : "null", 
+			pDestClient->GetClientName(), pDestClient->GetNetChannel() ? pDestClient->GetNetChannel()->GetAddress() : "null" );
+		break;
+	case VOICE_ROUTE_SELF:
+		Msg( "* SV_BroadcastVoiceData:  Self.  Dropping %d bytes from %s (%s) to %s (%s)\n", 
+			nBytes, cl->GetClientName(), 
+			cl->GetNetChannel() ? cl->GetNetChannel()->GetAddress() : "null", 
+			pDestClient->GetClientName(), pDestClient->GetNetChannel() ? pDestClient->GetNetChannel()->GetAddress() : "null" );
+		break;
+	case VOICE_ROUTE_NOT_HEARING:
+		Msg( "* SV_BroadcastVoiceData:  Doesn't hear player.  Dropping %d bytes from %s (%s) to %s (%s)\n", 
+			nBytes, cl->GetClientName(), 
+			cl->GetNetChannel() ? cl->GetNetChannel()->GetAddress() : "null", 
+			pDestClient->GetClientName(), pDestClient->GetNetChannel() ? pDestClient->GetNetChannel()->GetAddress() : "null" );
+		break;
+	default:
+		break;
+	}
+}
+
+static void SV_FlushVoiceData( bf_write *pSinks )
+{
+	if ( !s_VoiceQueue.Count() )
+		return;
+
+	VPROF_BUDGET( "SV_FlushVoiceData", VPROF_BUDGETGROUP_OTHER_NETWORKING );
+
+	if ( !sv_voiceenable.GetInt() || !sv.IsActive() )
+	{
+		s_VoiceQueue.RemoveAll();
+		s_VoiceQueuePayload.RemoveAll();
+		return;
+	}
+
+	s_VoiceRoutes.Update();
+
+	ConVarRef voice_verbose( "voice_verbose" );
+	bool bVerbose = voice_verbose.GetBool();
+
+	CUtlVector< byte > encodeBuffer;
+	CSVCMsg_VoiceData_t voiceData;
+	CSVCMsg_VoiceData_t emptyVoiceMsg;
+
+	for ( int nFrame = 0; nFrame < s_VoiceQueue.Count(); ++nFrame )
+	{
+		const QueuedVoiceFrame_t &frame = s_VoiceQueue[ nFrame ];
+
+		// Speaker left (and maybe someone else took the slot) since the frame arrived
+		if ( frame.m_nSpeaker >= sv.GetClientCount() || sv.Client( frame.m_nSpeaker )->GetUserID() != frame.m_nUserID )
+			continue;
+
+		CGameClient *cl = sv.Client( frame.m_nSpeaker );
+
+		voiceData.Clear();
+		voiceData.set_client( frame.m_nSpeaker );
+		voiceData.set_voice_data( s_VoiceQueuePayload.Base() + frame.m_nPayloadOffset, frame.m_nPayloadSize );
+		if ( frame.m_nXUID )
+		{
+			voiceData.set_xuid( frame.m_nXUID );
+		}
+		voiceData.set_format( ( VoiceDataFormat_t )frame.m_nFormat );
+		voiceData.set_sequence_bytes( frame.m_nSequenceBytes );
+		voiceData.set_section_number( frame.m_nSectionNumber );
+		voiceData.set_uncompressed_sample_offset( frame.m_nUncompressedSampleOffset );
+		++s_VoiceRelayStats.m_nFrames;
+
+		for ( int nGroup = 0; nGroup < s_VoiceRoutes.GetGroupCount( frame.m_nSpeaker ); ++nGroup )
+		{
+			const VoiceRouteGroup_t &group = s_VoiceRoutes.GetGroup( frame.m_nSpeaker, nGroup );
+
+			CSVCMsg_VoiceData_t *pMsg = &voiceData;
+			if ( group.m_bEmpty )
+			{
+				// Still send something, just zero length (this is so the client 
+				// can display something that shows knows the server knows it's talking).
+				emptyVoiceMsg.Clear();
+				emptyVoiceMsg.set_client( voiceData.client() );
+				emptyVoiceMsg.set_audible_mask( group.m_nAudibleMask );
+				emptyVoiceMsg.set_proximity( group.m_bProximity );
+				if ( voiceData.has_xuid() )
+				{
+					emptyVoiceMsg.set_xuid( voiceData.xuid() );
+				}
+				pMsg = &emptyVoiceMsg;
+			}
+			else
+			{
+				voiceData.set_audible_mask( group.m_nAudibleMask );
+				voiceData.set_proximity( group.m_bProximity );
+			}
+
+			// CHLTVServer::SendNetMsg treats voice as a CSVCMsg_VoiceData_t (caster flag and
+			// per-caster encryption), so proxies get the message itself, encoded per send.
+			// Everyone else shares one encoding.
+			encodeBuffer.SetCount( group.m_bProxy ? 0 : AlignValue( pMsg->ByteSize() + 16, 4 ) );
+			bf_write encoded( "SV_FlushVoiceData", encodeBuffer.Base(), encodeBuffer.Count() );
+			if ( !group.m_bProxy )
+			{
+				if ( !pMsg->WriteToBuffer( encoded ) )
+					continue;
+				++s_VoiceRelayStats.m_nEncodes;
+			}
+
+			CEncodedNetMessage encodedMsg( *pMsg, encoded );
+			INetMessage &sendMsg = group.m_bProxy ? static_cast< INetMessage & >( *pMsg ) : encodedMsg;
+			for ( int i = 0; i < group.m_nRecipientCount; ++i )
+			{
+				CGameClient *pDestClient = sv.Client( s_VoiceRoutes.GetRecipient( group, i ) );
+				SV_SendVoiceMsg( pDestClient, sendMsg, pSinks );
+				if ( group.m_bProxy )
+				{
+					++s_VoiceRelayStats.m_nEncodes;
+				}
+
+				if ( bVerbose )
+				{
+					Msg( "* SV_BroadcastVoiceData: Sending %d bits (%d bytes) from %s (%s) to %s (%s).  Proximity %s.\n", voiceData.voice_data().size(), Bits2Bytes(voiceData.voice_data().size()), cl->GetClientName(), cl->GetNetChannel() ? cl->GetNetChannel()->GetAddress() : "null", pDestClient->GetClientName(), pDestClient->GetNetChannel() ? pDestClient->GetNetChannel()->GetAddress() : "null", group.m_bProximity ? "true" : "false" );
+				}
+			}
+		}
+
+		if ( bVerbose )
+		{
+			for ( int nDest = 0; nDest < sv.GetClientCount(); ++nDest )
+			{
+				SV_PrintVoiceRouteDrop( s_VoiceRoutes.GetRoute( frame.m_nSpeaker, nDest ), cl, sv.Client( nDest ), frame.m_nPayloadSize );
+			}
+		}
+	}
+
+	s_VoiceQueue.RemoveAll();
+	s_VoiceQueuePayload.RemoveAll();
+}
+
+void SV_FlushVoiceData( void )
+{
+	SV_FlushVoiceData( NULL );
+}
+
+void SV_BroadcastVoiceData(IClient * cl, const CCLCMsg_VoiceData& msg )
+{
+    ConVarRef voice_verbose( "voice_verbose" );
+
+    // Disable voice?
+    if( !sv_voiceenable.GetInt() )
+    {
+        if ( voice_verbose.GetBool() )
+        {
+            Msg( "* SV_BroadcastVoiceData:  Dropping all voice.  sv_voiceenable is not set.\n" );
+        }
+        return;
+    }
+
+	if ( voice_debugfeedbackfrom.GetBool() )
+	{
+		Msg( "Sending voice from: %s - playerslot: %d [ xuid %llx ]\n", cl->GetClientName(), cl->GetPlayerSlot() + 1, msg.xuid() );
+	}
+
+	if ( sv_voice_batch.GetBool() )
+	{
+		// Relayed with everything else received this frame by SV_FlushVoiceData
+		SV_QueueVoiceData( cl, msg );
+	}
+	else
+	{
+		SV_RelayVoiceDataImmediate( cl, msg, NULL );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Drives simulated voice from every active client (add bots first) through the
+// immediate and the batched relay, writing into per-client scratch streams
+// instead of the net channels, and checks both produce the same bits.
+//-----------------------------------------------------------------------------
+CON_COMMAND_F( sv_voice_loadtest, "Relay simulated voice traffic from the current (fake) clients through both voice relay paths. Usage: sv_voice_loadtest [ticks=1000] [bytes=80] [-team] [-all]", FCVAR_CHEAT )
+{
+	if ( !sv.IsActive() )
+	{
+		ConMsg( "Can't 'sv_voice_loadtest', not running a server\n" );
+		return;
+	}
+
+	if ( !sv_voiceenable.GetBool() )
+	{
+		ConMsg( "sv_voice_loadtest: sv_voiceenable is 0\n" );
+		return;
+	}
+
+	int nTicks = ( args.ArgC() > 1 && args[1][0] != '-' ) ? Max( atoi( args[1] ), 1 ) : 1000;
+	int nBytes = ( args.ArgC() > 2 && args[2][0] != '-' ) ? clamp( atoi( args[2] ), 1, 4096 ) : 80;
+	bool bTeam = args.FindArg( "-team" ) != NULL;
+	bool bAll = args.FindArg( "-all" ) != NULL;
+
+	int nClients = sv.GetClientCount();
+	CUtlVector< int > speakers;
+	for ( int i = 0; i < nClients; ++i )
+	{
+		CGameClient *pClient = sv.Client( i );
+		if ( pClient->IsActive() && !pClient->IsSplitScreenUser() && !pClient->IsHLTV() && !pClient->IsReplay() )
+		{
+			speakers.AddToTail( i );
+		}
+	}
+
+	if ( speakers.Count() < 2 )
+	{
+		ConMsg( "sv_voice_loadtest: need at least two active clients, add some bots first\n" );
+		return;
+	}
+
+	// Optionally replace the game's listening state with a fixed pattern for the run
+	CUtlVector< CPlayerBitVec > savedStreams, savedProximity;
+	savedStreams.SetCount( nClients );
+	savedProximity.SetCount( nClients );
+	for ( int i = 0; i < nClients; ++i )
+	{
+		savedStreams[ i ] = sv.Client( i )->m_VoiceStreams;
+		savedProximity[ i ] = sv.Client( i )->m_VoiceProximity;
+		if ( bTeam || bAll )
+		{
+			for ( int j = 0; j < nClients; ++j )
+			{
+				sv.Client( i )->m_VoiceStreams.Set( j, ( bAll || ( i & 1 ) == ( j & 1 ) ) ? 1 : 0 );
+				sv.Client( i )->m_VoiceProximity.Set( j, 0 );
+			}
+		}
+	}
+	SV_InvalidateVoiceRoutes();
+
+	// Anything real that is queued goes out first so it doesn't end up in the scratch streams
+	SV_FlushVoiceData( NULL );
+
+	CUtlVector< byte > sinkMemory;
+	CUtlVector< bf_write > sinks;
+	int nSinkBytes = speakers.Count() * ( nBytes + 64 );
+	sinkMemory.SetCount( nClients * nSinkBytes );
+	sinks.SetCount( nClients );
+
+	CUtlVector< char > payload;
+	payload.SetCount( nBytes );
+
+	CCLCMsg_VoiceData_t voiceMsg;
+	voiceMsg.set_format( VOICEDATA_FORMAT_STEAM );
+
+	const char *pszPaths[] = { "immediate", "batched" };
+	VoiceRelayStats_t results[ 2 ];
+	CRC32_t nCRC[ 2 ];
+	double flMilliseconds[ 2 ];
+	int nOverflows[ 2 ];
+
+	for ( int nPath = 0; nPath < 2; ++nPath )
+	{
+		CUniformRandomStream random;
+		random.SetSeed( 0x5eed );
+
+		V_memset( &s_VoiceRelayStats, 0, sizeof( s_VoiceRelayStats ) );
+		SV_InvalidateVoiceRoutes();
+		CRC32_Init( &nCRC[ nPath ] );
+		flMilliseconds[ nPath ] = 0.0;
+		nOverflows[ nPath ] = 0;
+
+		for ( int nTick = 0; nTick < nTicks; ++nTick )
+		{
+			V_memset( sinkMemory.Base(), 0, sinkMemory.Count() );
+			for ( int i = 0; i < nClients; ++i )
+			{
+				sinks[ i ].StartWriting( sinkMemory.Base() + i * nSinkBytes, nSinkBytes );
+			}
+
+			CFastTimer timer;
+			double flTickMs = 0.0;
+			for ( int i = 0; i < speakers.Count(); ++i )
+			{
+				for ( int j = 0; j < nBytes; ++j )
+				{
+					payload[ j ] = ( char )random.RandomInt( 0, 255 );
+				}
+				voiceMsg.set_data( payload.Base(), nBytes );
+				voiceMsg.set_sequence_bytes( ( nTick + 1 ) * nBytes );
+				voiceMsg.set_section_number( nTick );
+
+				CGameClient *cl = sv.Client( speakers[ i ] );
+				timer.Start();
+				if ( nPath == 0 )
+				{
+					SV_RelayVoiceDataImmediate( cl, voiceMsg, sinks.Base() );
+				}
+				else
+				{
+					SV_QueueVoiceData( cl, voiceMsg );
+				}
+				timer.End();
+				flTickMs += timer.GetDuration().GetMillisecondsF();
+			}
+
+			if ( nPath == 1 )
+			{
+				timer.Start();
+				SV_FlushVoiceData( sinks.Base() );
+				timer.End();
+				flTickMs += timer.GetDuration().GetMillisecondsF();
+			}
+			flMilliseconds[ nPath ] += flTickMs;
+
+			for ( int i = 0; i < nClients; ++i )
+			{
+				nOverflows[ nPath ] += sinks[ i ].IsOverflowed() ? 1 : 0;
+				CRC32_ProcessBuffer( &nCRC[ nPath ], sinks[ i ].GetData(), sinks[ i ].GetNumBytesWritten() );
+			}
+		}
+
+		CRC32_Final( &nCRC[ nPath ] );
+		results[ nPath ] = s_VoiceRelayStats;
+	}
+
+	for ( int i = 0; i < nClients; ++i )
+	{
+		sv.Client( i )->m_VoiceStreams = savedStreams[ i ];
+		sv.Client( i )->m_VoiceProximity = savedProximity[ i ];
+	}
+	SV_InvalidateVoiceRoutes();
+	V_memset( &s_VoiceRelayStats, 0, sizeof( s_VoiceRelayStats ) );
+
+	ConMsg( "sv_voice_loadtest: %d speakers, %d clients, %d ticks, %d byte frames, routing %s\n",
+		speakers.Count(), nClients, nTicks, nBytes, bAll ? "all" : ( bTeam ? "team" : "game" ) );
+	for ( int nPath = 0; nPath < 2; ++nPath )
+	{
+		const VoiceRelayStats_t &stats = results[ nPath ];
+		ConMsg( "  %-9s %8.2f ms (%6.2f us/tick)  frames %lld  encodes %lld  sends %lld  bytes %lld  route builds %lld%s\n",
+			pszPaths[ nPath ], flMilliseconds[ nPath ], 1000.0 * flMilliseconds[ nPath ] / nTicks,
+			stats.m_nFrames, stats.m_nEncodes, stats.m_nSends, ( stats.m_nBitsSent + 7 ) / 8, stats.m_nRouteBuilds,
+			nOverflows[ nPath ] ? "  (scratch overflowed)" : "" );
+	}
+	ConMsg( "  output %s (crc %08x / %08x), speedup %.2fx\n",
+		nCRC[ 0 ] == nCRC[ 1 ] ? "matches" : "DIFFERS", nCRC[ 0 ], nCRC[ 1 ],
+		flMilliseconds[ 1 ] > 0.0 ? flMilliseconds[ 0 ] / flMilliseconds[ 1 ] : 0.0 );
+}
+
 
 // UNDONE: "player.mdl" ???  This should be set by name in the DLL
 /*
@@ -3440,6 +4134,7 @@ void SV_Frame( bool finalTick )
     {
         // Need to process LAN searches
         NET_ProcessSocket( NS_SERVER, &sv );
+        SV_FlushVoiceData();
         return;
     }
 
@@ -3454,6 +4149,9 @@ void SV_Frame( bool finalTick )
     // Run any commands from client and play client Think functions if it is time.
     sv.RunFrame(); // read network input etc
 
+    // Relay the voice that came in with it
+    SV_FlushVoiceData();
+
     if ( sv.GetClientCount() > 0 )
     {	
         bool serverCanSimulate = ( serverGameDLL && !serverGameDLL->IsRestoring() ) ? true : false;
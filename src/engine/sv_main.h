@@ -101,6 +101,10 @@ void SV_TermSendTables( ServerClass *pClasses );
 
 // send voice data from cl to other clients
 void SV_BroadcastVoiceData(IClient * cl, const CCLCMsg_VoiceData& msg );
+// relay the voice queued by SV_BroadcastVoiceData this frame
+void SV_FlushVoiceData( void );
+// listening state changed, rebuild the voice routing table before the next relay
+void SV_InvalidateVoiceRoutes( void );
 void SV_SendRestoreMsg( bf_write &dest );
 
 // A client has uploaded its logo to us;
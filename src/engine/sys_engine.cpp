@@ -31,6 +31,7 @@
 #include "gl_cvars.h"
 #include "filesystem_engine.h"
 #include "tier0/cpumonitoring.h"
+#include "net.h"
 #ifndef DEDICATED
 #include "vgui_baseui_interface.h"
 #endif
@@ -43,6 +44,11 @@
 #include "appframework/ilaunchermgr.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
+#if defined( LINUX )
+#include <pthread.h>
+#include <sched.h>
+#endif
+
 #include "tier0/memdbgon.h"
 
 
@@ -130,6 +136,103 @@ CON_COMMAND( host_filtered_time_report, "Dumps time spent idle in previous frame
 	}
 }
 
+static ConVar sv_tick_scheduler( "sv_tick_scheduler", "1", FCVAR_RELEASE, "Dedicated server: sleep until the exact next tick deadline (timerfd/epoll on Linux) and receive packets that arrive in between." );
+static ConVar sv_tick_scheduler_cpu( "sv_tick_scheduler_cpu", "-1", FCVAR_RELEASE, "Dedicated server: pin the main thread to this CPU (-1 to leave it unpinned, Linux only)." );
+
+// Lateness of frame start against the tick deadline the dedicated server slept for
+static const int s_TickJitterBucketsUS[] = { 10, 25, 50, 100, 250, 500, 1000, 2000, 5000 };
+static unsigned int	host_tickjitter_histogram[ ARRAYSIZE( s_TickJitterBucketsUS ) + 1 ] = { 0 };
+static unsigned int	host_tickjitter_count = 0;
+static double		host_tickjitter_total = 0.0;
+static double		host_tickjitter_max = 0.0;
+
+static void RecordTickJitter( double flLateness )
+{
+	int nLatenessUS = (int)( MAX( flLateness, 0.0 ) * 1000000.0 );
+	int nBucket = 0;
+	while ( nBucket < ARRAYSIZE( s_TickJitterBucketsUS ) && nLatenessUS >= s_TickJitterBucketsUS[ nBucket ] )
+	{
+		++nBucket;
+	}
+
+	++host_tickjitter_histogram[ nBucket ];
+	++host_tickjitter_count;
+	host_tickjitter_total += flLateness;
+	host_tickjitter_max = MAX( host_tickjitter_max, flLateness );
+}
+
+CON_COMMAND( host_tick_jitter_histogram, "Histogram of tick start lateness against the scheduled deadline in microseconds (dedicated only).\n  host_tick_jitter_histogram [reset]" )
+{
+	if ( !sv.IsDedicated() )
+		return;
+
+	if ( args.ArgC() > 1 && !V_stricmp( args[1], "reset" ) )
+	{
+		V_memset( host_tickjitter_histogram, 0, sizeof( host_tickjitter_histogram ) );
+		host_tickjitter_count = 0;
+		host_tickjitter_total = 0.0;
+		host_tickjitter_max = 0.0;
+		return;
+	}
+
+	Msg( "%u ticks, scheduler %s, mean %d us, max %d us\n", host_tickjitter_count, sv_tick_scheduler.GetBool() ? "on" : "off",
+		host_tickjitter_count ? (int)( host_tickjitter_total / host_tickjitter_count * 1000000.0 ) : 0, (int)( host_tickjitter_max * 1000000.0 ) );
+
+	for ( int i = 0; i < ARRAYSIZE( host_tickjitter_histogram ); ++i )
+	{
+		float flPercent = host_tickjitter_count ? 100.0f * host_tickjitter_histogram[i] / host_tickjitter_count : 0.0f;
+		if ( i < ARRAYSIZE( s_TickJitterBucketsUS ) )
+		{
+			Msg( "  < %5d us: %8u (%5.1f%%)\n", s_TickJitterBucketsUS[i], host_tickjitter_histogram[i], flPercent );
+		}
+		else
+		{
+			Msg( "  >=%5d us: %8u (%5.1f%%)\n", s_TickJitterBucketsUS[i - 1], host_tickjitter_histogram[i], flPercent );
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Applies sv_tick_scheduler_cpu to the calling (main) thread
+//-----------------------------------------------------------------------------
+static void UpdateMainThreadAffinity()
+{
+#if defined( LINUX )
+	static int s_nPinnedCPU = -1;
+	static bool s_bSavedAffinity = false;
+	static cpu_set_t s_OriginalAffinity;
+
+	int nCPU = sv_tick_scheduler_cpu.GetInt();
+	if ( nCPU == s_nPinnedCPU )
+		return;
+
+	if ( !s_bSavedAffinity )
+	{
+		pthread_getaffinity_np( pthread_self(), sizeof( s_OriginalAffinity ), &s_OriginalAffinity );
+		s_bSavedAffinity = true;
+	}
+
+	int nResult;
+	if ( nCPU >= 0 && nCPU < CPU_SETSIZE )
+	{
+		cpu_set_t cpuSet;
+		CPU_ZERO( &cpuSet );
+		CPU_SET( nCPU, &cpuSet );
+		nResult = pthread_setaffinity_np( pthread_self(), sizeof( cpuSet ), &cpuSet );
+	}
+	else
+	{
+		nResult = pthread_setaffinity_np( pthread_self(), sizeof( s_OriginalAffinity ), &s_OriginalAffinity );
+	}
+
+	if ( nResult != 0 )
+	{
+		Warning( "sv_tick_scheduler_cpu: couldn't set main thread affinity to CPU %d (error %d)\n", nCPU, nResult );
+	}
+	s_nPinnedCPU = nCPU;
+#endif
+}
+
 //-----------------------------------------------------------------------------
 // Purpose:
 //-----------------------------------------------------------------------------
@@ -173,6 +276,7 @@ private:
 	double			m_flPreviousTime;
 	float			m_flFilteredTime;
 	float			m_flMinFrameTime; // Expected duration of a frame, or zero if it is unlimited.
+	double			m_flTickDeadline; // Dedicated only: Plat_FloatTime the last filtered frame waited for, or zero.
 #ifdef _GAMECONSOLE
 	float           m_flTimeSinceLastXBXProcessEventsCall;
 #endif
@@ -205,6 +309,7 @@ CEngine::CEngine( void )
 	m_flPreviousTime	= 0.0;
 	m_flFilteredTime	= 0.0f;
 	m_flMinFrameTime	= 0.0f;
+	m_flTickDeadline	= 0.0;
 #ifdef _GAMECONSOLE
 	m_flTimeSinceLastXBXProcessEventsCall = 1.0e19;			// make ti call on first frame
 #endif
@@ -476,9 +581,26 @@ void CEngine::Frame( void )
 	if ( m_flFrameTime < 0.0f )
 		return;
 
+	if ( sv.IsDedicated() )
+	{
+		UpdateMainThreadAffinity();
+	}
+
 	// If the frametime is still too short, don't pass through
 	if ( !FilterTime( m_flFrameTime ) )
 	{
+		if ( sv.IsDedicated() && !g_bDedicatedServerBenchmarkMode )
+		{
+			m_flTickDeadline = Plat_FloatTime() + ( m_flMinFrameTime - m_flFrameTime );
+
+			if ( sv_tick_scheduler.GetBool() && sleep_when_meeting_framerate.GetInt() )
+			{
+				TM_ZONE( TELEMETRY_LEVEL0, TMZF_NONE, "Engine Tick Wait" );
+				NET_WaitForTickDeadline( m_flTickDeadline, true );
+				m_flFilteredTime += dt;
+				return;
+			}
+		}
 #ifdef POSIX
 		double fSleepNS = ( m_flMinFrameTime - m_flFrameTime ) * 1000000000.0;
 		unsigned nSleepNS = (unsigned)floor( fSleepNS );
@@ -502,6 +624,12 @@ void CEngine::Frame( void )
 
     TM_ZONE( TELEMETRY_LEVEL0, TMZF_NONE, __PRETTY_FUNCTION__ );
 
+	if ( m_flTickDeadline != 0.0 )
+	{
+		RecordTickJitter( Plat_FloatTime() - m_flTickDeadline );
+		m_flTickDeadline = 0.0;
+	}
+
 	if ( ShouldSerializeAsync() )
 	{
 		static ConVar *pSyncReportConVar = g_pCVar->FindVar( "fs_report_sync_opens" );
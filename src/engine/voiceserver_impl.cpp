@@ -7,6 +7,7 @@
 
 #include "quakedef.h"
 #include "server.h"
+#include "sv_main.h"
 #include "ivoiceserver.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
@@ -45,7 +46,11 @@ public:
 			Msg( "* CVoiceServer::SetClientListening:  %s m_VoiceStreams from %s (%s) to %s (%s)\n", bListen ? "Enable" : "Disable", cl->GetClientName(), cl->GetNetChannel() ? cl->GetNetChannel()->GetAddress() : "null", sv.Client(iReceiver)->GetClientName(), sv.Client(iReceiver)->GetNetChannel() ? sv.Client(iReceiver)->GetNetChannel()->GetAddress() : "null" );
 		}
 
-		cl->m_VoiceStreams.Set( iReceiver, bListen?1:0 );
+		if ( !!cl->m_VoiceStreams.Get( iReceiver ) != !!bListen )
+		{
+			cl->m_VoiceStreams.Set( iReceiver, bListen?1:0 );
+			SV_InvalidateVoiceRoutes();
+		}
 
 		return true;
 	}	
@@ -60,7 +65,11 @@ public:
 
 		CGameClient *cl = sv.Client(iSender);
 
-		cl->m_VoiceProximity.Set( iReceiver, bUseProximity );
+		if ( !!cl->m_VoiceProximity.Get( iReceiver ) != !!bUseProximity )
+		{
+			cl->m_VoiceProximity.Set( iReceiver, bUseProximity );
+			SV_InvalidateVoiceRoutes();
+		}
 
 		return true;
 	}	
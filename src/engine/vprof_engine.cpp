@@ -15,6 +15,8 @@
 #include "tier1/strtools.h"
 #include "con_nprint.h"
 #include "tier0/vprof.h"
+#include "tier0/vprof_trace.h"
+#include "host.h"
 #include "materialsystem/imaterialsystem.h"
 #ifndef DEDICATED
 #include "vgui_baseui_interface.h"
@@ -123,6 +125,88 @@ CON_COMMAND(vprof_dump_counters, "Dump vprof counters to the console" )
 	g_bDumpCounters = true;
 }
 
+//-----------------------------------------------------------------------------
+// Zone trace capture (tier0/vprof_trace.h): records TM_ZONE, SNPROF and VPROF
+// zones on every thread for a number of ticks and writes Chrome trace JSON
+//-----------------------------------------------------------------------------
+static ConVar trace_capture_events( "trace_capture_events", "262144", 0, "Number of zones each thread keeps during trace_capture (older zones are overwritten)." );
+
+static int s_nTraceCaptureStartTick = -1;
+static int s_nTraceCaptureTicks = 0;
+static char s_szTraceCaptureFile[ MAX_PATH ];
+
+static void TraceCapture_WriteToFile( const char *pData, int nLength, void *pContext )
+{
+	g_pFileSystem->Write( pData, nLength, (FileHandle_t)pContext );
+}
+
+static void TraceCapture_Finish()
+{
+	TraceCapture_Stop();
+
+	int nTicks = host_tickcount - s_nTraceCaptureStartTick;
+	s_nTraceCaptureStartTick = -1;
+
+	FileHandle_t hFile = g_pFileSystem->Open( s_szTraceCaptureFile, "wb" );
+	if ( hFile == FILESYSTEM_INVALID_HANDLE )
+	{
+		Warning( "trace_capture: couldn't open %s for writing\n", s_szTraceCaptureFile );
+		return;
+	}
+
+	int nZones = TraceCapture_WriteJSON( TraceCapture_WriteToFile, hFile );
+	g_pFileSystem->Close( hFile );
+
+	Msg( "trace_capture: wrote %d zones over %d ticks to %s\n", nZones, nTicks, s_szTraceCaptureFile );
+}
+
+static void UpdateTraceCapture()
+{
+	if ( s_nTraceCaptureStartTick >= 0 && host_tickcount - s_nTraceCaptureStartTick >= s_nTraceCaptureTicks )
+	{
+		TraceCapture_Finish();
+	}
+}
+
+CON_COMMAND( trace_capture, "Record TM_ZONE/SNPROF/VPROF zones on all threads for a number of ticks and write them as Chrome trace JSON.\n  trace_capture <ticks> [file]" )
+{
+	if ( args.ArgC() < 2 )
+	{
+		Msg( "Usage: trace_capture <ticks> [file]\n" );
+		return;
+	}
+
+	if ( s_nTraceCaptureStartTick >= 0 )
+	{
+		TraceCapture_Finish();
+	}
+
+	if ( args.ArgC() > 2 )
+	{
+		V_strncpy( s_szTraceCaptureFile, args[2], sizeof( s_szTraceCaptureFile ) );
+		V_DefaultExtension( s_szTraceCaptureFile, ".json", sizeof( s_szTraceCaptureFile ) );
+	}
+	else
+	{
+		g_pFileSystem->CreateDirHierarchy( "vprof" );
+		V_snprintf( s_szTraceCaptureFile, sizeof( s_szTraceCaptureFile ), "vprof/trace_%d.json", host_tickcount );
+	}
+
+	s_nTraceCaptureTicks = clamp( atoi( args[1] ), 1, 100000 );
+	s_nTraceCaptureStartTick = host_tickcount;
+	TraceCapture_Start( trace_capture_events.GetInt() );
+
+	Msg( "trace_capture: recording %d ticks\n", s_nTraceCaptureTicks );
+}
+
+CON_COMMAND( trace_capture_stop, "Stop a running trace_capture early and write it out." )
+{
+	if ( s_nTraceCaptureStartTick >= 0 )
+	{
+		TraceCapture_Finish();
+	}
+}
+
 void PreUpdateProfile( float filteredtime )
 {
 	Assert( g_VProfCurrentProfile.AtRoot() );
@@ -130,6 +214,7 @@ void PreUpdateProfile( float filteredtime )
 	ExecuteDeferredOp();
 	VProfExport_StartOrStop();
 	VProfRecord_StartOrStop();
+	UpdateTraceCapture();
 
 	if ( g_VProfCurrentProfile.GetTargetThreadId() != g_VProfTargetThread )
 	{
@@ -172,7 +257,7 @@ void PreUpdateProfile( float filteredtime )
 				Msg( "******** Spike on frame %d at time %.3f ", g_ServerGlobalVariables.framecount, Plat_FloatTime() );
 				if ( vprof_dump_spikes_hierarchy.GetBool() )
 				{
-					g_VProfCurrentProfile.OutputReport( VPRT_HIERARCHY_TIME_PER_FRAME_AND_COUNT_ONLY,
+					g_VProfCurrentProfile.OutputReport( VPRT_HIERARCHY_TIME_PER_FRAME_AND_COUNT_ONLY | VPRT_WORKER_THREADS,
 						( vprof_dump_spikes_node.GetString()[0] ) ? vprof_dump_spikes_node.GetString() : NULL,
 						( vprof_dump_spikes_budget_group.GetString()[0] ) ? g_VProfCurrentProfile.BudgetGroupNameToBudgetGroupID( vprof_dump_spikes_budget_group.GetString() ) : -1 );
 				}
@@ -181,7 +266,7 @@ void PreUpdateProfile( float filteredtime )
 					int flags;
 					if ( !vprof_dump_spikes_terse.GetBool() )
 					{
-						flags = VPRT_SUMMARY | VPRT_LIST_BY_TIME | VPRT_LIST_BY_AVG_TIME | VPRT_LIST_BY_TIME_LESS_CHILDREN | VPRT_LIST_TOP_ITEMS_ONLY;
+						flags = VPRT_SUMMARY | VPRT_LIST_BY_TIME | VPRT_LIST_BY_AVG_TIME | VPRT_LIST_BY_TIME_LESS_CHILDREN | VPRT_LIST_TOP_ITEMS_ONLY | VPRT_WORKER_THREADS;
 					}
 					else
 					{
@@ -780,6 +865,17 @@ public:
 		{
 			CalculateBudgetGroupTimes_Recursive( pNode->GetChild() );
 		}
+
+		// Scopes recorded on worker threads, so jobs are charged to their real
+		// budget groups instead of vanishing from the panel.
+		int nGroups = MIN( m_Times.Count(), GetActiveVProfile()->GetNumBudgetGroups() );
+		for ( int i = 0; i < nGroups; i++ )
+		{
+			if ( CanShowBudgetGroup( i ) )
+			{
+				m_Times[i] += GetActiveVProfile()->GetWorkerBudgetGroupTime( i );
+			}
+		}
 	}
 
 private:
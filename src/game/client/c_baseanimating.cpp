@@ -2892,7 +2892,9 @@ void C_BaseAnimating::ThreadedBoneSetup()
 			{
 				CParallelProcessor<C_BaseAnimating *, CFuncJobItemProcessor<C_BaseAnimating *>, 2 > processor;
 				processor.m_ItemProcessor.Init( &SetupBonesOnBaseAnimating, &PreThreadedBoneSetup, &PostThreadedBoneSetup );
+				::partition->BeginReadPhase( PARTITION_CLIENT_GAME_EDICTS );
 				processor.Run( g_PreviousBoneSetups.Base(), nCount, 1, INT_MAX, g_pBoneSetupThreadPool );
+				::partition->EndReadPhase( PARTITION_CLIENT_GAME_EDICTS );
 			}
 			else
 			{
@@ -1947,6 +1947,9 @@ public:
 		pParticle->m_vecVelocity += ( vecWindVelocity * r_SnowWindScale.GetFloat() );
 	}
 
+	// IsInAir queries the engine for point contents.
+	bool ShouldSimulateOnMainThread() const { return true; }
+
 	void SimulateParticles( CParticleSimulateIterator *pIterator )
 	{
 		float timeDelta = pIterator->GetTimeDelta();
@@ -49,6 +49,7 @@ public:
 
 	virtual void RenderParticles( CParticleRenderIterator *pIterator );
 	virtual void SimulateParticles( CParticleSimulateIterator *pIterator );
+	virtual bool ShouldSimulateOnMainThread() const	{ return true; }	// Traces through m_ParticleCollision.
 
 	//Setup for point emission
 	virtual void		Setup( const Vector &origin, const Vector *direction, float angularSpread, float minSpeed, float maxSpeed, float gravity, float dampen, int flags = 0 );
@@ -55,6 +55,7 @@ public:
 
 	virtual void RenderParticles( CParticleRenderIterator *pIterator );
 	virtual void SimulateParticles( CParticleSimulateIterator *pIterator );
+	virtual bool ShouldSimulateOnMainThread() const	{ return true; }	// Traces through m_ParticleCollision.
 
 	CParticleCollision	m_ParticleCollision;
 
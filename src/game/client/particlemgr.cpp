@@ -1192,6 +1192,13 @@ bool CParticleMgr::AddEffect( CParticleEffectBinding *pEffect, IParticleEffect *
 #endif
 	pEffect->Init( this, pSim );
 
+	// Effects that are also entities read their control points from entity state (abs origins,
+	// attachments) and have to stay on the main thread. ShouldSimulateOnMainThread is asked when
+	// simulating, since CParticleEffect adds itself from its constructor, before overrides apply.
+#if !defined( PARTICLEPROTOTYPE_APP )
+	pEffect->SetMainThreadSimulate( dynamic_cast< C_BaseEntity* >( pSim ) != NULL );
+#endif
+
 	// Add it to the leaf system.
 #if !defined( PARTICLEPROTOTYPE_APP )
 	ClientLeafSystem()->CreateRenderableHandle( pEffect, false, RENDERABLE_IS_TRANSLUCENT, RENDERABLE_MODEL_ENTITY );
@@ -1810,9 +1817,16 @@ void CParticleMgr::UpdateNewEffects( float flTimeDelta )
 		nCount = particlesToSimulate.Count();
 	}
 
+	// Flush dirty entities first, that writes to the partition
 	if ( nCount )
 	{
 		UpdateDirtySpatialPartitionEntities();
+	}
+
+	// Particle collision queries the partition from the simulation jobs; let them skip its lock
+	::partition->BeginReadPhase( PARTITION_ALL_CLIENT_EDICTS );
+	if ( nCount )
+	{
 		if ( !r_threaded_particles.GetBool() )
 		{
 			for( int i=0; i<nCount; i++)
@@ -1850,6 +1864,7 @@ void CParticleMgr::UpdateNewEffects( float flTimeDelta )
 	{
 		ParallelProcess( nonDrawingSimulateList.Base(), nonDrawingSimulateList.Count(), ProcessNonDrawingSystem, PreProcessPSystem, PostProcessPSystem );
 	}
+	::partition->EndReadPhase( PARTITION_ALL_CLIENT_EDICTS );
 
 	
 
@@ -1868,6 +1883,106 @@ void CParticleMgr::UpdateNewEffects( float flTimeDelta )
 	}
 }
 
+static ConVar r_threaded_particle_effects( "r_threaded_particle_effects", "1", 0, "Simulate old-style particle effects in batches on the job pool." );
+static ConVar r_particle_effect_batch_size( "r_particle_effect_batch_size", "256", 0, "Approximate number of particles in each old-style particle effect simulation batch." );
+
+struct LegacyEffectBatch_t
+{
+	CParticleEffectBinding **m_ppEffects;
+	int m_nCount;
+};
+
+static float s_flLegacyEffectTimeStep;
+
+static void ProcessLegacyEffectBatch( LegacyEffectBatch_t &batch )
+{
+	for ( int i = 0; i < batch.m_nCount; ++i )
+	{
+		batch.m_ppEffects[i]->SimulateParticles( s_flLegacyEffectTimeStep );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Simulates old-style particle effects. Effects that are flagged for the main
+// thread run here; the rest are grouped into batches of roughly
+// r_particle_effect_batch_size particles and run on the job pool. Returns
+// after all batches have been joined, so callers can render from the results.
+//-----------------------------------------------------------------------------
+void CParticleMgr::SimulateLegacyEffects( CParticleEffectBinding **ppEffects, int nCount, float flTimeDelta )
+{
+	if ( !nCount )
+		return;
+
+	VPROF_BUDGET( "CParticleMgr::SimulateLegacyEffects", VPROF_BUDGETGROUP_PARTICLE_SIMULATION );
+
+	double flStartTime = g_bMeasureParticlePerformance ? Plat_FloatTime() : 0.0;
+	int nParticles = 0;
+
+	// Move the effects that may run on a worker to the front, keeping their relative order.
+	CUtlVectorFixedGrowable< CParticleEffectBinding*, 256 > mainThreadEffects;
+	CUtlVectorFixedGrowable< LegacyEffectBatch_t, 32 > batches;
+	bool bThreaded = r_threaded_particles.GetBool() && r_threaded_particle_effects.GetBool();
+	int nBatchSize = MAX( 1, r_particle_effect_batch_size.GetInt() );
+
+	int nParallel = 0;
+	int nBatchParticles = 0;
+	for ( int i = 0; i < nCount; ++i )
+	{
+		CParticleEffectBinding *pEffect = ppEffects[i];
+		int nActive = pEffect->GetNumActiveParticles();
+		nParticles += nActive;
+
+		if ( !bThreaded || pEffect->GetMainThreadSimulate() || pEffect->GetFlag( CParticleEffectBinding::FLAGS_NEW_PARTICLE_SYSTEM ) ||
+			pEffect->m_pSim->ShouldSimulateOnMainThread() )
+		{
+			mainThreadEffects.AddToTail( pEffect );
+			continue;
+		}
+
+		if ( !batches.Count() || nBatchParticles >= nBatchSize )
+		{
+			LegacyEffectBatch_t &batch = batches[ batches.AddToTail() ];
+			batch.m_ppEffects = ppEffects + nParallel;
+			batch.m_nCount = 0;
+			nBatchParticles = 0;
+		}
+		ppEffects[nParallel++] = pEffect;
+		batches.Tail().m_nCount++;
+		nBatchParticles += nActive;
+	}
+
+	s_flLegacyEffectTimeStep = flTimeDelta;
+	if ( batches.Count() == 1 )
+	{
+		ProcessLegacyEffectBatch( batches[0] );
+	}
+	else if ( batches.Count() > 1 )
+	{
+		if ( !m_pThreadPool[1] )
+		{
+			ParallelProcess( batches.Base(), batches.Count(), ProcessLegacyEffectBatch, PreProcessPSystem, PostProcessPSystem );
+		}
+		else
+		{
+			CParallelProcessor< LegacyEffectBatch_t, CFuncJobItemProcessor< LegacyEffectBatch_t >, 3 > processor;
+			processor.m_ItemProcessor.Init( ProcessLegacyEffectBatch, PreProcessPSystem, PostProcessPSystem );
+			processor.Run( batches.Base(), batches.Count(), 1, INT_MAX, m_pThreadPool[1] );
+		}
+	}
+
+	// Effects that touch entities or the collision cache run on this thread once the batches have joined.
+	for ( int i = 0; i < mainThreadEffects.Count(); ++i )
+	{
+		mainThreadEffects[i]->SimulateParticles( flTimeDelta );
+	}
+
+	if ( g_bMeasureParticlePerformance )
+	{
+		g_nNumParticlesSimulated += nParticles;
+		g_nNumUSSpentSimulatingParticles += 1.0e6 * ( Plat_FloatTime() - flStartTime );
+	}
+}
+
 void CParticleMgr::UpdateAllEffects( float flTimeDelta )
 {
 	m_bUpdatingEffects = true;
@@ -1881,6 +1996,9 @@ void CParticleMgr::UpdateAllEffects( float flTimeDelta )
 	if( flTimeDelta > 0.1f )
 		flTimeDelta = 0.1f;
 
+	CUtlVectorFixedGrowable< CParticleEffectBinding*, 256 > effectsUpdated;
+	CUtlVectorFixedGrowable< CParticleEffectBinding*, 256 > effectsToSimulate;
+
 	FOR_EACH_LL( m_Effects, iEffect )
 	{
 		CParticleEffectBinding *pEffect = m_Effects[iEffect];
@@ -1905,16 +2023,23 @@ void CParticleMgr::UpdateAllEffects( float flTimeDelta )
 		// This flag will get set to true if the effect is drawn through the leaf system.
 		pEffect->SetDrawn( false );
 
-		// Update the effect.
+		// Update the effect. This can call into entity code, so it always happens here.
 		pEffect->m_pSim->Update( flTimeDelta );
+		effectsUpdated.AddToTail( pEffect );
 
 		if ( pEffect->GetFirstFrameFlag() )
 			pEffect->SetFirstFrameFlag( false );
 		else
-			pEffect->SimulateParticles( flTimeDelta );
+			effectsToSimulate.AddToTail( pEffect );
+	}
+
+	SimulateLegacyEffects( effectsToSimulate.Base(), effectsToSimulate.Count(), flTimeDelta );
 
-		// Update its position in the leaf system if its bbox changed.
-		pEffect->DetectChanges();
+	// Update positions in the leaf system for effects whose bbox changed. This has to wait
+	// until every batch has been joined since it may call into the leaf system.
+	for ( int i = 0; i < effectsUpdated.Count(); ++i )
+	{
+		effectsUpdated[i]->DetectChanges();
 	}
 
 	if ( g_bMeasureParticlePerformance )					// use fixed time step
@@ -117,6 +117,7 @@ entities. Each one is useful under different conditions.
 #include "iclientrenderable.h"
 #include "clientleafsystem.h"
 #include "tier0/fasttimer.h"
+#include "tier0/threadtools.h"
 #include "utllinkedlist.h"
 #include "utldict.h"
 #ifdef WIN32
@@ -270,6 +271,12 @@ public:
 	virtual void	SetShouldSimulate( bool bSim ) = 0;
 	virtual void	SimulateParticles( CParticleSimulateIterator *pIterator ) = 0;
 
+	// Return false only if SimulateParticles is reentrant: it touches no state shared
+	// with other effects or entities (collision traces, entity control points,
+	// function statics, etc.). Such effects may be simulated in batches on the
+	// particle job pool; everything else stays on the main thread.
+	virtual bool	ShouldSimulateOnMainThread() const { return true; }
+
 	// Render the particles.
 	virtual void	RenderParticles( CParticleRenderIterator *pIterator ) = 0;
 
@@ -403,6 +410,10 @@ public:
 	void			SetAlwaysSimulate( int bAlwaysSimulate )		{ SetFlag( FLAGS_ALWAYSSIMULATE, bAlwaysSimulate ); }
 
 	void			SetIsNewParticleSystem( void )		{ SetFlag( FLAGS_NEW_PARTICLE_SYSTEM, 1 ); }
+
+	// Set when the effect has to be simulated on the main thread rather than on the particle job pool.
+	int				GetMainThreadSimulate() const					{ return GetFlag( FLAGS_MAIN_THREAD_SIMULATE ); }
+	void			SetMainThreadSimulate( int bMainThread )		{ SetFlag( FLAGS_MAIN_THREAD_SIMULATE, bMainThread ); }
 	// Set if the effect was drawn the previous frame.
 	// This can be used by particle effect classes
 	// to decide whether or not they want to spawn
@@ -543,7 +554,8 @@ private:
 		FLAGS_DRAW_BEFORE_VIEW_MODEL=(1<<9),// Draw before the view model? If this is set, it assumes FLAGS_DRAW_THRU_LEAF_SYSTEM goes off.
 		FLAGS_AUTOAPPLYLOCALTRANSFORM=(1<<10), // Automatically apply the local transform to CParticleMgr::GetModelView()'s matrix.
 		FLAGS_FIRST_FRAME =         (1<<11),	// Cleared after the first frame that this system exists (so it can simulate after rendering once).
-		FLAGS_NEW_PARTICLE_SYSTEM=  (1<<12) // uses new particle system
+		FLAGS_NEW_PARTICLE_SYSTEM=  (1<<12), // uses new particle system
+		FLAGS_MAIN_THREAD_SIMULATE= (1<<13)	// The effect is an entity, so SimulateParticles must run on the main thread (see IParticleEffect::ShouldSimulateOnMainThread).
 	};
 
 
@@ -741,6 +753,7 @@ private:
 	void UpdateAllEffects( float flTimeDelta );
 
 	void UpdateNewEffects( float flTimeDelta );				// update new particle effects
+	void SimulateLegacyEffects( CParticleEffectBinding **ppEffects, int nCount, float flTimeDelta );
 
 	void SpewActiveParticleSystems( );
 
@@ -756,7 +769,8 @@ private:
 
 private:
 
-	int m_nCurrentParticlesAllocated;
+	// Particles are freed from the effect simulation jobs, so this must be interlocked.
+	CInterlockedInt m_nCurrentParticlesAllocated;
 
 	// Directional lighting info.
 	CParticleLightInfo m_DirectionalLight;
@@ -224,6 +224,7 @@ CSimpleEmitter::CSimpleEmitter( const char *pDebugName ) : CParticleEffect( pDeb
 	m_flNearClipMin	= 16.0f;
 	m_flNearClipMax	= 64.0f;
 	m_nSplitScreenPlayerSlot = -1;
+	m_bReentrantSimulate = false;
 }
 
 
@@ -235,6 +236,7 @@ CSmartPtr<CSimpleEmitter> CSimpleEmitter::Create( const char *pDebugName )
 {
 	CSimpleEmitter *pRet = new CSimpleEmitter( pDebugName );
 	pRet->SetDynamicallyAllocated( true );
+	pRet->m_bReentrantSimulate = true;
 	return pRet;
 }
 
@@ -170,6 +170,7 @@ public:
 	static CSmartPtr<CSimpleEmitter>	Create( const char *pDebugName );
 
 	virtual void	SimulateParticles( CParticleSimulateIterator *pIterator );
+	virtual bool	ShouldSimulateOnMainThread() const	{ return !m_bReentrantSimulate; }
 	virtual void	RenderParticles( CParticleRenderIterator *pIterator );
 
 	void			SetNearClip( float nearClipMin, float nearClipMax );
@@ -196,6 +197,10 @@ protected:
 
 	int				m_nSplitScreenPlayerSlot;
 
+	// The base update hooks are reentrant, so plain emitters from Create() may simulate on
+	// the job pool. Variants override the hooks and stay on the main thread unless audited.
+	bool			m_bReentrantSimulate;
+
 
 private:
 	CSimpleEmitter( const CSimpleEmitter & ); // not defined, not accessible
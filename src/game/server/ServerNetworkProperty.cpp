@@ -65,6 +65,7 @@ void CServerNetworkProperty::Init( CBaseEntity *pEntity )
 	m_pServerClass = NULL;
 //	m_pTransmitProxy = NULL;
 	m_bPendingStateChange = false;
+	m_bSuppressStateChanges = false;
 	m_PVSInfo.m_nClusterCount = 0;
 	m_TimerEvent.Init( &g_NetworkPropertyEventMgr, this );
 }
@@ -62,6 +62,10 @@ public:
 	void NetworkStateChanged();
 	void NetworkStateChanged( unsigned short offset );
 
+	// Ignores NetworkStateChanged while set. Used while a job thread runs a move on a
+	// player; the main thread flags the whole entity changed if the move is kept.
+	void SuppressStateChanges( bool bSuppress );
+
 	// Marks the PVS information dirty
 	void MarkPVSInformationDirty();
 
@@ -124,6 +128,7 @@ private:
 	// Counters for SetUpdateInterval.
 	CEventRegister	m_TimerEvent;
 	bool m_bPendingStateChange : 1;
+	bool m_bSuppressStateChanges : 1;
 
 //	friend class CBaseTransmitProxy;
 };
@@ -183,8 +188,16 @@ inline void CServerNetworkProperty::NetworkStateForceUpdate()
 		m_pPev->StateChanged();
 }
 
+inline void CServerNetworkProperty::SuppressStateChanges( bool bSuppress )
+{
+	m_bSuppressStateChanges = bSuppress;
+}
+
 inline void CServerNetworkProperty::NetworkStateChanged()
 { 
+	if ( m_bSuppressStateChanges )
+		return;
+
 	// If we're using the timer, then ignore this call.
 	if ( m_TimerEvent.IsRegistered() )
 	{
@@ -201,6 +214,9 @@ inline void CServerNetworkProperty::NetworkStateChanged()
 
 inline void CServerNetworkProperty::NetworkStateChanged( unsigned short varOffset )
 { 
+	if ( m_bSuppressStateChanges )
+		return;
+
 	// If we're using the timer, then ignore this call.
 	if ( m_TimerEvent.IsRegistered() )
 	{
@@ -20,6 +20,7 @@
 #include "isaverestore.h"
 #include "keyvalues.h"
 #include "tier0/vprof.h"
+#include "vstdlib/jobthread.h"
 #include "EntityFlame.h"
 #include "EntityDissolve.h"
 #if defined( HL2_EP3 ) || defined( INFESTED_DLL )
@@ -314,6 +315,8 @@ CBaseAnimating::CBaseAnimating()
 	m_pStudioHdr = NULL;
 	SetGlobalFadeScale( 1.0f );
 	m_fBoneCacheFlags = 0;
+	m_flBoneCachePrecomputeTime = -1.0f;
+	m_bBoneCachePrecomputeUsed = false;
 	
 	if ( m_pBoneMergeCache )
 	{
@@ -2924,6 +2927,312 @@ void CBaseAnimating::UnlockStudioHdr()
 	}
 }
 
+ConVar sv_threaded_bone_setup( "sv_threaded_bone_setup", "1", 0, "Precompute the bone caches of live players on the job pool at the start of each tick" );
+
+struct BoneSetupStats_t
+{
+	int		m_nTicks;
+	int		m_nPrecomputed;		// caches filled by ThreadedBoneSetup
+	int		m_nPrecomputedUsed;	// ...that were read at least once before going stale
+	int		m_nPrecomputedHits;	// GetBoneCache calls served by a precomputed cache
+	int		m_nCachedHits;		// GetBoneCache calls served by a cache computed on demand earlier
+	int		m_nOnDemand;		// GetBoneCache calls that had to run SetupBones
+	double	m_flTime;
+};
+
+// Only touched from the main thread
+static BoneSetupStats_t s_BoneSetupStats;
+
+struct BoneSetupJob_t
+{
+	CBaseAnimating	*m_pAnimating;
+	matrix3x4a_t	*m_pBoneToWorld;
+	int				m_nBoneMask;
+	int				m_nFirstBone;
+};
+
+static bool IsBoneCacheCurrent( const CBoneCache *pcache, int boneMask )
+{
+	return const_cast< CBoneCache * >( pcache )->IsValid( gpGlobals->curtime ) && 
+		( pcache->m_boneMask & boneMask ) == boneMask && 
+		pcache->m_timeValid <= gpGlobals->curtime;
+}
+
+static void SetupBonesForJob( BoneSetupJob_t &job )
+{
+	job.m_pAnimating->SetupBones( job.m_pBoneToWorld, job.m_nBoneMask );
+}
+
+static void PreThreadedBoneSetup()
+{
+	mdlcache->BeginCoarseLock();
+	mdlcache->BeginLock();
+}
+
+static void PostThreadedBoneSetup()
+{
+	mdlcache->EndLock();
+	mdlcache->EndCoarseLock();
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Run SetupBones for every live player in parallel and store the
+//			results in their bone caches. The caches are committed serially
+//			since creating one can evict another from the shared cache.
+//			Bone merged players depend on their parent's cache and are left
+//			to be set up on demand.
+//-----------------------------------------------------------------------------
+void CBaseAnimating::ThreadedBoneSetup( void )
+{
+	if ( !sv_threaded_bone_setup.GetBool() || ai_setupbones_debug.GetBool() )
+		return;
+
+	if ( !g_pThreadPool || !g_pThreadPool->NumThreads() )
+		return;
+
+	VPROF_BUDGET( "CBaseAnimating::ThreadedBoneSetup", VPROF_BUDGETGROUP_SERVER_ANIM );
+	SNPROF_ANIM( "CBaseAnimating::ThreadedBoneSetup" );
+
+	double flStartTime = Plat_FloatTime();
+
+	MDLCACHE_CRITICAL_SECTION();
+
+	static CUtlVector< BoneSetupJob_t > s_Jobs;
+	static CUtlVector< matrix3x4a_t > s_BoneToWorld;
+
+	s_Jobs.RemoveAll();
+	int nTotalBones = 0;
+
+	for ( int i = 1; i <= gpGlobals->maxClients; i++ )
+	{
+		CBasePlayer *pPlayer = UTIL_PlayerByIndex( i );
+		if ( !pPlayer || !pPlayer->IsAlive() )
+			continue;
+
+		if ( pPlayer->IsEffectActive( EF_BONEMERGE ) || pPlayer->IsEFlagSet( EFL_SETTING_UP_BONES ) )
+			continue;
+
+		CStudioHdr *pStudioHdr = pPlayer->GetModelPtr();
+		if ( !pStudioHdr || !pStudioHdr->SequencesAvailable() )
+			continue;
+
+		int boneMask = pPlayer->GetBoneCacheMask();
+		CBoneCache *pcache = Studio_GetBoneCache( pPlayer->m_boneCacheHandle );
+		if ( pcache && IsBoneCacheCurrent( pcache, boneMask ) )
+			continue;
+
+		// Resolve any dirty absolute transforms here; recomputing them from a
+		// worker would walk the move hierarchy.
+		pPlayer->GetAbsOrigin();
+		pPlayer->GetAbsAngles();
+
+		BoneSetupJob_t &job = s_Jobs[ s_Jobs.AddToTail() ];
+		job.m_pAnimating = pPlayer;
+		job.m_pBoneToWorld = NULL;
+		job.m_nBoneMask = boneMask;
+		job.m_nFirstBone = nTotalBones;
+		nTotalBones += pStudioHdr->numbones();
+	}
+
+	if ( !s_Jobs.Count() )
+		return;
+
+	s_BoneToWorld.EnsureCount( nTotalBones );
+	FOR_EACH_VEC( s_Jobs, i )
+	{
+		s_Jobs[i].m_pBoneToWorld = s_BoneToWorld.Base() + s_Jobs[i].m_nFirstBone;
+	}
+
+	// Bone setup traces against the partition from every job; keep it lock-free until they join
+	partition->BeginReadPhase( PARTITION_SERVER_GAME_EDICTS );
+	ParallelProcess( s_Jobs.Base(), s_Jobs.Count(), &SetupBonesForJob, &PreThreadedBoneSetup, &PostThreadedBoneSetup );
+	partition->EndReadPhase( PARTITION_SERVER_GAME_EDICTS );
+
+	FOR_EACH_VEC( s_Jobs, i )
+	{
+		CBaseAnimating *pAnimating = s_Jobs[i].m_pAnimating;
+		pAnimating->UpdateBoneCache( s_Jobs[i].m_pBoneToWorld, s_Jobs[i].m_nBoneMask );
+		pAnimating->m_flBoneCachePrecomputeTime = gpGlobals->curtime;
+		pAnimating->m_bBoneCachePrecomputeUsed = false;
+	}
+
+	s_BoneSetupStats.m_nTicks++;
+	s_BoneSetupStats.m_nPrecomputed += s_Jobs.Count();
+	s_BoneSetupStats.m_flTime += Plat_FloatTime() - flStartTime;
+}
+
+CON_COMMAND( sv_threaded_bone_setup_stats, "Reports how many bone cache requests were served by sv_threaded_bone_setup. Pass 'reset' to clear the counters." )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	if ( args.ArgC() > 1 && !V_stricmp( args[1], "reset" ) )
+	{
+		V_memset( &s_BoneSetupStats, 0, sizeof( s_BoneSetupStats ) );
+		return;
+	}
+
+	const BoneSetupStats_t &stats = s_BoneSetupStats;
+	int nRequests = stats.m_nPrecomputedHits + stats.m_nCachedHits + stats.m_nOnDemand;
+	Msg( "Threaded bone setup: %d ticks, %d caches precomputed, %.2f ms/tick\n",
+		stats.m_nTicks, stats.m_nPrecomputed, stats.m_nTicks ? 1000.0 * stats.m_flTime / stats.m_nTicks : 0.0 );
+	Msg( "  %d of %d precomputed caches were read (%.1f%%)\n",
+		stats.m_nPrecomputedUsed, stats.m_nPrecomputed, stats.m_nPrecomputed ? 100.0f * stats.m_nPrecomputedUsed / stats.m_nPrecomputed : 0.0f );
+	Msg( "  %d bone cache requests: %d precomputed (%.1f%%), %d cached, %d set up on demand\n",
+		nRequests, stats.m_nPrecomputedHits, nRequests ? 100.0f * stats.m_nPrecomputedHits / nRequests : 0.0f,
+		stats.m_nCachedHits, stats.m_nOnDemand );
+}
+
+// Time spent in GetSkeleton, for comparing the pose cache on and off (anim_pose_cache_stats)
+static CPerThreadCycleCounter s_SkeletonTime;
+
+CON_COMMAND( sv_anim_pose_cache_stats, "Reports pose cache (anim_pose_cache) hit rates and bone setup time. Pass 'reset' to clear the counters or 'flush' to empty the cache." )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	if ( args.ArgC() > 1 )
+	{
+		if ( !V_stricmp( args[1], "reset" ) )
+		{
+			Studio_ResetPoseCacheStats();
+			s_SkeletonTime.Reset();
+		}
+		else if ( !V_stricmp( args[1], "flush" ) )
+		{
+			Studio_FlushPoseCache();
+		}
+		return;
+	}
+
+	posecachestats_t stats;
+	Studio_GetPoseCacheStats( stats );
+
+	int nSkeletons;
+	int64 nSkeletonCycles;
+	s_SkeletonTime.Get( nSkeletons, nSkeletonCycles );
+	CCycleCount skeletonTime;
+	skeletonTime.Init( (uint64)nSkeletonCycles );
+
+	ConVarRef anim_pose_cache( "anim_pose_cache" );
+	Msg( "Pose cache %s: %d entries, %.1f of %.1f KB\n", anim_pose_cache.GetBool() ? "on" : "off",
+		stats.m_nEntries, stats.m_nUsedBytes / 1024.0f, stats.m_nBudgetBytes / 1024.0f );
+	Msg( "  %d lookups, %d hits (%.1f%%), %d inserts, %d evictions\n",
+		stats.m_nLookups, stats.m_nHits, stats.m_nLookups ? 100.0f * stats.m_nHits / stats.m_nLookups : 0.0f,
+		stats.m_nInserts, stats.m_nEvictions );
+	if ( !Studio_PoseCacheStatsEnabled() )
+	{
+		Msg( "  Pose and skeleton timing is off (anim_pose_cache_stats 1).\n" );
+	}
+	Msg( "  %d sequence poses, %.2f us/pose\n",
+		stats.m_nEvaluations, stats.m_nEvaluations ? 1000000.0 * stats.m_flEvaluationTime / stats.m_nEvaluations : 0.0 );
+	Msg( "  %d skeletons, %.2f us/skeleton, %.2f ms total\n",
+		nSkeletons, nSkeletons ? skeletonTime.GetMicrosecondsF() / nSkeletons : 0.0, skeletonTime.GetMillisecondsF() );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Time GetSkeleton on every player model in the level with the scalar
+//			and the batched animation decoder, and check that they agree
+//-----------------------------------------------------------------------------
+CON_COMMAND_F( sv_anim_decode_benchmark, "Times animation decode on the player models in the level with anim_simd_decode off and on. Usage: sv_anim_decode_benchmark [iterations]", FCVAR_CHEAT )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	ConVarRef anim_simd_decode( "anim_simd_decode" );
+	if ( !anim_simd_decode.IsValid() )
+		return;
+
+	int nIterations = ( args.ArgC() > 1 ) ? MAX( 1, atoi( args[1] ) ) : 1000;
+
+	MDLCACHE_CRITICAL_SECTION();
+
+	CUtlVector< CBaseAnimating * > models;
+	for ( CBaseEntity *pEntity = gEntList.FirstEnt(); pEntity; pEntity = gEntList.NextEnt( pEntity ) )
+	{
+		CBaseAnimating *pAnimating = pEntity->GetBaseAnimating();
+		if ( !pAnimating || !pAnimating->GetModelPtr() || !pAnimating->GetModelPtr()->SequencesAvailable() )
+			continue;
+
+		if ( V_strnicmp( STRING( pAnimating->GetModelName() ), "models/player/", 14 ) )
+			continue;
+
+		models.AddToTail( pAnimating );
+	}
+
+	if ( !models.Count() )
+	{
+		Msg( "sv_anim_decode_benchmark: no player models in the level\n" );
+		return;
+	}
+
+	bool bOldValue = anim_simd_decode.GetBool();
+
+	BoneVector pos[2][MAXSTUDIOBONES];
+	BoneQuaternionAligned q[2][MAXSTUDIOBONES];
+	double flTime[2];
+	float flMaxPosError = 0.0f, flMaxQuatError = 0.0f;
+	int nBones = 0;
+
+	for ( int nMode = 0; nMode < 2; nMode++ )
+	{
+		anim_simd_decode.SetValue( nMode );
+
+		double flStart = Plat_FloatTime();
+		for ( int i = 0; i < nIterations; i++ )
+		{
+			FOR_EACH_VEC( models, j )
+			{
+				models[j]->GetSkeleton( models[j]->GetModelPtr(), pos[nMode], q[nMode], BONE_USED_BY_ANYTHING );
+			}
+		}
+		flTime[nMode] = Plat_FloatTime() - flStart;
+	}
+
+	// compare one more pass of each decoder model by model
+	FOR_EACH_VEC( models, j )
+	{
+		CStudioHdr *pStudioHdr = models[j]->GetModelPtr();
+		for ( int nMode = 0; nMode < 2; nMode++ )
+		{
+			anim_simd_decode.SetValue( nMode );
+			models[j]->GetSkeleton( pStudioHdr, pos[nMode], q[nMode], BONE_USED_BY_ANYTHING );
+		}
+
+		for ( int i = 0; i < pStudioHdr->numbones(); i++ )
+		{
+			for ( int k = 0; k < 3; k++ )
+			{
+				flMaxPosError = MAX( flMaxPosError, fabs( pos[0][i][k] - pos[1][i][k] ) );
+			}
+			for ( int k = 0; k < 4; k++ )
+			{
+				flMaxQuatError = MAX( flMaxQuatError, fabs( q[0][i][k] - q[1][i][k] ) );
+			}
+		}
+		nBones += pStudioHdr->numbones();
+	}
+
+	anim_simd_decode.SetValue( bOldValue );
+
+	int nSkeletons = nIterations * models.Count();
+	Msg( "Animation decode: %d player models (%d bones), %d iterations\n", models.Count(), nBones, nIterations );
+	Msg( "  scalar:  %.2f us/skeleton\n", 1e6 * flTime[0] / nSkeletons );
+	Msg( "  batched: %.2f us/skeleton (%.2fx)\n", 1e6 * flTime[1] / nSkeletons, flTime[1] > 0.0 ? flTime[0] / flTime[1] : 0.0 );
+	Msg( "  max difference: position %g, quaternion %g\n", flMaxPosError, flMaxQuatError );
+}
+
+int CBaseAnimating::GetBoneCacheMask( void ) const
+{
+	int boneMask = BONE_USED_BY_HITBOX | BONE_USED_BY_ATTACHMENT;
+
+	// TF queries these bones to position weapons when players are killed
+#if defined( TF_DLL )
+	boneMask |= BONE_USED_BY_BONE_MERGE;
+#endif
+	return boneMask;
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: return the index to the shared bone cache
 // Output :
@@ -2934,42 +3243,63 @@ CBoneCache *CBaseAnimating::GetBoneCache( void )
 	Assert(pStudioHdr);
 
 	CBoneCache *pcache = Studio_GetBoneCache( m_boneCacheHandle );
-	int boneMask = BONE_USED_BY_HITBOX | BONE_USED_BY_ATTACHMENT;
+	int boneMask = GetBoneCacheMask();
 
-	// TF queries these bones to position weapons when players are killed
-#if defined( TF_DLL )
-	boneMask |= BONE_USED_BY_BONE_MERGE;
-#endif
-	if ( pcache )
+	if ( pcache && IsBoneCacheCurrent( pcache, boneMask ) )
 	{
-		if ( pcache->IsValid( gpGlobals->curtime ) && (pcache->m_boneMask & boneMask) == boneMask && pcache->m_timeValid <= gpGlobals->curtime)
+		// Msg("%s:%s:%s (%x:%x:%8.4f) cache\n", GetClassname(), GetDebugName(), STRING(GetModelName()), boneMask, pcache->m_boneMask, pcache->m_timeValid );
+		// in memory and still valid, use it!
+		if ( pcache->m_timeValid == m_flBoneCachePrecomputeTime )
 		{
-			// Msg("%s:%s:%s (%x:%x:%8.4f) cache\n", GetClassname(), GetDebugName(), STRING(GetModelName()), boneMask, pcache->m_boneMask, pcache->m_timeValid );
-			// in memory and still valid, use it!
-			return pcache;
+			s_BoneSetupStats.m_nPrecomputedHits++;
+			if ( !m_bBoneCachePrecomputeUsed )
+			{
+				m_bBoneCachePrecomputeUsed = true;
+				s_BoneSetupStats.m_nPrecomputedUsed++;
+			}
 		}
-		// in memory, but missing some of the bone masks
-		if ( (pcache->m_boneMask & boneMask) != boneMask )
+		else
 		{
-			Studio_DestroyBoneCache( m_boneCacheHandle );
-			m_boneCacheHandle = 0;
-			pcache = NULL;
+			s_BoneSetupStats.m_nCachedHits++;
 		}
+		return pcache;
 	}
 
+	s_BoneSetupStats.m_nOnDemand++;
+	m_flBoneCachePrecomputeTime = -1.0f;
+
 	matrix3x4a_t bonetoworld[MAXSTUDIOBONES];
 	SetupBones( bonetoworld, boneMask );
 
+	return UpdateBoneCache( bonetoworld, boneMask );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: store freshly set up bones in the shared bone cache
+//-----------------------------------------------------------------------------
+CBoneCache *CBaseAnimating::UpdateBoneCache( matrix3x4a_t *pBoneToWorld, int boneMask )
+{
+	CStudioHdr *pStudioHdr = GetModelPtr( );
+	CBoneCache *pcache = Studio_GetBoneCache( m_boneCacheHandle );
+
+	// in memory, but missing some of the bone masks
+	if ( pcache && (pcache->m_boneMask & boneMask) != boneMask )
+	{
+		Studio_DestroyBoneCache( m_boneCacheHandle );
+		m_boneCacheHandle = 0;
+		pcache = NULL;
+	}
+
 	if ( pcache )
 	{
 		// still in memory but out of date, refresh the bones.
-		pcache->UpdateBones( bonetoworld, pStudioHdr->numbones(), gpGlobals->curtime );
+		pcache->UpdateBones( pBoneToWorld, pStudioHdr->numbones(), gpGlobals->curtime );
 	}
 	else
 	{
 		bonecacheparams_t params;
 		params.pStudioHdr = pStudioHdr;
-		params.pBoneToWorld = bonetoworld;
+		params.pBoneToWorld = pBoneToWorld;
 		params.curtime = gpGlobals->curtime;
 		params.boneMask = boneMask;
 
@@ -3182,6 +3512,13 @@ void CBaseAnimating::GetSkeleton( CStudioHdr *pStudioHdr, BoneVector pos[], Bone
 		return;
 	}
 
+	bool bTimeSkeleton = Studio_PoseCacheStatsEnabled();
+	CFastTimer timer;
+	if ( bTimeSkeleton )
+	{
+		timer.Start();
+	}
+
 	IBoneSetup boneSetup( pStudioHdr, boneMask, GetPoseParameterArray() );
 	boneSetup.InitPose( pos, q );
 
@@ -3198,6 +3535,12 @@ void CBaseAnimating::GetSkeleton( CStudioHdr *pStudioHdr, BoneVector pos[], Bone
 		boneSetup.CalcAutoplaySequences( pos, q, gpGlobals->curtime, NULL );
 	}
 	boneSetup.CalcBoneAdj( pos, q, GetEncodedControllerArray() );
+
+	if ( bTimeSkeleton )
+	{
+		timer.End();
+		s_SkeletonTime.Add( (int64)timer.GetDuration().GetLongCycles() );
+	}
 }
 
 int CBaseAnimating::DrawDebugTextOverlays(void) 
@@ -289,6 +289,10 @@ public:
 	virtual bool TestHitboxes( const Ray_t &ray, unsigned int fContentsMask, trace_t& tr );
 	class CBoneCache *GetBoneCache( void );
 	virtual void InvalidateBoneCache( void );
+
+	// Fills the bone caches of live players on the job pool so hitbox and
+	// attachment queries made during the tick find them already valid.
+	static void ThreadedBoneSetup( void );
 	virtual int DrawDebugTextOverlays( void );
 	virtual bool IsViewModel() const { return false; }
 	
@@ -465,6 +469,8 @@ protected:
 
 	memhandle_t		m_boneCacheHandle;
 	unsigned short	m_fBoneCacheFlags;		// Used for bone cache state on model
+	float			m_flBoneCachePrecomputeTime;	// curtime the cache was filled by ThreadedBoneSetup, -1 if computed on demand
+	bool			m_bBoneCachePrecomputeUsed;
 
 	CNetworkVar( float, m_flFrozen );		// 0 - 1 amount that the model is frozen
 	float				m_flMovementFrozen;	// How frozen are the movement parts
@@ -484,6 +490,9 @@ private:
 	CThreadFastMutex	m_StudioHdrInitLock;
 	CThreadFastMutex	m_BoneSetupMutex;
 
+	int GetBoneCacheMask( void ) const;
+	class CBoneCache *UpdateBoneCache( matrix3x4a_t *pBoneToWorld, int boneMask );
+
 // FIXME: necessary so that cyclers can hack m_bSequenceFinished
 friend class CBaseAnimatingOverlay;
 friend class CFlexCycler;
@@ -436,6 +436,12 @@ bool CCSBot::IsVisible( CCSPlayer *player, bool testFOV, unsigned char *visParts
 		return false;
 	}
 
+	// skip the part traces if the player stands in an area that can never be seen from ours
+	if ( !TheNavMesh->CouldBeVisible( const_cast< CCSBot * >( this ), player ) )
+	{
+		return false;
+	}
+
 	unsigned char testVisParts = NONE;
 
 	// check gut
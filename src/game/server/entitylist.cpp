@@ -149,6 +149,11 @@ void AimTarget_ForceRepopulateList()
 // NOTE: This is usually a small subset of the global entity list, so it's
 // an optimization to maintain this list incrementally rather than polling each
 // frame.
+// Think-only entities are also kept in a two level timing wheel keyed on their
+// next think tick, so each frame only visits the slot for that tick instead of
+// scanning the whole list.
+static ConVar sv_think_wheel( "sv_think_wheel", "1", FCVAR_RELEASE, "Find entities due to think with a timing wheel instead of scanning the whole sim/think list each tick." );
+
 struct simthinkentry_t
 {
 	unsigned short	entEntry;
@@ -168,7 +173,13 @@ public:
 		for ( int i = 0; i < ARRAYSIZE(m_entinfoIndex); i++ )
 		{
 			m_entinfoIndex[i] = 0xFFFF;
+			m_wheelSlot[i] = 0xFFFF;
+		}
+		for ( int i = 0; i < ARRAYSIZE(m_wheelHead); i++ )
+		{
+			m_wheelHead[i] = 0xFFFF;
 		}
+		m_nWheelTick = -1;
 	}
 	void LevelInitPreEntity()
 	{
@@ -196,6 +207,7 @@ public:
 		if ( listHandle != 0xFFFF )
 		{
 			Assert(m_simThinkList[listHandle].entEntry == index);
+			WheelUnlink( index );
 			m_simThinkList.FastRemove( listHandle );
 			m_entinfoIndex[index] = 0xFFFF;
 			
@@ -213,6 +225,9 @@ public:
 
 	int ListCopy( CBaseEntity *pList[], int listMax )
 	{
+		if ( sv_think_wheel.GetBool() )
+			return WheelListCopy( pList, listMax );
+
 		int count = MIN(listMax, ListCount());
 		int out = 0;
 		for ( int i = 0; i < count; i++ )
@@ -279,12 +294,188 @@ public:
 					m_simThinkList[m_entinfoIndex[index]].nextThinkTick = 0;
 				}
 			}
+
+			WheelUnlink( index );
+			WheelInsert( index, m_simThinkList[m_entinfoIndex[index]].nextThinkTick );
 		}
 	}
 
 private:
+	enum
+	{
+		WHEEL_NEAR_BITS = 8,
+		WHEEL_NEAR_SLOTS = 1 << WHEEL_NEAR_BITS,	// one tick per slot
+		WHEEL_FAR_SLOTS = 64,						// WHEEL_NEAR_SLOTS ticks per slot
+		WHEEL_SLOT_FAR = WHEEL_NEAR_SLOTS,
+		WHEEL_SLOT_OVERFLOW = WHEEL_SLOT_FAR + WHEEL_FAR_SLOTS,	// further out than the far wheel reaches
+		WHEEL_SLOT_DUE = WHEEL_SLOT_OVERFLOW + 1,	// think tick has passed, copied out every frame until it changes
+		WHEEL_SLOT_SIMULATE = WHEEL_SLOT_DUE + 1,	// runs game physics, copied out every frame
+		WHEEL_SLOT_COUNT = WHEEL_SLOT_SIMULATE + 1,
+	};
+
+	static int __cdecl CompareListHandles( const int *a, const int *b )
+	{
+		return *a - *b;
+	}
+
+	void WheelLink( int index, int slot )
+	{
+		m_wheelSlot[index] = slot;
+		m_wheelPrev[index] = 0xFFFF;
+		m_wheelNext[index] = m_wheelHead[slot];
+		if ( m_wheelHead[slot] != 0xFFFF )
+		{
+			m_wheelPrev[m_wheelHead[slot]] = index;
+		}
+		m_wheelHead[slot] = index;
+	}
+
+	void WheelUnlink( int index )
+	{
+		int slot = m_wheelSlot[index];
+		if ( slot == 0xFFFF )
+			return;
+
+		if ( m_wheelPrev[index] != 0xFFFF )
+		{
+			m_wheelNext[m_wheelPrev[index]] = m_wheelNext[index];
+		}
+		else
+		{
+			m_wheelHead[slot] = m_wheelNext[index];
+		}
+		if ( m_wheelNext[index] != 0xFFFF )
+		{
+			m_wheelPrev[m_wheelNext[index]] = m_wheelPrev[index];
+		}
+		m_wheelSlot[index] = 0xFFFF;
+	}
+
+	void WheelInsert( int index, int nextThinkTick )
+	{
+		if ( nextThinkTick == 0 )
+		{
+			WheelLink( index, WHEEL_SLOT_SIMULATE );
+		}
+		else if ( nextThinkTick < 0 )
+		{
+			// TICK_NEVER_THINK, nothing to do until the think time changes again
+		}
+		else if ( nextThinkTick <= m_nWheelTick )
+		{
+			WheelLink( index, WHEEL_SLOT_DUE );
+		}
+		else if ( nextThinkTick - m_nWheelTick < WHEEL_NEAR_SLOTS )
+		{
+			WheelLink( index, nextThinkTick & ( WHEEL_NEAR_SLOTS - 1 ) );
+		}
+		else if ( ( nextThinkTick >> WHEEL_NEAR_BITS ) - ( m_nWheelTick >> WHEEL_NEAR_BITS ) < WHEEL_FAR_SLOTS )
+		{
+			WheelLink( index, WHEEL_SLOT_FAR + ( ( nextThinkTick >> WHEEL_NEAR_BITS ) & ( WHEEL_FAR_SLOTS - 1 ) ) );
+		}
+		else
+		{
+			WheelLink( index, WHEEL_SLOT_OVERFLOW );
+		}
+	}
+
+	// Re-files every entry of a slot against the current wheel tick
+	void WheelRefileSlot( int slot )
+	{
+		int index = m_wheelHead[slot];
+		m_wheelHead[slot] = 0xFFFF;
+		while ( index != 0xFFFF )
+		{
+			int next = m_wheelNext[index];
+			m_wheelSlot[index] = 0xFFFF;
+			WheelInsert( index, m_simThinkList[m_entinfoIndex[index]].nextThinkTick );
+			index = next;
+		}
+	}
+
+	void WheelRebuild( int tick )
+	{
+		for ( int i = 0; i < ARRAYSIZE(m_wheelHead); i++ )
+		{
+			m_wheelHead[i] = 0xFFFF;
+		}
+		m_nWheelTick = tick;
+		for ( int i = 0; i < m_simThinkList.Count(); i++ )
+		{
+			m_wheelSlot[m_simThinkList[i].entEntry] = 0xFFFF;
+			WheelInsert( m_simThinkList[i].entEntry, m_simThinkList[i].nextThinkTick );
+		}
+	}
+
+	// Moves everything due up to and including tick into the due slot
+	void WheelAdvance( int tick )
+	{
+		if ( tick < m_nWheelTick || tick - m_nWheelTick > WHEEL_NEAR_SLOTS * WHEEL_FAR_SLOTS )
+		{
+			// Tick count was reset or jumped further than the wheel covers
+			WheelRebuild( tick );
+			return;
+		}
+
+		while ( m_nWheelTick < tick )
+		{
+			++m_nWheelTick;
+			if ( !( m_nWheelTick & ( WHEEL_NEAR_SLOTS - 1 ) ) )
+			{
+				// Cascade the next far slot down into the near wheel
+				int nFarSlot = ( m_nWheelTick >> WHEEL_NEAR_BITS ) & ( WHEEL_FAR_SLOTS - 1 );
+				if ( !nFarSlot )
+				{
+					WheelRefileSlot( WHEEL_SLOT_OVERFLOW );
+				}
+				WheelRefileSlot( WHEEL_SLOT_FAR + nFarSlot );
+			}
+			WheelRefileSlot( m_nWheelTick & ( WHEEL_NEAR_SLOTS - 1 ) );
+		}
+	}
+
+	int WheelListCopy( CBaseEntity *pList[], int listMax )
+	{
+		WheelAdvance( gpGlobals->tickcount );
+
+		// Visit in sim/think list order, same as the full scan
+		CUtlVectorFixedGrowable< int, 512 > listHandles;
+		for ( int slot = WHEEL_SLOT_DUE; slot <= WHEEL_SLOT_SIMULATE; slot++ )
+		{
+			for ( int index = m_wheelHead[slot]; index != 0xFFFF; index = m_wheelNext[index] )
+			{
+				listHandles.AddToTail( m_entinfoIndex[index] );
+			}
+		}
+		listHandles.Sort( CompareListHandles );
+
+		int count = MIN( listMax, listHandles.Count() );
+		int out = 0;
+		for ( int i = 0; i < count; i++ )
+		{
+			const simthinkentry_t &entry = m_simThinkList[listHandles[i]];
+			Assert( entry.nextThinkTick >= 0 && entry.nextThinkTick <= gpGlobals->tickcount );
+			const CEntInfo *pInfo = gEntList.GetEntInfoPtrByIndex( entry.entEntry );
+			if ( !pInfo->m_pEntity )
+				continue;
+			pList[out] = (CBaseEntity *)pInfo->m_pEntity;
+			Assert(entry.nextThinkTick==0 || pList[out]->GetFirstThinkTick()==entry.nextThinkTick);
+			Assert( gEntList.IsEntityPtr( pList[out] ) );
+			out++;
+		}
+
+		return out;
+	}
+
 	unsigned short m_entinfoIndex[NUM_ENT_ENTRIES];
 	CUtlVector<simthinkentry_t>	m_simThinkList;
+
+	// Timing wheel, intrusive lists indexed by entinfo index
+	int m_nWheelTick;	// last tick moved into the due slot
+	unsigned short m_wheelHead[WHEEL_SLOT_COUNT];
+	unsigned short m_wheelSlot[NUM_ENT_ENTRIES];
+	unsigned short m_wheelNext[NUM_ENT_ENTRIES];
+	unsigned short m_wheelPrev[NUM_ENT_ENTRIES];
 };
 
 CSimThinkManager g_SimThinkManager;
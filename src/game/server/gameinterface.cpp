@@ -1414,6 +1414,13 @@ void CServerGameDLL::GameFrame( bool simulating )
 	{
 		MDLCACHE_CRITICAL_SECTION();
 
+		// Fill player bone caches up front so the hitbox and bone queries made
+		// by bots and weapons this tick don't each run SetupBones serially.
+		if ( simulating )
+		{
+			CBaseAnimating::ThreadedBoneSetup();
+		}
+
 		IGameSystem::FrameUpdatePreEntityThinkAllSystems();
 		GameStartFrame();
 
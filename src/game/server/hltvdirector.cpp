@@ -12,6 +12,7 @@
 #include "cbase.h"
 #include "hltvdirector.h"
 #include "keyvalues.h"
+#include "nav_mesh.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -1182,6 +1183,9 @@ void CHLTVDirector::AnalyzePlayers()
 			if ( dist > 1024.0f || dist < 4.0f )
 				continue;	// too close or far away
 
+			if ( !TheNavMesh->CouldBeVisible( pPlayer, pOtherPlayer ) )
+				continue;	// never visible from where this player stands
+
 			// check visibility
 			trace_t tr;
 			UTIL_TraceLine( vCamPos, pOtherPlayer->GetAbsOrigin(), MASK_SOLID, pOtherPlayer, COLLISION_GROUP_NONE, &tr  );
@@ -3675,6 +3675,19 @@ static Vector FindPositionInArea( CNavArea *area, NavCornerType corner )
  * Analyze local area neighborhood to find "hiding spots" for this area
  */
 void CNavArea::ComputeHidingSpots( void )
+{
+	HidingSpotCandidate candidates[ NUM_CORNERS ];
+	int count = FindHidingSpotCandidates( candidates );
+
+	CommitHidingSpots( candidates, count );
+}
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Find where hiding spots belong in this area without touching the global hiding spot list.
+ * Only reads adjacency and issues traces, so it can be run for many areas in parallel.
+ */
+int CNavArea::FindHidingSpotCandidates( HidingSpotCandidate candidates[ NUM_CORNERS ] ) const
 {
 	struct
 	{
@@ -3682,16 +3695,13 @@ void CNavArea::ComputeHidingSpots( void )
 	}
 	extent;
 
-	m_hidingSpots.PurgeAndDeleteElements();
-
-
 	// "jump areas" cannot have hiding spots
 	if ( GetAttributes() & NAV_MESH_JUMP )
-		return;
+		return 0;
 
 	// "don't hide areas" cannot have hiding spots
 	if ( GetAttributes() & NAV_MESH_DONT_HIDE )
-		return;
+		return 0;
 
 	int cornerCount[NUM_CORNERS];
 	for( int i=0; i<NUM_CORNERS; ++i )
@@ -3774,21 +3784,55 @@ void CNavArea::ComputeHidingSpots( void )
 		}
 	}
 
+	const float collisionRange = 30.0f;
+	int count = 0;
+
 	for ( int c=0; c<NUM_CORNERS; ++c )
 	{
 		// if a corner count is 2, then it really is a corner (walls on both sides)
 		if (cornerCount[c] == 2)
 		{
-			Vector pos = FindPositionInArea( this, (NavCornerType)c );
-			if ( !c || !IsHidingSpotCollision( pos ) )
+			Vector pos = FindPositionInArea( const_cast< CNavArea * >( this ), (NavCornerType)c );
+
+			// same rule as IsHidingSpotCollision(), applied to the spots we have found so far
+			bool collides = false;
+			for ( int i=0; c && i<count; ++i )
+			{
+				if ( ( candidates[i].pos - pos ).IsLengthLessThan( collisionRange ) )
+				{
+					collides = true;
+					break;
+				}
+			}
+
+			if ( !collides )
 			{
-				HidingSpot *spot = TheNavMesh->CreateHidingSpot();
-				spot->SetPosition( pos );
-				spot->SetFlags( IsHidingSpotInCover( pos ) ? HidingSpot::IN_COVER : HidingSpot::EXPOSED );
-				m_hidingSpots.AddToTail( spot );
+				candidates[ count ].pos = pos;
+				candidates[ count ].flags = IsHidingSpotInCover( pos ) ? HidingSpot::IN_COVER : HidingSpot::EXPOSED;
+				++count;
 			}
 		}
 	}
+
+	return count;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Replace this area's hiding spots with the given candidates. Must be called from the main thread,
+ * in area order, so spot IDs come out the same no matter how the candidates were found.
+ */
+void CNavArea::CommitHidingSpots( const HidingSpotCandidate *candidates, int count )
+{
+	m_hidingSpots.PurgeAndDeleteElements();
+
+	for ( int i=0; i<count; ++i )
+	{
+		HidingSpot *spot = TheNavMesh->CreateHidingSpot();
+		spot->SetPosition( candidates[i].pos );
+		spot->SetFlags( candidates[i].flags );
+		m_hidingSpots.AddToTail( spot );
+	}
 }
 
 //--------------------------------------------------------------------------------------------------------------
@@ -3973,8 +4017,10 @@ void CNavArea::AddSpotEncounters( const CNavArea *from, NavDirType fromDir, cons
 	Vector dir = e->path.to - e->path.from;
 	float length = dir.NormalizeInPlace();
 
-	// create unique marker to flag used spots
-	HidingSpot::ChangeMasterMarker();
+	// flag used spots locally rather than through the shared hiding spot marker, so encounters
+	// for different areas can be computed at the same time
+	CLargeVarBitVec encountered( MAX( TheHidingSpots.Count(), 1 ) );
+	encountered.ClearAll();
 
 	const float stepSize = 25.0f;		// 50
 	const float seeSpotRange = 2000.0f;	// 3000
@@ -4007,7 +4053,7 @@ void CNavArea::AddSpotEncounters( const CNavArea *from, NavDirType fromDir, cons
 			if (!spot->HasGoodCover())
 				continue;
 
-			if (spot->IsMarked())
+			if (encountered.IsBitSet( it ))
 				continue;
 
 			const Vector &spotPos = spot->GetPosition();
@@ -4043,7 +4089,7 @@ void CNavArea::AddSpotEncounters( const CNavArea *from, NavDirType fromDir, cons
 			}
 
 			// mark spot as encountered
-			spot->Mark();
+			encountered.Set( it );
 		}
 	}
 
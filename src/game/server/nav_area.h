@@ -685,6 +685,14 @@ private:
 	HidingSpotVector m_hidingSpots;
 	bool IsHidingSpotCollision( const Vector &pos ) const;		// returns true if an existing hiding spot is too close to given position
 
+	struct HidingSpotCandidate
+	{
+		Vector pos;
+		unsigned char flags;
+	};
+	int FindHidingSpotCandidates( HidingSpotCandidate candidates[ NUM_CORNERS ] ) const;	// trace-only half of ComputeHidingSpots, safe to run on a worker thread
+	void CommitHidingSpots( const HidingSpotCandidate *candidates, int count );		// replace our hiding spots with the given candidates, in order
+
 	//- encounter spots ---------------------------------------------------------------------------------
 	SpotEncounterVector m_spotEncounters;						// list of possible ways to move thru this area, and the spots to look at as we do
 	void AddSpotEncounters( const CNavArea *from, NavDirType fromDir, const CNavArea *to, NavDirType toDir );	// add spot encounter data when moving from area to area
@@ -3870,6 +3870,9 @@ bool CNavMesh::IsInSelectedSet( const CNavArea *area ) const
  */
 void CNavMesh::OnEditCreateNotify( CNavArea *newArea )
 {
+	// area IDs no longer match the visibility table
+	m_areaPVS.Reset();
+
 	FOR_EACH_VEC( TheNavAreas, it )
 	{
 		TheNavAreas[ it ]->OnEditCreateNotify( newArea );
@@ -3893,6 +3896,7 @@ void CNavMesh::OnEditDestroyNotify( CNavArea *deadArea )
 
 	m_avoidanceObstacleAreas.FindAndRemove( deadArea );
 	m_blockedAreas.FindAndRemove( deadArea );
+	m_areaPVS.Reset();
 
 	FOR_EACH_VEC( TheNavAreas, it )
 	{
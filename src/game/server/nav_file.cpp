@@ -36,7 +36,7 @@
 /// IMPORTANT: If this version changes, the swap function in makegamedata 
 /// must be updated to match. If not, this will break the Xbox 360.
 // TODO: Was changed from 15, update when latest 360 code is integrated (MSB 5/5/09)
-const int NavCurrentVersion = 16;
+const int NavCurrentVersion = 17;
 
 //--------------------------------------------------------------------------------------------------------------
 //
@@ -1105,6 +1105,7 @@ bool CNavMesh::Save( void ) const
 	// 14 - Added a bool for if the nav needs analysis
 	// 15 - removed approach areas
 	// 16 - Added visibility data to the base mesh
+	// 17 - Added the area-to-area PVS table
 	fileBuffer.PutUnsignedInt( NavCurrentVersion );
 
 	// The sub-version number is maintained and owned by classes derived from CNavMesh and CNavArea
@@ -1170,6 +1171,11 @@ bool CNavMesh::Save( void ) const
 			ladder->Save( fileBuffer, NavCurrentVersion );
 		}
 	}
+
+	//
+	// Store the area PVS table
+	//
+	m_areaPVS.Save( fileBuffer );
 	
 	//
 	// Store derived class mesh info
@@ -1579,6 +1585,23 @@ NavErrorType CNavMesh::Load( void )
 	// mark stairways (TODO: this can be removed once all maps are re-saved with this attribute in them)
 	MarkStairAreas();
 
+	//
+	// Load the area PVS table.  Its clusters are only meaningful for the bsp it was built from.
+	//
+	if ( version >= 17 )
+	{
+		if ( !m_areaPVS.Load( fileBuffer ) )
+		{
+			// the custom data after it would be read from the wrong offset
+			return NAV_CORRUPT_DATA;
+		}
+
+		if ( m_isOutOfDate )
+		{
+			m_areaPVS.Reset();
+		}
+	}
+
 	//
 	// Load derived class mesh info
 	//
@@ -18,6 +18,7 @@
 //#include "terror/TerrorShared.h"
 #include "fmtstr.h"
 #include "usermessages.h"
+#include "vstdlib/jobthread.h"
 
 #ifdef TERROR
 #include "func_simpleladder.h"
@@ -43,6 +44,10 @@ ConVar nav_generate_fixup_jump_areas( "nav_generate_fixup_jump_areas", "1", FCVA
 ConVar nav_generate_incremental_range( "nav_generate_incremental_range", "2000", FCVAR_CHEAT );
 ConVar nav_generate_incremental_tolerance( "nav_generate_incremental_tolerance", "0", FCVAR_CHEAT, "Z tolerance for adding new nav areas." );
 ConVar nav_area_max_size( "nav_area_max_size", "50", FCVAR_CHEAT, "Max area size created in nav generation" );
+ConVar nav_generate_parallel( "nav_generate_parallel", "1", FCVAR_CHEAT, "Run the per-area analysis passes (hiding, encounter and sniper spots) on the job pool. The saved mesh is identical to a serial run." );
+ConVar nav_generate_parallel_batch( "nav_generate_parallel_batch", "256", FCVAR_CHEAT, "Number of nav areas handed to the job pool per step when nav_generate_parallel is set." );
+
+extern void ClassifySniperSpot( HidingSpot *spot );
 
 // Common bounding box for traces
 Vector NavTraceMins( -0.45, -0.45, 0 );
@@ -3430,6 +3435,7 @@ void CNavMesh::BeginGeneration( bool incremental )
 
 	m_generationState = SAMPLE_WALKABLE_SPACE;
 	m_sampleTick = 0;
+	V_memset( m_generationPhaseTime, 0, sizeof( m_generationPhaseTime ) );
 	m_generationMode = (incremental) ? GENERATE_INCREMENTAL : GENERATE_FULL;
 	lastMsgTime = 0.0f;
 
@@ -3536,6 +3542,7 @@ void CNavMesh::BeginAnalysis( bool quitWhenFinished )
 	m_generationState = FIND_HIDING_SPOTS;
 	m_generationIndex = 0;
 	m_generationMode = GENERATE_ANALYSIS_ONLY;
+	V_memset( m_generationPhaseTime, 0, sizeof( m_generationPhaseTime ) );
 	m_bQuitWhenFinished = quitWhenFinished;
 	lastMsgTime = 0.0f;
 	m_generationStartTime = Plat_FloatTime();
@@ -3622,6 +3629,188 @@ static void HideAnalysisProgress( void )
 }
 
 
+//--------------------------------------------------------------------------------------------------------------
+static const char *s_generationStateNames[] =
+{
+	"Sample walkable space",
+	"Create areas from samples",
+	"Find hiding spots",
+	"Find encounter spots",
+	"Find sniper spots",
+	"Find earliest occupy times",
+	"Find light intensity",
+	"Compute mesh visibility",
+	"Custom analysis",
+	"Save nav mesh",
+};
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Accumulates the time spent in one UpdateGeneration() call into the phase it started in
+ */
+class CNavGenerationPhaseTimer
+{
+public:
+	CNavGenerationPhaseTimer( double *phaseTime ) : m_phaseTime( phaseTime )
+	{
+		m_startTime = Plat_FloatTime();
+	}
+
+	~CNavGenerationPhaseTimer()
+	{
+		*m_phaseTime += Plat_FloatTime() - m_startTime;
+	}
+
+private:
+	double *m_phaseTime;
+	double m_startTime;
+};
+
+
+//--------------------------------------------------------------------------------------------------------------
+void CNavMesh::PrintGenerationTimings( void ) const
+{
+	COMPILE_TIME_ASSERT( ARRAYSIZE( s_generationStateNames ) == NUM_GENERATION_STATES );
+
+	double total = 0.0;
+	for ( int i=0; i<NUM_GENERATION_STATES; ++i )
+	{
+		total += m_generationPhaseTime[i];
+	}
+
+	Msg( "Nav generation phase timings (%s):\n", nav_generate_parallel.GetBool() ? "parallel" : "serial" );
+	for ( int i=0; i<NUM_GENERATION_STATES; ++i )
+	{
+		Msg( "  %-28s %9.3f s  %5.1f%%\n", s_generationStateNames[i], m_generationPhaseTime[i], ( total > 0.0 ) ? 100.0 * m_generationPhaseTime[i] / total : 0.0 );
+	}
+	Msg( "  %-28s %9.3f s\n", "Total", total );
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+CON_COMMAND_F( nav_generate_timings, "Report the time spent in each phase of the last nav generation or analysis", FCVAR_CHEAT )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	TheNavMesh->PrintGenerationTimings();
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Job pool entry point for the hiding spot pass. Only traces - spots are created afterwards, in area order.
+ */
+void CNavMesh::FindHidingSpotsJob( HidingSpotJob &job )
+{
+	job.count = job.area->FindHidingSpotCandidates( job.candidates );
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+static void ComputeSpotEncountersJob( CNavArea *&area )
+{
+	area->ComputeSpotEncounters();
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+static void ClassifySniperSpotJob( HidingSpot *&spot )
+{
+	ClassifySniperSpot( spot );
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Compute hiding spots for a batch of areas starting at 'first'.  In parallel mode the traces
+ * run on the job pool and the spots are created here afterwards in area order, so spot IDs
+ * match a serial run exactly.
+ */
+int CNavMesh::ComputeHidingSpotsBatch( int first )
+{
+	if ( !nav_generate_parallel.GetBool() )
+	{
+		TheNavAreas[ first ]->ComputeHidingSpots();
+		return 1;
+	}
+
+	int count = MIN( MAX( nav_generate_parallel_batch.GetInt(), 1 ), TheNavAreas.Count() - first );
+
+	CUtlVector< HidingSpotJob > jobs;
+	jobs.SetCount( count );
+	for ( int i=0; i<count; ++i )
+	{
+		jobs[i].area = TheNavAreas[ first + i ];
+		jobs[i].count = 0;
+	}
+
+	ParallelProcess( jobs.Base(), jobs.Count(), &CNavMesh::FindHidingSpotsJob );
+
+	FOR_EACH_VEC( jobs, it )
+	{
+		jobs[it].area->CommitHidingSpots( jobs[it].candidates, jobs[it].count );
+	}
+
+	return count;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Compute spot encounters for a batch of areas starting at 'first'. Each area only writes its
+ * own encounter list, so the areas of a batch are independent.
+ */
+int CNavMesh::ComputeSpotEncountersBatch( int first )
+{
+	if ( !nav_generate_parallel.GetBool() )
+	{
+		TheNavAreas[ first ]->ComputeSpotEncounters();
+		return 1;
+	}
+
+	int count = MIN( MAX( nav_generate_parallel_batch.GetInt(), 1 ), TheNavAreas.Count() - first );
+
+	ParallelProcess( TheNavAreas.Base() + first, count, &ComputeSpotEncountersJob );
+
+	return count;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Classify the sniper spots of a batch of areas starting at 'first'. Each spot only writes its own flags.
+ */
+int CNavMesh::ComputeSniperSpotsBatch( int first )
+{
+	if ( !nav_generate_parallel.GetBool() )
+	{
+		TheNavAreas[ first ]->ComputeSniperSpots();
+		return 1;
+	}
+
+	int count = MIN( MAX( nav_generate_parallel_batch.GetInt(), 1 ), TheNavAreas.Count() - first );
+
+	if ( nav_quicksave.GetBool() )
+		return count;
+
+	CUtlVector< HidingSpot * > spots;
+	for ( int i=0; i<count; ++i )
+	{
+		const HidingSpotVector &areaSpots = TheNavAreas[ first + i ]->m_hidingSpots;
+		FOR_EACH_VEC( areaSpots, it )
+		{
+			spots.AddToTail( areaSpots[ it ] );
+		}
+	}
+
+	ParallelProcess( spots.Base(), spots.Count(), &ClassifySniperSpotJob );
+
+	return count;
+}
+
+
 //--------------------------------------------------------------------------------------------------------------
 /**
  * Process the auto-generation for 'maxTime' seconds. return false if generation is complete.
@@ -3629,6 +3818,7 @@ static void HideAnalysisProgress( void )
 bool CNavMesh::UpdateGeneration( float maxTime )
 {
 	double startTime = Plat_FloatTime();
+	CNavGenerationPhaseTimer phaseTimer( &m_generationPhaseTime[ m_generationState ] );
 	static unsigned int s_movedPlayerToArea = 0;	// Last area we moved a player to for lighting calcs
 	static CountdownTimer s_playerSettleTimer;		// Settle time after moving the player for lighting calcs
 	static CUtlVector<CNavArea *> s_unlitAreas;
@@ -3711,10 +3901,7 @@ bool CNavMesh::UpdateGeneration( float maxTime )
 		{
 			while( m_generationIndex < TheNavAreas.Count() )
 			{
-				CNavArea *area = TheNavAreas[ m_generationIndex ];
-				++m_generationIndex;
-
-				area->ComputeHidingSpots();
+				m_generationIndex += ComputeHidingSpotsBatch( m_generationIndex );
 
 				// don't go over our time allotment
 				if( Plat_FloatTime() - startTime > maxTime )
@@ -3736,10 +3923,7 @@ bool CNavMesh::UpdateGeneration( float maxTime )
 		{
 			while( m_generationIndex < TheNavAreas.Count() )
 			{
-				CNavArea *area = TheNavAreas[ m_generationIndex ];
-				++m_generationIndex;
-
-				area->ComputeSpotEncounters();
+				m_generationIndex += ComputeSpotEncountersBatch( m_generationIndex );
 
 				// don't go over our time allotment
 				if( Plat_FloatTime() - startTime > maxTime )
@@ -3761,10 +3945,7 @@ bool CNavMesh::UpdateGeneration( float maxTime )
 		{
 			while( m_generationIndex < TheNavAreas.Count() )
 			{
-				CNavArea *area = TheNavAreas[ m_generationIndex ];
-				++m_generationIndex;
-
-				area->ComputeSniperSpots();
+				m_generationIndex += ComputeSniperSpotsBatch( m_generationIndex );
 
 				// don't go over our time allotment
 				if( Plat_FloatTime() - startTime > maxTime )
@@ -4012,6 +4193,7 @@ bool CNavMesh::UpdateGeneration( float maxTime )
 			// generation complete!
 			float generationTime = Plat_FloatTime() - m_generationStartTime;
 			Msg( "Generation complete!  %0.1f seconds elapsed.\n", generationTime );
+			PrintGenerationTimings();
 			bool restart = m_generationMode != GENERATE_INCREMENTAL;
 			m_generationMode = GENERATE_NONE;
 			m_isLoaded = true;
@@ -4019,6 +4201,9 @@ bool CNavMesh::UpdateGeneration( float maxTime )
 
 			HideAnalysisProgress();
 
+			// areas are final - build the area PVS table that is saved with the mesh
+			m_areaPVS.Build();
+
 			// save the mesh
 			if (Save())
 			{
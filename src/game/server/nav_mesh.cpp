@@ -65,6 +65,7 @@ CNavMesh::CNavMesh( void )
 	m_editMode = NORMAL;
 	m_bQuitWhenFinished = false;
 	m_hostThreadModeRestoreValue = 0;
+	V_memset( m_generationPhaseTime, 0, sizeof( m_generationPhaseTime ) );
 	m_placeCount = 0;
 	m_placeName = NULL;
 
@@ -158,6 +159,7 @@ CNavArea *CNavMesh::GetMarkedArea( void ) const
  */
 void CNavMesh::DestroyNavigationMesh( bool incremental )
 {
+	m_areaPVS.Reset();
 	m_blockedAreas.RemoveAll();
 	m_avoidanceObstacleAreas.RemoveAll();
 	m_transientAreas.RemoveAll();
@@ -2496,6 +2498,7 @@ void CommandNavCompressID( void )
 
 	CNavArea::CompressIDs();
 	CNavLadder::CompressIDs();
+	TheNavMesh->GetAreaPVS().Reset();
 }
 static ConCommand nav_compress_id( "nav_compress_id", CommandNavCompressID, "Re-orders area and ladder ID's so they are continuous.", FCVAR_GAMEDLL | FCVAR_CHEAT );
 
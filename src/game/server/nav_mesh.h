@@ -26,10 +26,12 @@
 #include "nav.h"
 #include "nav_area.h"
 #include "nav_colors.h"
+#include "nav_pvs.h"
 
 
 class CNavArea;
 class CBaseEntity; 
+class CBaseCombatCharacter;
 class CBreakable;
 
 extern ConVar nav_edit;
@@ -328,6 +330,10 @@ public:
 	CNavArea *GetNavArea( CBaseEntity *pEntity, int nGetNavAreaFlags, float flBeneathLimit = 120.0f ) const;
 	CNavArea *GetNavAreaByID( unsigned int id ) const;
 	CNavArea *GetNearestNavArea( const Vector &pos, bool anyZ = false, float maxDist = 10000.0f, bool checkLOS = false, bool checkGround = true ) const;
+
+	CNavAreaPVS &GetAreaPVS( void )				{ return m_areaPVS; }	// precomputed area-to-area potential visibility
+	bool IsAreaInPVS( const CNavArea *from, const CNavArea *to ) const	{ return m_areaPVS.IsPotentiallyVisible( from, to ); }	// false only if 'to' can never be seen from 'from' (very fast)
+	bool CouldBeVisible( CBaseCombatCharacter *viewer, CBaseCombatCharacter *target ) const;	// false only if 'target' can't be seen from where 'viewer' stands (very fast)
 	CNavArea *GetNearestNavArea( CBaseEntity *pEntity, int nGetNavAreaFlags = GETNAVAREA_CHECK_GROUND, float maxDist = 10000.0f ) const;
 
 	Place GetPlace( const Vector &pos ) const;							// return Place at given coordinate
@@ -355,6 +361,7 @@ public:
 	void BeginAnalysis( bool quitWhenFinished = false );						// re-analyze an existing Mesh.  Determine Hiding Spots, Encounter Spots, etc.
 
 	bool IsGenerating( void ) const		{ return m_generationMode != GENERATE_NONE; }	// return true while a Navigation Mesh is being generated
+	void PrintGenerationTimings( void ) const;							// report time spent in each generation phase of the last (or current) generation
 	const char *GetPlayerSpawnName( void ) const;						// return name of player spawn entity
 	void SetPlayerSpawnName( const char *name );						// define the name of player spawn entities
 	void AddWalkableSeed( const Vector &pos, const Vector &normal );	// add given walkable position to list of seed positions for map sampling
@@ -798,6 +805,7 @@ private:
 	bool m_isLoaded;											// true if a Navigation Mesh has been loaded
 	bool m_isOutOfDate;											// true if the Navigation Mesh is older than the actual BSP
 	bool m_isAnalyzed;											// true if the Navigation Mesh needs analysis
+	CNavAreaPVS m_areaPVS;										// conservative area-to-area visibility from the BSP PVS
 
 	enum { HASH_TABLE_SIZE = 256 };
 	CNavArea *m_hashTable[ HASH_TABLE_SIZE ];					// hash table to optimize lookup by ID
@@ -939,6 +947,7 @@ private:
 	}
 	m_generationMode;											// true while a Navigation Mesh is being generated
 	int m_generationIndex;										// used for iterating nav areas during generation process
+	double m_generationPhaseTime[ NUM_GENERATION_STATES ];		// seconds spent in each generation state, for nav_generate_timings
 	int m_sampleTick;											// counter for displaying pseudo-progress while sampling walkable space
 	bool m_bQuitWhenFinished;
 	float m_generationStartTime;
@@ -957,6 +966,17 @@ private:
 	int m_seedIdx;
 	int m_hostThreadModeRestoreValue;							// stores the value of host_threadmode before we changed it
 
+	struct HidingSpotJob
+	{
+		CNavArea *area;
+		int count;
+		CNavArea::HidingSpotCandidate candidates[ NUM_CORNERS ];
+	};
+	static void FindHidingSpotsJob( HidingSpotJob &job );
+	int ComputeHidingSpotsBatch( int first );					// per-area analysis passes; return the number of areas processed starting at 'first'
+	int ComputeSpotEncountersBatch( int first );
+	int ComputeSniperSpotsBatch( int first );
+
 	void BuildTransientAreaList( void );
 	CUtlVector< CNavArea * > m_transientAreas;
 
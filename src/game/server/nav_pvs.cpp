@@ -0,0 +1,476 @@
+//===== Copyright  1996-2005, Valve Corporation, All rights reserved. ======//
+//
+// Purpose: 
+//
+// $NoKeywords: $
+//===========================================================================//
+
+// Precomputed area-to-area potential visibility for the Navigation Mesh
+
+#include "cbase.h"
+#include "nav_mesh.h"
+#include "nav_pvs.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+ConVar nav_area_pvs( "nav_area_pvs", "1", FCVAR_GAMEDLL, "Use the precomputed nav area PVS table to reject line-of-sight checks between areas that can never see each other." );
+
+
+//--------------------------------------------------------------------------------------------------------------
+static void PutRunLength( CUtlVector< unsigned char > &out, unsigned int run )
+{
+	while ( run >= 0x80 )
+	{
+		out.AddToTail( (unsigned char)( ( run & 0x7F ) | 0x80 ) );
+		run >>= 7;
+	}
+	out.AddToTail( (unsigned char)run );
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+static unsigned int GetRunLength( const unsigned char *&in, const unsigned char *end )
+{
+	unsigned int run = 0;
+	int shift = 0;
+	while ( in < end )
+	{
+		unsigned char b = *in++;
+		run |= (unsigned int)( b & 0x7F ) << shift;
+		if ( !( b & 0x80 ) )
+			break;
+		shift += 7;
+	}
+	return run;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Remember the cluster at the given position, if it is not already in this area's list
+ */
+static void AddAreaCluster( CUtlVector< int > &clusters, int first, const Vector &pos )
+{
+	int cluster = engine->GetClusterForOrigin( pos );
+	if ( cluster < 0 )
+		return;
+
+	for ( int i=first; i<clusters.Count(); ++i )
+	{
+		if ( clusters[i] == cluster )
+			return;
+	}
+
+	clusters.AddToTail( cluster );
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+CNavAreaPVS::CNavAreaPVS( void )
+{
+	m_maxID = 0;
+	m_areaCount = 0;
+	m_expandedRowCount = 0;
+	ResetStats();
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+CNavAreaPVS::~CNavAreaPVS()
+{
+	Reset();
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+void CNavAreaPVS::Reset( void )
+{
+	FOR_EACH_VEC( m_rows, it )
+	{
+		delete [] m_rows[ it ];
+	}
+	m_rows.Purge();
+	m_encoded.Purge();
+	m_rowOffset.Purge();
+	m_maxID = 0;
+	m_areaCount = 0;
+	m_expandedRowCount = 0;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * The table is keyed by area ID, so it is only usable while the set of areas is the one it was built for
+ */
+bool CNavAreaPVS::IsValid( void ) const
+{
+	return m_maxID > 0 && m_areaCount == TheNavAreas.Count();
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Build the table from the BSP cluster PVS.  Each area is reduced to the set of clusters its
+ * floor samples occupy from foot to the top of a standing hull, and area B is potentially
+ * visible from area A if any of B's clusters is in the union of A's cluster PVSs.
+ * Areas whose samples are all in solid space are treated as visible from and to everything.
+ */
+void CNavAreaPVS::Build( void )
+{
+	Reset();
+
+	int clusterCount = engine->GetClusterCount();
+	if ( clusterCount <= 0 || TheNavAreas.Count() == 0 )
+		return;
+
+	const int pvsSize = PAD_NUMBER( clusterCount, 8 ) / 8;
+
+	unsigned int maxID = 0;
+	FOR_EACH_VEC( TheNavAreas, it )
+	{
+		maxID = MAX( maxID, TheNavAreas[ it ]->GetID() );
+	}
+
+	// collect the clusters each area occupies
+	// sample up to the top of the head, since that may be all of a target that shows over cover
+	const float heights[] = { StepHeight, HumanCrouchEyeHeight, HumanEyeHeight, HumanHeight };
+	const float margin = GenerationStepSize/2.0f;
+
+	CUtlVector< int > clusters;
+	CUtlVector< int > clusterStart;
+	clusterStart.SetCount( TheNavAreas.Count() + 1 );
+
+	FOR_EACH_VEC( TheNavAreas, it )
+	{
+		const CNavArea *area = TheNavAreas[ it ];
+		clusterStart[ it ] = clusters.Count();
+
+		for ( int h=0; h<ARRAYSIZE( heights ); ++h )
+		{
+			AddAreaCluster( clusters, clusterStart[ it ], area->GetCenter() + Vector( 0, 0, heights[h] ) );
+
+			for ( int c=0; c<NUM_CORNERS; ++c )
+			{
+				AddAreaCluster( clusters, clusterStart[ it ], area->GetCorner( (NavCornerType)c ) + Vector( 0, 0, heights[h] ) );
+			}
+
+			Vector shift( 0, 0, 0 );
+			for( shift.y = margin; shift.y <= area->GetSizeY() - margin; shift.y += GenerationStepSize )
+			{
+				for( shift.x = margin; shift.x <= area->GetSizeX() - margin; shift.x += GenerationStepSize )
+				{
+					Vector pos( area->GetCorner( NORTH_WEST ) + shift );
+					pos.z = area->GetZ( pos ) + heights[h];
+
+					AddAreaCluster( clusters, clusterStart[ it ], pos );
+				}
+			}
+		}
+	}
+	clusterStart[ TheNavAreas.Count() ] = clusters.Count();
+
+	CUtlVector< byte > pvs;
+	CUtlVector< byte > clusterPVS;
+	pvs.SetCount( pvsSize );
+	clusterPVS.SetCount( pvsSize );
+
+	CUtlVector< uint32 > row;
+	row.SetCount( ( maxID + 32 ) / 32 );
+
+	m_rowOffset.SetCount( maxID + 1 );
+	FOR_EACH_VEC( m_rowOffset, it )
+	{
+		m_rowOffset[ it ] = -1;
+	}
+
+	FOR_EACH_VEC( TheNavAreas, it )
+	{
+		const CNavArea *area = TheNavAreas[ it ];
+		bool isAreaInSolid = ( clusterStart[ it ] == clusterStart[ it+1 ] );
+
+		// union of the PVS of every cluster this area occupies
+		V_memset( pvs.Base(), 0, pvsSize );
+		for ( int c=clusterStart[ it ]; c<clusterStart[ it+1 ]; ++c )
+		{
+			engine->GetPVSForCluster( clusters[c], pvsSize, clusterPVS.Base() );
+			for ( int b=0; b<pvsSize; ++b )
+			{
+				pvs[b] |= clusterPVS[b];
+			}
+		}
+
+		V_memset( row.Base(), 0, row.Count() * sizeof( uint32 ) );
+		FOR_EACH_VEC( TheNavAreas, ot )
+		{
+			bool isVisible = isAreaInSolid || ( it == ot ) || ( clusterStart[ ot ] == clusterStart[ ot+1 ] );
+
+			for ( int c=clusterStart[ ot ]; !isVisible && c<clusterStart[ ot+1 ]; ++c )
+			{
+				int cluster = clusters[c];
+				isVisible = ( pvs[ cluster >> 3 ] & ( 1 << ( cluster & 7 ) ) ) != 0;
+			}
+
+			if ( isVisible )
+			{
+				unsigned int id = TheNavAreas[ ot ]->GetID();
+				row[ id >> 5 ] |= 1u << ( id & 31 );
+			}
+		}
+
+		// run-length encode the row, alternating runs of clear and set bits starting with clear
+		m_rowOffset[ area->GetID() ] = m_encoded.Count();
+
+		bool runValue = false;
+		unsigned int runLength = 0;
+		for ( unsigned int id=0; id<=maxID; ++id )
+		{
+			bool bit = ( row[ id >> 5 ] & ( 1u << ( id & 31 ) ) ) != 0;
+			if ( bit != runValue )
+			{
+				PutRunLength( m_encoded, runLength );
+				runValue = bit;
+				runLength = 0;
+			}
+			++runLength;
+		}
+		PutRunLength( m_encoded, runLength );
+	}
+
+	m_maxID = maxID;
+	m_areaCount = TheNavAreas.Count();
+	m_rows.SetCount( maxID + 1 );
+	FOR_EACH_VEC( m_rows, it )
+	{
+		m_rows[ it ] = NULL;
+	}
+
+	DevMsg( "Nav area PVS: %d areas, %d clusters, %d bytes encoded.\n", m_areaCount, clusterCount, m_encoded.Count() );
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+void CNavAreaPVS::Save( CUtlBuffer &fileBuffer ) const
+{
+	if ( !IsValid() )
+	{
+		fileBuffer.PutUnsignedInt( 0 );
+		return;
+	}
+
+	fileBuffer.PutUnsignedInt( m_maxID );
+	fileBuffer.PutInt( m_areaCount );
+
+	for ( unsigned int id=0; id<=m_maxID; ++id )
+	{
+		fileBuffer.PutInt( m_rowOffset[ id ] );
+	}
+
+	fileBuffer.PutInt( m_encoded.Count() );
+	fileBuffer.Put( m_encoded.Base(), m_encoded.Count() );
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Read the encoded table.  Rows are left encoded until they are first queried.
+ * Returns false if the block is malformed, in which case the rest of the buffer cannot be trusted.
+ * A well-formed block may still leave the table empty (none was saved, or its rows are bad).
+ */
+bool CNavAreaPVS::Load( CUtlBuffer &fileBuffer )
+{
+	Reset();
+
+	unsigned int maxID = fileBuffer.GetUnsignedInt();
+	if ( !fileBuffer.IsValid() )
+		return false;
+
+	if ( maxID == 0 )
+		return true;
+
+	int areaCount = fileBuffer.GetInt();
+	if ( !fileBuffer.IsValid() || maxID >= (unsigned int)fileBuffer.GetBytesRemaining() / sizeof( int ) )
+		return false;
+
+	m_rowOffset.SetCount( maxID + 1 );
+	for ( unsigned int id=0; id<=maxID; ++id )
+	{
+		m_rowOffset[ id ] = fileBuffer.GetInt();
+	}
+
+	int encodedSize = fileBuffer.GetInt();
+	if ( !fileBuffer.IsValid() || encodedSize < 0 || encodedSize > fileBuffer.GetBytesRemaining() )
+	{
+		Reset();
+		return false;
+	}
+
+	m_encoded.SetCount( encodedSize );
+	fileBuffer.Get( m_encoded.Base(), encodedSize );
+
+	// the block has been consumed either way; bad rows only cost us the table
+	FOR_EACH_VEC( m_rowOffset, it )
+	{
+		if ( m_rowOffset[ it ] >= encodedSize )
+		{
+			Reset();
+			return true;
+		}
+	}
+
+	m_maxID = maxID;
+	m_areaCount = areaCount;
+	m_rows.SetCount( maxID + 1 );
+	FOR_EACH_VEC( m_rows, it )
+	{
+		m_rows[ it ] = NULL;
+	}
+
+	return true;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+const uint32 *CNavAreaPVS::GetRow( unsigned int id ) const
+{
+	if ( id > m_maxID || m_rowOffset[ id ] < 0 )
+		return NULL;
+
+	if ( m_rows[ id ] )
+		return m_rows[ id ];
+
+	int wordCount = ( m_maxID + 32 ) / 32;
+	uint32 *row = new uint32[ wordCount ];
+	V_memset( row, 0, wordCount * sizeof( uint32 ) );
+
+	const unsigned char *in = m_encoded.Base() + m_rowOffset[ id ];
+	const unsigned char *end = m_encoded.Base() + m_encoded.Count();
+
+	bool runValue = false;
+	unsigned int bit = 0;
+	while ( bit <= m_maxID && in < end )
+	{
+		unsigned int runEnd = MIN( bit + GetRunLength( in, end ), m_maxID + 1 );
+		if ( runValue )
+		{
+			for ( ; bit < runEnd; ++bit )
+			{
+				row[ bit >> 5 ] |= 1u << ( bit & 31 );
+			}
+		}
+		bit = runEnd;
+		runValue = !runValue;
+	}
+
+	m_rows[ id ] = row;
+	++m_expandedRowCount;
+
+	return row;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+bool CNavAreaPVS::IsPotentiallyVisible( const CNavArea *from, const CNavArea *to ) const
+{
+	if ( from == NULL || to == NULL || from == to )
+		return true;
+
+	if ( !nav_area_pvs.GetBool() || !IsValid() )
+		return true;
+
+	unsigned int toID = to->GetID();
+	if ( toID > m_maxID )
+		return true;
+
+	const uint32 *row = GetRow( from->GetID() );
+	if ( row == NULL )
+		return true;
+
+	++m_queryCount;
+
+	if ( row[ toID >> 5 ] & ( 1u << ( toID & 31 ) ) )
+		return true;
+
+	++m_rejectCount;
+	return false;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Return the area the character is standing in, or NULL if it is airborne or has left its last known area
+ * (in which case its eye may not be where the table assumes it is)
+ */
+static const CNavArea *GetStandingArea( CBaseCombatCharacter *character )
+{
+	const CNavArea *area = character->GetLastKnownArea();
+	if ( area == NULL || character->GetGroundEntity() == NULL )
+		return NULL;
+
+	// IsOverlapping is 2D only - also require the feet to be near the floor, so an area stacked
+	// above or below where the character really is will not answer for it
+	const Vector &origin = character->GetAbsOrigin();
+	if ( !area->IsOverlapping( origin ) || fabs( origin.z - area->GetZ( origin ) ) > StepHeight )
+		return NULL;
+
+	return area;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+bool CNavMesh::CouldBeVisible( CBaseCombatCharacter *viewer, CBaseCombatCharacter *target ) const
+{
+	return m_areaPVS.IsPotentiallyVisible( GetStandingArea( viewer ), GetStandingArea( target ) );
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+void CNavAreaPVS::ResetStats( void )
+{
+	m_queryCount = 0;
+	m_rejectCount = 0;
+	m_statsStartTick = gpGlobals ? gpGlobals->tickcount : 0;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+void CNavAreaPVS::PrintStats( void ) const
+{
+	if ( !IsValid() )
+	{
+		Msg( "Nav area PVS: no table for the current mesh (use nav_area_pvs_build).\n" );
+		return;
+	}
+
+	int ticks = MAX( gpGlobals->tickcount - m_statsStartTick, 1 );
+
+	Msg( "Nav area PVS: %d areas, %d bytes encoded, %d of %u rows expanded\n", m_areaCount, m_encoded.Count(), m_expandedRowCount, m_maxID );
+	Msg( "  %u queries, %u rejected without tracing (%.1f%%) over %d ticks\n", m_queryCount, m_rejectCount, m_queryCount ? 100.0f * m_rejectCount / m_queryCount : 0.0f, ticks );
+	Msg( "  %.2f visibility checks skipped per tick\n", (float)m_rejectCount / ticks );
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+CON_COMMAND_F( nav_area_pvs_build, "Compute the nav area PVS table for the current mesh. Use nav_save to store it in the .nav file.", FCVAR_CHEAT )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	TheNavMesh->GetAreaPVS().Build();
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+CON_COMMAND_F( nav_area_pvs_stats, "Report how many visibility checks the nav area PVS table rejected. 'nav_area_pvs_stats reset' clears the counters.", FCVAR_GAMEDLL )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	if ( args.ArgC() > 1 && FStrEq( args[1], "reset" ) )
+	{
+		TheNavMesh->GetAreaPVS().ResetStats();
+		return;
+	}
+
+	TheNavMesh->GetAreaPVS().PrintStats();
+}
@@ -0,0 +1,64 @@
+//===== Copyright  1996-2005, Valve Corporation, All rights reserved. ======//
+//
+// Purpose: 
+//
+// $NoKeywords: $
+//===========================================================================//
+
+// Precomputed area-to-area potential visibility for the Navigation Mesh
+
+#ifndef _NAV_PVS_H_
+#define _NAV_PVS_H_
+
+#include "utlvector.h"
+#include "utlbuffer.h"
+
+class CNavArea;
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * A conservative "can area A possibly see area B" table built from the BSP's cluster PVS.
+ * One row per area ID, one bit per area ID.  Rows are stored run-length encoded in the .nav
+ * file and in memory, and a row is only expanded to a bit vector the first time it is queried,
+ * after which lookups are O(1).
+ *
+ * A clear bit means nothing in the viewed area can be seen from anywhere in the viewing area,
+ * so callers may skip their line-of-sight traces.  A set bit means nothing - trace as usual.
+ */
+class CNavAreaPVS
+{
+public:
+	CNavAreaPVS( void );
+	~CNavAreaPVS();
+
+	void Reset( void );											///< discard the table
+	bool IsValid( void ) const;									///< return true if the table matches the current mesh
+
+	void Build( void );											///< compute the table for the current mesh from the BSP PVS
+
+	void Save( CUtlBuffer &fileBuffer ) const;
+	bool Load( CUtlBuffer &fileBuffer );							///< return false if the block is malformed
+
+	bool IsPotentiallyVisible( const CNavArea *from, const CNavArea *to ) const;	///< false only if 'to' can never be seen from 'from'
+
+	void ResetStats( void );
+	void PrintStats( void ) const;
+
+private:
+	const uint32 *GetRow( unsigned int id ) const;				///< expand the row for the given area ID on first use
+
+	unsigned int m_maxID;										///< rows and columns are area IDs 1..m_maxID
+	int m_areaCount;											///< number of areas when the table was built
+	CUtlVector< unsigned char > m_encoded;						///< all rows, run-length encoded back to back
+	CUtlVector< int > m_rowOffset;								///< offset of each row in m_encoded, -1 if no area has that ID
+
+	mutable CUtlVector< uint32 * > m_rows;						///< lazily expanded rows
+	mutable int m_expandedRowCount;
+
+	mutable unsigned int m_queryCount;							///< number of queries answered from the table
+	mutable unsigned int m_rejectCount;							///< number of queries answered "not visible"
+	int m_statsStartTick;
+};
+
+
+#endif // _NAV_PVS_H_
@@ -35,6 +35,7 @@
 #include "igamemovement.h"
 #include "tier0/cache_hints.h"
 #include "basecsgrenade_projectile.h"
+#include "player_movesched.h"
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
 
@@ -2276,6 +2277,42 @@ void Physics_SimulateEntity( CBaseEntity *pEntity )
 		pEntity->PhysicsRunThink();
 	}
 }
+static ConVar sv_thinkstats( "sv_thinkstats", "0", FCVAR_RELEASE, "Every N ticks, print per tick averages of entities in the sim/think list, entities visited and entities with a due think or game physics." );
+
+static struct ThinkStats_t
+{
+	int m_nTicks;
+	int m_nListed;
+	int m_nVisited;
+	int m_nWorking;
+} s_ThinkStats;
+
+static bool Physics_EntityHasWork( CBaseEntity *pEntity )
+{
+	if ( !pEntity->IsEFlagSet( EFL_NO_GAME_PHYSICS_SIMULATION ) )
+		return true;
+
+	int nThinkTick = pEntity->GetFirstThinkTick();
+	return nThinkTick > 0 && nThinkTick <= gpGlobals->tickcount;
+}
+
+static void Physics_UpdateThinkStats( int nListed, int nVisited, int nWorking )
+{
+	s_ThinkStats.m_nTicks++;
+	s_ThinkStats.m_nListed += nListed;
+	s_ThinkStats.m_nVisited += nVisited;
+	s_ThinkStats.m_nWorking += nWorking;
+
+	if ( s_ThinkStats.m_nTicks < sv_thinkstats.GetInt() )
+		return;
+
+	float flTicks = s_ThinkStats.m_nTicks;
+	Msg( "thinkstats: %d ticks, per tick %.1f listed, %.1f visited, %.1f with work (%.0f%% of visited)\n",
+		s_ThinkStats.m_nTicks, s_ThinkStats.m_nListed / flTicks, s_ThinkStats.m_nVisited / flTicks, s_ThinkStats.m_nWorking / flTicks,
+		s_ThinkStats.m_nVisited ? 100.0f * s_ThinkStats.m_nWorking / s_ThinkStats.m_nVisited : 100.0f );
+	V_memset( &s_ThinkStats, 0, sizeof( s_ThinkStats ) );
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: Runs the main physics simulation loop against all entities ( except players )
 //-----------------------------------------------------------------------------
@@ -2319,14 +2356,37 @@ void Physics_RunThinkFunctions( bool simulating )
 		// Do we really need UTIL_RemoveImmediate()?
 		int count = SimThink_ListCopy( list, listMax );
 
+		PlayerMoveSched_BeginTick();
+		bool bTimePlayers = PlayerMoveSched_IsTimingPlayers();
+
 		//DevMsg(1, "Count: %d\n", count );
+		bool bThinkStats = sv_thinkstats.GetInt() > 0;
+		int nWorking = 0;
 		for ( int i = 0; i < count; i++ )
 		{
 			// Always reset clock to real sv.time
 			gpGlobals->curtime = starttime;
+			if ( bThinkStats && Physics_EntityHasWork( list[i] ) )
+			{
+				nWorking++;
+			}
+			if ( bTimePlayers && list[i]->IsPlayer() )
+			{
+				double flStartTime = Plat_FloatTime();
+				Physics_SimulateEntity( list[i] );
+				PlayerMoveSched_PlayerSimulated( ToBasePlayer( list[i] ), Plat_FloatTime() - flStartTime );
+				continue;
+			}
 			Physics_SimulateEntity( list[i] );
 		}
 
+		PlayerMoveSched_EndTick();
+
+		if ( bThinkStats )
+		{
+			Physics_UpdateThinkStats( SimThink_ListCount(), count, nWorking );
+		}
+
 		// The pusher system queued up a bunch of physics updates.  Make them happen now.
 		g_pPushedEntities->UpdatePusherPhysicsEndOfTick();
 
@@ -698,6 +698,8 @@ CBasePlayer::CBasePlayer( )
 
 	m_flTimeLastTouchedGround = 0.0f;
 	m_ignoreLadderJumpTime = 0.0f;
+	m_vecMoveTrailingVelocity.Init();
+	m_flMoveTrailingVelocityTime = 0.0f;
 
 	m_PlayerInputDevice = INPUT_DEVICE_NONE;
 	m_PlayerPlatform = INPUT_DEVICE_PLATFORM_NONE;
@@ -9398,26 +9400,34 @@ bool CPlayerInfo::IsEFlagSet( int nEFlagMask )
 	return false;
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: The usercmd RunPlayerMove runs for a bot command
+//-----------------------------------------------------------------------------
+void BotCmdToUserCmd( const CBotCmd &botCmd, CUserCmd &cmd )
+{
+	cmd.buttons = botCmd.buttons;
+	cmd.command_number = botCmd.command_number;
+	cmd.forwardmove = botCmd.forwardmove;
+	cmd.hasbeenpredicted = botCmd.hasbeenpredicted;
+	cmd.impulse = botCmd.impulse;
+	cmd.mousedx = botCmd.mousedx;
+	cmd.mousedy = botCmd.mousedy;
+	cmd.random_seed = botCmd.random_seed;
+	cmd.sidemove = botCmd.sidemove;
+	cmd.tick_count = botCmd.tick_count;
+	cmd.upmove = botCmd.upmove;
+	cmd.viewangles = botCmd.viewangles;
+	cmd.weaponselect = botCmd.weaponselect;
+	cmd.weaponsubtype = botCmd.weaponsubtype;
+}
+
 void CPlayerInfo::RunPlayerMove( CBotCmd *ucmd ) 
 { 
 	if ( m_pParent->IsBot() )
 	{
 		Assert( m_pParent );
 		CUserCmd cmd;
-		cmd.buttons = ucmd->buttons;
-		cmd.command_number = ucmd->command_number;
-		cmd.forwardmove = ucmd->forwardmove;
-		cmd.hasbeenpredicted = ucmd->hasbeenpredicted;
-		cmd.impulse = ucmd->impulse;
-		cmd.mousedx = ucmd->mousedx;
-		cmd.mousedy = ucmd->mousedy;
-		cmd.random_seed = ucmd->random_seed;
-		cmd.sidemove = ucmd->sidemove;
-		cmd.tick_count = ucmd->tick_count;
-		cmd.upmove = ucmd->upmove;
-		cmd.viewangles = ucmd->viewangles;
-		cmd.weaponselect = ucmd->weaponselect;
-		cmd.weaponsubtype = ucmd->weaponsubtype;
+		BotCmdToUserCmd( *ucmd, cmd );
 
 		// Store off the globals.. they're gonna get whacked
 		float flOldFrametime = gpGlobals->frametime;
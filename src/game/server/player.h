@@ -149,6 +149,9 @@ extern bool gInitHUD;
 extern ConVar *sv_cheats;
 
 class CBasePlayer;
+
+void BotCmdToUserCmd( const CBotCmd &botCmd, CUserCmd &cmd );
+
 class CPlayerInfo : public IBotController, public IPlayerInfo
 {
 public:
@@ -901,6 +904,9 @@ public:
 	void				IncrementEFNoInterpParity();
 	int					GetEFNoInterpParity() const;
 
+	// Number of ticks of usercmds queued up for the next PhysicsSimulate
+	int					DetermineSimulationTicks( void );
+
 private:
 	
 	// For queueing up CUserCmds and running them from PhysicsSimulate
@@ -912,7 +918,6 @@ private:
 	CCommandContext		*RemoveAllCommandContextsExceptNewest( void );
 	void				ReplaceContextCommands( CCommandContext *ctx, CUserCmd *pCommands, int nCommands );
 
-	int					DetermineSimulationTicks( void );
 	void				AdjustPlayerTimeBase( int simulation_ticks );
 	void				UpdateSplitScreenAndPictureInPicturePlayerList();
 
@@ -1316,6 +1321,8 @@ protected:
 	int		m_nVehicleViewSavedFrame;	// Used to mark which frame was the last one the view was calculated for
 
 	Vector m_vecPreviouslyPredictedOrigin; // Used to determine if non-gamemovement game code has teleported, or tweaked the player's origin
+	Vector m_vecMoveTrailingVelocity;	// CMoveData trailing velocity, kept per player instead of carrying over between players
+	float m_flMoveTrailingVelocityTime;
 	int		m_nBodyPitchPoseParam;
 
 	CNetworkString( m_szLastPlaceName, MAX_PLACE_NAME_LENGTH );
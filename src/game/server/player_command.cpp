@@ -13,6 +13,8 @@
 #include "player_command.h"
 #include "movehelper_server.h"
 #include "iservervehicle.h"
+#include "gamemovement.h"
+#include "player_movesched.h"
 #include "tier0/vprof.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
@@ -181,6 +183,8 @@ void CPlayerMove::SetupMove( CBasePlayer *player, CUserCmd *ucmd, IMoveHelper *p
 	move->m_vecAngles			= player->pl.v_angle;
 
 	move->m_vecVelocity			= player->GetAbsVelocity();
+	move->m_vecTrailingVelocity	= player->m_vecMoveTrailingVelocity;
+	move->m_flTrailingVelocityTime = player->m_flMoveTrailingVelocityTime;
 
 	move->m_nPlayerHandle		= player;
 
@@ -199,6 +203,46 @@ void CPlayerMove::SetupMove( CBasePlayer *player, CUserCmd *ucmd, IMoveHelper *p
 	g_pGameMovement->SetupMovementBounds( move );
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Prepares the move data for a usercmd ahead of RunCommand, the way
+//			RunCommand will, so its movement can run on a job thread. Anything
+//			RunPreThink and friends change before then shows up in the inputs.
+// Input  : *player - 
+//			*ucmd - private copy of the usercmd, adjusted the way RunCommand
+//				adjusts the real one
+//			*move - 
+//			*pGameMovement - movement that will run the move
+//			&inputs - player state the move depends on
+//-----------------------------------------------------------------------------
+void CPlayerMove::SetupSpeculativeMove( CBasePlayer *player, CUserCmd *ucmd, CMoveData *move, CGameMovement *pGameMovement, PlayerMoveInputs_t &inputs )
+{
+	VPROF( "CPlayerMove::SetupSpeculativeMove" );
+
+	ucmd->buttons |= player->m_afButtonForced;
+	ucmd->buttons &= ~player->m_afButtonDisabled;
+
+	CUserCmd *pSavedCommand = SetSpeculativeCommand( player, ucmd );
+	QAngle vecSavedViewAngles = player->pl.v_angle;
+
+	// Only called with no fixangle pending, so the usercmd angles are used as is
+	Assert( player->pl.fixangle == FIXANGLE_NONE );
+	move->m_vecOldAngles = player->pl.v_angle;
+	player->pl.v_angle = ucmd->viewangles;
+
+	SetupMove( player, ucmd, MoveHelper(), move );
+	pGameMovement->GetMoveInputs( player, inputs );
+
+	player->pl.v_angle = vecSavedViewAngles;
+	SetSpeculativeCommand( player, pSavedCommand );
+}
+
+CUserCmd *CPlayerMove::SetSpeculativeCommand( CBasePlayer *player, CUserCmd *ucmd )
+{
+	CUserCmd *pPrevious = player->m_pCurrentCommand;
+	player->m_pCurrentCommand = ucmd;
+	return pPrevious;
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: Finishes running movement
 // Input  : *player - 
@@ -214,6 +258,8 @@ void CPlayerMove::FinishMove( CBasePlayer *player, CUserCmd *ucmd, CMoveData *mo
 	player->SetAbsOrigin( move->GetAbsOrigin() );
 	player->SetAbsVelocity( move->m_vecVelocity );
 	player->SetPreviouslyPredictedOrigin( move->GetAbsOrigin() );
+	player->m_vecMoveTrailingVelocity = move->m_vecTrailingVelocity;
+	player->m_flMoveTrailingVelocityTime = move->m_flTrailingVelocityTime;
 
 	player->m_Local.m_nOldButtons			= move->m_nButtons;
 
@@ -438,7 +484,11 @@ void CPlayerMove::RunCommand ( CBasePlayer *player, CUserCmd *ucmd, IMoveHelper
 	{
 		VPROF( "g_pGameMovement->ProcessMovement()" );
 		Assert( g_pGameMovement );
-		g_pGameMovement->ProcessMovement( player, g_pMoveData );
+		// Keep the result of a move already run on the job pool if nothing it depends on changed since
+		if ( !PlayerMoveSched_CommitMove( player, g_pMoveData, moveHelper ) )
+		{
+			g_pGameMovement->ProcessMovement( player, g_pMoveData );
+		}
 	}
 	else
 	{
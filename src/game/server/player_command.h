@@ -17,6 +17,8 @@
 class IMoveHelper;
 class CMoveData;
 class CBasePlayer;
+class CGameMovement;
+struct PlayerMoveInputs_t;
 
 //-----------------------------------------------------------------------------
 // Purpose: Server side player movement
@@ -34,6 +36,13 @@ public:
 	// Run a movement command from the player
 	virtual void	RunCommand ( CBasePlayer *player, CUserCmd *ucmd, IMoveHelper *moveHelper );
 
+	// Movement run ahead of time on a job thread (see player_movesched.cpp).
+	// Sets up the move data RunCommand would pass to ProcessMovement for a usercmd
+	// that hasn't run yet, and captures the player state the move depends on.
+	void			SetupSpeculativeMove( CBasePlayer *player, CUserCmd *ucmd, CMoveData *move, CGameMovement *pGameMovement, PlayerMoveInputs_t &inputs );
+	// Points the player at the usercmd a speculative move runs; returns the previous one
+	CUserCmd		*SetSpeculativeCommand( CBasePlayer *player, CUserCmd *ucmd );
+
 protected:
 	// Prepare for running movement
 	virtual void	SetupMove( CBasePlayer *player, CUserCmd *ucmd, IMoveHelper *pHelper, CMoveData *move );
@@ -0,0 +1,981 @@
+//========= Copyright  1996-2006, Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Opt-in parallel player movement (sv_parallel_playermove).
+//
+//			Conflict groups: players get a box covering everything their
+//			usercmds for the tick can reach. The spatial partition is read
+//			on the job pool to find the triggers and movable or touchable
+//			entities inside each box. Players whose boxes overlap, or who
+//			can reach the same entity, end up in one conflict group.
+//
+//			Speculative moves: bot usercmds handed over as a batch (the
+//			server benchmark's replay clients) are grouped the same way.
+//			Each player alone in its group has ProcessMovement run on the
+//			job pool, on its own CGameMovement, against the world as it is
+//			before the batch. The player is put back afterwards; what the
+//			move wrote to it, its CMoveData and its touches are kept. When
+//			RunCommand gets to that usercmd, the move is only applied if
+//			the player state it read, its CMoveData and the solid entities
+//			it could reach are unchanged. Anything the move would do
+//			outside the player (sounds, landing, jumping, ground changes,
+//			impacts) fails it early. Everyone else, and every failed or
+//			stale move, runs serially in the usual order, so the result is
+//			the same as running them all serially.
+//
+//			Human usercmds still run serially from PhysicsSimulate; each
+//			runs at its own tick base while gpGlobals holds one clock, and
+//			weapons and lag compensation run between them. Their groups and
+//			move times only estimate how much of the time is independent.
+//			See sv_parallel_playermove_stats.
+//
+// $NoKeywords: $
+//=============================================================================//
+
+#include "cbase.h"
+#include "player.h"
+#include "player_movesched.h"
+#include "movevars_shared.h"
+#include "ispatialpartition.h"
+#include "collisionutils.h"
+#include "checksum_crc.h"
+#include "serverbenchmark_base.h"
+#include "player_command.h"
+#include "gamemovement.h"
+#include "imovehelper.h"
+#include "tier0/vprof.h"
+#include "vstdlib/jobthread.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+extern CMoveData *g_pMoveData;
+extern IGameMovement *g_pGameMovement;
+
+ConVar sv_parallel_playermove( "sv_parallel_playermove", "0", 0, "1: run the movement of batched bot usercmds (the server benchmark's replay clients) on the job pool, keeping a move only if nothing it read changed before its usercmd runs. 2: also run the kept moves serially and warn if they differ. Either also finds the conflict groups of all moving players, see sv_parallel_playermove_stats." );
+
+#define MAX_PLAYERMOVE_REACHED	32
+
+struct PlayerMoveInfo_t
+{
+	CBasePlayer		*m_pPlayer;
+	Vector			m_vecMins;		// everything this tick's usercmds can reach
+	Vector			m_vecMaxs;
+	int				m_nParent;		// conflict group, union-find
+	int				m_nReached;		// -1 if more than MAX_PLAYERMOVE_REACHED
+	int				m_Reached[ MAX_PLAYERMOVE_REACHED ];	// entinfo index of triggers and movable or touchable entities in reach
+	double			m_flMoveTime;
+};
+
+struct PlayerMoveStats_t
+{
+	int		m_nTicks;
+	int		m_nPlayers;
+	int		m_nGroups;
+	int		m_nIsolated;		// players alone in their group
+	int		m_nLargestGroup;
+	double	m_flPrepassTime;
+	double	m_flMoveTime;
+	double	m_flProjectedMoveTime;	// estimate: slowest worker if each group ran on its own job
+};
+
+// Only touched from the main thread
+static CUtlVector< PlayerMoveInfo_t > s_PlayerMoves;
+static int s_PlayerMoveIndex[ MAX_PLAYERS + 1 ];
+static bool s_bPlayerMovesActive;
+static PlayerMoveStats_t s_PlayerMoveStats;
+static CRC32_t s_PlayerMoveCRC;
+static bool s_bPlayerMoveCRCInit;
+
+class CPlayerMoveReachEnum : public IPartitionEnumerator
+{
+public:
+	CPlayerMoveReachEnum( PlayerMoveInfo_t &info ) : m_Info( info )
+	{
+	}
+
+	virtual IterationRetval_t EnumElement( IHandleEntity *pHandleEntity )
+	{
+		CBaseEntity *pEntity = gEntList.GetBaseEntity( pHandleEntity->GetRefEHandle() );
+		if ( !pEntity || pEntity->IsPlayer() )
+			return ITERATION_CONTINUE;
+
+		// Still solids only block, the world is read only for every player
+		if ( !pEntity->IsSolidFlagSet( FSOLID_TRIGGER ) && pEntity->GetMoveType() == MOVETYPE_NONE && !pEntity->m_pfnTouch )
+			return ITERATION_CONTINUE;
+
+		if ( m_Info.m_nReached == MAX_PLAYERMOVE_REACHED )
+		{
+			m_Info.m_nReached = -1;
+			return ITERATION_STOP;
+		}
+
+		m_Info.m_Reached[ m_Info.m_nReached++ ] = pEntity->GetRefEHandle().GetEntryIndex();
+		return ITERATION_CONTINUE;
+	}
+
+private:
+	PlayerMoveInfo_t &m_Info;
+};
+
+static void FindPlayerMoveReach( PlayerMoveInfo_t &info )
+{
+	CPlayerMoveReachEnum reachEnum( info );
+	partition->EnumerateElementsInBox( PARTITION_ENGINE_SOLID_EDICTS | PARTITION_ENGINE_TRIGGER_EDICTS, info.m_vecMins, info.m_vecMaxs, false, &reachEnum );
+}
+
+static int FindPlayerMoveGroup( CUtlVector< PlayerMoveInfo_t > &moves, int i )
+{
+	while ( moves[i].m_nParent != i )
+	{
+		moves[i].m_nParent = moves[ moves[i].m_nParent ].m_nParent;
+		i = moves[i].m_nParent;
+	}
+	return i;
+}
+
+static void MergePlayerMoveGroups( CUtlVector< PlayerMoveInfo_t > &moves, int i, int j )
+{
+	i = FindPlayerMoveGroup( moves, i );
+	j = FindPlayerMoveGroup( moves, j );
+	if ( i != j )
+	{
+		// Lowest index wins so the grouping does not depend on merge order
+		moves[ MAX( i, j ) ].m_nParent = MIN( i, j );
+	}
+}
+
+static bool PlayerMovesShareEntity( const PlayerMoveInfo_t &a, const PlayerMoveInfo_t &b )
+{
+	if ( a.m_nReached < 0 || b.m_nReached < 0 )
+		return true;
+
+	for ( int i = 0; i < a.m_nReached; i++ )
+	{
+		for ( int j = 0; j < b.m_nReached; j++ )
+		{
+			if ( a.m_Reached[i] == b.m_Reached[j] )
+				return true;
+		}
+	}
+	return false;
+}
+
+static void AddPlayerMoveInfo( CUtlVector< PlayerMoveInfo_t > &moves, CBasePlayer *pPlayer, int nTicks )
+{
+	// Velocity is clamped to sv_maxvelocity per axis every move, plus a step up or down
+	float flReach = sv_maxvelocity.GetFloat() * nTicks * TICK_INTERVAL + sv_stepsize.GetFloat();
+	Vector vecReach( flReach, flReach, flReach );
+
+	// The hull can change with ducking, take the larger of the two
+	Vector vecHullMins, vecHullMaxs;
+	VectorMin( VEC_HULL_MIN, VEC_DUCK_HULL_MIN, vecHullMins );
+	VectorMax( VEC_HULL_MAX, VEC_DUCK_HULL_MAX, vecHullMaxs );
+
+	// Resolve any dirty absolute transforms here, not from a worker
+	const Vector &vecOrigin = pPlayer->GetAbsOrigin();
+
+	PlayerMoveInfo_t &info = moves[ moves.AddToTail() ];
+	info.m_pPlayer = pPlayer;
+	info.m_vecMins = vecOrigin + vecHullMins - vecReach;
+	info.m_vecMaxs = vecOrigin + vecHullMaxs + vecReach;
+	info.m_nParent = moves.Count() - 1;
+	info.m_nReached = 0;
+	info.m_flMoveTime = 0.0;
+}
+
+static void BuildPlayerMoveGroups( CUtlVector< PlayerMoveInfo_t > &moves )
+{
+	// The partition takes concurrent readers; nothing moves until the players run their usercmds
+	if ( g_pThreadPool && g_pThreadPool->NumThreads() )
+	{
+		ParallelProcess( moves.Base(), moves.Count(), &FindPlayerMoveReach );
+	}
+	else
+	{
+		FOR_EACH_VEC( moves, i )
+		{
+			FindPlayerMoveReach( moves[i] );
+		}
+	}
+
+	for ( int i = 0; i < moves.Count(); i++ )
+	{
+		const PlayerMoveInfo_t &a = moves[i];
+		for ( int j = i + 1; j < moves.Count(); j++ )
+		{
+			const PlayerMoveInfo_t &b = moves[j];
+			if ( IsBoxIntersectingBox( a.m_vecMins, a.m_vecMaxs, b.m_vecMins, b.m_vecMaxs ) || PlayerMovesShareEntity( a, b ) )
+			{
+				MergePlayerMoveGroups( moves, i, j );
+			}
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Called before entities simulate. Builds the conflict groups of all
+//			players with usercmds queued for this tick.
+//-----------------------------------------------------------------------------
+void PlayerMoveSched_BeginTick()
+{
+	s_bPlayerMovesActive = false;
+	if ( !sv_parallel_playermove.GetBool() )
+		return;
+
+	VPROF_BUDGET( "PlayerMoveSched_BeginTick", VPROF_BUDGETGROUP_PLAYER );
+
+	double flStartTime = Plat_FloatTime();
+
+	s_PlayerMoves.RemoveAll();
+	for ( int i = 1; i <= gpGlobals->maxClients; i++ )
+	{
+		s_PlayerMoveIndex[i] = -1;
+
+		CBasePlayer *pPlayer = UTIL_PlayerByIndex( i );
+		if ( !pPlayer || !pPlayer->IsAlive() )
+			continue;
+
+		int nTicks = pPlayer->DetermineSimulationTicks();
+		if ( nTicks <= 0 )
+			continue;
+
+		s_PlayerMoveIndex[i] = s_PlayerMoves.Count();
+		AddPlayerMoveInfo( s_PlayerMoves, pPlayer, nTicks );
+	}
+
+	if ( !s_PlayerMoves.Count() )
+		return;
+
+	BuildPlayerMoveGroups( s_PlayerMoves );
+
+	s_bPlayerMovesActive = true;
+	s_PlayerMoveStats.m_flPrepassTime += Plat_FloatTime() - flStartTime;
+}
+
+bool PlayerMoveSched_IsTimingPlayers()
+{
+	return s_bPlayerMovesActive;
+}
+
+void PlayerMoveSched_PlayerSimulated( CBasePlayer *pPlayer, double flSeconds )
+{
+	if ( !s_bPlayerMovesActive )
+		return;
+
+	int nIndex = s_PlayerMoveIndex[ pPlayer->entindex() ];
+	if ( nIndex >= 0 && s_PlayerMoves[nIndex].m_pPlayer == pPlayer )
+	{
+		s_PlayerMoves[nIndex].m_flMoveTime += flSeconds;
+	}
+}
+
+static int __cdecl CompareGroupTimes( const double *a, const double *b )
+{
+	// Longest first
+	return ( *a < *b ) ? 1 : ( ( *a > *b ) ? -1 : 0 );
+}
+
+static void UpdatePlayerMoveStats()
+{
+	int nCount = s_PlayerMoves.Count();
+
+	CUtlVectorFixedGrowable< double, MAX_PLAYERS > groupTimes;
+	CUtlVectorFixedGrowable< int, MAX_PLAYERS > groupSizes;
+	CUtlVectorFixedGrowable< int, MAX_PLAYERS > groupOf;
+	groupOf.SetCount( nCount );
+
+	double flMoveTime = 0.0;
+	for ( int i = 0; i < nCount; i++ )
+	{
+		int nRoot = FindPlayerMoveGroup( s_PlayerMoves, i );
+		if ( nRoot == i )
+		{
+			groupOf[i] = groupTimes.AddToTail( 0.0 );
+			groupSizes.AddToTail( 0 );
+		}
+		else
+		{
+			// Roots have the lowest index in their group, so they were visited first
+			groupOf[i] = groupOf[nRoot];
+		}
+		groupTimes[ groupOf[i] ] += s_PlayerMoves[i].m_flMoveTime;
+		groupSizes[ groupOf[i] ]++;
+		flMoveTime += s_PlayerMoves[i].m_flMoveTime;
+	}
+
+	int nLargest = 0;
+	int nIsolated = 0;
+	FOR_EACH_VEC( groupSizes, i )
+	{
+		nLargest = MAX( nLargest, groupSizes[i] );
+		nIsolated += ( groupSizes[i] == 1 ) ? 1 : 0;
+	}
+
+	// Longest group first onto the least loaded worker
+	int nWorkers = 1 + ( g_pThreadPool ? g_pThreadPool->NumThreads() : 0 );
+	CUtlVectorFixedGrowable< double, 64 > workerTimes;
+	workerTimes.SetCount( nWorkers );
+	FOR_EACH_VEC( workerTimes, i )
+	{
+		workerTimes[i] = 0.0;
+	}
+	groupTimes.Sort( CompareGroupTimes );
+	FOR_EACH_VEC( groupTimes, i )
+	{
+		int nLeast = 0;
+		for ( int j = 1; j < nWorkers; j++ )
+		{
+			if ( workerTimes[j] < workerTimes[nLeast] )
+				nLeast = j;
+		}
+		workerTimes[nLeast] += groupTimes[i];
+	}
+	double flProjected = 0.0;
+	FOR_EACH_VEC( workerTimes, i )
+	{
+		flProjected = MAX( flProjected, workerTimes[i] );
+	}
+
+	s_PlayerMoveStats.m_nTicks++;
+	s_PlayerMoveStats.m_nPlayers += nCount;
+	s_PlayerMoveStats.m_nGroups += groupSizes.Count();
+	s_PlayerMoveStats.m_nIsolated += nIsolated;
+	s_PlayerMoveStats.m_nLargestGroup = MAX( s_PlayerMoveStats.m_nLargestGroup, nLargest );
+	s_PlayerMoveStats.m_flMoveTime += flMoveTime;
+	s_PlayerMoveStats.m_flProjectedMoveTime += flProjected;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Called after all entities simulated for the tick
+//-----------------------------------------------------------------------------
+void PlayerMoveSched_EndTick()
+{
+	if ( s_bPlayerMovesActive )
+	{
+		UpdatePlayerMoveStats();
+		s_bPlayerMovesActive = false;
+	}
+
+	// The movement state CRC is only written out by the server benchmark
+	if ( !g_pServerBenchmark || !g_pServerBenchmark->IsBenchmarkRunning() )
+		return;
+
+	if ( !s_bPlayerMoveCRCInit )
+	{
+		CRC32_Init( &s_PlayerMoveCRC );
+		s_bPlayerMoveCRCInit = true;
+	}
+
+	for ( int i = 1; i <= gpGlobals->maxClients; i++ )
+	{
+		CBasePlayer *pPlayer = UTIL_PlayerByIndex( i );
+		if ( !pPlayer )
+			continue;
+
+		CBaseEntity *pGround = pPlayer->GetGroundEntity();
+		int nGround = pGround ? pGround->entindex() : -1;
+		int nFlags = pPlayer->GetFlags();
+
+		CRC32_ProcessBuffer( &s_PlayerMoveCRC, &i, sizeof( i ) );
+		CRC32_ProcessBuffer( &s_PlayerMoveCRC, pPlayer->GetAbsOrigin().Base(), sizeof( Vector ) );
+		CRC32_ProcessBuffer( &s_PlayerMoveCRC, pPlayer->GetAbsVelocity().Base(), sizeof( Vector ) );
+		CRC32_ProcessBuffer( &s_PlayerMoveCRC, pPlayer->GetViewOffset().Base(), sizeof( Vector ) );
+		CRC32_ProcessBuffer( &s_PlayerMoveCRC, &nFlags, sizeof( nFlags ) );
+		CRC32_ProcessBuffer( &s_PlayerMoveCRC, &nGround, sizeof( nGround ) );
+	}
+}
+
+unsigned int PlayerMoveSched_GetStateCRC()
+{
+	if ( !s_bPlayerMoveCRCInit )
+		return 0;
+
+	CRC32_t crc = s_PlayerMoveCRC;
+	CRC32_Final( &crc );
+	return crc;
+}
+
+void PlayerMoveSched_ResetStateCRC()
+{
+	s_bPlayerMoveCRCInit = false;
+}
+
+//-----------------------------------------------------------------------------
+// Speculative moves
+//-----------------------------------------------------------------------------
+#define PLAYERMOVE_WRITE_BLOCK	8
+
+// A piece of the player object a speculative move changed
+struct PlayerMoveWrite_t
+{
+	int		m_nOffset;
+	byte	m_Before[ PLAYERMOVE_WRITE_BLOCK ];
+	byte	m_After[ PLAYERMOVE_WRITE_BLOCK ];
+};
+
+struct PlayerMoveTouch_t
+{
+	bool	m_bReset;
+	Vector	m_vecImpactVelocity;
+	trace_t	m_Trace;
+};
+
+//-----------------------------------------------------------------------------
+// Stands in for the server move helper on a job thread. Touches are recorded
+// and handed to the real move helper if the move is kept; anything else that
+// reaches outside of the player fails the move.
+//-----------------------------------------------------------------------------
+class CPlayerMoveRecorder : public IMoveHelper
+{
+public:
+	void Begin()
+	{
+		m_Touches.RemoveAll();
+		m_bFailed = false;
+		SetThreadSingleton( this );
+	}
+
+	bool End()
+	{
+		SetThreadSingleton( NULL );
+		return !m_bFailed;
+	}
+
+	void Replay( IMoveHelper *pMoveHelper ) const
+	{
+		FOR_EACH_VEC( m_Touches, i )
+		{
+			const PlayerMoveTouch_t &touch = m_Touches[i];
+			if ( touch.m_bReset )
+			{
+				pMoveHelper->ResetTouchList();
+			}
+			else
+			{
+				pMoveHelper->AddToTouched( touch.m_Trace, touch.m_vecImpactVelocity );
+			}
+		}
+	}
+
+	virtual	char const *GetName( EntityHandle_t handle ) const	{ return ""; }
+	virtual void SetHost( CBaseEntity *host )					{}
+
+	virtual void ResetTouchList( void )
+	{
+		PlayerMoveTouch_t &touch = m_Touches[ m_Touches.AddToTail() ];
+		touch.m_bReset = true;
+	}
+
+	virtual bool AddToTouched( const CGameTrace &tr, const Vector &impactvelocity )
+	{
+		PlayerMoveTouch_t &touch = m_Touches[ m_Touches.AddToTail() ];
+		touch.m_bReset = false;
+		touch.m_vecImpactVelocity = impactvelocity;
+		touch.m_Trace = tr;
+		return true;
+	}
+
+	virtual void ProcessImpacts( void )							{ m_bFailed = true; }
+	virtual void Con_NPrintf( int idx, char const *fmt, ... )	{ m_bFailed = true; }
+	virtual void StartSound( const Vector &origin, int channel, char const *sample, float volume, soundlevel_t soundlevel, int fFlags, int pitch ) { m_bFailed = true; }
+	virtual void StartSound( const Vector &origin, const char *soundname ) { m_bFailed = true; }
+	virtual void PlaybackEventFull( int flags, int clientindex, unsigned short eventindex, float delay, Vector &origin, Vector &angles, float fparam1, float fparam2, int iparam1, int iparam2, int bparam1, int bparam2 ) { m_bFailed = true; }
+	virtual bool PlayerFallingDamage( void )					{ m_bFailed = true; return true; }
+	virtual void PlayerSetAnimation( PLAYER_ANIM playerAnim )	{ m_bFailed = true; }
+
+	virtual IPhysicsSurfaceProps *GetSurfaceProps( void )
+	{
+		extern IPhysicsSurfaceProps *physprops;
+		return physprops;
+	}
+
+	virtual bool IsWorldEntity( const CBaseHandle &handle )
+	{
+		return handle == CBaseEntity::Instance( 0 );
+	}
+
+private:
+	CUtlVector< PlayerMoveTouch_t >	m_Touches;
+	bool	m_bFailed;
+};
+
+// One per player slot, reused every batch
+struct PlayerMoveSpec_t
+{
+	CBasePlayer		*m_pPlayer;			// NULL once RunCommand used or dropped it
+	CUserCmd		m_Cmd;
+	CMoveData		m_MoveIn;			// what RunCommand must pass to ProcessMovement to keep the move
+	CMoveData		m_Move;				// ... and what ProcessMovement made of it
+	PlayerMoveInputs_t	m_Inputs;
+	CGameMovement	*m_pGameMovement;
+	CPlayerMoveRecorder	m_Recorder;
+	Vector			m_vecMins;			// everything the move can reach
+	Vector			m_vecMaxs;
+	CRC32_t			m_WorldCRC;			// solid entities in reach when the move ran
+	int				m_nObjectSize;
+	CUtlMemory< byte >	m_Snapshot;
+	CUtlVector< PlayerMoveWrite_t >	m_Writes;
+	bool			m_bSucceeded;
+};
+
+static PlayerMoveSpec_t s_PlayerMoveSpecs[ MAX_PLAYERS + 1 ];
+static bool s_bPlayerMoveSpecsActive;
+static PlayerMoveSpeculationStats_t s_PlayerMoveSpecStats;
+static CUtlVector< PlayerMoveInfo_t > s_PlayerMoveBatch;
+static CUtlMemory< byte > s_PlayerMoveVerifyBuffer;
+
+// What the solid entities near a move look like to its traces
+struct PlayerMoveWorldEntity_t
+{
+	unsigned long	m_hEntity;
+	Vector			m_vecOrigin;
+	QAngle			m_angAngles;
+	Vector			m_vecMins;
+	Vector			m_vecMaxs;
+	int				m_nSolid;
+	int				m_nSolidFlags;
+	int				m_nCollisionGroup;
+	int				m_nModelIndex;
+	int				m_iTeamNum;
+	int				m_fFlags;
+};
+
+class CPlayerMoveWorldEnum : public IPartitionEnumerator
+{
+public:
+	CPlayerMoveWorldEnum( CBasePlayer *pPlayer ) : m_pPlayer( pPlayer )
+	{
+		CRC32_Init( &m_CRC );
+	}
+
+	virtual IterationRetval_t EnumElement( IHandleEntity *pHandleEntity )
+	{
+		CBaseEntity *pEntity = gEntList.GetBaseEntity( pHandleEntity->GetRefEHandle() );
+		if ( !pEntity || pEntity == m_pPlayer )
+			return ITERATION_CONTINUE;
+
+		PlayerMoveWorldEntity_t entity;
+		V_memset( &entity, 0, sizeof( entity ) );
+		entity.m_hEntity = pEntity->GetRefEHandle().ToInt();
+		entity.m_vecOrigin = pEntity->GetAbsOrigin();
+		entity.m_angAngles = pEntity->GetAbsAngles();
+		entity.m_vecMins = pEntity->CollisionProp()->OBBMins();
+		entity.m_vecMaxs = pEntity->CollisionProp()->OBBMaxs();
+		entity.m_nSolid = pEntity->GetSolid();
+		entity.m_nSolidFlags = pEntity->GetSolidFlags();
+		entity.m_nCollisionGroup = pEntity->GetCollisionGroup();
+		entity.m_nModelIndex = pEntity->GetModelIndex();
+		entity.m_iTeamNum = pEntity->GetTeamNumber();
+		entity.m_fFlags = pEntity->GetFlags();
+		CRC32_ProcessBuffer( &m_CRC, &entity, sizeof( entity ) );
+		return ITERATION_CONTINUE;
+	}
+
+	CRC32_t GetCRC()
+	{
+		CRC32_t crc = m_CRC;
+		CRC32_Final( &crc );
+		return crc;
+	}
+
+private:
+	CBasePlayer *m_pPlayer;
+	CRC32_t m_CRC;
+};
+
+// Main thread only: reading the positions can resolve dirty transforms
+static CRC32_t GetPlayerMoveWorldCRC( CBasePlayer *pPlayer, const PlayerMoveSpec_t &spec )
+{
+	CPlayerMoveWorldEnum worldEnum( pPlayer );
+	partition->EnumerateElementsInBox( PARTITION_ENGINE_SOLID_EDICTS, spec.m_vecMins, spec.m_vecMaxs, false, &worldEnum );
+	return worldEnum.GetCRC();
+}
+
+static bool IsPlayerMoveSpeculatable( CBasePlayer *pPlayer )
+{
+	return pPlayer->IsBot() &&
+		pPlayer->IsAlive() &&
+		!pPlayer->IsObserver() &&
+		!pPlayer->IsDormant() &&
+		pPlayer->GetMoveType() == MOVETYPE_WALK &&
+		!pPlayer->GetVehicle() &&
+		!pPlayer->GetMoveParent() &&
+		pPlayer->GetLaggedMovementValue() == 1.0f &&
+		pPlayer->pl.fixangle == FIXANGLE_NONE;
+}
+
+#define PLAYERMOVE_MEMBER_MATCHES( a, b, member )	( !V_memcmp( &(a).member, &(b).member, sizeof( (a).member ) ) )
+
+// Bitwise, so a NaN or -0 difference counts. m_flMaxSpeed and the wish and jump
+// velocities are written by ProcessMovement before it reads them.
+static bool PlayerMoveDataMatches( const CMoveData &a, const CMoveData &b, bool bOutputs )
+{
+	if ( a.m_bFirstRunOfFunctions != b.m_bFirstRunOfFunctions ||
+		a.m_bGameCodeMovedPlayer != b.m_bGameCodeMovedPlayer ||
+		a.m_bNoAirControl != b.m_bNoAirControl ||
+		a.m_bConstraintPastRadius != b.m_bConstraintPastRadius ||
+		a.m_nPlayerHandle != b.m_nPlayerHandle ||
+		a.m_nImpulseCommand != b.m_nImpulseCommand ||
+		a.m_nButtons != b.m_nButtons ||
+		a.m_nOldButtons != b.m_nOldButtons )
+		return false;
+
+	if ( !PLAYERMOVE_MEMBER_MATCHES( a, b, m_vecViewAngles ) ||
+		!PLAYERMOVE_MEMBER_MATCHES( a, b, m_vecAbsViewAngles ) ||
+		!PLAYERMOVE_MEMBER_MATCHES( a, b, m_flForwardMove ) ||
+		!PLAYERMOVE_MEMBER_MATCHES( a, b, m_flSideMove ) ||
+		!PLAYERMOVE_MEMBER_MATCHES( a, b, m_flUpMove ) ||
+		!PLAYERMOVE_MEMBER_MATCHES( a, b, m_flClientMaxSpeed ) ||
+		!PLAYERMOVE_MEMBER_MATCHES( a, b, m_vecVelocity ) ||
+		!PLAYERMOVE_MEMBER_MATCHES( a, b, m_vecTrailingVelocity ) ||
+		!PLAYERMOVE_MEMBER_MATCHES( a, b, m_flTrailingVelocityTime ) ||
+		!PLAYERMOVE_MEMBER_MATCHES( a, b, m_vecAngles ) ||
+		!PLAYERMOVE_MEMBER_MATCHES( a, b, m_vecOldAngles ) ||
+		!PLAYERMOVE_MEMBER_MATCHES( a, b, m_outStepHeight ) ||
+		!PLAYERMOVE_MEMBER_MATCHES( a, b, m_vecConstraintCenter ) ||
+		!PLAYERMOVE_MEMBER_MATCHES( a, b, m_flConstraintRadius ) ||
+		!PLAYERMOVE_MEMBER_MATCHES( a, b, m_flConstraintWidth ) ||
+		!PLAYERMOVE_MEMBER_MATCHES( a, b, m_flConstraintSpeedFactor ) ||
+		V_memcmp( a.GetAbsOrigin().Base(), b.GetAbsOrigin().Base(), sizeof( Vector ) ) )
+		return false;
+
+	if ( bOutputs &&
+		( !PLAYERMOVE_MEMBER_MATCHES( a, b, m_flMaxSpeed ) ||
+		!PLAYERMOVE_MEMBER_MATCHES( a, b, m_outWishVel ) ||
+		!PLAYERMOVE_MEMBER_MATCHES( a, b, m_outJumpVel ) ) )
+		return false;
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Job: runs one player's move and records what it changed. The
+//			player is left as it was.
+//-----------------------------------------------------------------------------
+static void RunSpeculativeMove( PlayerMoveSpec_t *&pSpec )
+{
+	PlayerMoveSpec_t &spec = *pSpec;
+	CBasePlayer *pPlayer = spec.m_pPlayer;
+	byte *pObject = (byte *)dynamic_cast< void * >( pPlayer );
+	byte *pSnapshot = spec.m_Snapshot.Base();
+
+	// Point the player at the usercmd the way RunCommand will, then snapshot
+	pPlayer->NetworkProp()->SuppressStateChanges( true );
+	CUserCmd *pSavedCommand = PlayerMove()->SetSpeculativeCommand( pPlayer, &spec.m_Cmd );
+	QAngle angSavedViewAngles = pPlayer->pl.v_angle;
+	pPlayer->pl.v_angle = spec.m_Cmd.viewangles;
+	V_memcpy( pSnapshot, pObject, spec.m_nObjectSize );
+
+	spec.m_Recorder.Begin();
+	spec.m_pGameMovement->BeginSpeculativeMove();
+	spec.m_pGameMovement->ProcessMovement( pPlayer, &spec.m_Move );
+	bool bSucceeded = spec.m_pGameMovement->EndSpeculativeMove();
+	spec.m_pGameMovement->Reset();
+	bSucceeded = spec.m_Recorder.End() && bSucceeded;
+
+	spec.m_Writes.RemoveAll();
+	if ( bSucceeded )
+	{
+		for ( int nOffset = 0; nOffset < spec.m_nObjectSize; nOffset += PLAYERMOVE_WRITE_BLOCK )
+		{
+			int nSize = MIN( PLAYERMOVE_WRITE_BLOCK, spec.m_nObjectSize - nOffset );
+			if ( !V_memcmp( pObject + nOffset, pSnapshot + nOffset, nSize ) )
+				continue;
+
+			PlayerMoveWrite_t &write = spec.m_Writes[ spec.m_Writes.AddToTail() ];
+			write.m_nOffset = nOffset;
+			V_memcpy( write.m_Before, pSnapshot + nOffset, nSize );
+			V_memcpy( write.m_After, pObject + nOffset, nSize );
+		}
+	}
+
+	V_memcpy( pObject, pSnapshot, spec.m_nObjectSize );
+	pPlayer->pl.v_angle = angSavedViewAngles;
+	PlayerMove()->SetSpeculativeCommand( pPlayer, pSavedCommand );
+	pPlayer->NetworkProp()->SuppressStateChanges( false );
+
+	spec.m_bSucceeded = bSucceeded;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Runs the movement of the batched usercmds of players that can't
+//			interact with anyone else in the batch on the job pool.
+//-----------------------------------------------------------------------------
+void PlayerMoveSched_SpeculateMoves( CBasePlayer **ppPlayers, const CUserCmd *pCmds, int nCount )
+{
+	PlayerMoveSched_EndSpeculation();
+	if ( !sv_parallel_playermove.GetBool() || nCount <= 0 )
+		return;
+
+	VPROF_BUDGET( "PlayerMoveSched_SpeculateMoves", VPROF_BUDGETGROUP_PLAYER );
+
+	double flStartTime = Plat_FloatTime();
+	PlayerMoveSpeculationStats_t &stats = s_PlayerMoveSpecStats;
+	stats.m_nTicks++;
+
+	// Everyone in the batch takes part in the grouping, speculated or not
+	s_PlayerMoveBatch.RemoveAll();
+	for ( int i = 0; i < nCount; i++ )
+	{
+		AddPlayerMoveInfo( s_PlayerMoveBatch, ppPlayers[i], 1 );
+	}
+	BuildPlayerMoveGroups( s_PlayerMoveBatch );
+
+	CUtlVectorFixedGrowable< int, MAX_PLAYERS > groupSizes;
+	groupSizes.SetCount( nCount );
+	groupSizes.FillWithValue( 0 );
+	for ( int i = 0; i < nCount; i++ )
+	{
+		groupSizes[ FindPlayerMoveGroup( s_PlayerMoveBatch, i ) ]++;
+	}
+
+	// RunPlayerMove moves bots to the server tick, RunCommand then runs at that clock
+	float flSavedCurTime = gpGlobals->curtime;
+	float flSavedFrameTime = gpGlobals->frametime;
+	gpGlobals->curtime = TIME_TO_TICKS( gpGlobals->curtime ) * TICK_INTERVAL;
+	gpGlobals->frametime = TICK_INTERVAL;
+
+	CUtlVectorFixedGrowable< PlayerMoveSpec_t *, MAX_PLAYERS > specs;
+	for ( int i = 0; i < nCount; i++ )
+	{
+		CBasePlayer *pPlayer = ppPlayers[i];
+		if ( !IsPlayerMoveSpeculatable( pPlayer ) )
+		{
+			stats.m_nIneligible++;
+			continue;
+		}
+
+		if ( groupSizes[ FindPlayerMoveGroup( s_PlayerMoveBatch, i ) ] > 1 )
+		{
+			stats.m_nSerialGroup++;
+			continue;
+		}
+
+		IEntityFactory *pFactory = EntityFactoryDictionary()->FindFactory( pPlayer->GetClassname() );
+		if ( !pFactory )
+		{
+			stats.m_nIneligible++;
+			continue;
+		}
+
+		PlayerMoveSpec_t &spec = s_PlayerMoveSpecs[ pPlayer->entindex() ];
+		if ( !spec.m_pGameMovement )
+		{
+			spec.m_pGameMovement = CreateSpeculativeGameMovement();
+		}
+
+		spec.m_pPlayer = pPlayer;
+		spec.m_Cmd = pCmds[i];
+		spec.m_vecMins = s_PlayerMoveBatch[i].m_vecMins;
+		spec.m_vecMaxs = s_PlayerMoveBatch[i].m_vecMaxs;
+		spec.m_nObjectSize = (int)pFactory->GetEntitySize();
+		spec.m_Snapshot.EnsureCapacity( spec.m_nObjectSize );
+		spec.m_bSucceeded = false;
+
+		// Start from the shared move data so anything SetupMove leaves alone carries over as it would
+		spec.m_Move = *g_pMoveData;
+		PlayerMove()->SetupSpeculativeMove( pPlayer, &spec.m_Cmd, &spec.m_Move, spec.m_pGameMovement, spec.m_Inputs );
+		spec.m_MoveIn = spec.m_Move;
+
+		// The trace list is built here, where entities can still resolve their positions
+		spec.m_pGameMovement->SetupMovementBounds( &spec.m_Move );
+		spec.m_WorldCRC = GetPlayerMoveWorldCRC( pPlayer, spec );
+
+		specs.AddToTail( &spec );
+	}
+
+	if ( specs.Count() )
+	{
+		if ( g_pThreadPool && g_pThreadPool->NumThreads() )
+		{
+			ParallelProcess( specs.Base(), specs.Count(), &RunSpeculativeMove );
+		}
+		else
+		{
+			FOR_EACH_VEC( specs, i )
+			{
+				RunSpeculativeMove( specs[i] );
+			}
+		}
+		stats.m_nSpeculated += specs.Count();
+		s_bPlayerMoveSpecsActive = true;
+	}
+
+	gpGlobals->curtime = flSavedCurTime;
+	gpGlobals->frametime = flSavedFrameTime;
+
+	stats.m_flSpeculateTime += Plat_FloatTime() - flStartTime;
+}
+
+void PlayerMoveSched_EndSpeculation()
+{
+	if ( !s_bPlayerMoveSpecsActive )
+		return;
+
+	for ( int i = 0; i < ARRAYSIZE( s_PlayerMoveSpecs ); i++ )
+	{
+		s_PlayerMoveSpecs[i].m_pPlayer = NULL;
+	}
+	s_bPlayerMoveSpecsActive = false;
+}
+
+static bool IsPlayerMoveSpeculationCurrent( const PlayerMoveSpec_t &spec, CBasePlayer *pPlayer, const byte *pObject, const CMoveData *pMove )
+{
+	if ( pPlayer->CurrentCommandNumber() != spec.m_Cmd.command_number )
+		return false;
+
+	if ( !PlayerMoveDataMatches( *pMove, spec.m_MoveIn, false ) )
+		return false;
+
+	PlayerMoveInputs_t inputs;
+	spec.m_pGameMovement->GetMoveInputs( pPlayer, inputs );
+	if ( V_memcmp( &inputs, &spec.m_Inputs, sizeof( inputs ) ) )
+		return false;
+
+	FOR_EACH_VEC( spec.m_Writes, i )
+	{
+		const PlayerMoveWrite_t &write = spec.m_Writes[i];
+		if ( V_memcmp( pObject + write.m_nOffset, write.m_Before, MIN( PLAYERMOVE_WRITE_BLOCK, spec.m_nObjectSize - write.m_nOffset ) ) )
+			return false;
+	}
+
+	return GetPlayerMoveWorldCRC( pPlayer, spec ) == spec.m_WorldCRC;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: sv_parallel_playermove 2: runs the move serially and checks it
+//			came out the same as the speculative one. The serial run's
+//			touches are the ones processed; the recorded ones aren't compared.
+//-----------------------------------------------------------------------------
+static void VerifySpeculativeMove( const PlayerMoveSpec_t &spec, CBasePlayer *pPlayer, byte *pObject, CMoveData *pMove )
+{
+	s_PlayerMoveVerifyBuffer.EnsureCapacity( spec.m_nObjectSize );
+	byte *pBefore = s_PlayerMoveVerifyBuffer.Base();
+	V_memcpy( pBefore, pObject, spec.m_nObjectSize );
+
+	g_pGameMovement->ProcessMovement( pPlayer, pMove );
+
+	// Where the speculative move wrote the serial one must have written the same, nowhere else
+	int nBadOffset = -1;
+	int iWrite = 0;
+	for ( int nOffset = 0; nOffset < spec.m_nObjectSize && nBadOffset < 0; nOffset += PLAYERMOVE_WRITE_BLOCK )
+	{
+		int nSize = MIN( PLAYERMOVE_WRITE_BLOCK, spec.m_nObjectSize - nOffset );
+		const byte *pExpected = pBefore + nOffset;
+		if ( iWrite < spec.m_Writes.Count() && spec.m_Writes[iWrite].m_nOffset == nOffset )
+		{
+			pExpected = spec.m_Writes[iWrite++].m_After;
+		}
+		if ( V_memcmp( pObject + nOffset, pExpected, nSize ) )
+		{
+			nBadOffset = nOffset;
+		}
+	}
+
+	if ( !PlayerMoveDataMatches( *pMove, spec.m_Move, true ) )
+	{
+		s_PlayerMoveSpecStats.m_nVerifyMismatches++;
+		Warning( "sv_parallel_playermove: %s usercmd %d: move data differs from the serial run\n", pPlayer->GetPlayerName(), spec.m_Cmd.command_number );
+	}
+	else if ( nBadOffset >= 0 )
+	{
+		s_PlayerMoveSpecStats.m_nVerifyMismatches++;
+		Warning( "sv_parallel_playermove: %s usercmd %d: player differs from the serial run at offset %d\n", pPlayer->GetPlayerName(), spec.m_Cmd.command_number, nBadOffset );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Called by RunCommand in place of ProcessMovement
+// Output : false if the move has to be run serially
+//-----------------------------------------------------------------------------
+bool PlayerMoveSched_CommitMove( CBasePlayer *pPlayer, CMoveData *pMove, IMoveHelper *pMoveHelper )
+{
+	if ( !s_bPlayerMoveSpecsActive )
+		return false;
+
+	PlayerMoveSpec_t &spec = s_PlayerMoveSpecs[ pPlayer->entindex() ];
+	if ( spec.m_pPlayer != pPlayer )
+		return false;
+
+	// One usercmd per speculative move
+	spec.m_pPlayer = NULL;
+
+	if ( !spec.m_bSucceeded )
+	{
+		s_PlayerMoveSpecStats.m_nRerunBarrier++;
+		return false;
+	}
+
+	byte *pObject = (byte *)dynamic_cast< void * >( pPlayer );
+	if ( !IsPlayerMoveSpeculationCurrent( spec, pPlayer, pObject, pMove ) )
+	{
+		s_PlayerMoveSpecStats.m_nRerunChanged++;
+		return false;
+	}
+
+	if ( sv_parallel_playermove.GetInt() >= 2 )
+	{
+		VerifySpeculativeMove( spec, pPlayer, pObject, pMove );
+	}
+	else
+	{
+		FOR_EACH_VEC( spec.m_Writes, i )
+		{
+			const PlayerMoveWrite_t &write = spec.m_Writes[i];
+			V_memcpy( pObject + write.m_nOffset, write.m_After, MIN( PLAYERMOVE_WRITE_BLOCK, spec.m_nObjectSize - write.m_nOffset ) );
+		}
+		*pMove = spec.m_Move;
+		pPlayer->NetworkStateChanged();
+
+		// Impacts are processed after FinishMove, on the main thread, as usual
+		spec.m_Recorder.Replay( pMoveHelper );
+	}
+
+	s_PlayerMoveSpecStats.m_nCommitted++;
+	return true;
+}
+
+int PlayerMoveSched_GetParallelMode()
+{
+	return sv_parallel_playermove.GetInt();
+}
+
+const PlayerMoveSpeculationStats_t &PlayerMoveSched_GetSpeculationStats()
+{
+	return s_PlayerMoveSpecStats;
+}
+
+void PlayerMoveSched_ResetSpeculationStats()
+{
+	V_memset( &s_PlayerMoveSpecStats, 0, sizeof( s_PlayerMoveSpecStats ) );
+}
+
+CON_COMMAND( sv_parallel_playermove_stats, "Reports the player conflict groups and speculative moves of sv_parallel_playermove, with an estimate of the movement time if each group ran on its own job. Pass 'reset' to clear the counters." )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	if ( args.ArgC() > 1 && !V_stricmp( args[1], "reset" ) )
+	{
+		V_memset( &s_PlayerMoveStats, 0, sizeof( s_PlayerMoveStats ) );
+		PlayerMoveSched_ResetSpeculationStats();
+		return;
+	}
+
+	const PlayerMoveStats_t &stats = s_PlayerMoveStats;
+	float flTicks = MAX( stats.m_nTicks, 1 );
+	Msg( "Player move conflict groups: %d ticks, %.1f players/tick in %.1f groups, %.1f%% of players isolated, largest group %d\n",
+		stats.m_nTicks, stats.m_nPlayers / flTicks, stats.m_nGroups / flTicks,
+		stats.m_nPlayers ? 100.0f * stats.m_nIsolated / stats.m_nPlayers : 0.0f, stats.m_nLargestGroup );
+	Msg( "  pre-pass %.3f ms/tick, serial movement %.3f ms/tick, estimated grouped movement %.3f ms/tick (%d workers)\n",
+		1000.0 * stats.m_flPrepassTime / flTicks, 1000.0 * stats.m_flMoveTime / flTicks, 1000.0 * stats.m_flProjectedMoveTime / flTicks,
+		1 + ( g_pThreadPool ? g_pThreadPool->NumThreads() : 0 ) );
+
+	const PlayerMoveSpeculationStats_t &specStats = s_PlayerMoveSpecStats;
+	float flSpecTicks = MAX( specStats.m_nTicks, 1 );
+	Msg( "Speculative moves: %d batches, %d run on the job pool, %d kept, %d re-run after a side effect, %d re-run after a change\n",
+		specStats.m_nTicks, specStats.m_nSpeculated, specStats.m_nCommitted, specStats.m_nRerunBarrier, specStats.m_nRerunChanged );
+	Msg( "  %d serial in a shared group, %d serial ineligible, %d verify mismatches, speculation %.3f ms/batch\n",
+		specStats.m_nSerialGroup, specStats.m_nIneligible, specStats.m_nVerifyMismatches, 1000.0 * specStats.m_flSpeculateTime / flSpecTicks );
+	Msg( "  player movement state CRC %08x\n", PlayerMoveSched_GetStateCRC() );
+}
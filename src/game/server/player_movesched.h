@@ -0,0 +1,56 @@
+//========= Copyright  1996-2006, Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Opt-in parallel player movement (sv_parallel_playermove). Finds the
+//			groups of players moving each tick that can not affect one another,
+//			and runs the movement of batched bot usercmds on the job pool ahead
+//			of RunCommand.
+//
+// $NoKeywords: $
+//=============================================================================//
+
+#ifndef PLAYER_MOVESCHED_H
+#define PLAYER_MOVESCHED_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+class CBasePlayer;
+class CUserCmd;
+class CMoveData;
+class IMoveHelper;
+
+void PlayerMoveSched_BeginTick();
+void PlayerMoveSched_PlayerSimulated( CBasePlayer *pPlayer, double flSeconds );
+void PlayerMoveSched_EndTick();
+bool PlayerMoveSched_IsTimingPlayers();
+
+// Runs the movement of each player's next usercmd on the job pool. pCmds are the
+// usercmds the players are about to run through RunPlayerMove, in this order.
+void PlayerMoveSched_SpeculateMoves( CBasePlayer **ppPlayers, const CUserCmd *pCmds, int nCount );
+// Drops the speculative moves RunCommand didn't use
+void PlayerMoveSched_EndSpeculation();
+// Called by RunCommand in place of ProcessMovement; false if the move has to run serially
+bool PlayerMoveSched_CommitMove( CBasePlayer *pPlayer, CMoveData *pMove, IMoveHelper *pMoveHelper );
+
+struct PlayerMoveSpeculationStats_t
+{
+	int		m_nTicks;
+	int		m_nSpeculated;			// moves run on the job pool
+	int		m_nCommitted;			// ... and kept
+	int		m_nRerunBarrier;		// ... but reached a side effect, run again serially
+	int		m_nRerunChanged;		// ... but something they read changed before RunCommand, run again serially
+	int		m_nSerialGroup;			// not run ahead, shares a conflict group with another player
+	int		m_nIneligible;			// not run ahead, in a state speculation doesn't cover
+	int		m_nVerifyMismatches;	// sv_parallel_playermove 2: kept moves that differed from the serial run
+	double	m_flSpeculateTime;
+};
+
+int PlayerMoveSched_GetParallelMode();
+const PlayerMoveSpeculationStats_t &PlayerMoveSched_GetSpeculationStats();
+void PlayerMoveSched_ResetSpeculationStats();
+
+// CRC of every player's movement state after each tick of the running server benchmark
+unsigned int PlayerMoveSched_GetStateCRC();
+void PlayerMoveSched_ResetStateCRC();
+
+#endif // PLAYER_MOVESCHED_H
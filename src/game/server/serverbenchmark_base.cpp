@@ -7,8 +7,11 @@
 #include "cbase.h"
 #include "serverbenchmark_base.h"
 #include "props.h"
+#include "in_buttons.h"
+#include "player_movesched.h"
 #include "filesystem.h"
 #include "tier0/icommandline.h"
+#include "tier1/utlbuffer.h"
 
 
 // Server benchmark. Only works on specified maps.
@@ -17,9 +20,27 @@
 // Create 20 players and move them around and have them shoot.
 // At the end, report the # seconds it took to complete the test.
 // Don't start measuring for the first N ticks to account for HD load.
+//
+// -sv_benchmark_regression is the deterministic variant for comparing builds:
+// fixed seed, sv_benchmark_clients fake clients (with sv_stressbots net channels,
+// so packing and sending are exercised) replaying recorded usercmd streams, a
+// fixed warmup and run length in ticks, and p50/p95/p99/max tick time per VProf
+// budget group written to sv_benchmark_json. Example:
+//   srcds -sv_benchmark_regression +sv_benchmark_usercmds bench.sbu +map de_dust2
+//
+// To check sv_parallel_playermove, run once with it off, then again with it on
+// and sv_benchmark_reference_json pointing at the first run's results. Both runs
+// replay the same seeded usercmds; the second reports whether its playermove_crc
+// matches and how long the replay clients took to run their usercmds.
 
 static ConVar sv_benchmark_numticks( "sv_benchmark_numticks", "3300", 0, "If > 0, then it only runs the benchmark for this # of ticks." );
 static ConVar sv_benchmark_autovprofrecord( "sv_benchmark_autovprofrecord", "0", 0, "If running a benchmark and this is set, it will record a vprof file over the duration of the benchmark with filename benchmark.vprof." );
+static ConVar sv_benchmark_clients( "sv_benchmark_clients", "16", 0, "Number of fake clients replaying usercmds in a -sv_benchmark_regression run." );
+static ConVar sv_benchmark_seed( "sv_benchmark_seed", "1111", 0, "Random seed for -sv_benchmark_regression runs." );
+static ConVar sv_benchmark_warmup_ticks( "sv_benchmark_warmup_ticks", "128", 0, "Ticks a -sv_benchmark_regression run simulates after its clients join before it starts measuring." );
+static ConVar sv_benchmark_usercmds( "sv_benchmark_usercmds", "", 0, "Usercmd stream file (see sv_benchmark_record_usercmds) replayed by a -sv_benchmark_regression run. Empty synthesizes movement from the seed." );
+static ConVar sv_benchmark_json( "sv_benchmark_json", "sv_benchmark.json", 0, "File a -sv_benchmark_regression run writes its tick time percentiles to." );
+static ConVar sv_benchmark_reference_json( "sv_benchmark_reference_json", "", 0, "Results of an earlier -sv_benchmark_regression run with the same map, seed, usercmds and clients. The run checks its playermove_crc against it." );
 
 static float s_flBenchmarkStartWaitSeconds = 3;	// Wait this many seconds after level load before starting the benchmark.
 
@@ -28,6 +49,12 @@ static int s_nBenchmarkBotCreateInterval = 50;	// Create a bot every N ticks.
 
 static int s_nBenchmarkPhysicsObjects = 100;	// Create this many physics objects.
 
+// nBenchmarkMode values. 1 and 2 predate the regression harness and are passed as literals.
+#define BENCHMARKMODE_REGRESSION 3
+
+#define BENCHMARK_USERCMDS_ID		MAKEID( 'S', 'B', 'U', 'C' )
+#define BENCHMARK_USERCMDS_VERSION	1
+
 
 static double Benchmark_ValidTime()
 {
@@ -40,6 +67,280 @@ static double Benchmark_ValidTime()
 }
 
 
+// ---------------------------------------------------------------------------------------------- //
+// Recorded usercmd streams. One stream per recorded client, one command per tick.
+// ---------------------------------------------------------------------------------------------- //
+struct BenchmarkUserCmd_t
+{
+	QAngle	viewangles;
+	float	forwardmove;
+	float	sidemove;
+	float	upmove;
+	int		buttons;
+	int		impulse;
+	int		weaponselect;
+	int		weaponsubtype;
+	short	mousedx;
+	short	mousedy;
+};
+
+class CBenchmarkUserCmdStreams
+{
+public:
+	int Count() const
+	{
+		return m_Streams.Count();
+	}
+
+	const BenchmarkUserCmd_t &GetCmd( int iStream, int nTick ) const
+	{
+		const CUtlVector<BenchmarkUserCmd_t> &stream = m_Streams[iStream];
+		return stream[ nTick % stream.Count() ];
+	}
+
+	void Purge()
+	{
+		m_Streams.Purge();
+	}
+
+	bool Save( const char *pFilename )
+	{
+		CUtlBuffer buf;
+		int nStreams = 0;
+		for ( int i = 0; i < m_Streams.Count(); i++ )
+		{
+			if ( m_Streams[i].Count() )
+				++nStreams;
+		}
+
+		buf.PutInt( BENCHMARK_USERCMDS_ID );
+		buf.PutInt( BENCHMARK_USERCMDS_VERSION );
+		buf.PutInt( nStreams );
+		for ( int i = 0; i < m_Streams.Count(); i++ )
+		{
+			const CUtlVector<BenchmarkUserCmd_t> &stream = m_Streams[i];
+			if ( !stream.Count() )
+				continue;
+
+			buf.PutInt( stream.Count() );
+			for ( int j = 0; j < stream.Count(); j++ )
+			{
+				const BenchmarkUserCmd_t &cmd = stream[j];
+				buf.PutFloat( cmd.viewangles.x );
+				buf.PutFloat( cmd.viewangles.y );
+				buf.PutFloat( cmd.viewangles.z );
+				buf.PutFloat( cmd.forwardmove );
+				buf.PutFloat( cmd.sidemove );
+				buf.PutFloat( cmd.upmove );
+				buf.PutInt( cmd.buttons );
+				buf.PutInt( cmd.impulse );
+				buf.PutInt( cmd.weaponselect );
+				buf.PutInt( cmd.weaponsubtype );
+				buf.PutShort( cmd.mousedx );
+				buf.PutShort( cmd.mousedy );
+			}
+		}
+
+		return filesystem->WriteFile( pFilename, "DEFAULT_WRITE_PATH", buf );
+	}
+
+	bool Load( const char *pFilename )
+	{
+		Purge();
+
+		CUtlBuffer buf;
+		if ( !filesystem->ReadFile( pFilename, "GAME", buf ) )
+			return false;
+
+		if ( buf.GetInt() != BENCHMARK_USERCMDS_ID || buf.GetInt() != BENCHMARK_USERCMDS_VERSION )
+			return false;
+
+		int nStreams = buf.GetInt();
+		for ( int i = 0; i < nStreams && buf.IsValid(); i++ )
+		{
+			int nCmds = buf.GetInt();
+			if ( nCmds <= 0 )
+				continue;
+
+			CUtlVector<BenchmarkUserCmd_t> &stream = m_Streams[ m_Streams.AddToTail() ];
+			stream.SetCount( nCmds );
+			for ( int j = 0; j < nCmds; j++ )
+			{
+				BenchmarkUserCmd_t &cmd = stream[j];
+				cmd.viewangles.x = buf.GetFloat();
+				cmd.viewangles.y = buf.GetFloat();
+				cmd.viewangles.z = buf.GetFloat();
+				cmd.forwardmove = buf.GetFloat();
+				cmd.sidemove = buf.GetFloat();
+				cmd.upmove = buf.GetFloat();
+				cmd.buttons = buf.GetInt();
+				cmd.impulse = buf.GetInt();
+				cmd.weaponselect = buf.GetInt();
+				cmd.weaponsubtype = buf.GetInt();
+				cmd.mousedx = buf.GetShort();
+				cmd.mousedy = buf.GetShort();
+			}
+		}
+
+		if ( !buf.IsValid() )
+		{
+			Purge();
+			return false;
+		}
+		return m_Streams.Count() > 0;
+	}
+
+	CUtlVector< CUtlVector<BenchmarkUserCmd_t> > m_Streams;
+};
+
+
+// ---------------------------------------------------------------------------------------------- //
+// Records the last usercmd of every human client each tick.
+// ---------------------------------------------------------------------------------------------- //
+class CBenchmarkUserCmdRecorder
+{
+public:
+	CBenchmarkUserCmdRecorder()
+	{
+		m_nTicksLeft = 0;
+		m_szFilename[0] = 0;
+	}
+
+	bool IsRecording() const
+	{
+		return m_szFilename[0] != 0;
+	}
+
+	void Start( const char *pFilename, int nTicks )
+	{
+		m_Streams.Purge();
+		m_Streams.m_Streams.SetCount( gpGlobals->maxClients );
+		m_nTicksLeft = nTicks;
+		Q_strncpy( m_szFilename, pFilename, sizeof( m_szFilename ) );
+		Msg( "Recording usercmds to %s\n", m_szFilename );
+	}
+
+	void Stop()
+	{
+		if ( !IsRecording() )
+			return;
+
+		if ( m_Streams.Save( m_szFilename ) )
+		{
+			Msg( "Wrote usercmd streams to %s\n", m_szFilename );
+		}
+		else
+		{
+			Warning( "Couldn't write usercmd streams to %s\n", m_szFilename );
+		}
+		m_Streams.Purge();
+		m_szFilename[0] = 0;
+	}
+
+	void Update()
+	{
+		if ( !IsRecording() )
+			return;
+
+		for ( int i = 1; i <= gpGlobals->maxClients && i <= m_Streams.Count(); i++ )
+		{
+			CBasePlayer *pPlayer = UTIL_PlayerByIndex( i );
+			if ( !pPlayer || !pPlayer->IsConnected() || (pPlayer->GetFlags() & FL_FAKECLIENT) )
+				continue;
+
+			const CUserCmd *pCmd = pPlayer->GetLastUserCommand();
+			if ( !pCmd )
+				continue;
+
+			BenchmarkUserCmd_t &cmd = m_Streams.m_Streams[i-1][ m_Streams.m_Streams[i-1].AddToTail() ];
+			cmd.viewangles = pCmd->viewangles;
+			cmd.forwardmove = pCmd->forwardmove;
+			cmd.sidemove = pCmd->sidemove;
+			cmd.upmove = pCmd->upmove;
+			cmd.buttons = pCmd->buttons;
+			cmd.impulse = pCmd->impulse;
+			cmd.weaponselect = pCmd->weaponselect;
+			cmd.weaponsubtype = pCmd->weaponsubtype;
+			cmd.mousedx = pCmd->mousedx;
+			cmd.mousedy = pCmd->mousedy;
+		}
+
+		if ( m_nTicksLeft > 0 && --m_nTicksLeft == 0 )
+		{
+			Stop();
+		}
+	}
+
+private:
+	CBenchmarkUserCmdStreams m_Streams;
+	int m_nTicksLeft;
+	char m_szFilename[MAX_PATH];
+};
+
+static CBenchmarkUserCmdRecorder g_BenchmarkUserCmdRecorder;
+
+
+static int SortBenchmarkSamples( const float *pLeft, const float *pRight )
+{
+	return ( *pLeft < *pRight ) ? -1 : ( ( *pLeft > *pRight ) ? 1 : 0 );
+}
+
+// Nearest-rank percentile of an ascending sample list.
+static float BenchmarkPercentile( const CUtlVector<float> &sorted, float flFraction )
+{
+	if ( !sorted.Count() )
+		return 0.0f;
+
+	int nIndex = (int)ceil( flFraction * sorted.Count() ) - 1;
+	return sorted[ clamp( nIndex, 0, sorted.Count() - 1 ) ];
+}
+
+static void WriteBenchmarkPercentiles( FileHandle_t fh, const CUtlVector<float> &samples )
+{
+	CUtlVector<float> sorted;
+	sorted.CopyArray( samples.Base(), samples.Count() );
+	sorted.Sort( SortBenchmarkSamples );
+
+	double flSum = 0;
+	for ( int i = 0; i < sorted.Count(); i++ )
+	{
+		flSum += sorted[i];
+	}
+
+	filesystem->FPrintf( fh, "{ \"p50\": %.4f, \"p95\": %.4f, \"p99\": %.4f, \"max\": %.4f, \"mean\": %.4f }",
+		BenchmarkPercentile( sorted, 0.50f ), BenchmarkPercentile( sorted, 0.95f ), BenchmarkPercentile( sorted, 0.99f ),
+		sorted.Count() ? sorted.Tail() : 0.0f, sorted.Count() ? flSum / sorted.Count() : 0.0 );
+}
+
+// Reads a number from a results file written by WriteRegressionResults.
+static bool GetBenchmarkJSONNumber( const char *pJSON, const char *pKey, double &flValue )
+{
+	char szKey[64];
+	Q_snprintf( szKey, sizeof( szKey ), "\"%s\":", pKey );
+	const char *pFound = Q_strstr( pJSON, szKey );
+	if ( !pFound )
+		return false;
+
+	flValue = atof( pFound + Q_strlen( szKey ) );
+	return true;
+}
+
+// Map and budget group names are plain identifiers, but keep the output valid JSON regardless.
+static const char *BenchmarkJSONString( const char *pIn, char *pOut, int nOutSize )
+{
+	int j = 0;
+	for ( ; *pIn && j < nOutSize - 2; pIn++ )
+	{
+		if ( *pIn == '"' || *pIn == '\\' )
+			pOut[j++] = '\\';
+		if ( (unsigned char)*pIn >= ' ' )
+			pOut[j++] = *pIn;
+	}
+	pOut[j] = 0;
+	return pOut;
+}
+
+
 // ---------------------------------------------------------------------------------------------- //
 // CServerBenchmark implementation.
 // ---------------------------------------------------------------------------------------------- //
@@ -56,6 +357,9 @@ public:
 
 	virtual bool StartBenchmark()
 	{
+		if ( CommandLine()->FindParm( "-sv_benchmark_regression" ) )
+			return InternalStartBenchmark( BENCHMARKMODE_REGRESSION, 0 );
+
 		bool bBenchmark = (CommandLine()->FindParm( "-sv_benchmark" ) != 0);
 
 		return InternalStartBenchmark( bBenchmark, s_flBenchmarkStartWaitSeconds );
@@ -64,6 +368,7 @@ public:
 	// nBenchmarkMode: 0 = no benchmark
 	//                 1 = benchmark
 	//                 2 = exit out afterwards and write sv_benchmark.txt
+	//                 3 = BENCHMARKMODE_REGRESSION: replay usercmds, write sv_benchmark_json and exit
 	bool InternalStartBenchmark( int nBenchmarkMode, float flCountdown )
 	{
 		bool bWasRunningBenchmark = (m_BenchmarkState != BENCHMARKSTATE_NOT_RUNNING);
@@ -78,9 +383,30 @@ public:
 
 		m_nBenchmarkMode = nBenchmarkMode;
 
-		if ( !CServerBenchmarkHook::s_pBenchmarkHook )
+		if ( !CServerBenchmarkHook::s_pBenchmarkHook && nBenchmarkMode != BENCHMARKMODE_REGRESSION )
 			Error( "This game doesn't support server benchmarks (no CServerBenchmarkHook found)." );
 
+		if ( nBenchmarkMode == BENCHMARKMODE_REGRESSION )
+		{
+			m_UserCmdStreams.Purge();
+			const char *pUserCmds = sv_benchmark_usercmds.GetString();
+			if ( pUserCmds[0] && !m_UserCmdStreams.Load( pUserCmds ) )
+				Error( "sv_benchmark: couldn't load usercmd streams from %s.", pUserCmds );
+
+			m_ReplayClients.Purge();
+			m_bReplayClientsCreated = false;
+			m_nReplayTick = 0;
+			m_nWarmupTicksLeft = MAX( sv_benchmark_warmup_ticks.GetInt(), 1 );
+			m_flLastSampleTime = 0;
+			m_flReplayTime = 0;
+			m_nReplayTimedTicks = 0;
+			m_TickTimes.Purge();
+			m_BudgetGroupTimes.Purge();
+
+			RandomSeed( sv_benchmark_seed.GetInt() );
+			m_RandomStream.SetSeed( sv_benchmark_seed.GetInt() );
+		}
+
 		m_BenchmarkState = BENCHMARKSTATE_START_WAIT;
 		m_flBenchmarkStartTime = Plat_FloatTime();
 		m_flBenchmarkStartWaitTime = flCountdown;
@@ -92,14 +418,19 @@ public:
 		engine->SetDedicatedServerBenchmarkMode( true );	// Run 1 tick per frame and ignore all timing stuff.
 
 		// Tell the game-specific hook that we're starting.
-		CServerBenchmarkHook::s_pBenchmarkHook->StartBenchmark();
-		CServerBenchmarkHook::s_pBenchmarkHook->GetPhysicsModelNames( m_PhysicsModelNames );
+		if ( CServerBenchmarkHook::s_pBenchmarkHook )
+		{
+			CServerBenchmarkHook::s_pBenchmarkHook->StartBenchmark();
+			CServerBenchmarkHook::s_pBenchmarkHook->GetPhysicsModelNames( m_PhysicsModelNames );
+		}
 
 		return true;
 	}
 
 	virtual void UpdateBenchmark()
 	{
+		g_BenchmarkUserCmdRecorder.Update();
+
 		// No benchmark running?	
 		if ( m_BenchmarkState == BENCHMARKSTATE_NOT_RUNNING )
 			return;
@@ -107,7 +438,12 @@ public:
 		// Wait a certain number of ticks to start the benchmark.
 		if ( m_BenchmarkState == BENCHMARKSTATE_START_WAIT )
 		{
-			if ( (Plat_FloatTime() - m_flBenchmarkStartTime) < m_flBenchmarkStartWaitTime )
+			if ( m_nBenchmarkMode == BENCHMARKMODE_REGRESSION )
+			{
+				if ( !UpdateRegressionWarmup() )
+					return;
+			}
+			else if ( (Plat_FloatTime() - m_flBenchmarkStartTime) < m_flBenchmarkStartWaitTime )
 			{
 				UpdateStartWaitCounter();
 				return;
@@ -123,28 +459,310 @@ public:
 				m_BenchmarkState = BENCHMARKSTATE_RUNNING;
 
 				StartVProfRecord();
-
-				RandomSeed( 0 );
-				m_RandomStream.SetSeed( 0 );
+				PlayerMoveSched_ResetStateCRC();
+				PlayerMoveSched_ResetSpeculationStats();
+				m_flReplayTime = 0;
+				m_nReplayTimedTicks = 0;
+
+				int nSeed = ( m_nBenchmarkMode == BENCHMARKMODE_REGRESSION ) ? sv_benchmark_seed.GetInt() : 0;
+				RandomSeed( nSeed );
+				m_RandomStream.SetSeed( nSeed );
 			}
 		}
 
 		int nTicksRunSoFar = gpGlobals->tickcount - m_nBenchmarkStartTick;
 		UpdateBenchmarkCounter();
+
+		if ( m_nBenchmarkMode == BENCHMARKMODE_REGRESSION )
+		{
+			SampleTickTimes();
+		}
 	
 		// Are we finished with the benchmark?
 		if ( nTicksRunSoFar >= sv_benchmark_numticks.GetInt() )
 		{
 			EndVProfRecord();
 			OutputResults();
+			if ( m_nBenchmarkMode == BENCHMARKMODE_REGRESSION )
+			{
+				WriteRegressionResults();
+			}
 			EndBenchmark();
 			return;
 		}
 
 		// Ok, update whatever we're doing in the benchmark.
-		UpdatePlayerCreation();
+		if ( m_nBenchmarkMode == BENCHMARKMODE_REGRESSION )
+		{
+			UpdateReplayClients();
+		}
+		else
+		{
+			UpdatePlayerCreation();
+		}
 		UpdateVPhysicsObjects();
-		CServerBenchmarkHook::s_pBenchmarkHook->UpdateBenchmark();
+		if ( CServerBenchmarkHook::s_pBenchmarkHook )
+		{
+			CServerBenchmarkHook::s_pBenchmarkHook->UpdateBenchmark();
+		}
+	}
+
+	// Joins the replay clients on the first call, then runs the warmup ticks.
+	// Returns true once the measured part of the run should start.
+	bool UpdateRegressionWarmup()
+	{
+		if ( !m_bReplayClientsCreated )
+		{
+			m_bReplayClientsCreated = true;
+
+			// Budget group samples come from VProf; the engine turns it on at the next frame.
+			engine->ServerCommand( "vprof_on\n" );
+			engine->ServerExecute();
+
+			int nClients = sv_benchmark_clients.GetInt();
+			for ( int i = 0; i < nClients; i++ )
+			{
+				CBasePlayer *pPlayer = CreateReplayClient( i );
+				if ( !pPlayer )
+				{
+					Warning( "sv_benchmark: only %d of %d replay clients fit on the server.\n", i, nClients );
+					break;
+				}
+				m_ReplayClients.AddToTail( pPlayer );
+			}
+			Msg( "Warming up benchmark for %d ticks with %d clients...\n", m_nWarmupTicksLeft, m_ReplayClients.Count() );
+		}
+
+		UpdateReplayClients();
+		return --m_nWarmupTicksLeft <= 0;
+	}
+
+	CBasePlayer *CreateReplayClient( int iClient )
+	{
+		char szName[32];
+		Q_snprintf( szName, sizeof( szName ), "Replay%02d", iClient );
+
+		edict_t *pEdict = engine->CreateFakeClient( szName );
+		if ( !pEdict )
+			return NULL;
+
+		CBasePlayer *pPlayer = ToBasePlayer( CBaseEntity::Instance( pEdict ) );
+		if ( !pPlayer )
+			return NULL;
+
+		// Games that gate spawning on picking a team handle these; the rest ignore them.
+		CCommand joinGame;
+		joinGame.Tokenize( "joingame" );
+		pPlayer->ClientCommand( joinGame );
+
+		CCommand joinTeam;
+		joinTeam.Tokenize( ( iClient & 1 ) ? "jointeam 3 1" : "jointeam 2 1" );
+		pPlayer->ClientCommand( joinTeam );
+
+		return pPlayer;
+	}
+
+	void BuildReplayCmd( int iClient, int nTick, CBotCmd &cmd )
+	{
+		if ( m_UserCmdStreams.Count() )
+		{
+			const BenchmarkUserCmd_t &recorded = m_UserCmdStreams.GetCmd( iClient % m_UserCmdStreams.Count(), nTick );
+			cmd.viewangles = recorded.viewangles;
+			cmd.forwardmove = recorded.forwardmove;
+			cmd.sidemove = recorded.sidemove;
+			cmd.upmove = recorded.upmove;
+			cmd.buttons = recorded.buttons;
+			cmd.impulse = recorded.impulse;
+			cmd.weaponselect = recorded.weaponselect;
+			cmd.weaponsubtype = recorded.weaponsubtype;
+			cmd.mousedx = recorded.mousedx;
+			cmd.mousedy = recorded.mousedy;
+			return;
+		}
+
+		// Nothing recorded: run forward, turn every second, strafe and fire in bursts.
+		cmd.viewangles.Init( 0, (float)( ( iClient * 37 + ( nTick / 64 ) * 45 ) % 360 ), 0 );
+		cmd.forwardmove = 250;
+		cmd.sidemove = ( ( nTick / 32 + iClient ) & 1 ) ? 150 : -150;
+		if ( ( nTick + iClient * 7 ) % 96 < 8 )
+		{
+			cmd.buttons |= IN_ATTACK;
+		}
+		if ( ( nTick + iClient * 13 ) % 200 == 0 )
+		{
+			cmd.buttons |= IN_JUMP;
+		}
+	}
+
+	void UpdateReplayClients()
+	{
+		double flStartTime = Benchmark_ValidTime();
+
+		// Build every command up front so sv_parallel_playermove can run their movement ahead
+		CUtlVectorFixedGrowable< CBasePlayer *, MAX_PLAYERS > players;
+		CUtlVectorFixedGrowable< CBotCmd, MAX_PLAYERS > cmds;
+		for ( int i = 0; i < m_ReplayClients.Count(); i++ )
+		{
+			CBasePlayer *pPlayer = ToBasePlayer( m_ReplayClients[i].Get() );
+			if ( !pPlayer )
+				continue;
+
+			CBotCmd &cmd = cmds[ cmds.AddToTail() ];
+			BuildReplayCmd( i, m_nReplayTick, cmd );
+			cmd.command_number = m_nReplayTick + 1;
+			cmd.tick_count = gpGlobals->tickcount;
+			cmd.random_seed = m_RandomStream.RandomInt( 0, 0x7fffffff );
+			players.AddToTail( pPlayer );
+		}
+
+		CUtlVectorFixedGrowable< CUserCmd, MAX_PLAYERS > userCmds;
+		userCmds.SetCount( cmds.Count() );
+		for ( int i = 0; i < cmds.Count(); i++ )
+		{
+			BotCmdToUserCmd( cmds[i], userCmds[i] );
+		}
+		PlayerMoveSched_SpeculateMoves( players.Base(), userCmds.Base(), players.Count() );
+
+		for ( int i = 0; i < players.Count(); i++ )
+		{
+			players[i]->GetBotController()->RunPlayerMove( &cmds[i] );
+		}
+		PlayerMoveSched_EndSpeculation();
+		++m_nReplayTick;
+
+		if ( m_BenchmarkState == BENCHMARKSTATE_RUNNING )
+		{
+			m_flReplayTime += Benchmark_ValidTime() - flStartTime;
+			m_nReplayTimedTicks++;
+		}
+	}
+
+	// One sample per tick: wall time since the previous tick and VProf's
+	// per-budget-group time for the frame that just finished.
+	void SampleTickTimes()
+	{
+		double flNow = Benchmark_ValidTime();
+		if ( m_flLastSampleTime > 0 )
+		{
+			int nSamples = m_TickTimes.Count();
+			m_TickTimes.AddToTail( ( flNow - m_flLastSampleTime ) * 1000.0 );
+
+			int nGroups = g_VProfCurrentProfile.GetNumBudgetGroups();
+			while ( m_BudgetGroupTimes.Count() < nGroups )
+			{
+				CUtlVector<float> &times = m_BudgetGroupTimes[ m_BudgetGroupTimes.AddToTail() ];
+				times.SetCount( nSamples );
+				times.FillWithValue( 0.0f );
+			}
+			for ( int i = 0; i < nGroups; i++ )
+			{
+				m_BudgetGroupTimes[i].AddToTail( g_VProfCurrentProfile.GetPrevFrameBudgetGroupTime( i ) );
+			}
+		}
+		m_flLastSampleTime = flNow;
+	}
+
+	void WriteRegressionResults()
+	{
+		float flRunTime = Benchmark_ValidTime() - m_fl_ValidTime_BenchmarkStartTime;
+		const char *pFilename = sv_benchmark_json.GetString();
+
+		FileHandle_t fh = filesystem->Open( pFilename, "wt", "DEFAULT_WRITE_PATH" );
+		if ( !fh )
+		{
+			Warning( "sv_benchmark: couldn't write %s\n", pFilename );
+			return;
+		}
+
+		char szEscaped[256];
+		filesystem->FPrintf( fh, "{\n" );
+		filesystem->FPrintf( fh, "\t\"map\": \"%s\",\n", BenchmarkJSONString( STRING( gpGlobals->mapname ), szEscaped, sizeof( szEscaped ) ) );
+		filesystem->FPrintf( fh, "\t\"usercmds\": \"%s\",\n", BenchmarkJSONString( sv_benchmark_usercmds.GetString(), szEscaped, sizeof( szEscaped ) ) );
+		filesystem->FPrintf( fh, "\t\"seed\": %d,\n", sv_benchmark_seed.GetInt() );
+		filesystem->FPrintf( fh, "\t\"clients\": %d,\n", m_ReplayClients.Count() );
+		filesystem->FPrintf( fh, "\t\"ticks\": %d,\n", m_TickTimes.Count() );
+		filesystem->FPrintf( fh, "\t\"tick_interval_ms\": %.4f,\n", gpGlobals->interval_per_tick * 1000.0f );
+		filesystem->FPrintf( fh, "\t\"total_seconds\": %.4f,\n", flRunTime );
+		filesystem->FPrintf( fh, "\t\"ticks_per_second\": %.2f,\n", flRunTime > 0 ? sv_benchmark_numticks.GetInt() / flRunTime : 0.0f );
+		filesystem->FPrintf( fh, "\t\"crc\": %d,\n", CalculateBenchmarkCRC() );
+		filesystem->FPrintf( fh, "\t\"playermove_crc\": %u,\n", PlayerMoveSched_GetStateCRC() );
+		WriteParallelPlayerMoveResults( fh );
+		filesystem->FPrintf( fh, "\t\"tick_ms\": " );
+		WriteBenchmarkPercentiles( fh, m_TickTimes );
+		filesystem->FPrintf( fh, ",\n\t\"budget_groups_ms\": {" );
+
+		bool bFirst = true;
+		for ( int i = 0; i < m_BudgetGroupTimes.Count(); i++ )
+		{
+			const CUtlVector<float> &times = m_BudgetGroupTimes[i];
+			bool bAny = false;
+			for ( int j = 0; j < times.Count() && !bAny; j++ )
+			{
+				bAny = times[j] > 0.0f;
+			}
+			if ( !bAny )
+				continue;
+
+			filesystem->FPrintf( fh, "%s\n\t\t\"%s\": ", bFirst ? "" : ",", BenchmarkJSONString( g_VProfCurrentProfile.GetBudgetGroupName( i ), szEscaped, sizeof( szEscaped ) ) );
+			WriteBenchmarkPercentiles( fh, times );
+			bFirst = false;
+		}
+		filesystem->FPrintf( fh, "\n\t}\n}\n" );
+		filesystem->Close( fh );
+
+		Msg( "Wrote benchmark results to %s\n", pFilename );
+	}
+
+	// Replay client usercmd time and what sv_parallel_playermove did, then the
+	// playermove_crc check against sv_benchmark_reference_json.
+	void WriteParallelPlayerMoveResults( FileHandle_t fh )
+	{
+		const PlayerMoveSpeculationStats_t &stats = PlayerMoveSched_GetSpeculationStats();
+		float flTicks = MAX( m_nReplayTimedTicks, 1 );
+		filesystem->FPrintf( fh, "\t\"parallel_playermove\": { \"mode\": %d, \"replay_ms_per_tick\": %.4f, \"speculate_ms_per_tick\": %.4f, "
+			"\"speculated\": %d, \"committed\": %d, \"rerun_barrier\": %d, \"rerun_changed\": %d, \"serial_group\": %d, \"ineligible\": %d, \"verify_mismatches\": %d },\n",
+			PlayerMoveSched_GetParallelMode(), 1000.0 * m_flReplayTime / flTicks, 1000.0 * stats.m_flSpeculateTime / flTicks,
+			stats.m_nSpeculated, stats.m_nCommitted, stats.m_nRerunBarrier, stats.m_nRerunChanged, stats.m_nSerialGroup, stats.m_nIneligible, stats.m_nVerifyMismatches );
+		Msg( "sv_benchmark: replay clients ran their usercmds in %.3f ms/tick (sv_parallel_playermove %d, %d of %d moves run ahead kept)\n",
+			1000.0 * m_flReplayTime / flTicks, PlayerMoveSched_GetParallelMode(), stats.m_nCommitted, stats.m_nSpeculated );
+
+		const char *pReference = sv_benchmark_reference_json.GetString();
+		if ( !pReference[0] )
+			return;
+
+		CUtlBuffer buf;
+		bool bRead = filesystem->ReadFile( pReference, "GAME", buf );
+		buf.PutChar( 0 );
+
+		double flSeed, flClients, flCRC;
+		if ( !bRead ||
+			!GetBenchmarkJSONNumber( (const char *)buf.Base(), "seed", flSeed ) ||
+			!GetBenchmarkJSONNumber( (const char *)buf.Base(), "clients", flClients ) ||
+			!GetBenchmarkJSONNumber( (const char *)buf.Base(), "playermove_crc", flCRC ) )
+		{
+			Warning( "sv_benchmark: couldn't read playermove_crc from %s\n", pReference );
+			return;
+		}
+
+		if ( (int)flSeed != sv_benchmark_seed.GetInt() || (int)flClients != m_ReplayClients.Count() )
+		{
+			Warning( "sv_benchmark: %s ran with seed %d and %d clients, not %d and %d; not comparing playermove_crc\n",
+				pReference, (int)flSeed, (int)flClients, sv_benchmark_seed.GetInt(), m_ReplayClients.Count() );
+			return;
+		}
+
+		unsigned int nReferenceCRC = (unsigned int)flCRC;
+		bool bMatches = ( nReferenceCRC == PlayerMoveSched_GetStateCRC() );
+		filesystem->FPrintf( fh, "\t\"playermove_crc_reference\": %u,\n", nReferenceCRC );
+		filesystem->FPrintf( fh, "\t\"playermove_crc_matches_reference\": %s,\n", bMatches ? "true" : "false" );
+		if ( bMatches )
+		{
+			Msg( "sv_benchmark: playermove_crc matches %s\n", pReference );
+		}
+		else
+		{
+			Warning( "sv_benchmark: playermove_crc %u differs from %u in %s\n", PlayerMoveSched_GetStateCRC(), nReferenceCRC, pReference );
+		}
 	}
 
 	void StartVProfRecord()
@@ -183,6 +801,11 @@ public:
 			// Quit out.
 			engine->ServerCommand( "quit\n" );
 		}
+		else if ( m_nBenchmarkMode == BENCHMARKMODE_REGRESSION )
+		{
+			engine->ServerCommand( "vprof_off\n" );
+			engine->ServerCommand( "quit\n" );
+		}
 		
 		m_BenchmarkState = BENCHMARKSTATE_NOT_RUNNING;
 		engine->SetDedicatedServerBenchmarkMode( false );
@@ -394,6 +1017,18 @@ private:
 	CUtlVector<char*> m_PhysicsModelNames;
 	int m_nBenchmarkMode;
 
+	// BENCHMARKMODE_REGRESSION state.
+	CBenchmarkUserCmdStreams m_UserCmdStreams;
+	CUtlVector< EHANDLE > m_ReplayClients;
+	bool m_bReplayClientsCreated;
+	int m_nReplayTick;
+	int m_nWarmupTicksLeft;
+	double m_flLastSampleTime;
+	double m_flReplayTime;
+	int m_nReplayTimedTicks;
+	CUtlVector<float> m_TickTimes;
+	CUtlVector< CUtlVector<float> > m_BudgetGroupTimes;
+
 	CUniformRandomStream m_RandomStream;
 };
 
@@ -408,6 +1043,29 @@ CON_COMMAND( sv_benchmark_force_start, "Force start the benchmark. This is only
 	g_ServerBenchmark.InternalStartBenchmark( 1, 1 );
 }
 
+CON_COMMAND( sv_benchmark_record_usercmds, "Record the usercmds of every human client, one stream each, for replay with sv_benchmark_usercmds. Usage: sv_benchmark_record_usercmds <file> [ticks]" )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	if ( args.ArgC() < 2 )
+	{
+		Msg( "Usage: sv_benchmark_record_usercmds <file> [ticks]\n" );
+		return;
+	}
+
+	g_BenchmarkUserCmdRecorder.Stop();
+	g_BenchmarkUserCmdRecorder.Start( args[1], ( args.ArgC() > 2 ) ? atoi( args[2] ) : 0 );
+}
+
+CON_COMMAND( sv_benchmark_record_stop, "Stop sv_benchmark_record_usercmds and write the file." )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	g_BenchmarkUserCmdRecorder.Stop();
+}
+
 
 // ---------------------------------------------------------------------------------------------- //
 // CServerBenchmarkHook implementation.
@@ -94,6 +94,10 @@ public:
 	virtual float ClimbSpeed( void ) const;
 	virtual float LadderLateralMultiplier( void ) const;
 
+#if !defined( CLIENT_DLL )
+	virtual void GetMoveInputs( CBasePlayer *pPlayer, PlayerMoveInputs_t &inputs );
+#endif
+
 protected:
 	virtual void PlayerMove();
 
@@ -115,6 +119,20 @@ IGameMovement *g_pGameMovement = ( IGameMovement * )&g_GameMovement;
 
 EXPOSE_SINGLE_INTERFACE_GLOBALVAR(CGameMovement, IGameMovement,INTERFACENAME_GAMEMOVEMENT, g_GameMovement );
 
+#if !defined( CLIENT_DLL )
+extern void CreateStuckTable( void );
+
+//-----------------------------------------------------------------------------
+// Purpose: A private movement instance for running moves on a job thread
+//-----------------------------------------------------------------------------
+CGameMovement *CreateSpeculativeGameMovement( void )
+{
+	// CheckStuck builds this lazily; make sure no job thread is the first to get there
+	CreateStuckTable();
+	return new CCSGameMovement;
+}
+#endif
+
 
 // ---------------------------------------------------------------------------------------- //
 // CCSGameMovement.
@@ -428,6 +446,29 @@ void CCSGameMovement::ProcessMovement( CBasePlayer *pBasePlayer, CMoveData *pMov
 	BaseClass::ProcessMovement( pBasePlayer, pMove );
 }
 
+#if !defined( CLIENT_DLL )
+void CCSGameMovement::GetMoveInputs( CBasePlayer *pBasePlayer, PlayerMoveInputs_t &inputs )
+{
+	BaseClass::GetMoveInputs( pBasePlayer, inputs );
+
+	CCSPlayer *pPlayer = static_cast<CCSPlayer *>( pBasePlayer );
+	inputs.m_flStamina = pPlayer->m_flStamina;
+	inputs.m_flVelocityModifier = pPlayer->m_flVelocityModifier;
+	inputs.m_flGroundAccelLinearFracLastTime = pPlayer->m_flGroundAccelLinearFracLastTime;
+	inputs.m_iMoveState = pPlayer->m_iMoveState;
+	inputs.m_iPlayerState = pPlayer->State_Get();
+	inputs.m_bDuckUntilOnGround = pPlayer->m_duckUntilOnGround;
+	inputs.m_bDuckOverride = pPlayer->m_bDuckOverride;
+	inputs.m_bIsWalking = pPlayer->m_bIsWalking;
+	inputs.m_bCanMove = pPlayer->CanMove();
+	inputs.m_bTaunting = pPlayer->IsTaunting();
+	inputs.m_bThirdPersonTaunt = pPlayer->IsThirdPersonTaunt();
+	inputs.m_bIsDefusing = pPlayer->m_bIsDefusing;
+	inputs.m_bHasMovedSinceSpawn = pPlayer->m_bHasMovedSinceSpawn;
+	inputs.m_pActiveWeapon = pPlayer->GetActiveWeapon();
+}
+#endif
+
 
 bool CCSGameMovement::CanAccelerate()
 {
@@ -707,6 +748,10 @@ bool CCSGameMovement::CheckJumpButton( void )
 		PreventBunnyJumping();
 	}
 
+	// Jump sounds, animation and the player_jump event are left to the serial run
+	if ( SpeculationBarrier() )
+		return false;
+
 	// In the air now.
 	SetGroundEntity( NULL );
 
@@ -1445,6 +1490,10 @@ void CCSGameMovement::Accelerate( Vector& wishdir, float wishspeed, float accel
 					if ( pWeapon )
 					{
 #if defined( WEAPON_FIRE_BULLETS_ACCURACY_FISHTAIL_FEATURE )
+						// The weapon isn't part of the moving player
+						if ( SpeculationBarrier() )
+							return;
+
 						//DevMsg( "FISHTAIL %s!\n", flEyeDot > 0.0f ? "left" : "right" );
 
 						/*if ( sv_extreme_strafe_aim_punch.GetBool() )
@@ -741,6 +741,11 @@ void DrawDispCollPlane( CBaseTrace *pTrace )
 }
 #endif
 
+enum
+{
+	MAX_NESTING = 8
+};
+
 //-----------------------------------------------------------------------------
 // Purpose: Constructs GameMovement interface
 //-----------------------------------------------------------------------------
@@ -750,11 +755,16 @@ CGameMovement::CGameMovement( void )
 	m_flWaterEntryTime	= 0;
 	m_nOnLadder			= 0;
 	m_bProcessingMovement = false;
+	m_bSpeculativeMove	= false;
+	m_bSpeculationFailed = false;
 
 	mv					= NULL;
 
 	memset( m_flStuckCheckTime, 0, sizeof(m_flStuckCheckTime) );
 	m_pTraceListData = NULL;
+
+	m_pTraceFilters = new CTraceFilterSkipTwoEntitiesAndCheckTeamMask[ MAX_NESTING ];
+	m_nTraceFilterCount = 0;
 }
 
 //-----------------------------------------------------------------------------
@@ -766,25 +776,19 @@ CGameMovement::~CGameMovement( void )
 	{
 		enginetrace->FreeTraceListData(m_pTraceListData);
 	}
+
+	delete[] m_pTraceFilters;
 }
 
 //--------------------------------------------------------------------------------------------------------
-enum
-{
-	MAX_NESTING = 8
-};
-
-static CTraceFilterSkipTwoEntitiesAndCheckTeamMask s_TraceFilter[MAX_NESTING];
-static int s_nTraceFilterCount = 0;
-
 ITraceFilter *CGameMovement::LockTraceFilter( int collisionGroup )
 {
 	// If this assertion triggers, you forgot to call UnlockTraceFilter
-	Assert( s_nTraceFilterCount < MAX_NESTING );
-	if ( s_nTraceFilterCount >= MAX_NESTING )
+	Assert( m_nTraceFilterCount < MAX_NESTING );
+	if ( m_nTraceFilterCount >= MAX_NESTING )
 		return NULL;
 
-	CTraceFilterSkipTwoEntitiesAndCheckTeamMask *pFilter = &s_TraceFilter[s_nTraceFilterCount++];
+	CTraceFilterSkipTwoEntitiesAndCheckTeamMask *pFilter = &m_pTraceFilters[m_nTraceFilterCount++];
 	pFilter->SetPassEntity( mv->m_nPlayerHandle.Get() );
 	pFilter->SetCollisionGroup( collisionGroup );
 
@@ -793,9 +797,9 @@ ITraceFilter *CGameMovement::LockTraceFilter( int collisionGroup )
 
 void CGameMovement::UnlockTraceFilter( ITraceFilter *&pFilter )
 {
-	Assert( s_nTraceFilterCount > 0 );
-	--s_nTraceFilterCount;
-	Assert( &s_TraceFilter[s_nTraceFilterCount] == pFilter );
+	Assert( m_nTraceFilterCount > 0 );
+	--m_nTraceFilterCount;
+	Assert( &m_pTraceFilters[m_nTraceFilterCount] == pFilter );
 	pFilter = NULL;
 }
 
@@ -1332,7 +1336,12 @@ void CGameMovement::ProcessMovement( CBasePlayer *pPlayer, CMoveData *pMove )
 
 	//!!HACK HACK: Adrian - slow down all player movement by this factor.
 	//!!Blame Yahn for this one.
-	gpGlobals->frametime *= pPlayer->GetLaggedMovementValue();
+	// Only write it when it changes; speculative moves share gpGlobals across job threads
+	float flLaggedMovementValue = pPlayer->GetLaggedMovementValue();
+	if ( flLaggedMovementValue != 1.0f )
+	{
+		gpGlobals->frametime *= flLaggedMovementValue;
+	}
 
 	ResetGetWaterContentsForPointCache();
 
@@ -1364,18 +1373,89 @@ void CGameMovement::ProcessMovement( CBasePlayer *pPlayer, CMoveData *pMove )
 	// CheckV( player->CurrentCommandNumber(), "EndPos", mv->GetAbsOrigin() );
 
 	//This is probably not needed, but just in case.
-	gpGlobals->frametime = flStoreFrametime;
+	if ( flLaggedMovementValue != 1.0f )
+	{
+		gpGlobals->frametime = flStoreFrametime;
+	}
 
 	m_bProcessingMovement = false;
 
 #if !defined( CLIENT_DLL )
-	if ( !player->IsBot() )
+	if ( !player->IsBot() && !m_bSpeculativeMove )
 	{
 		VPROF_INCREMENT_COUNTER( "PlayerMovementTraces", m_nTraceCount );
 	}
 #endif
 }
 
+#if !defined( CLIENT_DLL )
+//-----------------------------------------------------------------------------
+// Purpose: Captures the player state ProcessMovement depends on outside of the
+//			move data, so a speculative move can be checked before it is kept
+//-----------------------------------------------------------------------------
+void CGameMovement::GetMoveInputs( CBasePlayer *pPlayer, PlayerMoveInputs_t &inputs )
+{
+	V_memset( &inputs, 0, sizeof( inputs ) );
+
+	inputs.m_flCurTime = gpGlobals->curtime;
+	inputs.m_flFrameTime = gpGlobals->frametime;
+	inputs.m_nCommandNumber = pPlayer->CurrentCommandNumber();
+	inputs.m_fFlags = pPlayer->GetFlags();
+	inputs.m_nMoveType = pPlayer->GetMoveType();
+	inputs.m_nMoveCollide = pPlayer->GetMoveCollide();
+	inputs.m_pGroundEntity = pPlayer->GetGroundEntity();
+	inputs.m_vecBaseVelocity = pPlayer->GetBaseVelocity();
+	inputs.m_vecAbsVelocity = pPlayer->GetAbsVelocity();
+	inputs.m_vecViewOffset = pPlayer->GetViewOffset();
+	inputs.m_nWaterLevel = pPlayer->GetWaterLevel();
+	inputs.m_nWaterType = pPlayer->GetWaterType();
+	inputs.m_flGravity = pPlayer->GetGravity();
+	inputs.m_flFriction = pPlayer->GetFriction();
+	inputs.m_flLaggedMovementValue = pPlayer->GetLaggedMovementValue();
+	inputs.m_flPlayerMaxSpeed = pPlayer->GetPlayerMaxSpeed();
+	inputs.m_iHealth = pPlayer->GetHealth();
+	inputs.m_bDeadFlag = pPlayer->pl.deadflag;
+	inputs.m_bDuckToggled = pPlayer->GetToggledDuckState();
+	inputs.m_iObserverMode = pPlayer->GetObserverMode();
+	inputs.m_iTeamNum = pPlayer->GetTeamNumber();
+	inputs.m_nSolidMask = pPlayer->PhysicsSolidMaskForEntity();
+	inputs.m_angViewAngle = pPlayer->pl.v_angle;
+
+	inputs.m_bDucked = pPlayer->m_Local.m_bDucked;
+	inputs.m_bDucking = pPlayer->m_Local.m_bDucking;
+	inputs.m_bInDuckJump = pPlayer->m_Local.m_bInDuckJump;
+	inputs.m_bAllowAutoMovement = pPlayer->m_Local.m_bAllowAutoMovement;
+	inputs.m_bSlowMovement = pPlayer->m_Local.m_bSlowMovement;
+	inputs.m_nDuckTimeMsecs = pPlayer->m_Local.m_nDuckTimeMsecs;
+	inputs.m_nDuckJumpTimeMsecs = pPlayer->m_Local.m_nDuckJumpTimeMsecs;
+	inputs.m_nJumpTimeMsecs = pPlayer->m_Local.m_nJumpTimeMsecs;
+	inputs.m_flFallVelocity = pPlayer->m_Local.m_flFallVelocity;
+	inputs.m_flLastDuckTime = pPlayer->m_Local.m_flLastDuckTime;
+	inputs.m_flStepSize = pPlayer->m_Local.m_flStepSize;
+	inputs.m_viewPunchAngle = pPlayer->m_Local.m_viewPunchAngle;
+	inputs.m_aimPunchAngle = pPlayer->m_Local.m_aimPunchAngle;
+	inputs.m_aimPunchAngleVel = pPlayer->m_Local.m_aimPunchAngleVel;
+
+	inputs.m_flWaterJumpTime = pPlayer->m_flWaterJumpTime;
+	inputs.m_vecWaterJumpVel = pPlayer->m_vecWaterJumpVel;
+	inputs.m_flSwimSoundTime = pPlayer->m_flSwimSoundTime;
+	inputs.m_flStepSoundTime = pPlayer->m_flStepSoundTime;
+	inputs.m_ignoreLadderJumpTime = pPlayer->m_ignoreLadderJumpTime;
+	inputs.m_vecLadderNormal = pPlayer->m_vecLadderNormal;
+	inputs.m_flDuckAmount = pPlayer->m_flDuckAmount;
+	inputs.m_flDuckSpeed = pPlayer->m_flDuckSpeed;
+	inputs.m_nNumCrouches = pPlayer->m_nNumCrouches;
+	inputs.m_StuckLast = pPlayer->m_StuckLast;
+	inputs.m_bHasWalkMovedSinceLastJump = pPlayer->m_bHasWalkMovedSinceLastJump;
+	inputs.m_vecLastPositionAtFullCrouchSpeed = pPlayer->m_vecLastPositionAtFullCrouchSpeed;
+	inputs.m_chTextureType = pPlayer->m_chTextureType;
+	inputs.m_chPreviousTextureType = pPlayer->m_chPreviousTextureType;
+	inputs.m_surfaceProps = pPlayer->m_surfaceProps;
+	inputs.m_pSurfaceData = pPlayer->m_pSurfaceData;
+	inputs.m_surfaceFriction = pPlayer->m_surfaceFriction;
+}
+#endif
+
 void CGameMovement::Reset( void )
 {
 	player = NULL;
@@ -2399,7 +2479,7 @@ void CGameMovement::FullWalkMove( )
 	if  ( ( m_nOldWaterLevel == WL_NotInWater && player->GetWaterLevel() != WL_NotInWater ) ||
 		  ( m_nOldWaterLevel != WL_NotInWater && player->GetWaterLevel() == WL_NotInWater ) )
 	{
-		if ( player->GetAbsVelocity().Length() > 135 )
+		if ( player->GetAbsVelocity().Length() > 135 && !SpeculationBarrier() )
 		{
 			PlaySwimSound();
 #if !defined( CLIENT_DLL )
@@ -2694,6 +2774,9 @@ bool CGameMovement::CheckJumpButton( void )
 		return false;
 
 
+	if ( SpeculationBarrier() )
+		return false;
+
 	// In the air now.
     SetGroundEntity( NULL );
 	
@@ -3223,6 +3306,9 @@ bool CGameMovement::LadderMove( void )
 			{
 				//debugoverlay->AddLineOverlay( vecTraceFrom, vecTraceTo, 255,0,0,20,1, 5 );
 
+				if ( SpeculationBarrier() )
+					return false;
+
 				player->SetMoveType( MOVETYPE_LADDER );
 				player->SetMoveCollide( MOVECOLLIDE_DEFAULT );
 
@@ -3246,6 +3332,10 @@ bool CGameMovement::LadderMove( void )
 			return false;
 	}
 
+	// Getting on a ladder changes movetype and gravity
+	if ( player->GetMoveType() != MOVETYPE_LADDER && SpeculationBarrier() )
+		return false;
+
 	if( player->GetMoveType() != MOVETYPE_LADDER )
 	{
 		OnStartMoveTypeLadder();
@@ -3793,6 +3883,10 @@ int CGameMovement::CheckStuck( void )
 		return 0;
 	}
 
+	// Unsticking is timed off the wall clock and touches what we're stuck in
+	if ( SpeculationBarrier() )
+		return 1;
+
 	// Deal with stuckness...
 #ifndef DEDICATED
 	if ( developer.GetBool() )
@@ -3974,7 +4068,7 @@ bool CGameMovement::CheckWater( void )
 	}
 
 	// if we just transitioned from not in water to in water, record the time it happened
-	if ( ( WL_NotInWater == m_nOldWaterLevel ) && ( player->GetWaterLevel() >  WL_NotInWater ) )
+	if ( ( WL_NotInWater == m_nOldWaterLevel ) && ( player->GetWaterLevel() >  WL_NotInWater ) && !SpeculationBarrier() )
 	{
 		m_flWaterEntryTime = gpGlobals->curtime;
 	}
@@ -3987,6 +4081,11 @@ void CGameMovement::SetGroundEntity( trace_t *pm )
 	CBaseEntity *newGround = pm ? pm->m_pEnt : NULL;
 
 	CBaseEntity *oldGround = player->GetGroundEntity();
+
+	// Changing ground links the player into the new ground's list
+	if ( newGround != oldGround && SpeculationBarrier() )
+		return;
+
 	Vector vecBaseVelocity = player->GetBaseVelocity();
 
 	if ( !oldGround && newGround )
@@ -4340,6 +4439,10 @@ void CGameMovement::CheckFalling( void )
 	if ( player->GetGroundEntity() == NULL || player->m_Local.m_flFallVelocity <= 0 )
 		return;
 
+	// Landing damage, sounds and punch reach outside of the player
+	if ( SpeculationBarrier() )
+		return;
+
 	if ( !IsDead() && player->m_Local.m_flFallVelocity >= PLAYER_FALL_PUNCH_THRESHOLD )
 	{
 		bool bAlive = true;
@@ -4417,6 +4520,9 @@ void CGameMovement::CheckFalling( void )
 
 void CGameMovement::PlayerRoughLandingEffects( float fvol )
 {
+	if ( SpeculationBarrier() )
+		return;
+
 	if ( fvol > 0.0 )
 	{
 		//
@@ -5057,7 +5163,16 @@ void CGameMovement::PlayerMove( void )
 
 	m_nOnLadder = 0;
 
-	player->UpdateStepSound( player->m_pSurfaceData, mv->GetAbsOrigin(), mv->m_vecVelocity );
+	// A speculative move can only count the step timer down; once it runs out a
+	// step sound may play, so leave that to the serial run.
+	if ( m_bSpeculativeMove && player->m_flStepSoundTime <= 1000.0f * gpGlobals->frametime )
+	{
+		SpeculationBarrier();
+	}
+	else
+	{
+		player->UpdateStepSound( player->m_pSurfaceData, mv->GetAbsOrigin(), mv->m_vecVelocity );
+	}
 
 	UpdateDuckJumpEyeOffset();
 	Duck();
@@ -35,6 +35,94 @@ enum
 struct surfacedata_t;
 
 class CBasePlayer;
+class CTraceFilterSkipTwoEntitiesAndCheckTeamMask;
+
+#if !defined( CLIENT_DLL )
+//-----------------------------------------------------------------------------
+// Player state ProcessMovement depends on outside of CMoveData. A move run
+// ahead of time on a job thread (see player_movesched.cpp) is only kept if
+// this still matches when the usercmd is really run. Zero it before filling
+// it in so it can be compared with memcmp.
+//-----------------------------------------------------------------------------
+struct PlayerMoveInputs_t
+{
+	float			m_flCurTime;
+	float			m_flFrameTime;
+	int				m_nCommandNumber;
+	int				m_fFlags;
+	int				m_nMoveType;
+	int				m_nMoveCollide;
+	CBaseEntity		*m_pGroundEntity;
+	Vector			m_vecBaseVelocity;
+	Vector			m_vecAbsVelocity;
+	Vector			m_vecViewOffset;
+	int				m_nWaterLevel;
+	int				m_nWaterType;
+	float			m_flGravity;
+	float			m_flFriction;
+	float			m_flLaggedMovementValue;
+	float			m_flPlayerMaxSpeed;
+	int				m_iHealth;
+	bool			m_bDeadFlag;
+	bool			m_bDuckToggled;
+	int				m_iObserverMode;
+	int				m_iTeamNum;
+	unsigned int	m_nSolidMask;
+	QAngle			m_angViewAngle;
+
+	// m_Local
+	bool			m_bDucked;
+	bool			m_bDucking;
+	bool			m_bInDuckJump;
+	bool			m_bAllowAutoMovement;
+	bool			m_bSlowMovement;
+	int				m_nDuckTimeMsecs;
+	int				m_nDuckJumpTimeMsecs;
+	int				m_nJumpTimeMsecs;
+	float			m_flFallVelocity;
+	float			m_flLastDuckTime;
+	float			m_flStepSize;
+	QAngle			m_viewPunchAngle;
+	QAngle			m_aimPunchAngle;
+	QAngle			m_aimPunchAngleVel;
+
+	float			m_flWaterJumpTime;
+	Vector			m_vecWaterJumpVel;
+	float			m_flSwimSoundTime;
+	float			m_flStepSoundTime;
+	float			m_ignoreLadderJumpTime;
+	Vector			m_vecLadderNormal;
+	float			m_flDuckAmount;
+	float			m_flDuckSpeed;
+	int				m_nNumCrouches;
+	int				m_StuckLast;
+	bool			m_bHasWalkMovedSinceLastJump;
+	Vector2D		m_vecLastPositionAtFullCrouchSpeed;
+	char			m_chTextureType;
+	char			m_chPreviousTextureType;
+	int				m_surfaceProps;
+	surfacedata_t	*m_pSurfaceData;
+	float			m_surfaceFriction;
+
+#if defined( CSTRIKE_DLL )
+	// Filled in by CCSGameMovement::GetMoveInputs
+	float			m_flStamina;
+	float			m_flVelocityModifier;
+	float			m_flGroundAccelLinearFracLastTime;
+	int				m_iMoveState;
+	int				m_iPlayerState;
+	bool			m_bDuckUntilOnGround;
+	bool			m_bDuckOverride;
+	bool			m_bIsWalking;
+	bool			m_bCanMove;
+	bool			m_bTaunting;
+	bool			m_bThirdPersonTaunt;
+	bool			m_bIsDefusing;
+	bool			m_bHasMovedSinceSpawn;
+	CBaseEntity		*m_pActiveWeapon;
+#endif
+};
+#endif
 
 class CGameMovement : public IGameMovement
 {
@@ -68,6 +156,18 @@ public:
 	virtual unsigned int PlayerSolidMask( bool brushOnly = false, CBasePlayer *testPlayer = NULL ) const;	///< returns the solid mask for the given player, so bots can have a more-restrictive set
 	CBasePlayer		*player;
 	CMoveData *GetMoveData() { return mv; }
+
+	// Speculative movement: ProcessMovement run for a player on a job thread with a
+	// private CGameMovement (see player_movesched.cpp). Anything that would reach
+	// outside of the moving player fails the move instead; the caller then runs the
+	// usercmd again in order.
+	void			BeginSpeculativeMove( void )	{ m_bSpeculativeMove = true; m_bSpeculationFailed = false; }
+	bool			EndSpeculativeMove( void )		{ m_bSpeculativeMove = false; return !m_bSpeculationFailed; }
+
+#if !defined( CLIENT_DLL )
+	virtual void	GetMoveInputs( CBasePlayer *pPlayer, PlayerMoveInputs_t &inputs );
+#endif
+
 protected:
 	// Input/Output for this movement
 	CMoveData		*mv;
@@ -272,6 +372,16 @@ protected:
 
 	virtual bool	GameHasLadders() const;
 
+	// Returns true, and fails the move, if a speculative move got to a side effect it can't make
+	bool			SpeculationBarrier( void )
+	{
+		if ( m_bSpeculativeMove )
+		{
+			m_bSpeculationFailed = true;
+		}
+		return m_bSpeculativeMove;
+	}
+
 	enum
 	{
 		// eyes, waist, feet points (since they are all deterministic
@@ -290,6 +400,13 @@ protected:
 
 	float			m_flStuckCheckTime[MAX_PLAYERS+1][2]; // Last time we did a full test
 
+	// Trace filters handed out by LockTraceFilter, per instance so job threads don't share them
+	CTraceFilterSkipTwoEntitiesAndCheckTeamMask	*m_pTraceFilters;
+	int				m_nTraceFilterCount;
+
+	bool			m_bSpeculativeMove;
+	bool			m_bSpeculationFailed;
+
 	// special function for teleport-with-duck for episodic
 #ifdef HL2_EPISODIC
 public:
@@ -339,4 +456,9 @@ inline void CGameMovement::GameMovementTraceHull( const Vector& start, const Vec
 	}
 }
 
+#if !defined( CLIENT_DLL )
+// Implemented by the mod's movement; a new instance for running moves on a job thread
+CGameMovement *CreateSpeculativeGameMovement( void );
+#endif
+
 #endif // GAMEMOVEMENT_H
@@ -12,6 +12,7 @@
 #pragma once
 #endif
 
+#include "tier0/threadtools.h"
 
 //-----------------------------------------------------------------------------
 // Forward declarations
@@ -56,7 +57,11 @@ abstract_class IMoveHelper
 {
 public:
 	// Call this to set the singleton
-	static IMoveHelper* GetSingleton( ) { return sm_pSingleton; }
+	static IMoveHelper* GetSingleton( )
+	{
+		IMoveHelper *pThreadMoveHelper = sm_pThreadSingleton;
+		return pThreadMoveHelper ? pThreadMoveHelper : sm_pSingleton;
+	}
 	
 	// Methods associated with a particular entity
 	virtual	char const*		GetName( EntityHandle_t handle ) const = 0;
@@ -91,11 +96,15 @@ protected:
 	// Inherited classes can call this to set the singleton
 	static void SetSingleton( IMoveHelper* pMoveHelper ) { sm_pSingleton = pMoveHelper; }
 
+	// Overrides the singleton on the calling thread only (movement run on a job thread)
+	static void SetThreadSingleton( IMoveHelper* pMoveHelper ) { sm_pThreadSingleton = pMoveHelper; }
+
 	// Clients shouldn't call delete directly
 	virtual			~IMoveHelper() {}
 
 	// The global instance
 	static IMoveHelper* sm_pSingleton;
+	static CTHREADLOCALPTR( IMoveHelper ) sm_pThreadSingleton;
 };
 
 //-----------------------------------------------------------------------------
@@ -103,7 +112,8 @@ protected:
 //-----------------------------------------------------------------------------
 
 #define IMPLEMENT_MOVEHELPER()	\
-	IMoveHelper* IMoveHelper::sm_pSingleton = 0
+	IMoveHelper* IMoveHelper::sm_pSingleton = 0;	\
+	CTHREADLOCALPTR( IMoveHelper ) IMoveHelper::sm_pThreadSingleton
 
 //-----------------------------------------------------------------------------
 // Call this to set the singleton
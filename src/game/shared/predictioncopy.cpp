@@ -27,6 +27,16 @@
 #include "tier0/vprof.h"
 #include "tier1/tokenset.h"
 
+#if defined( __x86_64__ ) || defined( _M_X64 ) || defined( __SSE2__ )
+#include <emmintrin.h>
+#define PREDICTIONCOPY_SIMD_COMPARE 1
+#elif defined( __aarch64__ )
+#include <sse2neon.h>
+#define PREDICTIONCOPY_SIMD_COMPARE 1
+#else
+#define PREDICTIONCOPY_SIMD_COMPARE 0
+#endif
+
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
 
@@ -1211,6 +1221,99 @@ static void BuildDataRuns( datamap_t *dmap )
 	}
 }
 
+// Only the types PREDICTIONCOPY_APPLY knows how to compare go in compare runs
+static bool IsCompareRunField( const typedescription_t *td )
+{
+	if ( td->flags & FTYPEDESC_NOERRORCHECK )
+		return false;
+	if ( td->fieldSizeInBytes <= 0 )
+		return false;
+
+	switch ( td->fieldType )
+	{
+	case FIELD_FLOAT:
+	case FIELD_STRING:
+	case FIELD_VECTOR:
+	case FIELD_QUATERNION:
+	case FIELD_COLOR32:
+	case FIELD_BOOLEAN:
+	case FIELD_INTEGER:
+	case FIELD_SHORT:
+	case FIELD_CHARACTER:
+	case FIELD_EHANDLE:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static void BuildCompareRuns( datamap_t *dmap )
+{
+	for ( int pc = 0; pc < PC_COPYTYPE_COUNT; ++pc )
+	{
+		datamapinfo_t &info = dmap->m_pOptimizedDataMap->m_Info[ pc ];
+		const flattenedoffsets_t &flat = info.m_Flat;
+		CUtlVector< datarun_t > &vecRuns = info.m_CompareRuns.m_vecRuns;
+
+		Assert( !vecRuns.Count() );
+
+		bool bInRun = false;
+		datarun_t run;
+		int nLastFieldEnd[ TD_OFFSET_COUNT ] = { 0 };
+
+		for ( int i = 0; i < flat.m_Flattened.Count(); ++i )
+		{
+			const typedescription_t *td = &flat.m_Flattened[ i ];
+			if ( td->fieldType == FIELD_VOID )
+				continue;
+
+			if ( !IsCompareRunField( td ) )
+			{
+				// Breaks the run, the bytes of this field must not be compared
+				if ( bInRun )
+				{
+					vecRuns.AddToTail( run );
+					bInRun = false;
+				}
+				continue;
+			}
+
+			// Extend the run only if the field follows on directly in both layouts, so
+			//  one length covers the same fields whichever layout src and dest use
+			if ( bInRun &&
+				td->flatOffset[ TD_OFFSET_NORMAL ] == nLastFieldEnd[ TD_OFFSET_NORMAL ] &&
+				td->flatOffset[ TD_OFFSET_PACKED ] == nLastFieldEnd[ TD_OFFSET_PACKED ] )
+			{
+				run.m_nEndFlatField = i;
+				run.m_nLength += td->fieldSizeInBytes;
+			}
+			else
+			{
+				if ( bInRun )
+				{
+					vecRuns.AddToTail( run );
+				}
+
+				bInRun = true;
+				run.m_nStartFlatField = i;
+				run.m_nEndFlatField = i;
+				run.m_nStartOffset[ TD_OFFSET_NORMAL ] = td->flatOffset[ TD_OFFSET_NORMAL ];
+				run.m_nStartOffset[ TD_OFFSET_PACKED ] = td->flatOffset[ TD_OFFSET_PACKED ];
+				run.m_nLength = td->fieldSizeInBytes;
+			}
+
+			nLastFieldEnd[ TD_OFFSET_NORMAL ] = td->flatOffset[ TD_OFFSET_NORMAL ] + td->fieldSizeInBytes;
+			nLastFieldEnd[ TD_OFFSET_PACKED ] = td->flatOffset[ TD_OFFSET_PACKED ] + td->fieldSizeInBytes;
+		}
+
+		// Close off last run
+		if ( bInRun )
+		{
+			vecRuns.AddToTail( run );
+		}
+	}
+}
+
 static void BuildFlattenedChains( datamap_t *dmap )
 {
 	if ( dmap->m_pOptimizedDataMap )
@@ -1259,6 +1362,7 @@ static void BuildFlattenedChains( datamap_t *dmap )
 	}
 
 	BuildDataRuns( dmap );
+	BuildCompareRuns( dmap );
 }
 
 const tokenset_t< int > s_PredCopyType[] =
@@ -1276,13 +1380,12 @@ const tokenset_t< int > s_PredPackType[] =
 	{ NULL, -1 }
 };
 
-static void DescribeRuns( const datamap_t *dmap, int nPredictionCopyType, int packType )
+static void DescribeRuns( const datamap_t *dmap, const datacopyruns_t &runs, char const *pchRunType, int nPredictionCopyType, int packType )
 {
 	const flattenedoffsets_t *flat;
 	const datarun_t *run;
-	const datacopyruns_t &runs = dmap->m_pOptimizedDataMap->m_Info[ nPredictionCopyType ].m_CopyRuns;
 	flat = &dmap->m_pOptimizedDataMap->m_Info[ nPredictionCopyType ].m_Flat;
-	Msg( "   Runs for copy type: %s, packing: %s\n", s_PredCopyType->GetNameByToken( nPredictionCopyType ), s_PredPackType->GetNameByToken( packType ) );
+	Msg( "   %s runs for copy type: %s, packing: %s\n", pchRunType, s_PredCopyType->GetNameByToken( nPredictionCopyType ), s_PredPackType->GetNameByToken( packType ) );
 	for ( int i = 0; i < runs.m_vecRuns.Count(); ++i )
 	{
 		run = &runs.m_vecRuns[ i ];
@@ -1353,7 +1456,9 @@ static void DescribeFlattenedList( const datamap_t *dmap, int nPredictionCopyTyp
 	}
 	Msg( "->\n" );
 
-	DescribeRuns( dmap, nPredictionCopyType, packType );
+	const datamapinfo_t &info = dmap->m_pOptimizedDataMap->m_Info[ nPredictionCopyType ];
+	DescribeRuns( dmap, info.m_CopyRuns, "Copy", nPredictionCopyType, packType );
+	DescribeRuns( dmap, info.m_CompareRuns, "Compare", nPredictionCopyType, packType );
 }
 
 void CPredictionCopy::CopyFlatFieldsUsingRuns( const datamap_t *pCurrentMap, int nPredictionCopyType )
@@ -1458,6 +1563,64 @@ void CPredictionCopy::ErrorCheckFlatFields_NoSpew( const datamap_t *pCurrentMap,
 	}
 }
 
+static ConVar cl_predictioncopy_compare_runs( "cl_predictioncopy_compare_runs", "1", FCVAR_CHEAT, "Prediction error checks compare contiguous runs of fields at once, falling back to per-field compares only where the bytes differ." );
+
+// Bitwise equality of a run, 16 bytes at a time
+static FORCEINLINE bool PredictionCopyBytesEqual( const byte *a, const byte *b, int nLength )
+{
+#if PREDICTIONCOPY_SIMD_COMPARE
+	while ( nLength >= 16 )
+	{
+		__m128i va = _mm_loadu_si128( ( const __m128i * )a );
+		__m128i vb = _mm_loadu_si128( ( const __m128i * )b );
+		if ( _mm_movemask_epi8( _mm_cmpeq_epi8( va, vb ) ) != 0xFFFF )
+			return false;
+		a += 16;
+		b += 16;
+		nLength -= 16;
+	}
+#endif
+	return !nLength || !V_memcmp( a, b, nLength );
+}
+
+// Same result as ErrorCheckFlatFields_NoSpew: fields with identical bytes compare as IDENTICAL, so only
+//  runs whose bytes differ need the per-field compare (which also applies the float tolerances)
+void CPredictionCopy::ErrorCheckFlatFieldsUsingRuns_NoSpew( const datamap_t *pCurrentMap, int nPredictionCopyType )
+{
+	const datamapinfo_t &info = pCurrentMap->m_pOptimizedDataMap->m_Info[ nPredictionCopyType ];
+	const datacopyruns_t &runs = info.m_CompareRuns;
+	const typedescription_t *pBase = info.m_Flat.m_Flattened.Base();
+
+	const byte * RESTRICT pDest = (const byte * RESTRICT)m_pDest;
+	const byte * RESTRICT pSrc = (const byte * RESTRICT)m_pSrc;
+
+	PREFETCH360( pSrc, 0 );
+	PREFETCH360( pDest, 0 );
+
+	int c = runs.m_vecRuns.Count();
+	for ( int i = 0; i < c && !m_nErrorCount; ++i )
+	{
+		const datarun_t * RESTRICT run = &runs.m_vecRuns[ i ];
+
+		if ( PredictionCopyBytesEqual( pDest + run->m_nStartOffset[ m_nDestOffsetIndex ], pSrc + run->m_nStartOffset[ m_nSrcOffsetIndex ], run->m_nLength ) )
+			continue;
+
+		for ( int j = run->m_nStartFlatField; j <= run->m_nEndFlatField && !m_nErrorCount; ++j )
+		{
+			const typedescription_t * RESTRICT pField = &pBase[ j ];
+			if ( pField->fieldType == FIELD_VOID )
+				continue;
+
+			const byte *pOutputData = pDest + pField->flatOffset[ m_nDestOffsetIndex ];
+			const byte *pInputData = pSrc + pField->flatOffset[ m_nSrcOffsetIndex ];
+			int fieldSize = pField->fieldSize;
+			int nFieldType = pField->fieldType;
+
+			PREDICTIONCOPY_APPLY( ProcessField_Compare_NoSpew, nFieldType, pCurrentMap, pField, pOutputData, pInputData, fieldSize );
+		}
+	}
+}
+
 void CPredictionCopy::ErrorCheckFlatFields_Spew( const datamap_t *pCurrentMap, int nPredictionCopyType )
 {
 	int				i;
@@ -1546,6 +1709,96 @@ CON_COMMAND( cl_predictioncopy_describe, "Describe datamap_t for entindex" )
 	}
 }
 
+static double PredictionCopyBenchCompare( byte *pA, byte *pB, const datamap_t *dmap, int nIterations, bool bUseRuns, int *pErrorCount )
+{
+	bool bWasUsingRuns = cl_predictioncopy_compare_runs.GetBool();
+	cl_predictioncopy_compare_runs.SetValue( bUseRuns );
+
+	int nErrorCount = 0;
+	double flStart = Plat_FloatTime();
+	for ( int i = 0; i < nIterations; ++i )
+	{
+		CPredictionCopy errorCheckHelper( PC_NETWORKED_ONLY, pA, TD_OFFSET_PACKED, pB, TD_OFFSET_PACKED, CPredictionCopy::TRANSFERDATA_ERRORCHECK_NOSPEW );
+		nErrorCount = errorCheckHelper.TransferData( "cl_predictioncopy_benchmark", -1, (datamap_t *)dmap );
+	}
+	double flElapsed = Plat_FloatTime() - flStart;
+
+	cl_predictioncopy_compare_runs.SetValue( bWasUsingRuns );
+	*pErrorCount = nErrorCount;
+	return flElapsed;
+}
+
+CON_COMMAND( cl_predictioncopy_benchmark, "Time prediction save, restore and error check of each player: cl_predictioncopy_benchmark [iterations]" )
+{
+	int nIterations = ( args.ArgC() > 1 ) ? MAX( 1, Q_atoi( args[ 1 ] ) ) : 1000;
+	int nPlayers = 0;
+
+	for ( int nPlayer = 1; nPlayer <= gpGlobals->maxClients; ++nPlayer )
+	{
+		C_BasePlayer *pPlayer = UTIL_PlayerByIndex( nPlayer );
+		if ( !pPlayer )
+			continue;
+
+		datamap_t *dmap = pPlayer->GetPredDescMap();
+		if ( !dmap )
+			continue;
+		CPredictionCopy::PrepareDataMap( dmap );
+
+		int nSize = MAX( dmap->m_nPackedSize, 4 );
+		byte *pA = new byte[ nSize ];
+		byte *pB = new byte[ nSize ];
+		Q_memset( pA, 0, nSize );
+
+		double flStart = Plat_FloatTime();
+		for ( int i = 0; i < nIterations; ++i )
+		{
+			CPredictionCopy copyHelper( PC_EVERYTHING, pA, TD_OFFSET_PACKED, (const byte *)pPlayer, TD_OFFSET_NORMAL, CPredictionCopy::TRANSFERDATA_COPYONLY );
+			copyHelper.TransferData( "cl_predictioncopy_benchmark", pPlayer->entindex(), dmap );
+		}
+		double flSave = Plat_FloatTime() - flStart;
+
+		// Restores the values just saved, so the player is left as it was
+		flStart = Plat_FloatTime();
+		for ( int i = 0; i < nIterations; ++i )
+		{
+			CPredictionCopy copyHelper( PC_EVERYTHING, (byte *)pPlayer, TD_OFFSET_NORMAL, pA, TD_OFFSET_PACKED, CPredictionCopy::TRANSFERDATA_COPYONLY );
+			copyHelper.TransferData( "cl_predictioncopy_benchmark", pPlayer->entindex(), dmap );
+		}
+		double flRestore = Plat_FloatTime() - flStart;
+
+		int nFieldErrors, nRunErrors;
+		Q_memcpy( pB, pA, nSize );
+		double flCompareFields = PredictionCopyBenchCompare( pA, pB, dmap, nIterations, false, &nFieldErrors );
+		double flCompareRuns = PredictionCopyBenchCompare( pA, pB, dmap, nIterations, true, &nRunErrors );
+		bool bMismatch = ( nFieldErrors != nRunErrors );
+
+		// Disturb the tail of the data, where the slowest per-field walk finds the first error
+		pB[ nSize - 1 ] ^= 0x5a;
+		pB[ nSize / 2 ] ^= 0x5a;
+		int nFieldDiffErrors, nRunDiffErrors;
+		double flDiffFields = PredictionCopyBenchCompare( pA, pB, dmap, nIterations, false, &nFieldDiffErrors );
+		double flDiffRuns = PredictionCopyBenchCompare( pA, pB, dmap, nIterations, true, &nRunDiffErrors );
+		bMismatch |= ( nFieldDiffErrors != nRunDiffErrors );
+
+		const datamapinfo_t &info = dmap->m_pOptimizedDataMap->m_Info[ PC_NETWORKED_ONLY ];
+		double flScale = 1000000.0 / nIterations;
+		Msg( "%2d %s (%s): %d bytes, %d fields, %d compare runs\n", nPlayer, pPlayer->GetPlayerName(), dmap->dataClassName, nSize, info.m_Flat.m_Flattened.Count(), info.m_CompareRuns.m_vecRuns.Count() );
+		Msg( "   save %.3f us, restore %.3f us\n", flSave * flScale, flRestore * flScale );
+		Msg( "   error check equal: fields %.3f us, runs %.3f us\n", flCompareFields * flScale, flCompareRuns * flScale );
+		Msg( "   error check differ: fields %.3f us, runs %.3f us\n", flDiffFields * flScale, flDiffRuns * flScale );
+		if ( bMismatch )
+		{
+			Warning( "   MISMATCH: fields found %d/%d errors, runs found %d/%d errors\n", nFieldErrors, nFieldDiffErrors, nRunErrors, nRunDiffErrors );
+		}
+
+		delete[] pA;
+		delete[] pB;
+		++nPlayers;
+	}
+
+	Msg( "cl_predictioncopy_benchmark: %d players, %d iterations\n", nPlayers, nIterations );
+}
+
 // 0 PC_NON_NETWORKED_ONLY = (1<<0) or (1)
 // 1 PC_NETWORKED_ONLY = (1<<1) or (2)
 // 2 PC_EVERYTHING = ( PC_NON_NETWORKED_ONLY | PC_NETWORKED_ONLY ) or 3
@@ -1597,12 +1850,20 @@ void CPredictionCopy::TransferDataCopyOnly( const datamap_t *dmap )
 // Stop at first error
 void CPredictionCopy::TransferDataErrorCheckNoSpew( char const *pchOperation, const datamap_t *dmap )
 {
+	bool bUseRuns = cl_predictioncopy_compare_runs.GetBool();
 	int types = ComputeTypeMask( m_nType );
 	for ( int i = 0; i < PC_COPYTYPE_COUNT && !m_nErrorCount; ++i )
 	{
 		if ( types & (1<<i) )
 		{
-			ErrorCheckFlatFields_NoSpew( dmap, i );
+			if ( bUseRuns )
+			{
+				ErrorCheckFlatFieldsUsingRuns_NoSpew( dmap, i );
+			}
+			else
+			{
+				ErrorCheckFlatFields_NoSpew( dmap, i );
+			}
 		}
 	}
 }
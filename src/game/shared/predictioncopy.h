@@ -42,6 +42,8 @@ typedef void ( *FN_FIELD_COMPARE )( const char *classname, const char *fieldname
 //  one for PC_NETWORKED_DATA and one for PC_NON_NETWORKED_ONLY (optimized_datamap_t::datamapinfo_t::flattenedoffsets_t)
 // Each flattened array is sorted by offset for better cache performance
 // Finally, contiguous "runs" off offsets are precomputed (optimized_datamap_t::datamapinfo_t::datacopyruns_t) for fast copy operations
+// A second set of runs covers only the error checked fields, so TRANSFERDATA_ERRORCHECK_NOSPEW can compare
+//  a whole run at once and only falls back to per-field (tolerance aware) compares for runs whose bytes differ
 
 // A data run is a set of DEFINE_PRED_FIELD fields in a c++ object which are contiguous and can be processing
 //  using a single memcpy operation
@@ -91,6 +93,9 @@ struct datamapinfo_t
 	//  and FTYPEDESC_OVERRIDE (overridden) fields removed
 	flattenedoffsets_t	m_Flat;
 	datacopyruns_t		m_CopyRuns;
+	// Runs of comparable fields without FTYPEDESC_NOERRORCHECK which are 
+	//  contiguous in both the normal and packed layouts
+	datacopyruns_t		m_CompareRuns;
 };
 
 struct optimized_datamap_t
@@ -145,6 +150,7 @@ private:
 
 	// Helper for TransferDataErrorCheckNoSpew
 	void	ErrorCheckFlatFields_NoSpew( const datamap_t *pCurrentMap, int nPredictionCopyType );
+	void	ErrorCheckFlatFieldsUsingRuns_NoSpew( const datamap_t *pCurrentMap, int nPredictionCopyType );
 	template< class T >
 	FORCEINLINE void ProcessField_Compare_NoSpew( const datamap_t *pCurrentMap, const typedescription_t *pField, const T *pOutputData, const T *pInputData, int fieldSize );
 
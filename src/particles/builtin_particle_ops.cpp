@@ -15,6 +15,7 @@
 #include "studio.h"
 #include "bspflags.h"
 #include "tier0/vprof.h"
+#include "particles_internal.h"
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
 
@@ -165,26 +166,10 @@ void C_OP_BasicMovement::Operate( CParticleCollection *pParticles, float flStren
 	
 	CHECKSYSTEM( pParticles );
 	fltx4 DtSquared = ReplicateX4( pParticles->m_flDt * pParticles->m_flDt );
-	int ctr = pParticles->m_nPaddedActiveParticles;
-	FourVectors *pAccIn = PerParticleForceAccumulator;
-	do
-	{
-		fltx4 accFactorX = MulSIMD( pAccIn->x, DtSquared );
-		fltx4 accFactorY = MulSIMD( pAccIn->y, DtSquared );
-		fltx4 accFactorZ = MulSIMD( pAccIn->z, DtSquared );
-		
-		// we will write prev xyz, and swap prev and cur at the end
-		prev_xyz->x = AddSIMD( xyz->x,
-							   AddSIMD( accFactorX, MulSIMD( adj_dt, SubSIMD( xyz->x, prev_xyz->x ) ) ) );
-		prev_xyz->y = AddSIMD( xyz->y,
-							   AddSIMD( accFactorY, MulSIMD( adj_dt, SubSIMD( xyz->y, prev_xyz->y ) ) ) );
-		prev_xyz->z = AddSIMD( xyz->z,
-							   AddSIMD( accFactorZ, MulSIMD( adj_dt, SubSIMD( xyz->z, prev_xyz->z ) ) ) );
-		CHECKSYSTEM( pParticles );
-		++prev_xyz;
-		++xyz;
-		pAccIn += nForceStride;
-	} while (--ctr);
+
+	// we will write prev xyz, and swap prev and cur at the end
+	GetParticleSIMDKernels().m_pfnIntegrateMovement( xyz, xyz.Stride(), prev_xyz, prev_xyz.Stride(),
+		PerParticleForceAccumulator, nForceStride, adj_dt, DtSquared, pParticles->m_nPaddedActiveParticles );
 
 	CHECKSYSTEM( pParticles );
 	pParticles->SwapPosAndPrevPos();
@@ -3341,43 +3326,16 @@ END_PARTICLE_OPERATOR_UNPACK( C_OP_Decay )
 
 void C_OP_Decay::Operate( CParticleCollection *pParticles, float flStrength,  void *pContext ) const
 {
-	fltx4 fl4CurTime = pParticles->m_fl4CurTime;
+	size_t nCreationStride, nLifeStride;
+	const fltx4 *pCreationTime = pParticles->GetM128AttributePtr( PARTICLE_ATTRIBUTE_CREATION_TIME, &nCreationStride );
+	const fltx4 *pLifeDuration = pParticles->GetM128AttributePtr( PARTICLE_ATTRIBUTE_LIFE_DURATION, &nLifeStride );
 
-	CM128AttributeIterator pCreationTime( PARTICLE_ATTRIBUTE_CREATION_TIME, pParticles );
-	CM128AttributeIterator pLifeDuration( PARTICLE_ATTRIBUTE_LIFE_DURATION, pParticles );
-
-	int nLimit = pParticles->m_nPaddedActiveParticles << 2;
-
-	for ( int i = 0; i < nLimit; i+= 4 )
+	int nBlocks = pParticles->m_nPaddedActiveParticles;
+	uint8 nKillMasks[ MAX_PARTICLES_IN_A_SYSTEM / 4 + 1 ];
+	if ( GetParticleSIMDKernels().m_pfnLifespanKillMasks( pCreationTime, nCreationStride, pLifeDuration, nLifeStride,
+			pParticles->m_fl4CurTime, nBlocks, nKillMasks ) )
 	{
-		fltx4 fl4LifeDuration = *pLifeDuration;
-		
-		bi32x4 fl4KillMask = CmpLeSIMD( fl4LifeDuration, Four_Zeros );
-
-		fltx4 fl4Age = SubSIMD( fl4CurTime, *pCreationTime );
-
-		//test for low framerate problems
-		//fltx4 fl4Dt = ReplicateX4( pParticles->m_flDt );
-		//fl4Age = AddSIMD( fl4Age, fl4Dt );
-		//endtest
-
-		fl4KillMask = OrSIMD( fl4KillMask, CmpGeSIMD( fl4Age, fl4LifeDuration ) );
-		if ( IsAnyTrue( fl4KillMask ) )
-		{
-			// not especially pretty - we need to kill some particles.
-			int nMask = TestSignSIMD( fl4KillMask );
-			if ( nMask & 1 )
-				pParticles->KillParticle( i );
-			if ( nMask & 2 )
-				pParticles->KillParticle( i + 1 );
-			if ( nMask & 4 )
-				pParticles->KillParticle( i + 2 );
-			if ( nMask & 8 )
-				pParticles->KillParticle( i + 3 );
-
-		}
-		++pCreationTime;
-		++pLifeDuration;
+		KillParticlesFromMasks( pParticles, nKillMasks, nBlocks );
 	}
 }
 
@@ -3504,30 +3462,15 @@ void C_OP_AlphaDecay::Operate( CParticleCollection *pParticles, float flStrength
 {
 	fltx4 fl4MinAlpha = ReplicateX4( m_flMinAlpha + FLT_EPSILON );
 
-	CM128AttributeIterator pAlpha( PARTICLE_ATTRIBUTE_ALPHA, pParticles );
-	CM128AttributeIterator pAlpha2( PARTICLE_ATTRIBUTE_ALPHA2, pParticles );
-
-	int nLimit = pParticles->m_nPaddedActiveParticles << 2;
+	size_t nAlphaStride, nAlpha2Stride;
+	const fltx4 *pAlpha = pParticles->GetM128AttributePtr( PARTICLE_ATTRIBUTE_ALPHA, &nAlphaStride );
+	const fltx4 *pAlpha2 = pParticles->GetM128AttributePtr( PARTICLE_ATTRIBUTE_ALPHA2, &nAlpha2Stride );
 
-	for ( int i = 0; i < nLimit; i+= 4 )
+	int nBlocks = pParticles->m_nPaddedActiveParticles;
+	uint8 nKillMasks[ MAX_PARTICLES_IN_A_SYSTEM / 4 + 1 ];
+	if ( GetParticleSIMDKernels().m_pfnAlphaKillMasks( pAlpha, nAlphaStride, pAlpha2, nAlpha2Stride, fl4MinAlpha, nBlocks, nKillMasks ) )
 	{
-		bi32x4 fl4KillMask = CmpLeSIMD( MulSIMD( *pAlpha, *pAlpha2 ), fl4MinAlpha );
-
-		if ( IsAnyTrue( fl4KillMask ) )
-		{
-			// not especially pretty - we need to kill some particles.
-			int nMask = TestSignSIMD( fl4KillMask );
-			if ( nMask & 1 )
-				pParticles->KillParticle( i );
-			if ( nMask & 2 )
-				pParticles->KillParticle( i + 1 );
-			if ( nMask & 4 )
-				pParticles->KillParticle( i + 2 );
-			if ( nMask & 8 )
-				pParticles->KillParticle( i + 3 );
-		}
-		++pAlpha;
-		++pAlpha2;
+		KillParticlesFromMasks( pParticles, nKillMasks, nBlocks );
 	}
 }
 
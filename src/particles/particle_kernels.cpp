@@ -0,0 +1,440 @@
+//===== Copyright (c) 1996-2006, Valve Corporation, All rights reserved. ======//
+//
+// Purpose: runtime-dispatched SIMD kernels for the hottest particle operators
+//
+//===========================================================================//
+
+#include "tier0/platform.h"
+#include "particles/particles.h"
+#include "tier1/convar.h"
+#include "tier1/strtools.h"
+#include "tier0/vprof.h"
+#include "particles_internal.h"
+
+#if defined( __GNUC__ ) && ( defined( __i386__ ) || defined( __x86_64__ ) )
+#include <immintrin.h>
+#define PARTICLE_SIMD_HAS_AVX2 1
+#define PARTICLE_AVX2_TARGET __attribute__(( target( "avx2,fma" ) ))
+#elif defined( _MSC_VER ) && ( defined( _M_IX86 ) || defined( _M_X64 ) ) && !defined( _X360 )
+#include <immintrin.h>
+#define PARTICLE_SIMD_HAS_AVX2 1
+#define PARTICLE_AVX2_TARGET
+#else
+#define PARTICLE_SIMD_HAS_AVX2 0
+#endif
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+static ConVar particle_simd_avx2( "particle_simd_avx2", "1", 0, "Use the 8-wide AVX2 particle operator kernels when the CPU supports them." );
+
+
+//-----------------------------------------------------------------------------
+// 4-wide kernels. These are the reference implementations; the operators used
+// to run exactly this code inline.
+//-----------------------------------------------------------------------------
+static void IntegrateMovement_SSE( FourVectors *pXYZ, size_t nXYZStride, FourVectors *pPrevXYZ, size_t nPrevStride,
+								  const FourVectors *pAccel, size_t nAccelStride, fltx4 fl4AdjDt, fltx4 fl4DtSq, int nBlocks )
+{
+	for ( ; nBlocks > 0; --nBlocks )
+	{
+		fltx4 accX = MulSIMD( pAccel->x, fl4DtSq );
+		fltx4 accY = MulSIMD( pAccel->y, fl4DtSq );
+		fltx4 accZ = MulSIMD( pAccel->z, fl4DtSq );
+
+		// we write prev xyz; the caller swaps prev and cur afterwards
+		pPrevXYZ->x = AddSIMD( pXYZ->x, AddSIMD( accX, MulSIMD( fl4AdjDt, SubSIMD( pXYZ->x, pPrevXYZ->x ) ) ) );
+		pPrevXYZ->y = AddSIMD( pXYZ->y, AddSIMD( accY, MulSIMD( fl4AdjDt, SubSIMD( pXYZ->y, pPrevXYZ->y ) ) ) );
+		pPrevXYZ->z = AddSIMD( pXYZ->z, AddSIMD( accZ, MulSIMD( fl4AdjDt, SubSIMD( pXYZ->z, pPrevXYZ->z ) ) ) );
+
+		pXYZ += nXYZStride;
+		pPrevXYZ += nPrevStride;
+		pAccel += nAccelStride;
+	}
+}
+
+static bool LifespanKillMasks_SSE( const fltx4 *pCreationTime, size_t nCreationStride, const fltx4 *pLifeDuration, size_t nLifeStride,
+								  fltx4 fl4CurTime, int nBlocks, uint8 *pMasksOut )
+{
+	int nAny = 0;
+	for ( int i = 0; i < nBlocks; ++i )
+	{
+		fltx4 fl4LifeDuration = *pLifeDuration;
+		bi32x4 fl4KillMask = CmpLeSIMD( fl4LifeDuration, Four_Zeros );
+		fltx4 fl4Age = SubSIMD( fl4CurTime, *pCreationTime );
+		fl4KillMask = OrSIMD( fl4KillMask, CmpGeSIMD( fl4Age, fl4LifeDuration ) );
+		int nMask = TestSignSIMD( fl4KillMask );
+		pMasksOut[i] = (uint8)nMask;
+		nAny |= nMask;
+
+		pCreationTime += nCreationStride;
+		pLifeDuration += nLifeStride;
+	}
+	return nAny != 0;
+}
+
+static bool AlphaKillMasks_SSE( const fltx4 *pAlpha, size_t nAlphaStride, const fltx4 *pAlpha2, size_t nAlpha2Stride,
+							   fltx4 fl4MinAlpha, int nBlocks, uint8 *pMasksOut )
+{
+	int nAny = 0;
+	for ( int i = 0; i < nBlocks; ++i )
+	{
+		bi32x4 fl4KillMask = CmpLeSIMD( MulSIMD( *pAlpha, *pAlpha2 ), fl4MinAlpha );
+		int nMask = TestSignSIMD( fl4KillMask );
+		pMasksOut[i] = (uint8)nMask;
+		nAny |= nMask;
+
+		pAlpha += nAlphaStride;
+		pAlpha2 += nAlpha2Stride;
+	}
+	return nAny != 0;
+}
+
+
+#if PARTICLE_SIMD_HAS_AVX2
+//-----------------------------------------------------------------------------
+// 8-wide kernels. Two particle blocks are packed into one ymm register, so
+// the attribute strides don't have to be contiguous. A trailing odd block
+// falls through to the 4-wide version.
+//-----------------------------------------------------------------------------
+#define COMBINE_BLOCKS( _lo, _hi ) _mm256_insertf128_ps( _mm256_castps128_ps256( _lo ), _hi, 1 )
+#define LOAD_TWO_BLOCKS( _p, _stride ) COMBINE_BLOCKS( *(_p), *( (_p) + (_stride) ) )
+
+PARTICLE_AVX2_TARGET static void IntegrateMovement_AVX2( FourVectors *pXYZ, size_t nXYZStride, FourVectors *pPrevXYZ, size_t nPrevStride,
+														const FourVectors *pAccel, size_t nAccelStride, fltx4 fl4AdjDt, fltx4 fl4DtSq, int nBlocks )
+{
+	__m256 adjDt = COMBINE_BLOCKS( fl4AdjDt, fl4AdjDt );
+	__m256 dtSq = COMBINE_BLOCKS( fl4DtSq, fl4DtSq );
+
+	for ( ; nBlocks >= 2; nBlocks -= 2 )
+	{
+		FourVectors *pXYZ1 = pXYZ + nXYZStride;
+		FourVectors *pPrev1 = pPrevXYZ + nPrevStride;
+		const FourVectors *pAccel1 = pAccel + nAccelStride;
+
+		for ( int nComp = 0; nComp < 3; ++nComp )
+		{
+			__m256 xyz = COMBINE_BLOCKS( (*pXYZ)[nComp], (*pXYZ1)[nComp] );
+			__m256 prev = COMBINE_BLOCKS( (*pPrevXYZ)[nComp], (*pPrev1)[nComp] );
+			__m256 acc = COMBINE_BLOCKS( (*pAccel)[nComp], (*pAccel1)[nComp] );
+
+			// prev = xyz + ( acc * dt^2 + adjDt * ( xyz - prev ) )
+			__m256 result = _mm256_add_ps( xyz, _mm256_fmadd_ps( adjDt, _mm256_sub_ps( xyz, prev ), _mm256_mul_ps( acc, dtSq ) ) );
+			(*pPrevXYZ)[nComp] = _mm256_castps256_ps128( result );
+			(*pPrev1)[nComp] = _mm256_extractf128_ps( result, 1 );
+		}
+
+		pXYZ = pXYZ1 + nXYZStride;
+		pPrevXYZ = pPrev1 + nPrevStride;
+		pAccel = pAccel1 + nAccelStride;
+	}
+
+	if ( nBlocks )
+	{
+		IntegrateMovement_SSE( pXYZ, nXYZStride, pPrevXYZ, nPrevStride, pAccel, nAccelStride, fl4AdjDt, fl4DtSq, nBlocks );
+	}
+}
+
+PARTICLE_AVX2_TARGET static bool LifespanKillMasks_AVX2( const fltx4 *pCreationTime, size_t nCreationStride, const fltx4 *pLifeDuration, size_t nLifeStride,
+														fltx4 fl4CurTime, int nBlocks, uint8 *pMasksOut )
+{
+	__m256 curTime = COMBINE_BLOCKS( fl4CurTime, fl4CurTime );
+	__m256 zero = _mm256_setzero_ps();
+
+	int nAny = 0;
+	int i = 0;
+	for ( ; i + 2 <= nBlocks; i += 2 )
+	{
+		__m256 lifeDuration = LOAD_TWO_BLOCKS( pLifeDuration, nLifeStride );
+		__m256 age = _mm256_sub_ps( curTime, LOAD_TWO_BLOCKS( pCreationTime, nCreationStride ) );
+		__m256 killMask = _mm256_or_ps( _mm256_cmp_ps( lifeDuration, zero, _CMP_LE_OQ ), _mm256_cmp_ps( age, lifeDuration, _CMP_GE_OQ ) );
+		int nMask = _mm256_movemask_ps( killMask );
+		pMasksOut[i] = (uint8)( nMask & 0xf );
+		pMasksOut[i + 1] = (uint8)( nMask >> 4 );
+		nAny |= nMask;
+
+		pCreationTime += 2 * nCreationStride;
+		pLifeDuration += 2 * nLifeStride;
+	}
+
+	if ( i < nBlocks )
+	{
+		nAny |= LifespanKillMasks_SSE( pCreationTime, nCreationStride, pLifeDuration, nLifeStride, fl4CurTime, nBlocks - i, pMasksOut + i );
+	}
+	return nAny != 0;
+}
+
+PARTICLE_AVX2_TARGET static bool AlphaKillMasks_AVX2( const fltx4 *pAlpha, size_t nAlphaStride, const fltx4 *pAlpha2, size_t nAlpha2Stride,
+													 fltx4 fl4MinAlpha, int nBlocks, uint8 *pMasksOut )
+{
+	__m256 minAlpha = COMBINE_BLOCKS( fl4MinAlpha, fl4MinAlpha );
+
+	int nAny = 0;
+	int i = 0;
+	for ( ; i + 2 <= nBlocks; i += 2 )
+	{
+		__m256 alpha = _mm256_mul_ps( LOAD_TWO_BLOCKS( pAlpha, nAlphaStride ), LOAD_TWO_BLOCKS( pAlpha2, nAlpha2Stride ) );
+		int nMask = _mm256_movemask_ps( _mm256_cmp_ps( alpha, minAlpha, _CMP_LE_OQ ) );
+		pMasksOut[i] = (uint8)( nMask & 0xf );
+		pMasksOut[i + 1] = (uint8)( nMask >> 4 );
+		nAny |= nMask;
+
+		pAlpha += 2 * nAlphaStride;
+		pAlpha2 += 2 * nAlpha2Stride;
+	}
+
+	if ( i < nBlocks )
+	{
+		nAny |= AlphaKillMasks_SSE( pAlpha, nAlphaStride, pAlpha2, nAlpha2Stride, fl4MinAlpha, nBlocks - i, pMasksOut + i );
+	}
+	return nAny != 0;
+}
+
+#undef LOAD_TWO_BLOCKS
+#undef COMBINE_BLOCKS
+#endif // PARTICLE_SIMD_HAS_AVX2
+
+
+//-----------------------------------------------------------------------------
+// Dispatch
+//-----------------------------------------------------------------------------
+static const ParticleSIMDKernels_t s_SSEKernels =
+{
+	IntegrateMovement_SSE,
+	LifespanKillMasks_SSE,
+	AlphaKillMasks_SSE,
+	"sse",
+};
+
+#if PARTICLE_SIMD_HAS_AVX2
+static const ParticleSIMDKernels_t s_AVX2Kernels =
+{
+	IntegrateMovement_AVX2,
+	LifespanKillMasks_AVX2,
+	AlphaKillMasks_AVX2,
+	"avx2",
+};
+#endif
+
+bool ParticleSIMDKernelsSupportAVX2()
+{
+#if PARTICLE_SIMD_HAS_AVX2
+	return GetCPUInformation().m_bAVX2;
+#else
+	return false;
+#endif
+}
+
+const ParticleSIMDKernels_t &GetParticleSIMDKernels( bool bAllowAVX2 )
+{
+#if PARTICLE_SIMD_HAS_AVX2
+	static bool s_bAVX2 = ParticleSIMDKernelsSupportAVX2();
+	if ( s_bAVX2 && bAllowAVX2 )
+		return s_AVX2Kernels;
+#endif
+	return s_SSEKernels;
+}
+
+// Set by the benchmark to time one kernel set regardless of particle_simd_avx2
+static const ParticleSIMDKernels_t *s_pForcedKernels;
+
+const ParticleSIMDKernels_t &GetParticleSIMDKernels()
+{
+	if ( s_pForcedKernels )
+		return *s_pForcedKernels;
+	return GetParticleSIMDKernels( particle_simd_avx2.GetBool() );
+}
+
+void KillParticlesFromMasks( CParticleCollection *pParticles, const uint8 *pMasks, int nBlocks )
+{
+	for ( int i = 0; i < nBlocks; ++i )
+	{
+		int nMask = pMasks[i];
+		if ( !nMask )
+			continue;
+
+		int nParticle = i << 2;
+		if ( nMask & 1 )
+			pParticles->KillParticle( nParticle );
+		if ( nMask & 2 )
+			pParticles->KillParticle( nParticle + 1 );
+		if ( nMask & 4 )
+			pParticles->KillParticle( nParticle + 2 );
+		if ( nMask & 8 )
+			pParticles->KillParticle( nParticle + 3 );
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Benchmark: simulates particle systems from the loaded .pcf files with no
+// renderer attached, once per kernel set, and checks that the 8-wide kernels
+// agree with the 4-wide ones on synthetic data.
+//-----------------------------------------------------------------------------
+static const char *s_pDefaultBenchmarkSystems[] =
+{
+	"explosion_smokegrenade",
+	"molotov_groundfire",
+	"impact_metal",
+};
+
+static float CompareKernelSets( const ParticleSIMDKernels_t &a, const ParticleSIMDKernels_t &b, int *pMaskMismatches )
+{
+	const int nBlocks = 63;	// odd, so the 4-wide tail of the 8-wide kernels is exercised too
+	CUtlVector< FourVectors > xyz, prevA, prevB, accel;
+	CUtlVector< fltx4 > creation, life;
+	xyz.SetCount( nBlocks ); prevA.SetCount( nBlocks ); prevB.SetCount( nBlocks ); accel.SetCount( nBlocks );
+	creation.SetCount( nBlocks ); life.SetCount( nBlocks );
+
+	for ( int i = 0; i < nBlocks; ++i )
+	{
+		for ( int nComp = 0; nComp < 3; ++nComp )
+		{
+			for ( int j = 0; j < 4; ++j )
+			{
+				SubFloat( xyz[i][nComp], j ) = RandomFloat( -512.0f, 512.0f );
+				SubFloat( prevA[i][nComp], j ) = SubFloat( xyz[i][nComp], j ) + RandomFloat( -8.0f, 8.0f );
+				SubFloat( accel[i][nComp], j ) = RandomFloat( -800.0f, 800.0f );
+			}
+		}
+		for ( int j = 0; j < 4; ++j )
+		{
+			SubFloat( creation[i], j ) = RandomFloat( 0.0f, 4.0f );
+			SubFloat( life[i], j ) = RandomFloat( -0.5f, 3.0f );
+		}
+		prevB[i] = prevA[i];
+	}
+
+	fltx4 fl4AdjDt = ReplicateX4( 0.98f );
+	fltx4 fl4DtSq = ReplicateX4( ( 1.0f / 64.0f ) * ( 1.0f / 64.0f ) );
+	a.m_pfnIntegrateMovement( xyz.Base(), 1, prevA.Base(), 1, accel.Base(), 1, fl4AdjDt, fl4DtSq, nBlocks );
+	b.m_pfnIntegrateMovement( xyz.Base(), 1, prevB.Base(), 1, accel.Base(), 1, fl4AdjDt, fl4DtSq, nBlocks );
+
+	float flMaxDelta = 0.0f;
+	for ( int i = 0; i < nBlocks; ++i )
+	{
+		for ( int nComp = 0; nComp < 3; ++nComp )
+		{
+			for ( int j = 0; j < 4; ++j )
+			{
+				flMaxDelta = MAX( flMaxDelta, fabs( SubFloat( prevA[i][nComp], j ) - SubFloat( prevB[i][nComp], j ) ) );
+			}
+		}
+	}
+
+	uint8 masksA[nBlocks], masksB[nBlocks];
+	fltx4 fl4CurTime = ReplicateX4( 2.0f );
+	a.m_pfnLifespanKillMasks( creation.Base(), 1, life.Base(), 1, fl4CurTime, nBlocks, masksA );
+	b.m_pfnLifespanKillMasks( creation.Base(), 1, life.Base(), 1, fl4CurTime, nBlocks, masksB );
+	*pMaskMismatches = 0;
+	for ( int i = 0; i < nBlocks; ++i )
+	{
+		*pMaskMismatches += ( masksA[i] != masksB[i] );
+	}
+
+	fltx4 fl4MinAlpha = ReplicateX4( 1.0f );
+	a.m_pfnAlphaKillMasks( creation.Base(), 1, life.Base(), 1, fl4MinAlpha, nBlocks, masksA );
+	b.m_pfnAlphaKillMasks( creation.Base(), 1, life.Base(), 1, fl4MinAlpha, nBlocks, masksB );
+	for ( int i = 0; i < nBlocks; ++i )
+	{
+		*pMaskMismatches += ( masksA[i] != masksB[i] );
+	}
+
+	return flMaxDelta;
+}
+
+static int CountActiveParticles( CParticleCollection *pCollection )
+{
+	int nActive = pCollection->m_nActiveParticles;
+	for( CParticleCollection *i = pCollection->m_Children.m_pHead; i; i=i->m_pNext )
+	{
+		nActive += CountActiveParticles( i );
+	}
+	return nActive;
+}
+
+static void BenchmarkParticleSystem( const char *pSystemName, int nFrames, const ParticleSIMDKernels_t &kernels )
+{
+	const float flDt = 1.0f / 64.0f;
+
+	CParticleCollection *pCollection = g_pParticleSystemMgr->CreateParticleCollection( pSystemName, 0.0f, 1 );
+	if ( !pCollection )
+		return;
+
+	// the CS systems only read the first couple of control points; put them all at the origin, z up
+	for ( int i = 0; i < 4; ++i )
+	{
+		pCollection->SetControlPoint( i, vec3_origin );
+		pCollection->SetControlPointOrientation( i, Vector( 1, 0, 0 ), Vector( 0, -1, 0 ), Vector( 0, 0, 1 ) );
+	}
+
+	s_pForcedKernels = &kernels;
+
+	int64 nParticleFrames = 0;
+	int nPeakParticles = 0;
+	double flStart = Plat_FloatTime();
+	for ( int i = 0; i < nFrames; ++i )
+	{
+		pCollection->Simulate( flDt );
+
+		int nActive = CountActiveParticles( pCollection );
+		nParticleFrames += nActive;
+		nPeakParticles = MAX( nPeakParticles, nActive );
+	}
+	double flElapsed = Plat_FloatTime() - flStart;
+
+	s_pForcedKernels = NULL;
+	delete pCollection;
+
+	double flMs = flElapsed * 1000.0;
+	Msg( "  %-28s %-5s %7.3f ms/frame  peak %5d  %9.0f particles/ms\n",
+		pSystemName, kernels.m_pName, flMs / nFrames, nPeakParticles, flMs > 0.0 ? nParticleFrames / flMs : 0.0 );
+}
+
+CON_COMMAND_F( particle_simd_benchmark, "Simulate particle systems without rendering and compare the SIMD kernel sets. Usage: particle_simd_benchmark [frames=640] [system ...]", FCVAR_CHEAT )
+{
+	if ( !g_pParticleSystemMgr )
+		return;
+
+	int nFrames = ( args.ArgC() > 1 ) ? MAX( 1, atoi( args[1] ) ) : 640;
+
+	CUtlVector< const char * > systems;
+	for ( int i = 2; i < args.ArgC(); ++i )
+	{
+		systems.AddToTail( args[i] );
+	}
+	if ( !systems.Count() )
+	{
+		systems.AddMultipleToTail( ARRAYSIZE( s_pDefaultBenchmarkSystems ), s_pDefaultBenchmarkSystems );
+	}
+
+	const ParticleSIMDKernels_t &sse = GetParticleSIMDKernels( false );
+	const ParticleSIMDKernels_t &best = GetParticleSIMDKernels( true );
+
+	if ( &sse != &best )
+	{
+		int nMaskMismatches;
+		float flMaxDelta = CompareKernelSets( sse, best, &nMaskMismatches );
+		Msg( "Kernel check (%s vs %s): max position delta %g, kill mask mismatches %d\n", sse.m_pName, best.m_pName, flMaxDelta, nMaskMismatches );
+	}
+	else
+	{
+		Msg( "AVX2 kernels unavailable on this CPU; timing %s only\n", sse.m_pName );
+	}
+
+	Msg( "Simulating %d frames at 64Hz per system:\n", nFrames );
+	for ( int i = 0; i < systems.Count(); ++i )
+	{
+		if ( !g_pParticleSystemMgr->FindParticleSystem( systems[i] ) )
+		{
+			Warning( "  %s: no such particle system (is its .pcf loaded?)\n", systems[i] );
+			continue;
+		}
+
+		BenchmarkParticleSystem( systems[i], nFrames, sse );
+		if ( &sse != &best )
+		{
+			BenchmarkParticleSystem( systems[i], nFrames, best );
+		}
+	}
+}
@@ -7,6 +7,7 @@
 #include <algorithm>
 #include "tier0/platform.h"
 #include "tier0/vprof.h"
+#include "tier1/convar.h"
 #include "particles/particles.h"
 #include "particles_internal.h"
 #include "bitmap/psheet.h"
@@ -155,6 +156,218 @@ static bool SortLessFunc( const ParticleRenderData_t &left, const ParticleRender
 	
 }
 
+static bool SortLessFuncExtended( ParticleFullRenderData_Scalar_View * const &left, const ParticleFullRenderData_Scalar_View * const &right )
+{
+	return left->m_nSortKey < right->m_nSortKey;
+	
+}
+
+
+//-----------------------------------------------------------------------------
+// Depth sort. The sort keys are squared distances compared as ints, so they
+// can be radix sorted directly: flipping the sign bit makes the unsigned order
+// match the signed compare the heap sort used. The result is a permutation
+// ordered by ( key, particle index ), i.e. a stable sort.
+//
+// Last frame's permutation is cached on the collection. When the camera has
+// barely moved it is used as the starting point for an insertion sort, which
+// finishes in close to linear time while smoke drifts slowly. If the order has
+// degraded too much to be worth fixing up, we fall back to the radix sort.
+// Both paths produce exactly the same order.
+//-----------------------------------------------------------------------------
+static ConVar particle_sort_radix( "particle_sort_radix", "1", 0, "Depth sort particle render lists with a stable radix sort instead of a heap sort." );
+static ConVar particle_sort_coherence( "particle_sort_coherence", "1", 0, "Start particle depth sorts from last frame's order when the camera has barely moved." );
+static ConVar particle_sort_coherence_dist( "particle_sort_coherence_dist", "16", 0, "Camera movement, in units, beyond which last frame's particle sort order is discarded." );
+
+#define SORT_RADIX_BITS 11
+#define SORT_RADIX_BUCKETS ( 1 << SORT_RADIX_BITS )
+#define SORT_RADIX_PASSES 3		// 3 x 11 bits covers the 32 bit key
+
+// insertion sort gives up once it has moved this many elements per particle
+#define SORT_COHERENT_MAX_MOVES_PER_PARTICLE 4
+
+static uint32 s_SortKeys[ MAX_PARTICLES_IN_A_SYSTEM + 4 ];
+static uint16 s_SortOrder[ MAX_PARTICLES_IN_A_SYSTEM + 4 ];
+static uint16 s_SortOrderTemp[ MAX_PARTICLES_IN_A_SYSTEM + 4 ];
+static ALIGN16 ParticleRenderData_t s_SortRecordTemp[ MAX_PARTICLES_IN_A_SYSTEM + 4 ] ALIGN16_POST;
+static void *s_pSortPtrTemp[ MAX_PARTICLES_IN_A_SYSTEM + 4 ];
+
+struct ParticleSortStats_t
+{
+	int m_nSorts;
+	int m_nCoherentSorts;
+	int m_nRadixSorts;
+};
+static ParticleSortStats_t s_SortStats;
+
+FORCEINLINE uint32 ParticleSortKey( int nSortKey )
+{
+	return (uint32)nSortKey ^ 0x80000000;
+}
+
+static void RadixSortIndices( const uint32 *pKeys, int nCount, uint16 *pOrder, uint16 *pTemp )
+{
+	uint32 nHistogram[ SORT_RADIX_PASSES ][ SORT_RADIX_BUCKETS ];
+	memset( nHistogram, 0, sizeof( nHistogram ) );
+	for ( int i = 0; i < nCount; ++i )
+	{
+		uint32 nKey = pKeys[i];
+		nHistogram[0][ nKey & ( SORT_RADIX_BUCKETS - 1 ) ]++;
+		nHistogram[1][ ( nKey >> SORT_RADIX_BITS ) & ( SORT_RADIX_BUCKETS - 1 ) ]++;
+		nHistogram[2][ nKey >> ( 2 * SORT_RADIX_BITS ) ]++;
+		pOrder[i] = i;
+	}
+
+	uint16 *pSrc = pOrder;
+	uint16 *pDst = pTemp;
+	for ( int nPass = 0; nPass < SORT_RADIX_PASSES; ++nPass )
+	{
+		int nShift = nPass * SORT_RADIX_BITS;
+		uint32 *pHist = nHistogram[nPass];
+
+		// every key has the same digit - this pass wouldn't change anything
+		if ( pHist[ ( pKeys[0] >> nShift ) & ( SORT_RADIX_BUCKETS - 1 ) ] == (uint32)nCount )
+			continue;
+
+		uint32 nSum = 0;
+		for ( int i = 0; i < SORT_RADIX_BUCKETS; ++i )
+		{
+			uint32 nBucket = pHist[i];
+			pHist[i] = nSum;
+			nSum += nBucket;
+		}
+		for ( int i = 0; i < nCount; ++i )
+		{
+			uint16 nIndex = pSrc[i];
+			pDst[ pHist[ ( pKeys[nIndex] >> nShift ) & ( SORT_RADIX_BUCKETS - 1 ) ]++ ] = nIndex;
+		}
+		V_swap( pSrc, pDst );
+	}
+
+	if ( pSrc != pOrder )
+	{
+		memcpy( pOrder, pSrc, nCount * sizeof( uint16 ) );
+	}
+}
+
+FORCEINLINE bool SortIndexLess( const uint32 *pKeys, uint16 nLeft, uint16 nRight )
+{
+	return ( pKeys[nLeft] < pKeys[nRight] ) || ( ( pKeys[nLeft] == pKeys[nRight] ) && ( nLeft < nRight ) );
+}
+
+// Rebuilds last frame's order for the current particle set and insertion sorts it.
+// Returns false if it would take too much work, leaving pOrder undefined.
+static bool CoherentSortIndices( const uint32 *pKeys, int nCount, const CUtlVector< uint16 > &lastOrder, uint16 *pOrder, uint16 *pSeen )
+{
+	// particles that were killed left their slot to a moved particle, and new particles
+	// were appended past the old count; both just show up as out of order entries
+	memset( pSeen, 0, nCount * sizeof( uint16 ) );
+	int nOut = 0;
+	for ( int i = 0; i < lastOrder.Count(); ++i )
+	{
+		uint16 nIndex = lastOrder[i];
+		if ( nIndex < nCount && !pSeen[nIndex] )
+		{
+			pSeen[nIndex] = 1;
+			pOrder[nOut++] = nIndex;
+		}
+	}
+	for ( int i = 0; i < nCount; ++i )
+	{
+		if ( !pSeen[i] )
+		{
+			pOrder[nOut++] = i;
+		}
+	}
+	Assert( nOut == nCount );
+
+	int nMovesLeft = SORT_COHERENT_MAX_MOVES_PER_PARTICLE * nCount;
+	for ( int i = 1; i < nCount; ++i )
+	{
+		uint16 nIndex = pOrder[i];
+		int j = i;
+		while ( j > 0 && SortIndexLess( pKeys, nIndex, pOrder[j - 1] ) )
+		{
+			pOrder[j] = pOrder[j - 1];
+			--j;
+		}
+		pOrder[j] = nIndex;
+		nMovesLeft -= i - j;
+		if ( nMovesLeft < 0 )
+			return false;
+	}
+	return true;
+}
+
+// Fills s_SortOrder with the sorted permutation of s_SortKeys[0..nCount)
+static void SortParticleKeys( CParticleCollection *pParticles, int nCount, const Vector &vecCamera )
+{
+	++s_SortStats.m_nSorts;
+
+	bool bSorted = false;
+	float flMaxDist = particle_sort_coherence_dist.GetFloat();
+	if ( particle_sort_coherence.GetBool() && pParticles->m_LastSortOrder.Count() &&
+		 vecCamera.DistToSqr( pParticles->m_vecLastSortCamera ) <= flMaxDist * flMaxDist )
+	{
+		bSorted = CoherentSortIndices( s_SortKeys, nCount, pParticles->m_LastSortOrder, s_SortOrder, s_SortOrderTemp );
+		s_SortStats.m_nCoherentSorts += bSorted;
+	}
+	if ( !bSorted )
+	{
+		RadixSortIndices( s_SortKeys, nCount, s_SortOrder, s_SortOrderTemp );
+		++s_SortStats.m_nRadixSorts;
+	}
+
+	pParticles->m_LastSortOrder.CopyArray( s_SortOrder, nCount );
+	pParticles->m_vecLastSortCamera = vecCamera;
+}
+
+static void SortRenderData( CParticleCollection *pParticles, ParticleRenderData_t *pData, int nCount, const Vector &vecCamera )
+{
+	if ( !particle_sort_radix.GetBool() )
+	{
+		pParticles->m_LastSortOrder.RemoveAll();
+		std::make_heap( pData, pData + nCount, SortLessFunc );
+		std::sort_heap( pData, pData + nCount, SortLessFunc );
+		return;
+	}
+
+	for ( int i = 0; i < nCount; ++i )
+	{
+		s_SortKeys[i] = ParticleSortKey( TREATASINT( pData[i].m_flSortKey ) );
+	}
+	SortParticleKeys( pParticles, nCount, vecCamera );
+
+	memcpy( s_SortRecordTemp, pData, nCount * sizeof( ParticleRenderData_t ) );
+	for ( int i = 0; i < nCount; ++i )
+	{
+		pData[i] = s_SortRecordTemp[ s_SortOrder[i] ];
+	}
+}
+
+template< class T > static void SortExtendedRenderData( CParticleCollection *pParticles, T **ppData, int nCount, const Vector &vecCamera )
+{
+	if ( !particle_sort_radix.GetBool() )
+	{
+		pParticles->m_LastSortOrder.RemoveAll();
+		std::make_heap( ppData, ppData + nCount, SortLessFuncExtended );
+		std::sort_heap( ppData, ppData + nCount, SortLessFuncExtended );
+		return;
+	}
+
+	for ( int i = 0; i < nCount; ++i )
+	{
+		s_SortKeys[i] = ParticleSortKey( ppData[i]->m_nSortKey );
+	}
+	SortParticleKeys( pParticles, nCount, vecCamera );
+
+	memcpy( s_pSortPtrTemp, ppData, nCount * sizeof( T * ) );
+	for ( int i = 0; i < nCount; ++i )
+	{
+		ppData[i] = reinterpret_cast< T * >( s_pSortPtrTemp[ s_SortOrder[i] ] );
+	}
+}
+
 
 int CParticleCollection::GenerateSortedIndexList( ParticleRenderData_t *pOut, Vector vecCamera, CParticleVisibilityData *pVisibilityData, bool bSorted )
 {
@@ -171,8 +384,7 @@ int CParticleCollection::GenerateSortedIndexList( ParticleRenderData_t *pOut, Ve
 	if ( bSorted )
 	{
 		// sort the output in place
-		std::make_heap( pOut, pOut + nParticles, SortLessFunc );
-		std::sort_heap( pOut, pOut + nParticles, SortLessFunc );
+		SortRenderData( this, pOut, nParticles, vecCamera );
 	}
 	return nParticles;
 }
@@ -194,8 +406,7 @@ int CParticleCollection::GenerateCulledSortedIndexList(
 	if ( bSorted )
 	{
 		// sort the output in place
-		std::make_heap( pOut, pOut + nParticles, SortLessFunc );
-		std::sort_heap( pOut, pOut + nParticles, SortLessFunc );
+		SortRenderData( this, pOut, nParticles, vecCamera );
 	}
 #endif
 	return nParticles;
@@ -457,12 +668,6 @@ void s_GenerateExtendedData(
 
 
 
-static bool SortLessFuncExtended( ParticleFullRenderData_Scalar_View * const &left, const ParticleFullRenderData_Scalar_View * const &right )
-{
-	return left->m_nSortKey < right->m_nSortKey;
-	
-}
-
 int GenerateExtendedSortedIndexList( Vector vecCamera, Vector *pCameraFwd, CParticleVisibilityData *pVisibilityData, 
 									 CParticleCollection *pParticles, bool bSorted, void *pOutBuf, 
 									 ParticleFullRenderData_Scalar_View **pParticlePtrs )
@@ -483,8 +688,7 @@ int GenerateExtendedSortedIndexList( Vector vecCamera, Vector *pCameraFwd, CPart
 	if ( bSorted )
 	{
 		// sort the output in place
-		std::make_heap( pParticlePtrs, pParticlePtrs + nParticles, SortLessFuncExtended );
-		std::sort_heap( pParticlePtrs, pParticlePtrs + nParticles, SortLessFuncExtended );
+		SortExtendedRenderData( pParticles, pParticlePtrs, nParticles, vecCamera );
 	}
 	return nParticles;
 }
@@ -512,8 +716,7 @@ int GenerateExtendedSortedIndexListWithPerParticleGlow(
 	if ( bSorted )
 	{
 		// sort the output in place
-		std::make_heap( pParticlePtrs, pParticlePtrs + nParticles, SortLessFuncExtended );
-		std::sort_heap( pParticlePtrs, pParticlePtrs + nParticles, SortLessFuncExtended );
+		SortExtendedRenderData( pParticles, pParticlePtrs, nParticles, vecCamera );
 	}
 	return nParticles;
 }
@@ -541,8 +744,7 @@ int GenerateExtendedSortedIndexListWithNormals(
 	if ( bSorted )
 	{
 		// sort the output in place
-		std::make_heap( pParticlePtrs, pParticlePtrs + nParticles, SortLessFuncExtended );
-		std::sort_heap( pParticlePtrs, pParticlePtrs + nParticles, SortLessFuncExtended );
+		SortExtendedRenderData( pParticles, pParticlePtrs, nParticles, vecCamera );
 	}
 	return nParticles;
 }
@@ -604,3 +806,168 @@ ParticleRenderDataWithNormal_Scalar_View **GetExtendedRenderListWithNormals(
 	*pNparticles = nParticles;
 	return ( ParticleRenderDataWithNormal_Scalar_View ** ) ( s_pParticlePtrs + nParticles );
 }
+
+
+//-----------------------------------------------------------------------------
+// Sort benchmark: records particle positions from a simulated system (smoke by
+// default) and replays them against a slowly orbiting camera, timing the heap
+// sort, the radix sort and the coherent sort on identical keys.
+//-----------------------------------------------------------------------------
+struct ParticleSortSnapshot_t
+{
+	CUtlVector< Vector > m_Positions;
+};
+
+static void RecordParticlePositions( CParticleCollection *pCollection, const Vector &vecOffset, CUtlVector< Vector > &positions )
+{
+	for ( int i = 0; i < pCollection->m_nActiveParticles && positions.Count() < MAX_PARTICLES_IN_A_SYSTEM; ++i )
+	{
+		const float *pXYZ = pCollection->GetFloatAttributePtr( PARTICLE_ATTRIBUTE_XYZ, i );
+		positions.AddToTail( Vector( pXYZ[0], pXYZ[4], pXYZ[8] ) + vecOffset );
+	}
+	for( CParticleCollection *i = pCollection->m_Children.m_pHead; i; i=i->m_pNext )
+	{
+		RecordParticlePositions( i, vecOffset, positions );
+	}
+}
+
+static void BuildSortKeys( const ParticleSortSnapshot_t &snapshot, const Vector &vecCamera )
+{
+	for ( int i = 0; i < snapshot.m_Positions.Count(); ++i )
+	{
+		float flDistSqr = vecCamera.DistToSqr( snapshot.m_Positions[i] );
+		s_SortKeys[i] = ParticleSortKey( TREATASINT( flDistSqr ) );
+	}
+}
+
+CON_COMMAND_F( particle_sort_benchmark, "Compare particle depth sorts on recorded particle snapshots. Usage: particle_sort_benchmark [system=explosion_smokegrenade] [frames=256] [copies=4]", FCVAR_CHEAT )
+{
+	if ( !g_pParticleSystemMgr )
+		return;
+
+	const char *pSystemName = ( args.ArgC() > 1 ) ? args[1] : "explosion_smokegrenade";
+	int nFrames = ( args.ArgC() > 2 ) ? MAX( 1, atoi( args[2] ) ) : 256;
+	int nCopies = ( args.ArgC() > 3 ) ? clamp( atoi( args[3] ), 1, 16 ) : 4;
+
+	if ( !g_pParticleSystemMgr->FindParticleSystem( pSystemName ) )
+	{
+		Warning( "particle_sort_benchmark: no such particle system %s (is its .pcf loaded?)\n", pSystemName );
+		return;
+	}
+
+	// record: several overlapping copies of the system, merged into one list per frame
+	CUtlVector< CParticleCollection * > collections;
+	for ( int i = 0; i < nCopies; ++i )
+	{
+		CParticleCollection *pCollection = g_pParticleSystemMgr->CreateParticleCollection( pSystemName, 0.0f, i + 1 );
+		if ( !pCollection )
+			continue;
+		pCollection->SetControlPoint( 0, vec3_origin );
+		pCollection->SetControlPointOrientation( 0, Vector( 1, 0, 0 ), Vector( 0, -1, 0 ), Vector( 0, 0, 1 ) );
+		collections.AddToTail( pCollection );
+	}
+
+	CUtlVector< ParticleSortSnapshot_t > snapshots;
+	snapshots.SetCount( nFrames );
+	int64 nTotalParticles = 0;
+	for ( int nFrame = 0; nFrame < nFrames; ++nFrame )
+	{
+		for ( int i = 0; i < collections.Count(); ++i )
+		{
+			collections[i]->Simulate( 1.0f / 64.0f );
+			RecordParticlePositions( collections[i], Vector( 48.0f * i, 24.0f * ( i & 1 ), 0 ), snapshots[nFrame].m_Positions );
+		}
+		nTotalParticles += snapshots[nFrame].m_Positions.Count();
+	}
+	collections.PurgeAndDeleteElements();
+
+	if ( !nTotalParticles )
+	{
+		Warning( "particle_sort_benchmark: %s produced no particles\n", pSystemName );
+		return;
+	}
+
+	// replay: camera orbits the smoke slowly, about 2 units per frame
+	CUtlVector< Vector > cameraPath;
+	cameraPath.SetCount( nFrames );
+	for ( int nFrame = 0; nFrame < nFrames; ++nFrame )
+	{
+		float flAngle = nFrame * ( 2.0f / 300.0f );
+		cameraPath[nFrame].Init( 300.0f * cosf( flAngle ), 300.0f * sinf( flAngle ), 64.0f );
+	}
+
+	CFastTimer timer;
+	uint64 nHeapCycles = 0, nRadixCycles = 0, nCoherentCycles = 0;
+	int nMismatches = 0, nCoherentHits = 0;
+	CUtlVector< uint16 > lastOrder;
+	static uint16 s_RadixResult[ MAX_PARTICLES_IN_A_SYSTEM + 4 ];
+
+	for ( int nFrame = 0; nFrame < nFrames; ++nFrame )
+	{
+		const ParticleSortSnapshot_t &snapshot = snapshots[nFrame];
+		int nCount = snapshot.m_Positions.Count();
+		if ( !nCount )
+		{
+			lastOrder.RemoveAll();
+			continue;
+		}
+		BuildSortKeys( snapshot, cameraPath[nFrame] );
+
+		// heap sort, as GetRenderList used to do it
+		ParticleRenderData_t *pRecords = s_SortRecordTemp;
+		for ( int i = 0; i < nCount; ++i )
+		{
+			int nKey = (int)( s_SortKeys[i] ^ 0x80000000 );
+			pRecords[i].m_flSortKey = *reinterpret_cast< float * >( &nKey );
+			pRecords[i].m_nIndex = i;
+		}
+		timer.Start();
+		std::make_heap( pRecords, pRecords + nCount, SortLessFunc );
+		std::sort_heap( pRecords, pRecords + nCount, SortLessFunc );
+		timer.End();
+		nHeapCycles += timer.GetDuration().GetLongCycles();
+
+		timer.Start();
+		RadixSortIndices( s_SortKeys, nCount, s_RadixResult, s_SortOrderTemp );
+		timer.End();
+		nRadixCycles += timer.GetDuration().GetLongCycles();
+
+		// heap sort isn't stable, so only the key sequence has to match it
+		for ( int i = 0; i < nCount; ++i )
+		{
+			if ( ParticleSortKey( TREATASINT( pRecords[i].m_flSortKey ) ) != s_SortKeys[ s_RadixResult[i] ] )
+			{
+				++nMismatches;
+				break;
+			}
+		}
+
+		timer.Start();
+		bool bCoherent = lastOrder.Count() && CoherentSortIndices( s_SortKeys, nCount, lastOrder, s_SortOrder, s_SortOrderTemp );
+		if ( !bCoherent )
+		{
+			RadixSortIndices( s_SortKeys, nCount, s_SortOrder, s_SortOrderTemp );
+		}
+		timer.End();
+		nCoherentCycles += timer.GetDuration().GetLongCycles();
+		nCoherentHits += bCoherent;
+		lastOrder.CopyArray( s_SortOrder, nCount );
+
+		// both stable sorts must agree exactly
+		if ( memcmp( s_SortOrder, s_RadixResult, nCount * sizeof( uint16 ) ) )
+		{
+			++nMismatches;
+		}
+	}
+
+	CCycleCount heapTime, radixTime, coherentTime;
+	heapTime.Init( nHeapCycles );
+	radixTime.Init( nRadixCycles );
+	coherentTime.Init( nCoherentCycles );
+	Msg( "%s x%d: %d frames, %.0f particles/frame on average\n", pSystemName, nCopies, nFrames, (float)nTotalParticles / nFrames );
+	Msg( "  heap sort      %8.2f us/frame\n", heapTime.GetMicrosecondsF() / nFrames );
+	Msg( "  radix sort     %8.2f us/frame\n", radixTime.GetMicrosecondsF() / nFrames );
+	Msg( "  coherent sort  %8.2f us/frame (%d of %d frames reused the previous order)\n", coherentTime.GetMicrosecondsF() / nFrames, nCoherentHits, nFrames );
+	Msg( "  %d mismatched frames\n", nMismatches );
+	Msg( "Render list sorts since startup: %d (%d coherent, %d radix)\n", s_SortStats.m_nSorts, s_SortStats.m_nCoherentSorts, s_SortStats.m_nRadixSorts );
+}
@@ -53,6 +53,36 @@ struct CWorldCollideContextData
 						  Vector const *pCpOffset = NULL, float flMovementTolerance = 0.  );
 };
 
+//-----------------------------------------------------------------------------
+// Hot operator kernels (particle_kernels.cpp). The default set is plain fltx4
+// code; on CPUs with AVX2 and FMA the 8-wide set is used instead unless
+// particle_simd_avx2 is 0. Strides are in units of the pointed-to type, as
+// returned by the CParticleCollection attribute accessors.
+//-----------------------------------------------------------------------------
+struct ParticleSIMDKernels_t
+{
+	// Verlet step for C_OP_BasicMovement: prev = xyz + accel * dt^2 + adjdt * ( xyz - prev )
+	void ( *m_pfnIntegrateMovement )( FourVectors *pXYZ, size_t nXYZStride, FourVectors *pPrevXYZ, size_t nPrevStride,
+									  const FourVectors *pAccel, size_t nAccelStride, fltx4 fl4AdjDt, fltx4 fl4DtSq, int nBlocks );
+
+	// Writes a 4 bit kill mask per block, set where age >= duration or duration <= 0. Returns true if any bit is set.
+	bool ( *m_pfnLifespanKillMasks )( const fltx4 *pCreationTime, size_t nCreationStride, const fltx4 *pLifeDuration, size_t nLifeStride,
+									  fltx4 fl4CurTime, int nBlocks, uint8 *pMasksOut );
+
+	// Writes a 4 bit kill mask per block, set where alpha * alpha2 <= min alpha. Returns true if any bit is set.
+	bool ( *m_pfnAlphaKillMasks )( const fltx4 *pAlpha, size_t nAlphaStride, const fltx4 *pAlpha2, size_t nAlpha2Stride,
+								   fltx4 fl4MinAlpha, int nBlocks, uint8 *pMasksOut );
+
+	const char *m_pName;
+};
+
+const ParticleSIMDKernels_t &GetParticleSIMDKernels();
+const ParticleSIMDKernels_t &GetParticleSIMDKernels( bool bAllowAVX2 );
+bool ParticleSIMDKernelsSupportAVX2();
+
+// Calls KillParticle for every bit set in the per-block masks, in particle order
+void KillParticlesFromMasks( CParticleCollection *pParticles, const uint8 *pMasks, int nBlocks );
+
 // This is defined in the owner DLL
 extern bool UTIL_IsDedicatedServer( void );
 
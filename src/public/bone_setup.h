@@ -458,6 +458,66 @@ memhandle_t Studio_CreateBoneCache( bonecacheparams_t &params );
 void Studio_DestroyBoneCache( memhandle_t cacheHandle );
 void Studio_InvalidateBoneCacheIfNotMatching( memhandle_t cacheHandle, float flTimeValid );
 
+// Counters for the shared pose cache (anim_pose_cache)
+struct posecachestats_t
+{
+	int m_nLookups;
+	int m_nHits;
+	int m_nInserts;
+	int m_nEvictions;
+	int m_nEntries;
+	unsigned int m_nUsedBytes;
+	unsigned int m_nBudgetBytes;
+	int m_nEvaluations;			// sequence poses evaluated, cached or not
+	double m_flEvaluationTime;	// seconds spent evaluating them
+};
+
+void Studio_GetPoseCacheStats( posecachestats_t &stats );
+void Studio_ResetPoseCacheStats();
+void Studio_FlushPoseCache();
+bool Studio_PoseCacheStatsEnabled();		// anim_pose_cache_stats: time pose evaluation and bone setup
+
+// Event count and cycle total kept per thread, so bone setup jobs timing themselves
+// never write to a shared cache line. Each slot is only written by its own thread.
+class CPerThreadCycleCounter
+{
+public:
+	CPerThreadCycleCounter() { Reset(); }
+
+	void Add( int64 nCycles )
+	{
+		Slot_t &slot = m_Slots[g_nThreadID];
+		++slot.m_nCount;
+		slot.m_nCycles += nCycles;
+	}
+
+	void Get( int &nCount, int64 &nCycles ) const
+	{
+		int64 nTotalCount = 0;
+		nCycles = 0;
+		for ( int i = 0; i < MAX_THREADS_SUPPORTED; ++i )
+		{
+			nTotalCount += m_Slots[i].m_nCount;
+			nCycles += m_Slots[i].m_nCycles;
+		}
+		nCount = (int)nTotalCount;
+	}
+
+	void Reset()
+	{
+		memset( m_Slots, 0, sizeof( m_Slots ) );
+	}
+
+private:
+	struct Slot_t
+	{
+		int64	m_nCount;
+		int64	m_nCycles;
+		byte	m_Pad[128 - 2 * sizeof( int64 )];
+	};
+	Slot_t m_Slots[MAX_THREADS_SUPPORTED];
+};
+
 // Given a ray, trace for an intersection with this studiomodel.  Get the array of bones from StudioSetupHitboxBones
 bool TraceToStudio( class IPhysicsSurfaceProps *pProps, const Ray_t& ray, CStudioHdr *pStudioHdr, mstudiohitboxset_t *set, matrix3x4_t **hitboxbones, int fContentsMask, const Vector &vecOrigin, float flScale, trace_t &trace );
 // Given a ray, trace for an intersection with this studiomodel, bullets will hit bodyparts that result in higher damage
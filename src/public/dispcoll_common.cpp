@@ -16,6 +16,7 @@
 #include "tier0/fasttimer.h"
 #include "vphysics/virtualmesh.h"
 #include "tier1/datamanager.h"
+#include "tier1/utlbuffer.h"
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
 
@@ -329,26 +330,11 @@ void CDispCollTree::AABBTree_CopyDispData( CCoreDispInfo *pDisp )
 		pSurf->GetPoint( iPoint, m_vecSurfPoints[iPoint] );
 	}
 
-	// Allocate collision tree data.
-	HUNK_ALLOC_CREDIT_( "AABBTree_CopyDispData" );
-	m_aVerts.SetSize( GetSize() );
-	m_aTris.SetSize( GetTriSize() );
-	int numLeaves = (GetWidth()-1) * (GetHeight()-1);
-	m_leaves.SetCount(numLeaves);
-	int numNodes = Nodes_CalcCount( m_nPower );
-	numNodes -= numLeaves;
-	m_nodes.SetCount(numNodes);
-
-	// Setup size.
-	m_nSize = sizeof( this );
-	m_nSize += sizeof( Vector ) * GetSize();
-	m_nSize += sizeof( CDispCollTri ) * GetTriSize();
-#if OLD_DISP_AABB
-	m_nSize += sizeof( CDispCollAABBNode ) * Nodes_CalcCount( m_nPower );
-#endif
-	m_nSize += sizeof(m_nodes[0]) * m_nodes.Count();
-	m_nSize += sizeof(m_leaves[0]) * m_leaves.Count();
-	m_nSize += sizeof( CDispCollTri* ) * DISPCOLL_TREETRI_SIZE;
+	// Allocate collision tree data, unless PreallocateTree already did.
+	if ( m_aVerts.Count() != GetSize() )
+	{
+		AABBTree_AllocData();
+	}
 
 	// Copy vertex data.
 	for ( int iVert = 0; iVert < m_aVerts.Count(); iVert++ )
@@ -423,6 +409,32 @@ void CDispCollTree::AABBTree_CopyDispData( CCoreDispInfo *pDisp )
 	}
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Size the tree arrays for the current power.
+//-----------------------------------------------------------------------------
+void CDispCollTree::AABBTree_AllocData( void )
+{
+	HUNK_ALLOC_CREDIT_( "AABBTree_AllocData" );
+	m_aVerts.SetSize( GetSize() );
+	m_aTris.SetSize( GetTriSize() );
+	int numLeaves = (GetWidth()-1) * (GetHeight()-1);
+	m_leaves.SetCount(numLeaves);
+	int numNodes = Nodes_CalcCount( m_nPower );
+	numNodes -= numLeaves;
+	m_nodes.SetCount(numNodes);
+
+	// Setup size.
+	m_nSize = sizeof( this );
+	m_nSize += sizeof( Vector ) * GetSize();
+	m_nSize += sizeof( CDispCollTri ) * GetTriSize();
+#if OLD_DISP_AABB
+	m_nSize += sizeof( CDispCollAABBNode ) * Nodes_CalcCount( m_nPower );
+#endif
+	m_nSize += sizeof(m_nodes[0]) * m_nodes.Count();
+	m_nSize += sizeof(m_leaves[0]) * m_leaves.Count();
+	m_nSize += sizeof( CDispCollTri* ) * DISPCOLL_TREETRI_SIZE;
+}
+
 //-----------------------------------------------------------------------------
 // Purpose:
 //-----------------------------------------------------------------------------
@@ -1473,6 +1485,100 @@ bool CDispCollTree::Create( CCoreDispInfo *pDisp )
 	return AABBTree_Create( pDisp );
 }
 
+//-----------------------------------------------------------------------------
+// Purpose:
+//-----------------------------------------------------------------------------
+void CDispCollTree::PreallocateTree( int nPower )
+{
+	m_nPower = nPower;
+	AABBTree_AllocData();
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Append the tree arrays to the data blob (16-byte aligned) and fill
+//			out the record that locates them.
+//-----------------------------------------------------------------------------
+static int DispCollTree_PutAligned( CUtlBuffer &data, const void *pSrc, int nBytes )
+{
+	static const byte s_Pad[16] = { 0 };
+	int nPad = AlignValue( data.TellPut(), 16 ) - data.TellPut();
+	data.Put( s_Pad, nPad );
+	int nOffset = data.TellPut();
+	data.Put( pSrc, nBytes );
+	return nOffset;
+}
+
+void CDispCollTree::SaveToCache( dispcolltreerecord_t &record, CUtlBuffer &data )
+{
+	memset( &record, 0, sizeof( record ) );
+	record.m_mins = m_mins;
+	record.m_maxs = m_maxs;
+	for ( int iPoint = 0; iPoint < 4; ++iPoint )
+	{
+		record.m_vecSurfPoints[iPoint] = m_vecSurfPoints[iPoint];
+	}
+	record.m_vecStabDir = m_vecStabDir;
+	record.m_nContents = m_nContents;
+	record.m_nPower = m_nPower;
+	record.m_nFlags = m_nFlags;
+	record.m_nVertOffset = DispCollTree_PutAligned( data, m_aVerts.Base(), m_aVerts.Count() * sizeof( Vector ) );
+	record.m_nTriOffset = DispCollTree_PutAligned( data, m_aTris.Base(), m_aTris.Count() * sizeof( CDispCollTri ) );
+	record.m_nNodeOffset = DispCollTree_PutAligned( data, m_nodes.Base(), m_nodes.Count() * sizeof( CDispCollNode ) );
+	record.m_nLeafOffset = DispCollTree_PutAligned( data, m_leaves.Base(), m_leaves.Count() * sizeof( CDispCollLeaf ) );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Rebuild the tree from a cache record instead of a CCoreDispInfo.
+//			Returns false (leaving the tree empty) if the record doesn't fit
+//			the data blob.
+//-----------------------------------------------------------------------------
+bool CDispCollTree::LoadFromCache( const dispcolltreerecord_t &record, const byte *pData, int nDataSize )
+{
+	if ( record.m_nPower < 2 || record.m_nPower > 4 )
+		return false;
+
+	m_nPower = record.m_nPower;
+	int nLeaves = ( GetWidth() - 1 ) * ( GetHeight() - 1 );
+	int nNodes = Nodes_CalcCount( m_nPower ) - nLeaves;
+
+	struct
+	{
+		int m_nOffset;
+		int m_nBytes;
+	} arrays[4] =
+	{
+		{ record.m_nVertOffset, GetSize() * (int)sizeof( Vector ) },
+		{ record.m_nTriOffset, GetTriSize() * (int)sizeof( CDispCollTri ) },
+		{ record.m_nNodeOffset, nNodes * (int)sizeof( CDispCollNode ) },
+		{ record.m_nLeafOffset, nLeaves * (int)sizeof( CDispCollLeaf ) },
+	};
+	for ( int i = 0; i < ARRAYSIZE( arrays ); ++i )
+	{
+		if ( arrays[i].m_nOffset < 0 || ( arrays[i].m_nOffset & 15 ) || arrays[i].m_nOffset + arrays[i].m_nBytes > nDataSize )
+		{
+			m_nPower = 0;
+			return false;
+		}
+	}
+
+	m_mins = record.m_mins;
+	m_maxs = record.m_maxs;
+	for ( int iPoint = 0; iPoint < 4; ++iPoint )
+	{
+		m_vecSurfPoints[iPoint] = record.m_vecSurfPoints[iPoint];
+	}
+	m_vecStabDir = record.m_vecStabDir;
+	m_nContents = record.m_nContents;
+	m_nFlags = record.m_nFlags;
+
+	AABBTree_AllocData();
+	memcpy( m_aVerts.Base(), pData + arrays[0].m_nOffset, arrays[0].m_nBytes );
+	memcpy( m_aTris.Base(), pData + arrays[1].m_nOffset, arrays[1].m_nBytes );
+	memcpy( m_nodes.Base(), pData + arrays[2].m_nOffset, arrays[2].m_nBytes );
+	memcpy( m_leaves.Base(), pData + arrays[3].m_nOffset, arrays[3].m_nBytes );
+	return true;
+}
+
 //-----------------------------------------------------------------------------
 // Purpose:
 //-----------------------------------------------------------------------------
@@ -136,6 +136,26 @@ public:
 	short	m_tris[2];
 };
 
+//=============================================================================
+//	Map load cache record (see engine/mapcache.cpp). Array offsets are byte
+//	offsets into the cache's data section and are 16-byte aligned.
+struct dispcolltreerecord_t
+{
+	Vector	m_mins;
+	Vector	m_maxs;
+	Vector	m_vecSurfPoints[4];
+	Vector	m_vecStabDir;
+	int		m_nContents;
+	int		m_nPower;								// 0 if the tree was never built
+	int		m_nFlags;
+	int		m_nVertOffset;
+	int		m_nTriOffset;
+	int		m_nNodeOffset;
+	int		m_nLeafOffset;
+};
+
+class CUtlBuffer;
+
 // a power 4 displacement can have 341 nodes, pad out to 344 for 16-byte alignment
 const int MAX_DISP_AABB_NODES = 341;
 const int MAX_AABB_LIST = 344;
@@ -162,6 +182,10 @@ public:
 	~CDispCollTree();
 	virtual bool Create( CCoreDispInfo *pDisp );
 
+	// Sizes the tree for a displacement of this power ahead of Create, so Create
+	// can run off the main thread (hunk allocations aren't thread safe).
+	void PreallocateTree( int nPower );
+
 	// Raycasts.
 	// NOTE: These assume you've precalculated invDelta as well as culled to the bounds of this disp
 	bool AABBTree_Ray( const Ray_t &ray, const Vector &invDelta, CBaseTrace *pTrace, bool bSide = true );
@@ -212,6 +236,10 @@ public:
 	void GetVirtualMeshList( struct virtualmeshlist_t *pList );
 	int AABBTree_GetTrisInSphere( const Vector &center, float radius, unsigned short *pIndexOut, int indexMax );
 
+	// Map load cache: flatten the built tree into a record + data blob, or rebuild it from one.
+	void SaveToCache( dispcolltreerecord_t &record, CUtlBuffer &data );
+	bool LoadFromCache( const dispcolltreerecord_t &record, const byte *pData, int nDataSize );
+
 public:
 
 	inline int Nodes_GetChild( int iNode, int nDirection );
@@ -259,6 +287,7 @@ protected:
 
 	bool AABBTree_Create( CCoreDispInfo *pDisp );
 	void AABBTree_CopyDispData( CCoreDispInfo *pDisp );
+	void AABBTree_AllocData( void );
 	void AABBTree_CreateLeafs( void );
 	void AABBTree_GenerateBoxes_r( int nodeIndex, Vector *pMins, Vector *pMaxs );
 	void AABBTree_CalcBounds( void );
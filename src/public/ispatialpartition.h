@@ -20,7 +20,7 @@ struct Ray_t;
 class IHandleEntity;
 
 
-#define INTERFACEVERSION_SPATIALPARTITION	"SpatialPartition001"
+#define INTERFACEVERSION_SPATIALPARTITION	"SpatialPartition002"
 
 //-----------------------------------------------------------------------------
 // These are the various partition lists. Note some are server only, some
@@ -184,6 +184,30 @@ public:
 		IPartitionEnumerator* pIterator
 		) = 0;
 
+	// Batch versions of the box and point queries (fine test only): fill pList
+	// with up to nMaxCount elements and return how many were written
+	virtual int GetElementsInBox(
+		SpatialPartitionListMask_t listMask,
+		const Vector& mins,
+		const Vector& maxs,
+		IHandleEntity **pList,
+		int nMaxCount
+		) = 0;
+
+	virtual int GetElementsAtPoint(
+		SpatialPartitionListMask_t listMask,
+		const Vector& pt,
+		IHandleEntity **pList,
+		int nMaxCount
+		) = 0;
+
+	// Brackets a parallel job that queries the trees holding listMask. Until
+	// EndReadPhase those trees are frozen: queries skip the partition lock and
+	// writes to their elements are queued, then applied by EndReadPhase. Call
+	// both from the thread that writes to the partition, outside any query.
+	virtual void BeginReadPhase( SpatialPartitionListMask_t listMask ) = 0;
+	virtual void EndReadPhase( SpatialPartitionListMask_t listMask ) = 0;
+
 	// For debugging.... suppress queries on particular lists
 	virtual void SuppressLists( SpatialPartitionListMask_t nListMask, bool bSuppress ) = 0;
 	virtual SpatialPartitionListMask_t GetSuppressedLists() = 0;
@@ -2105,6 +2105,9 @@ public:
 	Vector m_Center;										// average of particle centers
 	void *m_pRenderable;									// for use by client
 
+	CUtlVector< uint16 > m_LastSortOrder;					// last frame's depth sort permutation, see particle_sort.cpp
+	Vector m_vecLastSortCamera;								// camera position m_LastSortOrder was sorted for
+
 
 	void *operator new(size_t nSize);
 	void *operator new( size_t size, int nBlockUse, const char *pFileName, int nLine );
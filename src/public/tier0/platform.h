@@ -1248,7 +1248,8 @@ struct CPUInformation
 		 m_bSSE4a : 1,
 		 m_bSSE41 : 1,
 		 m_bSSE42 : 1,
-		 m_bAVX   : 1;  // Is AVX supported?
+		 m_bAVX   : 1,  // Is AVX supported?
+		 m_bAVX2  : 1;  // Are AVX2 and FMA3 supported?
 
 	int64 m_Speed;						// In cycles per second.
 
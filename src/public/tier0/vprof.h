@@ -118,6 +118,7 @@
 #define VPROF_BUDGETGROUP_JOBS_COROUTINES			_T("Jobs/Coroutines")
 #define VPROF_BUDGETGROUP_SLEEPING					_T("Sleeping")
 #define VPROF_BUDGETGROUP_THREADINGMAIN				_T("ThreadingMain")
+#define VPROF_BUDGETGROUP_JOB_WAIT					_T("Job_Wait")		// time the target thread spends blocked on pool jobs
 #define VPROF_BUDGETGROUP_ENCRYPTION				_T("Encryption")
 
 
@@ -429,6 +430,7 @@ enum VProfReportType_t
 	VPRT_LIST_BY_PEAK_TIME							= ( 1 << 7 ),
 	VPRT_LIST_BY_PEAK_OVER_AVERAGE					= ( 1 << 8 ),
 	VPRT_LIST_TOP_ITEMS_ONLY						= ( 1 << 9 ),
+	VPRT_WORKER_THREADS								= ( 1 << 10 ),	// per-thread trees, budget groups and job wait
 
 	VPRT_FULL = (0xffffffff & ~(VPRT_HIERARCHY_TIME_PER_FRAME_AND_COUNT_ONLY|VPRT_LIST_TOP_ITEMS_ONLY)),
 };
@@ -445,6 +447,10 @@ enum CounterGroup_t
 	COUNTER_GROUP_TELEMETRY,
 }; 
 
+class CVProfThreadTree;
+
+#define VPROF_MAX_THREAD_TREES 64
+
 class PLATFORM_CLASS CVProfile 
 {
 public:
@@ -526,6 +532,27 @@ public:
 	void HideBudgetGroup( int budgetGroupID, bool bHide = true );
 	void HideBudgetGroup( const tchar *pszName, bool bHide = true ) { HideBudgetGroup( BudgetGroupNameToBudgetGroupID( pszName), bHide ); }
 
+	//
+	// Scopes entered on threads other than the target thread are recorded into
+	// a node tree owned by that thread and rolled over with the main tree in
+	// MarkFrame. Budget group times are previous-frame milliseconds.
+	//
+	int GetNumThreadTrees() const			{ return m_nThreadTrees; }
+	CVProfNode *GetThreadTreeRoot( int iThread );
+	const tchar *GetThreadTreeName( int iThread );
+	double GetThreadTreeBudgetGroupTime( int iThread, int budgetGroupID );
+	double GetWorkerBudgetGroupTime( int budgetGroupID );
+	void SetThreadTreeName( const tchar *pszName );	// names the calling thread's tree
+
+	// Critical path: how long the target thread sat in VPROF_BUDGETGROUP_JOB_WAIT
+	// scopes last frame, against the busiest worker thread.
+	double GetPrevFrameJobWaitTime();
+	double GetPrevFrameBusiestWorkerTime();
+
+	// Previous-frame milliseconds per budget group, target thread plus workers.
+	// Captured in MarkFrame, so unaffected by CVProfNode::ClearPrevTime.
+	double GetPrevFrameBudgetGroupTime( int budgetGroupID );
+
 	int *FindOrCreateCounter( const tchar *pName, CounterGroup_t eCounterGroup=COUNTER_GROUP_DEFAULT  );
 	void ResetCounters( CounterGroup_t eCounterGroup );
 	
@@ -567,6 +594,13 @@ protected:
 	int FindBudgetGroupName( const tchar *pBudgetGroupName );
 	int AddBudgetGroupName( const tchar *pBudgetGroupName, int budgetFlags );
 
+	CVProfThreadTree *GetThreadTree();
+	void EnterThreadTreeScope( const tchar *pszName, int detailLevel, const tchar *pBudgetGroupName, int budgetFlags );
+	void ExitThreadTreeScope();
+	void MarkFrameThreadTrees();
+	void ResetThreadTrees();
+	void OutputThreadTreeReport( int type, int budgetGroupID );
+
 #ifdef VPROF_VTUNE_GROUP
 	bool		m_bVTuneGroupEnabled;
 	int			m_nVTuneGroupID;
@@ -592,6 +626,18 @@ protected:
 	int			m_nBudgetGroupNamesAllocated;
 	int			m_nBudgetGroupNames;
 	void		(*m_pNumBudgetGroupsChangedCallBack)(void);
+	CThreadFastMutex m_BudgetGroupMutex;	// worker threads can add budget groups
+	bool		m_bBudgetGroupsChanged;		// deferred callback for groups added off the target thread
+
+	CVProfThreadTree *m_pThreadTrees[VPROF_MAX_THREAD_TREES];
+	int volatile m_nThreadTrees;
+	CThreadFastMutex m_ThreadTreeMutex;
+	int			m_nJobWaitBudgetGroupID;
+	double		m_flPrevJobWaitTime;
+	double		m_flTotalJobWaitTime;
+	double		m_flPrevBusiestWorkerTime;
+	double		*m_pPrevBudgetGroupTimes;
+	int			m_nPrevBudgetGroupTimes;
 
 	// Performance monitoring events.
 	bool		m_bPMEInit;
@@ -979,6 +1025,10 @@ inline void CVProfile::EnterScope( const tchar *pszName, int detailLevel, const
 		m_pCurNode->EnterScope();
 		m_fAtRoot = false;
 	}
+	else if ( m_enabled != 0 && !InTargetThread() )
+	{
+		EnterThreadTreeScope( pszName, detailLevel, pBudgetGroupName, budgetFlags );
+	}
 }
 
 inline void CVProfile::EnterScope( const tchar *pszName, int detailLevel, const tchar *pBudgetGroupName, bool bAssertAccounted )
@@ -1004,6 +1054,10 @@ inline void CVProfile::ExitScope()
 		}
 		m_fAtRoot = ( m_pCurNode == &m_Root );
 	}
+	else if ( !InTargetThread() )
+	{
+		ExitThreadTreeScope();
+	}
 }
 
 //-------------------------------------
@@ -1030,6 +1084,7 @@ inline void CVProfile::Resume()
 inline void CVProfile::Reset()
 {
 	m_Root.Reset(); 
+	ResetThreadTrees();
 	m_nFrames = 0;
 }
 
@@ -1055,6 +1110,7 @@ inline void CVProfile::MarkFrame()
 		m_Root.ExitScope();
 		m_Root.MarkFrame();
 		m_Root.EnterScope();
+		MarkFrameThreadTrees();
 	}
 }
 
@@ -30,15 +30,11 @@ public:
 
 class CVProfSnMarkerScope  { public: CVProfSnMarkerScope( const char * ) {} };
 
-//lwss - These are ps3 specific profiling points - going to disable
-#if defined( _PS3 )
-    #define SNPROF(name) TM_ZONE( TELEMETRY_LEVEL1, TMZF_NONE, "%s", name );
-    #define SNPROF_ANIM(name) TM_ZONE( TELEMETRY_LEVEL1, TMZF_NONE, "anim %s", name );
-#else
-    #define SNPROF(name) (void)0
-    #define SNPROF_ANIM(name) (void)0
-#endif
-//lwss end
+#include "tier0/vprof_telemetry.h"
+
+// These go through TM_ZONE, which lands in the built-in trace capture (tier0/vprof_trace.h) without Telemetry
+#define SNPROF(name) TM_ZONE( TELEMETRY_LEVEL1, TMZF_NONE, "%s", name );
+#define SNPROF_ANIM(name) TM_ZONE( TELEMETRY_LEVEL1, TMZF_NONE, "anim %s", name );
 
 #endif
 #endif
@@ -57,6 +57,9 @@ enum TelemetryZonePlotSlot_t
 // Different versions of radbase.h define RADCOPYRIGHT to different values. So undef that here.
 #undef RADCOPYRIGHT
 
+// Zones go to the built-in trace capture instead
+#include "tier0/vprof_trace.h"
+
 inline void TelemetryTick() {}
 inline void TelemetrySetLevel( unsigned int Level ) {}
 
@@ -187,7 +190,11 @@ PLATFORM_INTERFACE TelemetryData g_Telemetry;
 //	cx [in] handle to a valid Telemetry context
 //	kFlags [in] flags for the zone (same as those passed to tmEnter
 //	kpFormat [in] name of the zone (same as those passed to tmEnter. This may contain printf-style format specifiers.
+#if defined( RAD_TELEMETRY_ENABLED )
 #define TM_ZONE( context, kFlags, kpFormat, ... ) TELEMETRY_REQUIRED( tmZone( context, kFlags, kpFormat, ##__VA_ARGS__ ) )
+#else
+#define TM_ZONE( context, kFlags, kpFormat, ... ) TRACE_ZONE( kpFormat, ##__VA_ARGS__ )
+#endif
 
 //Standardized zones
 #define TM_ZONE_DEFAULT( context ) TM_ZONE( context, TMZF_NONE, __FUNCTION__ )
@@ -0,0 +1,100 @@
+//========= Copyright  1996-2005, Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Built-in zone trace capture. This is what TM_ZONE and SNPROF record into
+//			when the Telemetry SDK isn't compiled in. While a capture runs, each thread
+//			appends complete zones to its own buffer without taking locks; the capture is
+//			written out as Chrome trace event JSON (chrome://tracing, ui.perfetto.dev).
+//
+// $NoKeywords: $
+//=============================================================================//
+
+#ifndef VPROF_TRACE_H
+#define VPROF_TRACE_H
+
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "tier0/platform.h"
+
+// Set while a capture is running; the only thing a zone looks at when it isn't.
+PLATFORM_INTERFACE volatile bool g_bTraceCaptureActive;
+
+// Starts a capture. Each thread keeps its most recent nEventsPerThread zones.
+PLATFORM_INTERFACE void TraceCapture_Start( int nEventsPerThread );
+PLATFORM_INTERFACE void TraceCapture_Stop();
+PLATFORM_INTERFACE bool TraceCapture_IsActive();
+
+// Writes the last capture as Chrome trace JSON through pfnWrite. Returns the number of zones written.
+typedef void ( *TraceCaptureWriteFn_t )( const char *pData, int nLength, void *pContext );
+PLATFORM_INTERFACE int TraceCapture_WriteJSON( TraceCaptureWriteFn_t pfnWrite, void *pContext );
+
+// Zone names are stored as pointers and formatted when the capture is written, so the format
+// and any const char * arguments must outlive the capture (string literals, vprof names).
+// Anything else is formatted up front into a per-thread string pool.
+PLATFORM_INTERFACE void TraceCapture_EmitZone( uint64 nStart, const char *pFormat, const char *pArg0, const char *pArg1 );
+PLATFORM_INTERFACE const char *TraceCapture_FormatName( PRINTF_FORMAT_STRING const char *pFormat, ... ) FMTFUNCTION( 1, 2 );
+
+class CTraceZoneScope
+{
+public:
+	CTraceZoneScope( const char *pName ) : m_nStart( 0 )
+	{
+		if ( g_bTraceCaptureActive )
+		{
+			Begin( pName, NULL, NULL );
+		}
+	}
+
+	CTraceZoneScope( const char *pFormat, const char *pArg0 ) : m_nStart( 0 )
+	{
+		if ( g_bTraceCaptureActive )
+		{
+			Begin( pFormat, pArg0, NULL );
+		}
+	}
+
+	CTraceZoneScope( const char *pFormat, const char *pArg0, const char *pArg1 ) : m_nStart( 0 )
+	{
+		if ( g_bTraceCaptureActive )
+		{
+			Begin( pFormat, pArg0, pArg1 );
+		}
+	}
+
+	template < typename... ARGS >
+	CTraceZoneScope( const char *pFormat, ARGS... args ) : m_nStart( 0 )
+	{
+		if ( g_bTraceCaptureActive )
+		{
+			Begin( TraceCapture_FormatName( pFormat, args... ), NULL, NULL );
+		}
+	}
+
+	~CTraceZoneScope()
+	{
+		if ( m_nStart )
+		{
+			TraceCapture_EmitZone( m_nStart, m_pFormat, m_pArgs[0], m_pArgs[1] );
+		}
+	}
+
+private:
+	void Begin( const char *pFormat, const char *pArg0, const char *pArg1 )
+	{
+		m_pFormat = pFormat;
+		m_pArgs[0] = pArg0;
+		m_pArgs[1] = pArg1;
+		m_nStart = Plat_Rdtsc();
+	}
+
+	uint64		m_nStart;
+	const char	*m_pFormat;
+	const char	*m_pArgs[2];
+};
+
+#define TRACE_ZONE_VARIABLE_NAME( line )	TRACE_ZONE_VARIABLE_NAME_( line )
+#define TRACE_ZONE_VARIABLE_NAME_( line )	traceZone_##line
+#define TRACE_ZONE( kpFormat, ... )			CTraceZoneScope TRACE_ZONE_VARIABLE_NAME( __LINE__ )( kpFormat, ##__VA_ARGS__ )
+
+#endif // VPROF_TRACE_H
@@ -29,6 +29,7 @@
 
 #include <limits.h>
 #include "tier0/threadtools.h"
+#include "tier0/vprof.h"
 #include "tier1/refcount.h"
 #include "tier1/utllinkedlist.h"
 #include "tier1/utlvector.h"
@@ -957,6 +958,7 @@ public:
 
 			DoExecute();
 
+			VPROF_BUDGET( "ParallelProcess wait", VPROF_BUDGETGROUP_JOB_WAIT );
 			for ( i = 0; i < nJobs; i++ )
 			{
 				jobs[i]->Abort(); // will either abort ones that never got a thread, or noop on ones that did
@@ -1126,6 +1128,7 @@ public:
 
 			DoExecute();
 
+			VPROF_BUDGET( "ParallelProcess wait", VPROF_BUDGETGROUP_JOB_WAIT );
 			for ( i = 0; i < nJobs; i++ )
 			{
 				jobs[i]->Abort(); // will either abort ones that never got a thread, or noop on ones that did
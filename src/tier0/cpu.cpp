@@ -201,6 +201,26 @@ static CpuIdResult_t cpuidex( unsigned long function, unsigned long subfunction
 }
 
 
+// Low 32 bits of XCR0, the register state the OS saves on a context switch.
+// Only valid once CPUID.1:ECX.OSXSAVE says xgetbv can be executed.
+static unsigned long GetXCR0()
+{
+#if defined( _X360 ) || defined( _PS3 ) || defined( __aarch64__ )
+	return 0;
+#elif defined(GNUC)
+	unsigned long out_eax, out_edx;
+	asm( "xgetbv"
+		: "=a" ( out_eax ),
+		  "=d" ( out_edx )
+		: "c" ( 0 )
+		);
+	return out_eax;
+#else
+	return ( unsigned long )_xgetbv( 0 );
+#endif
+}
+
+
 static bool CheckSSETechnology(void)
 {
 #if defined( _X360 ) || defined( _PS3 ) || defined( __aarch64__ )
@@ -756,7 +776,14 @@ const CPUInformation& GetCPUInformation()
 		pi.m_bSSE4a = CheckSSE4aTechnology();
 		pi.m_bSSE41 = ( cpuid1.ecx >> 19 ) & 1;
 		pi.m_bSSE42 = ( cpuid1.ecx >> 20 ) & 1;
-		pi.m_bAVX	= ( cpuid1.ecx >> 28 ) & 1;
+		// AVX also needs the OS to save the ymm registers: OSXSAVE set and XMM|YMM enabled in XCR0
+		bool bOSXSave = ( ( cpuid1.ecx >> 27 ) & 1 ) != 0;
+		pi.m_bAVX	= ( ( cpuid1.ecx >> 28 ) & 1 ) && bOSXSave && ( ( GetXCR0() & 6 ) == 6 );
+		if ( pi.m_bAVX && cpuid0.eax >= 7 )
+		{
+			CpuIdResult_t cpuid7 = cpuidex( 7, 0 );
+			pi.m_bAVX2 = ( ( cpuid7.ebx >> 5 ) & 1 ) && ( ( cpuid1.ecx >> 12 ) & 1 );
+		}
 		pi.m_szProcessorID = ( tchar* )GetProcessorVendorId();
 		pi.m_szProcessorBrand = ( tchar* )GetProcessorBrand();
 		pi.m_bHT = ( pi.m_nPhysicalProcessors < pi.m_nLogicalProcessors ); //HTSupported();
@@ -344,6 +344,7 @@ map<const tchar *, uintp>	g_TimeSumsMap;
 vector<TimeSums_t> 			g_TimeSums;
 CVProfNode *				g_pStartNode;
 const tchar *				g_pszSumNode;
+vector<void *>				g_RetiredBudgetGroups;
 
 //-------------------------------------
 
@@ -946,6 +947,10 @@ void CVProfile::OutputReport( int type, const tchar *pszStartNode, int budgetGro
 			DumpSorted( _T("-- Profile scopes sorted by peak over average (including children) --"), GetTotalTimeSampled(), PeakOverAverageCompare, maxLen );
 			Msg( _T("\n") );
 		}
+		if ( type & VPRT_WORKER_THREADS )
+		{
+			OutputThreadTreeReport( type, budgetGroupID );
+		}
 		
 		// TODO: Functions by time less children
 		// TODO: Functions by time averages
@@ -959,6 +964,341 @@ void CVProfile::OutputReport( int type, const tchar *pszStartNode, int budgetGro
 
 }
 
+//=============================================================================
+//
+// Per-thread node trees. Scopes entered off the target thread land in a tree
+// owned by the entering thread; the target thread rolls every tree over in
+// MarkFrame, so worker nodes have the same prev/total/peak semantics as the
+// main tree. A scope that is still open at MarkFrame is charged to the frame
+// in which it exits.
+//
+
+class CVProfThreadTree
+{
+public:
+	CVProfThreadTree( ThreadId_t threadId, const tchar *pszName )
+	 :	m_Root( m_szName, 0, NULL, VPROF_BUDGETGROUP_OTHER_UNACCOUNTED, 0 ),
+		m_pCurNode( &m_Root ),
+		m_ThreadId( threadId ),
+		m_flPrevBusyTime( 0 ),
+		m_flTotalBusyTime( 0 )
+	{
+		if ( pszName && pszName[0] )
+		{
+			_snprintf( m_szName, ARRAYSIZE( m_szName ), "%s", pszName );
+		}
+		else
+		{
+			_snprintf( m_szName, ARRAYSIZE( m_szName ), "Thread %llu", (unsigned long long)threadId );
+		}
+		m_szName[ ARRAYSIZE( m_szName ) - 1 ] = 0;
+	}
+
+	tchar			m_szName[64];
+	CVProfNode		m_Root;
+	CVProfNode		*m_pCurNode;
+	ThreadId_t		m_ThreadId;
+	CThreadFastMutex m_Mutex;		// owner thread on enter/exit, target thread on frame rollover and reports
+
+	vector<double>	m_PrevBudgetGroupTimes;
+	double			m_flPrevBusyTime;
+	double			m_flTotalBusyTime;
+};
+
+static CTHREADLOCALPTR( CVProfThreadTree ) s_pVProfThreadTree;
+static CTHREADLOCALPTR( tchar ) s_pszVProfThreadName;
+
+void CVProfile::SetThreadTreeName( const tchar *pszName )
+{
+	s_pszVProfThreadName = const_cast<tchar *>( pszName );
+}
+
+CVProfThreadTree *CVProfile::GetThreadTree()
+{
+	CVProfThreadTree *pTree = s_pVProfThreadTree;
+	if ( pTree )
+	{
+		return pTree;
+	}
+
+	AUTO_LOCK_FM( m_ThreadTreeMutex );
+	if ( m_nThreadTrees >= VPROF_MAX_THREAD_TREES )
+	{
+		return NULL;
+	}
+
+	MEM_ALLOC_CREDIT();
+	pTree = new CVProfThreadTree( ThreadGetCurrentId(), s_pszVProfThreadName );
+	m_pThreadTrees[m_nThreadTrees] = pTree;
+	ThreadMemoryBarrier();
+	m_nThreadTrees = m_nThreadTrees + 1;
+	s_pVProfThreadTree = pTree;
+	return pTree;
+}
+
+void CVProfile::EnterThreadTreeScope( const tchar *pszName, int detailLevel, const tchar *pBudgetGroupName, int budgetFlags )
+{
+	CVProfThreadTree *pTree = GetThreadTree();
+	if ( !pTree )
+	{
+		return;
+	}
+
+	AUTO_LOCK_FM( pTree->m_Mutex );
+	if ( pszName != pTree->m_pCurNode->GetName() )
+	{
+		pTree->m_pCurNode = pTree->m_pCurNode->GetSubNode( pszName, detailLevel, pBudgetGroupName, budgetFlags );
+	}
+	pTree->m_pCurNode->EnterScope();
+}
+
+void CVProfile::ExitThreadTreeScope()
+{
+	CVProfThreadTree *pTree = s_pVProfThreadTree;
+	if ( !pTree )
+	{
+		return;
+	}
+
+	AUTO_LOCK_FM( pTree->m_Mutex );
+	if ( pTree->m_pCurNode == &pTree->m_Root )
+	{
+		return;
+	}
+	if ( pTree->m_pCurNode->ExitScope() )
+	{
+		pTree->m_pCurNode = pTree->m_pCurNode->GetParent();
+	}
+}
+
+static void SumThreadTreeBudgetGroupTimes_R( CVProfNode *pNode, double *pTimes, int nGroups )
+{
+	for ( ; pNode; pNode = pNode->GetSibling() )
+	{
+		int budgetGroupID = pNode->GetBudgetGroupID();
+		if ( budgetGroupID >= 0 && budgetGroupID < nGroups )
+		{
+			pTimes[budgetGroupID] += pNode->GetPrevTimeLessChildren();
+		}
+		if ( pNode->GetChild() )
+		{
+			SumThreadTreeBudgetGroupTimes_R( pNode->GetChild(), pTimes, nGroups );
+		}
+	}
+}
+
+// Outermost nodes only: unaccounted children inherit their parent's group.
+static double SumBudgetGroupPrevTime_R( CVProfNode *pNode, int budgetGroupID )
+{
+	double flTime = 0;
+	for ( ; pNode; pNode = pNode->GetSibling() )
+	{
+		if ( pNode->GetBudgetGroupID() == budgetGroupID )
+		{
+			flTime += pNode->GetPrevTime();
+		}
+		else if ( pNode->GetChild() )
+		{
+			flTime += SumBudgetGroupPrevTime_R( pNode->GetChild(), budgetGroupID );
+		}
+	}
+	return flTime;
+}
+
+void CVProfile::MarkFrameThreadTrees()
+{
+	int nGroups = m_nBudgetGroupNames;
+	int nTrees = m_nThreadTrees;
+	double flBusiest = 0;
+	for ( int i = 0; i < nTrees; i++ )
+	{
+		CVProfThreadTree *pTree = m_pThreadTrees[i];
+		AUTO_LOCK_FM( pTree->m_Mutex );
+
+		pTree->m_Root.MarkFrame();
+		pTree->m_PrevBudgetGroupTimes.assign( nGroups, 0.0 );
+
+		double flBusy = 0;
+		for ( CVProfNode *pNode = pTree->m_Root.GetChild(); pNode; pNode = pNode->GetSibling() )
+		{
+			flBusy += pNode->GetPrevTime();
+		}
+		if ( pTree->m_Root.GetChild() && nGroups )
+		{
+			SumThreadTreeBudgetGroupTimes_R( pTree->m_Root.GetChild(), &pTree->m_PrevBudgetGroupTimes[0], nGroups );
+		}
+		pTree->m_flPrevBusyTime = flBusy;
+		pTree->m_flTotalBusyTime += flBusy;
+		flBusiest = max( flBusiest, flBusy );
+	}
+	m_flPrevBusiestWorkerTime = flBusiest;
+
+	m_flPrevJobWaitTime = m_Root.GetChild() ? SumBudgetGroupPrevTime_R( m_Root.GetChild(), m_nJobWaitBudgetGroupID ) : 0.0;
+	m_flTotalJobWaitTime += m_flPrevJobWaitTime;
+
+	if ( m_nPrevBudgetGroupTimes < nGroups )
+	{
+		MEM_ALLOC_CREDIT();
+		delete [] m_pPrevBudgetGroupTimes;
+		m_nPrevBudgetGroupTimes = nGroups;
+		m_pPrevBudgetGroupTimes = new double[ m_nPrevBudgetGroupTimes ];
+	}
+	if ( nGroups )
+	{
+		memset( m_pPrevBudgetGroupTimes, 0, nGroups * sizeof( m_pPrevBudgetGroupTimes[0] ) );
+		if ( m_Root.GetChild() )
+		{
+			SumThreadTreeBudgetGroupTimes_R( m_Root.GetChild(), m_pPrevBudgetGroupTimes, nGroups );
+		}
+		for ( int i = 0; i < nTrees; i++ )
+		{
+			const vector<double> &times = m_pThreadTrees[i]->m_PrevBudgetGroupTimes;
+			for ( int j = 0; j < nGroups && j < (int)times.size(); j++ )
+			{
+				m_pPrevBudgetGroupTimes[j] += times[j];
+			}
+		}
+	}
+
+	if ( m_bBudgetGroupsChanged )
+	{
+		m_bBudgetGroupsChanged = false;
+		if ( m_pNumBudgetGroupsChangedCallBack )
+		{
+			(*m_pNumBudgetGroupsChangedCallBack)();
+		}
+	}
+}
+
+void CVProfile::ResetThreadTrees()
+{
+	int nTrees = m_nThreadTrees;
+	for ( int i = 0; i < nTrees; i++ )
+	{
+		CVProfThreadTree *pTree = m_pThreadTrees[i];
+		AUTO_LOCK_FM( pTree->m_Mutex );
+		pTree->m_Root.Reset();
+		pTree->m_PrevBudgetGroupTimes.clear();
+		pTree->m_flPrevBusyTime = 0;
+		pTree->m_flTotalBusyTime = 0;
+	}
+	m_flPrevJobWaitTime = 0;
+	m_flTotalJobWaitTime = 0;
+	m_flPrevBusiestWorkerTime = 0;
+	if ( m_nPrevBudgetGroupTimes )
+	{
+		memset( m_pPrevBudgetGroupTimes, 0, m_nPrevBudgetGroupTimes * sizeof( m_pPrevBudgetGroupTimes[0] ) );
+	}
+}
+
+CVProfNode *CVProfile::GetThreadTreeRoot( int iThread )
+{
+	return ( iThread >= 0 && iThread < m_nThreadTrees ) ? &m_pThreadTrees[iThread]->m_Root : NULL;
+}
+
+const tchar *CVProfile::GetThreadTreeName( int iThread )
+{
+	return ( iThread >= 0 && iThread < m_nThreadTrees ) ? m_pThreadTrees[iThread]->m_szName : NULL;
+}
+
+double CVProfile::GetThreadTreeBudgetGroupTime( int iThread, int budgetGroupID )
+{
+	if ( iThread < 0 || iThread >= m_nThreadTrees || budgetGroupID < 0 )
+		return 0;
+
+	const vector<double> &times = m_pThreadTrees[iThread]->m_PrevBudgetGroupTimes;
+	return ( (unsigned)budgetGroupID < times.size() ) ? times[budgetGroupID] : 0;
+}
+
+double CVProfile::GetWorkerBudgetGroupTime( int budgetGroupID )
+{
+	double flTime = 0;
+	int nTrees = m_nThreadTrees;
+	for ( int i = 0; i < nTrees; i++ )
+	{
+		flTime += GetThreadTreeBudgetGroupTime( i, budgetGroupID );
+	}
+	return flTime;
+}
+
+double CVProfile::GetPrevFrameJobWaitTime()
+{
+	return m_flPrevJobWaitTime;
+}
+
+double CVProfile::GetPrevFrameBusiestWorkerTime()
+{
+	return m_flPrevBusiestWorkerTime;
+}
+
+double CVProfile::GetPrevFrameBudgetGroupTime( int budgetGroupID )
+{
+	return ( budgetGroupID >= 0 && budgetGroupID < m_nPrevBudgetGroupTimes ) ? m_pPrevBudgetGroupTimes[budgetGroupID] : 0;
+}
+
+static void DumpThreadTreeNodes_R( CVProfNode *pNode, int indent, double flFrames )
+{
+	for ( ; pNode; pNode = pNode->GetSibling() )
+	{
+		if ( pNode->GetTotalCalls() > 0 )
+		{
+			Msg( _T("  %10.3f %9.2f      %8d %6.2f  "),
+				pNode->GetTotalTime() / flFrames,
+				pNode->GetTotalTimeLessChildren() / flFrames,
+				pNode->GetTotalCalls(), pNode->GetPeakTime() );
+			for ( int i = 1; i < indent; i++ )
+			{
+				Msg( _T("|  ") );
+			}
+			Msg( _T("%s\n"), pNode->GetName() );
+		}
+		if ( pNode->GetChild() )
+		{
+			DumpThreadTreeNodes_R( pNode->GetChild(), indent + 1, flFrames );
+		}
+	}
+}
+
+void CVProfile::OutputThreadTreeReport( int type, int budgetGroupID )
+{
+	int nTrees = m_nThreadTrees;
+	if ( !nTrees )
+		return;
+
+	double flFrames = max( NumFramesSampled(), 1 );
+
+	Msg( _T("-- Worker Threads --\n") );
+	Msg( _T("Main thread waited on jobs %.3f ms/frame (%.3f ms last frame), busiest worker %.3f ms last frame\n"),
+		m_flTotalJobWaitTime / flFrames, m_flPrevJobWaitTime, m_flPrevBusiestWorkerTime );
+
+	for ( int i = 0; i < nTrees; i++ )
+	{
+		CVProfThreadTree *pTree = m_pThreadTrees[i];
+		AUTO_LOCK_FM( pTree->m_Mutex );
+
+		if ( pTree->m_flTotalBusyTime <= 0 )
+			continue;
+
+		Msg( _T("\n%s: %.3f ms/frame busy (%.3f ms last frame)\n"), pTree->m_szName, pTree->m_flTotalBusyTime / flFrames, pTree->m_flPrevBusyTime );
+		for ( unsigned j = 0; j < pTree->m_PrevBudgetGroupTimes.size(); j++ )
+		{
+			if ( pTree->m_PrevBudgetGroupTimes[j] > 0 && ( budgetGroupID == -1 || (int)j == budgetGroupID ) )
+			{
+				Msg( _T("    %-40s %8.3f ms\n"), GetBudgetGroupName( j ), pTree->m_PrevBudgetGroupTimes[j] );
+			}
+		}
+
+		if ( type & ( VPRT_HIERARCHY | VPRT_HIERARCHY_TIME_PER_FRAME_AND_COUNT_ONLY ) )
+		{
+			Msg( _T(" Avg Time/Frame (ms)\n") );
+			Msg( _T("[ func+child      func ]       Count   Peak\n") );
+			Msg( _T("  ---------- ---------      -------- ------\n") );
+			DumpThreadTreeNodes_R( pTree->m_Root.GetChild(), 1, flFrames );
+		}
+	}
+	Msg( _T("\n") );
+}
+
 //=============================================================================
 
 CVProfile::CVProfile() 
@@ -976,6 +1316,15 @@ CVProfile::CVProfile()
 #endif
 
 	m_TargetThreadId = ThreadGetCurrentId();
+
+	m_bBudgetGroupsChanged = false;
+	memset( m_pThreadTrees, 0, sizeof( m_pThreadTrees ) );
+	m_nThreadTrees = 0;
+	m_flPrevJobWaitTime = 0;
+	m_flTotalJobWaitTime = 0;
+	m_flPrevBusiestWorkerTime = 0;
+	m_pPrevBudgetGroupTimes = NULL;
+	m_nPrevBudgetGroupTimes = 0;
 	
 	// Go ahead and allocate 32 slots for budget group names
 	MEM_ALLOC_CREDIT();
@@ -1016,6 +1365,7 @@ CVProfile::CVProfile()
 	BudgetGroupNameToBudgetGroupID( VPROF_BUDGETGROUP_TOOLS,					BUDGETFLAG_OTHER | BUDGETFLAG_CLIENT );
 	BudgetGroupNameToBudgetGroupID( VPROF_BUDGETGROUP_TEXTURE_CACHE,			BUDGETFLAG_CLIENT );
 	BudgetGroupNameToBudgetGroupID( VPROF_BUDGETGROUP_REPLAY,					BUDGETFLAG_SERVER );
+	m_nJobWaitBudgetGroupID = BudgetGroupNameToBudgetGroupID( VPROF_BUDGETGROUP_JOB_WAIT, BUDGETFLAG_OTHER | BUDGETFLAG_CLIENT | BUDGETFLAG_SERVER );
 //	BudgetGroupNameToBudgetGroupID( VPROF_BUDGETGROUP_DISP_HULLTRACES );
 
 	m_bPMEInit = false;
@@ -1073,6 +1423,11 @@ void CVProfile::Term()
 	delete[] m_pBudgetGroups; //lwss: fix delete => delete[]
 	m_nBudgetGroupNames = m_nBudgetGroupNamesAllocated = 0;
 	m_pBudgetGroups = NULL;
+	for ( i = 0; i < (int)g_RetiredBudgetGroups.size(); i++ )
+	{
+		delete [] (CBudgetGroup *)g_RetiredBudgetGroups[i];
+	}
+	g_RetiredBudgetGroups.clear();
 
 	int n;
 	for( n = 0; n < m_NumCounters; n++ )
@@ -1087,6 +1442,23 @@ void CVProfile::Term()
 	{
 		FreeNodes_R( GetRoot() );
 	}
+
+	for ( i = 0; i < m_nThreadTrees; i++ )
+	{
+		CVProfNode *pNext;
+		for ( CVProfNode *pChild = m_pThreadTrees[i]->m_Root.GetChild(); pChild; pChild = pNext )
+		{
+			pNext = pChild->GetSibling();
+			FreeNodes_R( pChild );
+		}
+		delete m_pThreadTrees[i];
+		m_pThreadTrees[i] = NULL;
+	}
+	m_nThreadTrees = 0;
+
+	delete [] m_pPrevBudgetGroupTimes;
+	m_pPrevBudgetGroupTimes = NULL;
+	m_nPrevBudgetGroupTimes = 0;
 }
 
 
@@ -1145,14 +1517,23 @@ int CVProfile::AddBudgetGroupName( const tchar *pBudgetGroupName, int budgetFlag
 		for ( int i=0; i < m_nBudgetGroupNames; i++ )
 			pNew[i] = m_pBudgetGroups[i];
 		
-		delete [] m_pBudgetGroups;
+		// The target thread reads the array without the lock, and a worker
+		// thread can get here while it does; keep the old one until Term().
+		g_RetiredBudgetGroups.push_back( m_pBudgetGroups );
+		ThreadMemoryBarrier();
 		m_pBudgetGroups = pNew;
 	}
 
 	m_pBudgetGroups[m_nBudgetGroupNames].m_pName = pNewString;
 	m_pBudgetGroups[m_nBudgetGroupNames].m_BudgetFlags = budgetFlags;
+	ThreadMemoryBarrier();
 	m_nBudgetGroupNames++;
-	if( m_pNumBudgetGroupsChangedCallBack )
+	if ( !InTargetThread() )
+	{
+		// Panels hooked to the callback aren't thread safe; run it from MarkFrame.
+		m_bBudgetGroupsChanged = true;
+	}
+	else if( m_pNumBudgetGroupsChangedCallBack )
 	{
 		(*m_pNumBudgetGroupsChangedCallBack)();
 	}
@@ -1166,6 +1547,7 @@ int CVProfile::AddBudgetGroupName( const tchar *pBudgetGroupName, int budgetFlag
 
 int CVProfile::BudgetGroupNameToBudgetGroupID( const tchar *pBudgetGroupName, int budgetFlagsToORIn )
 {
+	AUTO_LOCK_FM( m_BudgetGroupMutex );
 	int budgetGroupID = FindBudgetGroupName( pBudgetGroupName );
 	if( budgetGroupID == -1 )
 	{
@@ -0,0 +1,358 @@
+//========= Copyright  1996-2005, Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Built-in zone trace capture, see tier0/vprof_trace.h
+//
+// $NoKeywords: $
+//=============================================================================//
+
+#include "pch_tier0.h"
+#include "tier0/vprof_trace.h"
+#include "tier0/threadtools.h"
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+
+#ifdef POSIX
+#include <pthread.h>
+#endif
+
+// NOTE: This has to be the last file included!
+#include "tier0/memdbgon.h"
+
+#define TRACE_MAX_THREADS			256
+#define TRACE_STRING_POOL_SIZE		( 64 * 1024 )
+#define TRACE_MIN_EVENTS			1024
+#define TRACE_MAX_EVENTS			( 4 * 1024 * 1024 )
+
+struct TraceZone_t
+{
+	uint64		m_nStart;
+	uint64		m_nEnd;
+	const char	*m_pFormat;
+	const char	*m_pArgs[2];
+};
+
+//-----------------------------------------------------------------------------
+// One per thread that ever recorded a zone. Only the owning thread writes to it;
+// the capture is read back once it has been stopped.
+//-----------------------------------------------------------------------------
+struct TraceThreadBuffer_t
+{
+	ThreadId_t		m_nThreadId;
+	char			m_szThreadName[32];
+	int				m_nGeneration;		// capture this buffer was last reset for
+	TraceZone_t		*m_pZones;
+	int				m_nCapacity;
+	volatile int	m_nWritten;			// zones written this capture, the buffer holds the last m_nCapacity of them
+	int32 volatile	m_nInEmit;			// set while the owner is writing, so TraceCapture_Stop can wait it out
+	char			*m_pStringPool;
+	int				m_nStringPoolUsed;
+};
+
+volatile bool g_bTraceCaptureActive = false;
+
+static CThreadFastMutex			s_TraceBuffersMutex;
+static TraceThreadBuffer_t		*s_pTraceBuffers[ TRACE_MAX_THREADS ];
+static volatile int				s_nTraceBufferCount = 0;
+static CTHREADLOCALPTR( TraceThreadBuffer_t ) s_pThreadTraceBuffer;
+
+static int32 volatile	s_nTraceFence = 0;
+static int				s_nTraceGeneration = 0;
+static int				s_nTraceEventsPerThread = 0;
+static uint64			s_nTraceStartTSC = 0;
+static uint64			s_nTraceStopTSC = 0;
+static double			s_flTraceStartTime = 0.0;
+static double			s_flTraceStopTime = 0.0;
+
+static TraceThreadBuffer_t *GetThreadTraceBuffer()
+{
+	TraceThreadBuffer_t *pBuffer = s_pThreadTraceBuffer;
+	if ( pBuffer )
+		return pBuffer;
+
+	AUTO_LOCK( s_TraceBuffersMutex );
+	if ( s_nTraceBufferCount >= TRACE_MAX_THREADS )
+		return NULL;
+
+	pBuffer = new TraceThreadBuffer_t;
+	memset( pBuffer, 0, sizeof( *pBuffer ) );
+	pBuffer->m_nThreadId = ThreadGetCurrentId();
+	pBuffer->m_nGeneration = -1;
+
+	if ( ThreadInMainThread() )
+	{
+		V_tier0_strncpy( pBuffer->m_szThreadName, "MainThrd", sizeof( pBuffer->m_szThreadName ) );
+	}
+#if defined( LINUX )
+	else if ( pthread_getname_np( pthread_self(), pBuffer->m_szThreadName, sizeof( pBuffer->m_szThreadName ) ) != 0 || !pBuffer->m_szThreadName[0] )
+#else
+	else
+#endif
+	{
+		snprintf( pBuffer->m_szThreadName, sizeof( pBuffer->m_szThreadName ), "Thread %llu", (unsigned long long)pBuffer->m_nThreadId );
+	}
+
+	s_pTraceBuffers[ s_nTraceBufferCount ] = pBuffer;
+	ThreadMemoryBarrier();
+	++s_nTraceBufferCount;
+
+	s_pThreadTraceBuffer = pBuffer;
+	return pBuffer;
+}
+
+// Called by the owning thread only, and only while a capture is running
+static void ResetStaleTraceBuffer( TraceThreadBuffer_t *pBuffer )
+{
+	if ( pBuffer->m_nGeneration == s_nTraceGeneration )
+		return;
+
+	if ( pBuffer->m_nCapacity != s_nTraceEventsPerThread )
+	{
+		delete[] pBuffer->m_pZones;
+		pBuffer->m_pZones = new TraceZone_t[ s_nTraceEventsPerThread ];
+		pBuffer->m_nCapacity = s_nTraceEventsPerThread;
+	}
+
+	if ( !pBuffer->m_pStringPool )
+	{
+		pBuffer->m_pStringPool = new char[ TRACE_STRING_POOL_SIZE ];
+	}
+
+	pBuffer->m_nWritten = 0;
+	pBuffer->m_nStringPoolUsed = 0;
+	pBuffer->m_nGeneration = s_nTraceGeneration;
+}
+
+void TraceCapture_EmitZone( uint64 nStart, const char *pFormat, const char *pArg0, const char *pArg1 )
+{
+	uint64 nEnd = Plat_Rdtsc();
+
+	TraceThreadBuffer_t *pBuffer = GetThreadTraceBuffer();
+	if ( !pBuffer )
+		return;
+
+	// Full barrier between publishing m_nInEmit and looking at the capture state; pairs with TraceCapture_Stop
+	ThreadInterlockedExchange( &pBuffer->m_nInEmit, 1 );
+
+	// Zones that were already open when the capture started are dropped
+	if ( g_bTraceCaptureActive && nStart >= s_nTraceStartTSC )
+	{
+		ResetStaleTraceBuffer( pBuffer );
+
+		TraceZone_t &zone = pBuffer->m_pZones[ (unsigned)pBuffer->m_nWritten % (unsigned)pBuffer->m_nCapacity ];
+		zone.m_nStart = nStart;
+		zone.m_nEnd = nEnd;
+		zone.m_pFormat = pFormat;
+		zone.m_pArgs[0] = pArg0;
+		zone.m_pArgs[1] = pArg1;
+
+		ThreadMemoryBarrier();
+		pBuffer->m_nWritten = pBuffer->m_nWritten + 1;
+	}
+
+	ThreadInterlockedExchange( &pBuffer->m_nInEmit, 0 );
+}
+
+const char *TraceCapture_FormatName( const char *pFormat, ... )
+{
+	TraceThreadBuffer_t *pBuffer = GetThreadTraceBuffer();
+	if ( !pBuffer || !g_bTraceCaptureActive )
+		return pFormat;
+
+	ResetStaleTraceBuffer( pBuffer );
+
+	int nAvailable = TRACE_STRING_POOL_SIZE - pBuffer->m_nStringPoolUsed;
+	if ( nAvailable < 2 )
+		return "(trace string pool full)";
+
+	char *pName = pBuffer->m_pStringPool + pBuffer->m_nStringPoolUsed;
+
+	va_list args;
+	va_start( args, pFormat );
+	int nLength = vsnprintf( pName, nAvailable, pFormat, args );
+	va_end( args );
+
+	if ( nLength < 0 )
+		return pFormat;
+
+	pBuffer->m_nStringPoolUsed += MIN( nLength, nAvailable - 1 ) + 1;
+	return pName;
+}
+
+void TraceCapture_Start( int nEventsPerThread )
+{
+	if ( g_bTraceCaptureActive )
+	{
+		TraceCapture_Stop();
+	}
+
+	s_nTraceEventsPerThread = clamp( nEventsPerThread, TRACE_MIN_EVENTS, TRACE_MAX_EVENTS );
+	++s_nTraceGeneration;
+	s_flTraceStartTime = Plat_FloatTime();
+	s_nTraceStartTSC = Plat_Rdtsc();
+
+	ThreadInterlockedExchange( &s_nTraceFence, 0 );
+	g_bTraceCaptureActive = true;
+}
+
+void TraceCapture_Stop()
+{
+	if ( !g_bTraceCaptureActive )
+		return;
+
+	g_bTraceCaptureActive = false;
+	ThreadInterlockedExchange( &s_nTraceFence, 0 );
+
+	s_nTraceStopTSC = Plat_Rdtsc();
+	s_flTraceStopTime = Plat_FloatTime();
+
+	// Anyone who saw the capture running has m_nInEmit set by now; let them finish
+	int nBuffers = s_nTraceBufferCount;
+	for ( int i = 0; i < nBuffers; i++ )
+	{
+		while ( s_pTraceBuffers[i]->m_nInEmit )
+		{
+			ThreadPause();
+		}
+	}
+}
+
+bool TraceCapture_IsActive()
+{
+	return g_bTraceCaptureActive;
+}
+
+//-----------------------------------------------------------------------------
+// Buffered output for TraceCapture_WriteJSON
+//-----------------------------------------------------------------------------
+class CTraceJSONWriter
+{
+public:
+	CTraceJSONWriter( TraceCaptureWriteFn_t pfnWrite, void *pContext ) : m_pfnWrite( pfnWrite ), m_pContext( pContext ), m_nUsed( 0 ) {}
+	~CTraceJSONWriter() { Flush(); }
+
+	void Printf( PRINTF_FORMAT_STRING const char *pFormat, ... )
+	{
+		if ( m_nUsed > sizeof( m_Buffer ) - 1024 )
+		{
+			Flush();
+		}
+
+		va_list args;
+		va_start( args, pFormat );
+		int nLength = vsnprintf( m_Buffer + m_nUsed, sizeof( m_Buffer ) - m_nUsed, pFormat, args );
+		va_end( args );
+
+		if ( nLength > 0 )
+		{
+			m_nUsed += MIN( (size_t)nLength, sizeof( m_Buffer ) - m_nUsed - 1 );
+		}
+	}
+
+	void String( const char *pString )
+	{
+		char szEscaped[ 512 ];
+		size_t nOut = 0;
+		for ( const char *p = pString; *p && nOut < sizeof( szEscaped ) - 7; ++p )
+		{
+			unsigned char c = *p;
+			if ( c == '"' || c == '\\' )
+			{
+				szEscaped[ nOut++ ] = '\\';
+				szEscaped[ nOut++ ] = c;
+			}
+			else if ( c < 0x20 )
+			{
+				nOut += snprintf( szEscaped + nOut, sizeof( szEscaped ) - nOut, "\\u%04x", c );
+			}
+			else
+			{
+				szEscaped[ nOut++ ] = c;
+			}
+		}
+		szEscaped[ nOut ] = 0;
+		Printf( "\"%s\"", szEscaped );
+	}
+
+	void Flush()
+	{
+		if ( m_nUsed )
+		{
+			m_pfnWrite( m_Buffer, (int)m_nUsed, m_pContext );
+			m_nUsed = 0;
+		}
+	}
+
+private:
+	TraceCaptureWriteFn_t	m_pfnWrite;
+	void					*m_pContext;
+	size_t					m_nUsed;
+	char					m_Buffer[ 64 * 1024 ];
+};
+
+int TraceCapture_WriteJSON( TraceCaptureWriteFn_t pfnWrite, void *pContext )
+{
+	TraceCapture_Stop();
+
+	if ( !s_nTraceGeneration )
+		return 0;
+
+	// Calibrate the TSC against the wall clock over the capture itself
+	double flTicksPerUS = (double)GetCPUInformation().m_Speed / 1000000.0;
+	double flElapsed = s_flTraceStopTime - s_flTraceStartTime;
+	if ( flElapsed > 0.001 && s_nTraceStopTSC > s_nTraceStartTSC )
+	{
+		flTicksPerUS = (double)( s_nTraceStopTSC - s_nTraceStartTSC ) / ( flElapsed * 1000000.0 );
+	}
+	if ( flTicksPerUS <= 0.0 )
+	{
+		flTicksPerUS = 1.0;
+	}
+
+	CTraceJSONWriter *pWriter = new CTraceJSONWriter( pfnWrite, pContext );
+	CTraceJSONWriter &writer = *pWriter;
+	writer.Printf( "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n" );
+	writer.Printf( "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"game\"}}" );
+
+	int nZones = 0;
+	int nBuffers = s_nTraceBufferCount;
+	for ( int i = 0; i < nBuffers; i++ )
+	{
+		TraceThreadBuffer_t *pBuffer = s_pTraceBuffers[i];
+		if ( pBuffer->m_nGeneration != s_nTraceGeneration )
+			continue;
+
+		unsigned long long nTid = (unsigned long long)pBuffer->m_nThreadId;
+		int nWritten = pBuffer->m_nWritten;
+		int nCount = MIN( nWritten, pBuffer->m_nCapacity );
+
+		writer.Printf( ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%llu,\"args\":{\"name\":", nTid );
+		writer.String( pBuffer->m_szThreadName );
+		writer.Printf( ",\"overwritten\":%d}}", nWritten - nCount );
+		writer.Printf( ",\n{\"name\":\"thread_sort_index\",\"ph\":\"M\",\"pid\":1,\"tid\":%llu,\"args\":{\"sort_index\":%d}}", nTid, strcmp( pBuffer->m_szThreadName, "MainThrd" ) ? i + 1 : 0 );
+
+		for ( int j = nWritten - nCount; j < nWritten; j++ )
+		{
+			const TraceZone_t &zone = pBuffer->m_pZones[ (unsigned)j % (unsigned)pBuffer->m_nCapacity ];
+
+			char szName[ 256 ];
+			const char *pName = zone.m_pFormat;
+			if ( zone.m_pArgs[0] )
+			{
+				snprintf( szName, sizeof( szName ), zone.m_pFormat, zone.m_pArgs[0], zone.m_pArgs[1] ? zone.m_pArgs[1] : "" );
+				pName = szName;
+			}
+
+			writer.Printf( ",\n{\"name\":" );
+			writer.String( pName ? pName : "(null)" );
+			writer.Printf( ",\"ph\":\"X\",\"pid\":1,\"tid\":%llu,\"ts\":%.3f,\"dur\":%.3f}", nTid,
+				(double)( zone.m_nStart - s_nTraceStartTSC ) / flTicksPerUS, (double)( zone.m_nEnd - zone.m_nStart ) / flTicksPerUS );
+			++nZones;
+		}
+	}
+
+	writer.Printf( "\n]}\n" );
+	delete pWriter;
+
+	return nZones;
+}
@@ -13,6 +13,7 @@
 #include "tier0/tslist.h"
 #include "tier0/icommandline.h"
 #include "tier0/threadtools.h"
+#include "tier0/vprof.h"
 #include "vstdlib/jobthread.h"
 #include "vstdlib/random.h"
 #include "tier1/functors.h"
@@ -416,6 +417,10 @@ private:
 		unsigned waitResult;
 		bool	 bExit = false;
 
+#ifdef VPROF_ENABLED
+		g_VProfCurrentProfile.SetThreadTreeName( GetName() );
+#endif
+
 		m_pOwner->m_nIdleThreads++;
 		m_IdleEvent.Set();
 		while ( !bExit && ( waitResult = Wait() ) != TW_FAILED )